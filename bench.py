@@ -0,0 +1,274 @@
+# Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of the North Carolina State University Aerial Robotics Club
+#       nor the names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+"""
+Capture path benchmarks and soak test, on a simulated camera
+
+Each mode opens a simulated camera, consumes images for a while, and
+reports throughput, latency percentiles, Python allocations per image and
+drop rates.  Latency is from the simulated capture time to the image
+reaching Python.  Use --json to keep results for comparison across
+releases.  Requires Python 3.
+
+    $ python3 bench.py --width 4000 --height 2750 --framerate 0
+    $ python3 bench.py --mode next --soak 3600 --loss 0.001 --jitter 0.002
+"""
+
+import argparse
+import json
+import os
+import sys
+import tempfile
+import time
+
+import numpy as np
+import svs
+import svs_core
+
+MODES = ['next', 'next_into', 'batch', 'zero_copy', 'record']
+
+BATCH_SIZE = 16
+
+
+def percentiles(latencies):
+    if not latencies:
+        return {}
+
+    values = np.percentile(latencies, [50, 90, 99, 99.9])
+    return {
+        'p50': values[0], 'p90': values[1], 'p99': values[2],
+        'p99.9': values[3], 'max': max(latencies),
+    }
+
+
+def open_camera(args, mode):
+    simulate = {
+        'width': args.width, 'height': args.height,
+        'pixel_type': args.pixel_type, 'framerate': args.framerate,
+        'loss': args.loss, 'jitter': args.jitter, 'seed': args.seed,
+    }
+
+    return svs.Camera(simulate=simulate, output_format=args.output_format,
+                      queue_length=args.queue_length,
+                      zero_copy=(mode == 'zero_copy'))
+
+
+class Consumer(object):
+    """Takes images from a camera one way, and accounts for them"""
+
+    def __init__(self, cam, mode):
+        self.cam = cam
+        self.mode = mode
+        self.images = 0
+        self.bytes = 0
+        self.blocks = 0
+        self.calls = 0
+        self.latencies = []
+        self.last_count = None
+        self.out_of_order = 0
+        self.out = None
+
+    def account(self, count, ticks, nbytes):
+        self.latencies.append(time.monotonic() - ticks*1e-6)
+        self.images += 1
+        self.bytes += nbytes
+
+        if self.last_count is not None and count <= self.last_count:
+            self.out_of_order += 1
+        self.last_count = count
+
+    def step(self, timeout):
+        """Consume what's available, waiting up to timeout"""
+        cam = self.cam
+
+        before = sys.getallocatedblocks()
+        try:
+            if self.mode in ('next', 'zero_copy'):
+                img, meta = cam.next(timeout=timeout)
+            elif self.mode == 'next_into':
+                if self.out is None:
+                    img, meta = cam.next(timeout=timeout)
+                    self.out = np.empty_like(img)
+                else:
+                    meta = cam.next_into(self.out, timeout=timeout)
+                    img = self.out
+            else:
+                images, meta = cam.next_batch(BATCH_SIZE, timeout=timeout)
+        except svs_core.SVSNoImagesError:
+            return
+        self.blocks += sys.getallocatedblocks() - before
+        self.calls += 1
+
+        if self.mode == 'batch':
+            for i in range(len(meta)):
+                self.account(meta['image_count'][i], meta['ticks'][i],
+                             images[i].nbytes)
+        else:
+            self.account(meta.image_count, meta.ticks, img.nbytes)
+
+
+def run(args, mode):
+    """Run one mode, returning its results"""
+    with open_camera(args, mode) as cam:
+        consumer = Consumer(cam, mode)
+        path = None
+
+        if mode == 'record':
+            fd, path = tempfile.mkstemp(prefix='svs_bench', dir=args.record_dir)
+            os.close(fd)
+            cam.record(path, compress=args.compress)
+
+        start = time.monotonic()
+        end = start + (args.soak or args.duration)
+        next_report = start + args.report_interval
+
+        while time.monotonic() < end:
+            if mode == 'record':
+                time.sleep(0.1)
+            else:
+                consumer.step(0.1)
+
+            if args.soak and time.monotonic() >= next_report:
+                next_report += args.report_interval
+                progress(mode, cam, consumer, time.monotonic() - start)
+
+        elapsed = time.monotonic() - start
+
+        if mode == 'record':
+            recording = cam.stop_recording()
+            consumer.images = recording['written']
+            consumer.bytes = recording['bytes']
+            for name in (path, path + '.idx'):
+                if os.path.exists(name):
+                    os.unlink(name)
+        else:
+            recording = None
+
+        stats = cam.stats()
+        dropped = cam.dropped
+        produced = cam.simulated['produced']
+        python_blocks = sys.getallocatedblocks()
+
+    callback = stats['callback']
+    result = {
+        'mode': mode,
+        'seconds': elapsed,
+        'images': consumer.images,
+        'fps': consumer.images/elapsed,
+        'mb_per_s': consumer.bytes/elapsed/1e6,
+        'latency': percentiles(consumer.latencies),
+        'callback_mean': callback['sum']/callback['count'] if callback['count'] else None,
+        'blocks_per_call': consumer.blocks/consumer.calls if consumer.calls else None,
+        'produced': produced,
+        'frame_loss': stats['frame_loss'],
+        'dropped': dropped,
+        'drop_rate': sum(dropped.values())/produced if produced else 0,
+        'out_of_order': consumer.out_of_order,
+        'python_blocks': python_blocks,
+    }
+
+    if recording:
+        result['record_dropped'] = recording['dropped']
+        if recording['stored']:
+            result['compression_ratio'] = recording['bytes']/recording['stored']
+        result['drop_rate'] = (recording['dropped'] +
+                               sum(dropped.values()))/produced if produced else 0
+
+    return result
+
+
+def progress(mode, cam, consumer, elapsed):
+    print('%s %8.0fs %10d images %8.1f fps  dropped %s  blocks %d' % (
+        mode, elapsed, consumer.images, consumer.images/elapsed, cam.dropped,
+        sys.getallocatedblocks()))
+    sys.stdout.flush()
+
+
+def report(result):
+    latency = result['latency']
+    print('%-10s %8.1f fps %8.1f MB/s  drop %.4f  blocks/call %s' % (
+        result['mode'], result['fps'], result['mb_per_s'], result['drop_rate'],
+        '-' if result['blocks_per_call'] is None
+            else '%.1f' % result['blocks_per_call']))
+    if latency:
+        print('           latency ms: p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f' % (
+            1e3*latency['p50'], 1e3*latency['p90'], 1e3*latency['p99'],
+            1e3*latency['p99.9'], 1e3*latency['max']))
+    if 'compression_ratio' in result:
+        print('           compression ratio %.2f' % result['compression_ratio'])
+    if result['out_of_order']:
+        print('           %d images out of order' % result['out_of_order'])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n\n')[0])
+    parser.add_argument('--mode', choices=MODES, action='append',
+                        help='mode to run, repeatable (default: all)')
+    parser.add_argument('--width', type=int, default=4000)
+    parser.add_argument('--height', type=int, default=2750)
+    parser.add_argument('--pixel-type', default='bayer_gr12_packed')
+    parser.add_argument('--framerate', type=float, default=30,
+                        help='images per second, 0 for as fast as possible')
+    parser.add_argument('--loss', type=float, default=0)
+    parser.add_argument('--jitter', type=float, default=0,
+                        help='largest deviation of capture times (s)')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--output-format', default='raw')
+    parser.add_argument('--queue-length', type=int, default=50)
+    parser.add_argument('--workers', type=int, default=0,
+                        help='conversion worker threads')
+    parser.add_argument('--duration', type=float, default=5,
+                        help='seconds per mode')
+    parser.add_argument('--soak', type=float, default=0,
+                        help='seconds to run each mode, reporting progress')
+    parser.add_argument('--report-interval', type=float, default=60)
+    parser.add_argument('--record-dir', default=None)
+    parser.add_argument('--compress', action='store_true',
+                        help='compress images in record mode')
+    parser.add_argument('--json', metavar='PATH',
+                        help='also write results to PATH')
+    args = parser.parse_args()
+
+    if args.workers:
+        svs.set_worker_threads(args.workers)
+
+    results = []
+    for mode in args.mode or MODES:
+        result = run(args, mode)
+        report(result)
+        results.append(result)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'config': vars(args), 'results': results}, f, indent=2,
+                      default=float)
+
+    # A soak test fails on misordered images
+    if args.soak and any(r['out_of_order'] for r in results):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
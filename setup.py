@@ -25,12 +25,49 @@
 # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+import os
+import sys
 from distutils.core import setup, Extension
 
+# Build profile, from the environment:
+#   SVS_BUILD=release   -O3 with link time optimization (the default)
+#   SVS_BUILD=debug     unoptimized, with full debug information
+#   SVS_MARCH=<cpu>     also target a CPU, e.g. native or x86-64-v3
+# svs_core.build_info() reports what a module was built with.
+profiles = {
+    'release': ['-O3', '-flto', '-fno-semantic-interposition', '-g'],
+    'debug': ['-O0', '-g3'],
+}
+
+profile = os.environ.get('SVS_BUILD', 'release')
+march = os.environ.get('SVS_MARCH')
+
+if profile not in profiles:
+    sys.exit("Unknown SVS_BUILD '%s', expected one of: %s" %
+             (profile, ', '.join(sorted(profiles))))
+
+compile_args = ['-std=gnu99'] + profiles[profile]
+if march:
+    compile_args.append('-march=' + march)
+
+# Link time optimization generates code at link, with the same flags
+lto = '-flto' in compile_args
+link_args = compile_args[1:] if lto else []
+
+macros = [
+    ('SVS_BUILD_PROFILE', '"%s"' % profile),
+    ('SVS_BUILD_FLAGS', '"%s"' % ' '.join(compile_args)),
+    ('SVS_BUILD_LTO', '1' if lto else '0'),
+]
+if march:
+    macros.append(('SVS_BUILD_MARCH', '"%s"' % march))
+
 svs_core = Extension("svs_core",
-                     extra_compile_args = ['-std=gnu99', '-g3'],
+                     extra_compile_args = compile_args,
+                     extra_link_args = link_args,
+                     define_macros = macros,
                      library_dirs = ['/usr/local/lib/'],
-                     libraries = ['svgige', 'm'],
+                     libraries = ['svgige', 'm', 'pthread', 'rt'],
                      sources = [
                             'svs_core/svs_core.c',
                             'svs_core/svs_core_methods.c',
@@ -39,6 +76,21 @@ svs_core = Extension("svs_core",
                             'svs_core/svs_core_Camera_attributes.c',
                             'svs_core/svs_core_Camera_methods.c',
                             'svs_core/svs_core_Camera_callback.c',
+                            'svs_core/svs_core_Camera_config.c',
+                            'svs_core/svs_core_FrameInfo.c',
+                            'svs_core/svs_core_CameraGroup.c',
+                            'svs_core/svs_core_frame.c',
+                            'svs_core/svs_core_clock.c',
+                            'svs_core/svs_core_stats.c',
+                            'svs_core/svs_core_record.c',
+                            'svs_core/svs_core_bus.c',
+                            'svs_core/svs_core_placement.c',
+                            'svs_core/svs_core_pool.c',
+                            'svs_core/svs_core_sim.c',
+                            'svs_core/svs_core_unpack.c',
+                            'svs_core/svs_core_convert.c',
+                            'svs_core/svs_core_codec.c',
+                            'svs_core/svs_core_monitor.c',
                             'svs_core/svs_core_util.c',
                      ])
 
@@ -47,5 +99,6 @@ setup(name = 'svs',
       description = 'Interface for SVS-VISTEK machine vision cameras',
       author = 'NC State Aerial Robotics Club',
       license = 'BSD',
-      py_modules = ['svs'],
+      py_modules = ['svs', 'svs_asyncio'],
+      headers = ['svs_core/svs_native.h'],
       ext_modules = [svs_core])
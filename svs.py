@@ -24,8 +24,13 @@
 # SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 import logging
+import mmap
+import struct
+import numpy as np
 import svs_core
-from svs_core import camera_list
+from svs_core import camera_list, clear_camera_cache, CameraGroup, Subscriber
+from svs_core import set_worker_threads, worker_threads, worker_placement
+from svs_core import compress, decompress
 
 class Camera(svs_core.Camera):
     """
@@ -37,7 +42,8 @@ class Camera(svs_core.Camera):
     camera.
 
     If ip and source_ip are not passed in, the class connects to the first
-    available camera.
+    available camera.  Discovery results are cached by camera_list(), so
+    opening several cameras searches the network once.
 
     Arguments:
         logger (optional): logging object to use for log output.
@@ -51,15 +57,88 @@ class Camera(svs_core.Camera):
         packet_size (optional): MTU packet size.
         queue_length (optional): Maximum number of images to queue for
             return by next().  Once this limit is reached, old images are
-            dropped from the queue.  A length of zero allows infinite
-            images to queue.
+            dropped from the queue.  Frame buffers are allocated as the
+            queue grows and reused afterwards, so this must be at least 1.
+        zero_copy (optional): If True, next() returns arrays backed
+            directly by the camera's frame pool instead of copies.  A
+            frame returns to the pool once its array is freed.
+        pool_size (optional): Number of frames in the pool.  At least
+            queue_length + 2 are used.  In zero-copy mode, each array held
+            by the application occupies one frame.
+        pool_timeout (optional): Milliseconds to wait for the application
+            to free a frame when the pool is exhausted, before dropping
+            the new image.  Zero drops immediately.
+        clock_interval (optional): Seconds between measurements of the
+            camera clock against the host clock, used to estimate offset
+            and drift for image timestamps.  Zero measures only at open.
+        msb_aligned (optional): If True, 12-bit pixels are shifted to the
+            top of the 16-bit array values (0..65520).  If False, they
+            keep their 12-bit range (0..4095).
+        output_format (optional): Format of images returned by next().
+            'raw' returns the sensor data (Bayer or mono).  'rgb8' and
+            'rgb16' return demosaiced (height, width, 3) arrays, with rgb16
+            at full 16-bit scale.  'mono8' returns 8-bit luma.
+        preview_decimation (optional): If non-zero, also produce preview
+            images for next_preview(), box filtered down by this factor in
+            each dimension.  Must be even, up to 16.  Previews of Bayer
+            cameras are (height, width, 3) rgb8 arrays, otherwise mono8.
+        preview_rate (optional): Maximum preview images per second.  Zero
+            produces a preview of every image.
+        overflow_policy (optional): What to do with a new image when
+            queue_length images are already queued.  'drop_oldest' drops
+            the oldest queued image.  'drop_newest' drops the new image.
+            'latest_only' keeps only the newest image, ignoring
+            queue_length.  'block' holds the SVGigE buffer until next()
+            makes room, for up to pool_timeout milliseconds, or
+            indefinitely if pool_timeout is 0.  Dropped images are
+            counted in the dropped attribute.
+        multicast (optional): 'none' streams to this host only.
+            'controller' controls the camera and streams to a multicast
+            group chosen by the SDK, which other hosts may join.
+            'listener' joins a controller's group without taking control:
+            images are queued as usual, but settings are read-only, and
+            the image size and depth are those set by the controller.
+        autotune (optional): If True, use the largest packet size up to
+            packet_size that the network path carries, and enough buffers
+            for half a second of images at the current framerate, within
+            an eighth of free memory, and at least 10.  The values chosen
+            are in stream_config.
+        resend_timeout (optional): Milliseconds before missing packets
+            are requested again.
+        heartbeat_timeout (optional): Milliseconds without a heartbeat
+            before the camera releases this connection.
+        cpus (optional): Sequence of CPU numbers to pin the stream
+            callback thread to.
+        priority (optional): SCHED_FIFO priority for the stream callback
+            thread, 1 to 99, or 0 to leave its policy alone.  Needs
+            CAP_SYS_NICE.  Failures are reported in placement.
+        numa_node (optional): NUMA node to allocate frame buffers on.
+            By default, the node of the NIC with source_ip.  -1 allows
+            any node.
+        simulate (optional): dict describing a simulated camera, used
+            instead of the SDK to exercise the capture path without
+            hardware.  Keys, all optional, are width and height (1024 x
+            768), pixel_type ('mono12_packed', or e.g. 'mono8', 'mono16',
+            'bayer_gr8', 'bayer_gr12_packed'), framerate (30, or 0 for as
+            fast as possible), loss (probability an image is lost), jitter
+            (largest deviation of image times, in seconds), count (images
+            to produce, 0 for no limit) and seed.  Images start at once and
+            carry host monotonic microseconds in ticks.  Camera settings
+            are unavailable; ip and source_ip are not needed.
+        reconnect_interval (optional): Seconds between attempts to
+            reopen the camera after its connection is lost.  Settings are
+            restored and images resume into the same queue; see
+            connection().  Zero only reports the loss, after which
+            next() and iteration raise SVSClosedError.
     """
 
     def __init__(self, *args, **kwargs):
         logging.basicConfig()   # Configure logging, if it isn't already
         self.logger = kwargs.pop('logger', None) or logging.getLogger(__name__)
 
-        if not 'ip' in kwargs or not 'local_ip' in kwargs:
+        # Simulated cameras need no addresses
+        if kwargs.get('simulate') is None and \
+                (not 'ip' in kwargs or not 'source_ip' in kwargs):
             cameras = camera_list()
             if len(cameras) == 0:
                 raise IOError("No cameras found")
@@ -68,9 +147,232 @@ class Camera(svs_core.Camera):
 
         super(Camera, self).__init__(*args, **kwargs)
 
+    def next_async(self, timeout=None):
+        """
+        Coroutine returning the next image, as next(), for asyncio
 
-def number_cameras():
+        The event loop waits on fileno() instead of a thread, so one loop
+        can serve many cameras.  Requires Python 3.5 or later.
+
+        Arguments:
+            timeout (optional): Seconds to wait for an image, or None to
+                wait forever.
+        """
+        import svs_asyncio
+        return svs_asyncio.next_async(self, timeout)
+
+    def frames(self, timeout=None):
+        """
+        Asynchronous iterator over images, for async for
+
+        Yields (image, FrameInfo) tuples as next().  Iteration ends when no
+        image arrives within timeout seconds, if given.  Requires Python
+        3.6 or later.
+        """
+        import svs_asyncio
+        return svs_asyncio.frames(self, timeout)
+
+
+def number_cameras(max_age=5.0):
     """
     Determines total number of cameras available.
+
+    Uses cached discovery results younger than max_age seconds, see
+    camera_list().
     """
-    return len(camera_list())
+    return len(camera_list(max_age=max_age))
+
+
+class Recording(object):
+    """
+    Reader for files written by Camera.record()
+
+    Maps the data file, so images are read on demand, and indexed views of
+    8 and 16-bit images share the file's memory instead of copying it.
+    12-bit packed images are unpacked as next() does, and images from
+    record(compress=True) are decompressed.  The index file is read whole,
+    giving constant time access by position.
+
+    Indexing with an integer gives an (image, metadata) tuple, as
+    Camera.next().  Indexing with a slice gives an (images, metadata)
+    tuple, as Camera.next_batch().  Metadata records have the fields of
+    next()'s metadata as keys and attributes, with timestamp as a numpy
+    datetime64.  Iterating gives each (image, metadata) in turn.  In
+    recordings made since compression was added, records also have stored,
+    the bytes each image takes in the file, so length / stored is its
+    compression ratio, and codec, nonzero if it was compressed.
+
+    Arguments:
+        path: Data file passed to Camera.record().  The index is read from
+            path + '.idx'.
+        msb_aligned (optional): As for Camera, whether 12-bit pixels are
+            shifted to the top of the 16-bit values.
+    """
+
+    DATA_MAGIC = b'SVSRAW\0\0'
+    INDEX_MAGIC = b'SVSIDX\0\0'
+    VERSION = 2
+
+    _fields = [('offset', 'u8'), ('length', 'u8'),
+               ('timestamp', 'M8[us]'), ('ticks', 'u8'),
+               ('clock_offset', 'f8'), ('clock_drift', 'f8'),
+               ('width', 'u4'), ('height', 'u4'), ('pixel_type', 'u4'),
+               ('image_count', 'u4'), ('frame_loss', 'u4'),
+               ('packet_count', 'u4'), ('packet_resend', 'u4'),
+               ('transfer_time', 'u4'), ('dropped', 'u4')]
+
+    # Index record layout of each version
+    dtypes = {
+        1: np.dtype(_fields, align=True),
+        2: np.dtype(_fields + [('stored', 'u8'), ('codec', 'u4')], align=True),
+    }
+    dtype = dtypes[VERSION]
+
+    def __init__(self, path, msb_aligned=True):
+        self.path = path
+        self.shift = 4 if msb_aligned else 0
+
+        with open(path + '.idx', 'rb') as f:
+            magic, version, record_size = struct.unpack('<8sII', f.read(16))
+            if magic != self.INDEX_MAGIC or version not in self.dtypes:
+                raise ValueError("%s.idx is not a recording index" % path)
+            self.version = version
+            self.dtype = self.dtypes[version]
+            if record_size != self.dtype.itemsize:
+                raise ValueError("%s.idx has %d byte records, expected %d"
+                                 % (path, record_size, self.dtype.itemsize))
+
+            # An interrupted recording may end in a partial record
+            index = f.read()
+            count = len(index) // record_size
+            self.index = np.frombuffer(index, self.dtype, count).view(np.recarray)
+
+        with open(path, 'rb') as f:
+            header = f.read(16)
+            if len(header) < 16 or header[:8] != self.DATA_MAGIC:
+                raise ValueError("%s is not a recording" % path)
+
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        self._data = np.frombuffer(self._map, np.uint8)
+
+    def __len__(self):
+        return len(self.index)
+
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        """
+        Release the mapping.
+
+        The file is unmapped once arrays viewing it are freed as well.
+        """
+        self._data = None
+        self._map = None
+
+    def find(self, time):
+        """
+        Position of the first image captured at or after time.
+
+        Arguments:
+            time: datetime (UTC, as in image metadata) or numpy datetime64.
+
+        Returns:
+            Position in the recording, len(self) if every image is older.
+        """
+        return int(np.searchsorted(self.index.timestamp,
+                                   np.datetime64(time, 'us')))
+
+    def _compressed(self, records):
+        return self.version >= 2 and bool(np.any(records.codec))
+
+    def _raw(self, record):
+        if self._compressed(record):
+            stored = self._data[record.offset:record.offset + record.stored]
+            return np.frombuffer(svs_core.decompress(stored), np.uint8)
+
+        return self._data[record.offset:record.offset + record.length]
+
+    def _image(self, record):
+        raw = self._raw(record)
+        bits = (record.pixel_type >> 16) & 0xff
+        shape = (record.height, record.width)
+
+        if bits == 8:
+            return raw.reshape(shape)
+        elif bits == 16:
+            return raw.view('<u2').reshape(shape)
+        elif bits == 12:
+            return self._unpack12(raw, shape)
+
+        raise svs_core.SVSError("Unsupported pixel type %#x" % record.pixel_type)
+
+    def _unpack12(self, raw, shape):
+        """
+        Expand GVSP 12-bit packed pixels, as svs_core's unpack12
+        """
+        pixels = shape[0] * shape[1]
+        image = np.empty(pixels, np.uint16)
+        pairs = raw[:pixels // 2 * 3].reshape(-1, 3).astype(np.uint16)
+
+        image[0:pixels - 1:2] = (pairs[:, 0] << 4) | (pairs[:, 1] & 0xf)
+        image[1::2] = (pairs[:, 2] << 4) | (pairs[:, 1] >> 4)
+        if pixels & 1:
+            last = raw[pixels // 2 * 3:].astype(np.uint16)
+            image[-1] = last[0] << 4 | (last[1] & 0xf if len(last) > 1 else 0)
+
+        if self.shift:
+            image <<= self.shift
+
+        return image.reshape(shape)
+
+    def _images(self, records):
+        """
+        Images of records as one array
+
+        Images of the same size and type, evenly spaced in the file, as
+        recorded back to back, are viewed in place.
+        """
+        first = records[0]
+        bits = (first.pixel_type >> 16) & 0xff
+
+        if (len(records) == 1 or bits not in (8, 16) or
+                self._compressed(records)):
+            return np.stack([self._image(r) for r in records])
+
+        steps = np.diff(records.offset.astype(np.int64))
+        uniform = ((steps == steps[0]).all() and steps[0] > 0 and
+                   (records.length == first.length).all() and
+                   (records.width == first.width).all() and
+                   (records.height == first.height).all() and
+                   (records.pixel_type == first.pixel_type).all())
+        if not uniform:
+            return np.stack([self._image(r) for r in records])
+
+        # Images are padded to whole pages, so the file holds whole pixels
+        pixels = self._data[int(first.offset):].view(
+            np.uint8 if bits == 8 else '<u2')
+        size = pixels.itemsize
+
+        return np.lib.stride_tricks.as_strided(pixels,
+                shape=(len(records), int(first.height), int(first.width)),
+                strides=(int(steps[0]), int(first.width) * size, size),
+                writeable=False)
+
+    def __getitem__(self, key):
+        if isinstance(key, slice):
+            records = self.index[key]
+            if not len(records):
+                raise IndexError("Empty slice of recording")
+            return self._images(records), records
+
+        record = self.index[key]
+        return self._image(record), record
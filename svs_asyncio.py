@@ -0,0 +1,132 @@
+# Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+# All rights reserved.
+# 
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of the North Carolina State University Aerial Robotics Club
+#       nor the names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+"""
+asyncio support for svs.Camera
+
+Kept apart from svs.py, which must still import under Python 2.  Waiting is
+driven by the camera's fileno(), which the stream callback signals as images
+are queued, so one event loop can serve any number of cameras without
+executor threads or polling.
+"""
+
+import asyncio
+import weakref
+
+import svs_core
+
+
+def _wake(fd, loop, waiters):
+    loop.remove_reader(fd)
+    for future in waiters:
+        if not future.done():
+            future.set_result(None)
+    del waiters[:]
+
+
+async def _readable(camera, timeout):
+    """
+    Wait until images may be queued, or timeout seconds pass
+
+    All coroutines waiting on a camera in a loop share one reader.
+    """
+    loop = asyncio.get_event_loop()
+    fd = camera.fileno()
+
+    loops = camera.__dict__.setdefault('_async_waiters',
+                                       weakref.WeakKeyDictionary())
+    waiters = loops.setdefault(loop, [])
+    if not waiters:
+        loop.add_reader(fd, _wake, fd, loop, waiters)
+
+    future = loop.create_future()
+    waiters.append(future)
+    try:
+        await asyncio.wait_for(future, timeout)
+    except asyncio.TimeoutError:
+        pass
+    finally:
+        if future in waiters:
+            waiters.remove(future)
+            if not waiters:
+                loop.remove_reader(fd)
+
+
+async def next_async(camera, timeout=None):
+    """
+    Get the next image from camera, waiting without blocking the loop
+
+    Arguments:
+        camera: Camera to take the image from.
+        timeout: Seconds to wait for an image, or None to wait forever.
+
+    Returns:
+        (image, FrameInfo) tuple, as from Camera.next().
+
+    Raises:
+        SVSNoImagesError: No image was queued before the timeout.
+        SVSClosedError: The camera was closed, and no images are left.
+    """
+    loop = asyncio.get_event_loop()
+    deadline = None if timeout is None else loop.time() + timeout
+
+    while True:
+        # The event is only a hint: another reader may take the image first
+        try:
+            return camera.next()
+        except svs_core.SVSClosedError:
+            # Closed cameras stay readable, so waiting would spin
+            raise
+        except svs_core.SVSNoImagesError:
+            if deadline is None:
+                remaining = None
+            else:
+                remaining = deadline - loop.time()
+                if remaining <= 0:
+                    raise
+
+        await _readable(camera, remaining)
+
+
+async def frames(camera, timeout=None):
+    """
+    Asynchronously iterate over images from camera
+
+    Arguments:
+        camera: Camera to take images from.
+        timeout: Seconds to wait for each image, or None to wait forever.
+            Iteration stops once an image takes longer than timeout, or
+            the camera is closed.
+
+    Yields:
+        (image, FrameInfo) tuples, as from Camera.next().
+    """
+    while True:
+        try:
+            frame = await next_async(camera, timeout)
+        except svs_core.SVSNoImagesError:
+            return
+
+        yield frame
@@ -37,6 +37,7 @@
 PyObject *SVSError;
 PyObject *SVSAsyncError;
 PyObject *SVSNoImagesError;
+PyObject *SVSClosedError;
 
 #if PY_MAJOR_VERSION >= 3
 static struct PyModuleDef svs_coremodule = {
@@ -65,8 +66,35 @@ PyMODINIT_FUNC initsvs_core(void) {
 #endif
     }
 
+    svs_core_CameraGroupType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&svs_core_CameraGroupType) < 0) {
+#if PY_MAJOR_VERSION >= 3
+        return NULL;
+#else
+        return;
+#endif
+    }
+
+    svs_core_SubscriberType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&svs_core_SubscriberType) < 0) {
+#if PY_MAJOR_VERSION >= 3
+        return NULL;
+#else
+        return;
+#endif
+    }
+
+    if (PyType_Ready(&svs_core_FrameInfoType) < 0) {
+#if PY_MAJOR_VERSION >= 3
+        return NULL;
+#else
+        return;
+#endif
+    }
+
     import_array();
     import_datetime();
+    unpack_init();
 
 #if PY_MAJOR_VERSION >= 3
     m = PyModule_Create(&svs_coremodule);
@@ -85,6 +113,15 @@ PyMODINIT_FUNC initsvs_core(void) {
     Py_INCREF(&svs_core_CameraType);
     PyModule_AddObject(m, "Camera", (PyObject *) &svs_core_CameraType);
 
+    Py_INCREF(&svs_core_CameraGroupType);
+    PyModule_AddObject(m, "CameraGroup", (PyObject *) &svs_core_CameraGroupType);
+
+    Py_INCREF(&svs_core_SubscriberType);
+    PyModule_AddObject(m, "Subscriber", (PyObject *) &svs_core_SubscriberType);
+
+    Py_INCREF(&svs_core_FrameInfoType);
+    PyModule_AddObject(m, "FrameInfo", (PyObject *) &svs_core_FrameInfoType);
+
     add_constants(m);
 
     /* SVS Exceptions */
@@ -105,6 +142,12 @@ PyMODINIT_FUNC initsvs_core(void) {
     Py_INCREF(SVSNoImagesError);
     PyModule_AddObject(m, "SVSNoImagesError", SVSNoImagesError);
 
+    SVSClosedError = PyErr_NewExceptionWithDoc("svs_core.SVSClosedError",
+            "Raised when no more images will arrive, as the camera is closed.",
+            SVSNoImagesError, NULL);
+    Py_INCREF(SVSClosedError);
+    PyModule_AddObject(m, "SVSClosedError", SVSClosedError);
+
 #if PY_MAJOR_VERSION >= 3
     return m;
 #endif
@@ -2,16 +2,546 @@
 #define SVS_CORE_H_INCLUDED
 
 #include <pthread.h>
-#include <sys/queue.h>
+#include <sched.h>
+#include <sys/time.h>
 #include <libsvgige/svgige.h>
+#include "svs_native.h"
 
 /* Module methods */
 extern PyMethodDef svs_coreMethods[];
 
-struct image {
-    PyObject *array;
-    PyObject *info;
-    TAILQ_ENTRY(image) entry;
+/*
+ * Image metadata
+ *
+ * Plain copy of the SVGigE_IMAGE fields we report, filled in by the
+ * stream callback so that no Python objects are needed until next().
+ */
+struct frame_info {
+    uint64_t        timestamp;      /* Camera ticks */
+    struct timeval  time;           /* Host time of capture */
+    double          clock_offset;   /* Host minus camera clock (s) */
+    double          clock_drift;    /* Camera clock drift (s/s) */
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        pixel_type;     /* GVSP_PIXEL_TYPE */
+    uint32_t        image_count;
+    uint32_t        frame_loss;
+    uint32_t        packet_count;
+    uint32_t        packet_resend;
+    uint32_t        transfer_time;
+    uint32_t        dropped;        /* Images dropped before this one queued */
+    uint32_t        compressed;     /* Bytes compressed to, 0 if not */
+};
+
+/*
+ * Image metadata record
+ *
+ * Fixed layout of next_batch() metadata arrays and of recording indexes.
+ * Laid out as batch_descr(), with numpy's aligned padding.
+ */
+struct batch_record {
+    int64_t     timestamp;      /* us since the epoch */
+    uint64_t    ticks;
+    double      clock_offset;
+    double      clock_drift;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    pixel_type;
+    uint32_t    image_count;
+    uint32_t    frame_loss;
+    uint32_t    packet_count;
+    uint32_t    packet_resend;
+    uint32_t    transfer_time;
+    uint32_t    dropped;
+};
+
+/*
+ * Task for the worker pool
+ *
+ * Embedded in the structure it works on, so queueing never allocates.
+ */
+struct pool_deque;
+
+struct pool_task {
+    void                (*run)(struct pool_task *task);
+    struct pool_task    *prev;
+    struct pool_task    *next;
+    struct pool_deque   *deque;     /* Holding the task, or NULL once taken */
+};
+
+/*
+ * Pooled conversion or decimation of a frame
+ *
+ * The callback copies the raw image to raw, and a worker converts it
+ * into the frame data.
+ */
+struct frame_work {
+    struct pool_task    task;       /* First, as tasks are cast to work */
+    void                *raw;
+    size_t              raw_size;   /* Bytes allocated in raw */
+    uint32_t            width;      /* Of the raw image */
+    uint32_t            height;
+    uint32_t            pixel_type;
+    int                 format;     /* enum output_format */
+    int                 shift;      /* As for convert_frame() */
+    unsigned int        factor;     /* Decimation factor, or 0 to convert */
+    struct camera_stats *stats;     /* Or NULL */
+    int                 pending;    /* 1 while queued or running, 2 if waited on */
+};
+
+/*
+ * Frame buffer
+ *
+ * Image data copied out of the SVGigE buffer.  Data is page-aligned,
+ * allocated on first use, and grown if a larger image arrives.
+ */
+struct frame {
+    void                *data;
+    size_t              size;       /* Bytes allocated in data */
+    size_t              length;     /* Bytes of image data */
+    int                 converted;  /* Data already converted to format */
+    int                 format;     /* enum output_format of data */
+    uint64_t            queued;     /* stats_now() when queued */
+    struct frame_info   info;
+    struct frame_work   work;       /* Data still being produced if pending */
+};
+
+/* Image output formats */
+enum output_format {
+    FORMAT_RAW,         /* Camera pixels, 12-bit expanded to 16-bit */
+    FORMAT_MONO8,       /* 8-bit luma */
+    FORMAT_RGB8,        /* Demosaiced 8-bit RGB */
+    FORMAT_RGB16,       /* Demosaiced full scale 16-bit RGB */
+};
+
+/*
+ * Lock-free ring of frame indices
+ *
+ * Single producer, single consumer.  The producer owns head, while tail
+ * is advanced with compare-and-swap, so that the producer may also pop
+ * entries (e.g., to drop the oldest frame when full).
+ */
+struct frame_ring {
+    unsigned int    *slots;
+    unsigned int    mask;       /* Allocated slots - 1 */
+    unsigned int    limit;      /* Maximum entries in ring */
+    unsigned int    head;       /* Next slot to write */
+    unsigned int    tail;       /* Next slot to read */
+};
+
+/* What the callback does when the image queue is full */
+enum overflow_policy {
+    OVERFLOW_DROP_OLDEST,   /* Replace the oldest queued image */
+    OVERFLOW_DROP_NEWEST,   /* Discard the new image */
+    OVERFLOW_LATEST_ONLY,   /* Queue of one, always the newest image */
+    OVERFLOW_BLOCK,         /* Hold the SVGigE buffer until there is room */
+};
+
+/* Reasons for dropping images, counted per queue */
+enum drop_reason {
+    DROP_OLDEST,        /* Replaced by a newer image */
+    DROP_NEWEST,        /* Discarded, queue full */
+    DROP_POOL,          /* No free frame, consumer holds them all */
+    DROP_TIMEOUT,       /* Blocked too long waiting for room */
+    DROP_ERROR,         /* Unable to allocate or convert */
+    DROP_REASONS,
+};
+
+/* Python names of drop reasons */
+extern const char *const drop_reason_names[DROP_REASONS];
+
+/* Capture statistics */
+
+/* Power of two microsecond latency buckets, the last unbounded */
+#define STATS_BUCKETS   24
+
+struct stats_histogram {
+    uint64_t    count;
+    uint64_t    sum;                    /* ns */
+    uint64_t    max;                    /* ns */
+    uint64_t    buckets[STATS_BUCKETS];
+};
+
+enum stats_histogram_id {
+    STATS_CALLBACK,     /* Callback entry to image queued */
+    STATS_RESIDENCY,    /* Image queued to taken by next() */
+    STATS_GIL_WAIT,     /* Reacquiring the GIL after a blocking call */
+    STATS_UNPACK,       /* Unpacking and converting an image */
+    STATS_HISTOGRAMS,
+};
+
+enum stats_counter_id {
+    STATS_IMAGES,           /* Images received from the SDK */
+    STATS_DELIVERED,        /* Images returned by next() */
+    STATS_FRAME_LOSS,       /* Sum of SDK frame loss */
+    STATS_PACKETS,          /* Sum of SDK packet counts */
+    STATS_PACKET_RESEND,    /* Sum of SDK packet resends */
+    STATS_COUNTERS,
+};
+
+/*
+ * Lock-free capture statistics
+ *
+ * Updated with relaxed atomics from the callback and consumer threads.
+ * Resetting records a baseline subtracted on reporting, so writers never
+ * race with a reset.
+ */
+struct camera_stats {
+    uint64_t                counters[STATS_COUNTERS];
+    struct stats_histogram  histograms[STATS_HISTOGRAMS];
+    /* Values at the last reset */
+    uint64_t                counters_base[STATS_COUNTERS];
+    struct stats_histogram  histograms_base[STATS_HISTOGRAMS];
+    uint64_t                dropped_base[DROP_REASONS];
+};
+
+/*
+ * Queue of frames from the stream callback to Python
+ *
+ * Frames come from a fixed pool.  The callback fills a frame and pushes
+ * it to images, while the consumer returns it through free_frames.
+ */
+struct frame_queue {
+    struct frame    *frames;                /* Frame pool */
+    unsigned int    frames_count;           /* Frames in pool */
+    unsigned int    frames_allocated;       /* Frames handed out so far */
+    int             spare_frame;            /* Owned by callback, or -1 */
+    int             held;                   /* Put back by consumer, or -1 */
+    struct frame_ring images;               /* Frames waiting for the consumer */
+    struct frame_ring free_frames;          /* Frames returned by the consumer */
+    unsigned int    images_max;             /* Max queue length */
+    int             event_fd;               /* Readable while images queued */
+    int             pool_fd;                /* Signalled when a frame is freed */
+    int             pool_waiting;           /* Callback is waiting on pool_fd */
+    int             closed;                 /* Callback must not wait */
+    int             ended;                  /* No more images will be queued */
+    int             overflow_policy;        /* enum overflow_policy */
+    int             numa_node;              /* Of frame data, or -1 for any */
+    uint64_t        dropped[DROP_REASONS];  /* Images dropped, by reason */
+    struct camera_stats *stats;             /* Statistics to update, or NULL */
+};
+
+/* Images held in the preview queue */
+#define PREVIEW_QUEUE_LENGTH    2
+
+/* Largest preview decimation factor */
+#define PREVIEW_MAX_DECIMATION  16
+
+/* Coding of recorded and published image data */
+enum image_codec {
+    CODEC_NONE,         /* Raw camera data */
+    CODEC_RICE,         /* From codec_encode() */
+};
+
+/* Recording to disk */
+
+/* Alignment of data file writes, as required by O_DIRECT */
+#define RECORD_ALIGN        4096
+
+/* Bytes an image takes in the data file */
+#define RECORD_PADDED(length) \
+    (((length) + RECORD_ALIGN - 1) & ~((size_t) RECORD_ALIGN - 1))
+
+/* Images written per system call, at most */
+#define RECORD_BATCH        16
+
+/* Default images held waiting for the writer */
+#define RECORD_QUEUE_LENGTH 16
+
+#define RECORD_VERSION      2
+
+/*
+ * Recording data file header, padded to RECORD_ALIGN
+ *
+ * Each image follows at a RECORD_ALIGN aligned offset, as raw SVGigE
+ * data or compressed by codec_encode(), zero padded to a multiple of
+ * RECORD_ALIGN.
+ */
+struct record_header {
+    char        magic[8];       /* "SVSRAW\0\0" */
+    uint32_t    version;
+    uint32_t    align;
+    uint32_t    codec;          /* enum image_codec requested */
+};
+
+/*
+ * Recording index file header
+ *
+ * Followed by a struct record_index per image written, in order.
+ */
+struct record_index_header {
+    char        magic[8];       /* "SVSIDX\0\0" */
+    uint32_t    version;
+    uint32_t    record_size;    /* sizeof(struct record_index) */
+};
+
+struct record_index {
+    uint64_t    offset;         /* Of image in data file */
+    uint64_t    length;         /* Of raw image */
+    struct batch_record info;
+    uint64_t    stored;         /* Bytes in data file, without padding */
+    uint32_t    codec;          /* enum image_codec of the stored image */
+};
+
+enum recorder_state {
+    RECORDER_IDLE,
+    RECORDER_RUNNING,
+    RECORDER_STOPPING,
+};
+
+/*
+ * Recorder
+ *
+ * While active, the callback copies images into frames from its own
+ * queue instead of the image queue.  A writer thread empties the queue
+ * to disk without the GIL, so the queue has a single producer and a
+ * single consumer, as for next().  When compressing, the writer codes
+ * each image into packed before writing it.
+ */
+struct recorder {
+    struct frame_queue queue;
+    pthread_t       thread;
+    int             active;         /* Callback records images */
+    int             users;          /* Callbacks inside the recorder */
+    int             state;          /* enum recorder_state */
+    int             fd;             /* Data file */
+    int             index_fd;
+    int             direct;         /* fd opened with O_DIRECT */
+    uint64_t        offset;         /* End of data written */
+    uint64_t        preallocated;   /* Bytes reserved in data file */
+    uint64_t        dropped;        /* Images lost to a full queue */
+    int             codec;          /* enum image_codec to store images in */
+    void            *packed[RECORD_BATCH];      /* Compressed images */
+    size_t          packed_size[RECORD_BATCH];  /* Bytes allocated */
+    /* Progress, written by the writer thread */
+    uint64_t        written;        /* Images */
+    uint64_t        bytes;          /* Of raw images */
+    uint64_t        stored;         /* Of images as stored */
+    uint64_t        write_errors;   /* Images lost to failed writes */
+    int             error;          /* errno of last failed write */
+};
+
+/* Shared-memory frame bus */
+
+#define BUS_VERSION     2
+
+/* Default slots in the bus ring */
+#define BUS_SLOTS       8
+
+/* Alignment of slot data in the mapping */
+#define BUS_ALIGN       4096
+
+/*
+ * Bus header, at the start of the shared-memory object
+ *
+ * Followed by a struct bus_slot per slot, then the slot data from
+ * data_offset, slot_size bytes per slot.  Image n (from 1) goes in slot
+ * (n - 1) % slots.  The magic is written last, once the rest is ready.
+ */
+struct bus_header {
+    char        magic[8];       /* "SVSBUS\0\0" */
+    uint32_t    version;
+    uint32_t    slots;
+    uint64_t    slot_size;
+    uint64_t    data_offset;
+    uint32_t    futex;          /* Bumped for every image published */
+    uint32_t    waiters;        /* Subscribers waiting on futex */
+    uint64_t    published;      /* Number of the newest image */
+    uint32_t    closed;         /* Publisher stopped */
+    uint32_t    header_size;    /* sizeof(struct bus_header) */
+};
+
+/*
+ * Bus slot header
+ *
+ * Published with a seqlock.  Readers check seq before and after taking
+ * an image, and retry or skip ahead if it was overwritten meanwhile.
+ */
+struct bus_slot {
+    uint32_t            seq;        /* Odd while being written */
+    uint32_t            format;     /* enum output_format of data, once decoded */
+    uint32_t            codec;      /* enum image_codec of data */
+    int32_t             shift;      /* As for convert_frame(), if compressed */
+    uint64_t            number;     /* Image in slot, 0 if none */
+    uint64_t            length;     /* Bytes of image data */
+    struct frame_info   info;
+};
+
+/*
+ * Publishing side of a bus
+ *
+ * Written only by the stream callback, so the bus has a single writer.
+ */
+struct frame_bus {
+    char                *name;
+    int                 fd;
+    void                *map;
+    size_t              map_size;
+    struct bus_header   *header;
+    struct bus_slot     *slots;
+    uint8_t             *data;
+    int                 codec;      /* enum image_codec of images published */
+    uint64_t            too_large;  /* Images larger than a slot */
+    uint64_t            errors;     /* Images that failed to convert */
+};
+
+/*
+ * CPU affinity and real-time priority for a thread
+ *
+ * Applied by the thread itself, as the SDK creates the stream thread.
+ */
+struct thread_placement {
+    cpu_set_t       cpus;
+    int             cpus_set;       /* Else any CPU */
+    int             priority;       /* SCHED_FIFO priority, or 0 to leave */
+    int             pending;        /* Not yet applied by the thread */
+    int             error;          /* errno of the last failure */
+};
+
+/*
+ * Simulated camera, standing in for the SDK stream
+ */
+struct sim_camera {
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        pixel_type;
+    double          framerate;      /* Images per second, or 0 flat out */
+    double          loss;           /* Probability an image is lost */
+    double          jitter;         /* Largest deviation of image times (s) */
+    uint64_t        count;          /* Images to capture, or 0 for no limit */
+    unsigned int    seed;           /* Of loss and jitter */
+    size_t          size;           /* Bytes per image */
+    void            *data;          /* Shared by every image */
+    void            *context;       /* Camera, for the stream callback */
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             running;
+    int             started;
+    uint64_t        produced;       /* Images given to the callback */
+};
+
+/* Camera clock synchronization */
+
+/* Samples kept for offset and drift estimation */
+#define CLOCK_SAMPLES   16
+
+struct clock_sample {
+    uint64_t    ticks;      /* Camera counter */
+    double      offset;     /* Host minus camera time (s) */
+    double      delay;      /* Round trip of counter read (s) */
+};
+
+/*
+ * Camera to host clock model
+ *
+ * Host time = ticks*tick_period + ref_offset + drift*(ticks - ref_ticks)*tick_period
+ *
+ * The model is refreshed by a background thread and published with a
+ * seqlock, so converting a timestamp is arithmetic, without locks or
+ * camera round trips.
+ */
+struct clock_sync {
+    Camera_handle   handle;
+    double          tick_period;    /* Seconds per camera tick */
+    double          interval;       /* Seconds between refreshes */
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             running;
+    struct clock_sample samples[CLOCK_SAMPLES];
+    unsigned int    samples_count;
+    unsigned int    samples_next;
+    /* Published model */
+    unsigned int    seq;            /* Odd while being updated */
+    uint64_t        ref_ticks;
+    double          ref_offset;
+    double          drift;
+};
+
+/*
+ * Native callback registered with set_native_callback()
+ *
+ * Replaced as a whole, so the callback sees a consistent set.
+ */
+struct native_hook {
+    svs_native_callback callback;
+    void            *context;
+    int             queue;          /* Also queue images for next() */
+    PyObject        *capsule;       /* Keeps callback and context alive */
+};
+
+/* Camera settings cache */
+
+/*
+ * Camera registers read or written by configure() and snapshot()
+ *
+ * Some settings share a register pair, such as the auto exposure
+ * limits, which the SDK reads and writes together.
+ */
+enum config_register {
+    CONFIG_AUTO_EXPOSURE,
+    CONFIG_AUTO_EXPOSURE_LIMITS,    /* min, max (us) */
+    CONFIG_AUTO_GAIN_LIMITS,        /* min, max (dB) */
+    CONFIG_AUTO_BRIGHTNESS,         /* 0..255 */
+    CONFIG_AUTO_DYNAMICS,           /* I, D */
+    CONFIG_GAIN,                    /* dB */
+    CONFIG_EXPOSURE,                /* us */
+    CONFIG_FRAMERATE,               /* Hz */
+    CONFIG_REGISTERS,
+};
+
+/*
+ * Last values written to or read from each register, in SDK units
+ *
+ * Gain and exposure are only served from the cache while auto exposure
+ * is known to be off, as the camera changes them otherwise.
+ */
+struct config_cache {
+    int             valid[CONFIG_REGISTERS];
+    float           value[CONFIG_REGISTERS][2];
+    /* Set through attributes, kept to restore after a reconnect */
+    int             roi_valid;
+    int             roi[4];                 /* width, height, offset_x, offset_y */
+    int             binning_valid;
+    int             binning;                /* BINNING_MODE */
+    int             acquisition_valid;
+    int             acquisition_mode;       /* ACQUISITION_MODE */
+    int             acquisition_start;      /* Else stopped */
+    int             polarity_valid;
+    int             polarity;               /* TRIGGER_POLARITY */
+};
+
+/* Connection monitoring */
+
+enum monitor_state {
+    MONITOR_CONNECTED,
+    MONITOR_DISCONNECTED,       /* Lost, and not reconnecting */
+    MONITOR_RECONNECTING,
+};
+
+/*
+ * Connection state and history, reported by connection()
+ *
+ * The stream callback reports a lost connection, and a thread closes the
+ * camera and reconnects it in the background.  Counters are under lock.
+ */
+struct camera_monitor {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             running;
+    int             lost;                   /* Loss not yet handled */
+    double          interval;               /* s between attempts, 0 for none */
+    int             state;                  /* enum monitor_state */
+    uint64_t        disconnects;
+    uint64_t        reconnects;
+    unsigned int    attempts;               /* Failed, in this outage */
+    double          lost_time;              /* Host time of the last loss */
+    double          lost_mono;              /* Monotonic time of the last loss */
+    double          downtime;               /* s, of outages since ended */
+    double          last_downtime;          /* s, of the last outage ended */
+    char            error[160];             /* Last failure, or empty */
 };
 
 /* Camera class */
@@ -24,25 +554,166 @@ typedef struct {
     int             ready;
     Camera_handle   handle;
     Stream_handle   stream;
+    struct sim_camera *sim;                 /* Instead of SDK, or NULL */
     unsigned int    stream_ip;
     unsigned short  stream_port;
+    int             multicast;              /* MULTICAST_MODE */
     int             depth;
     unsigned int    buffer_size;
+    unsigned int    buffer_count;
+    unsigned int    packet_size;
+    unsigned int    resend_timeout;         /* ms */
+    unsigned int    heartbeat_timeout;      /* ms */
+    int             autotuned;              /* Stream settings auto-tuned */
+    int             numa_node;              /* Of frame data, or -1 for any */
+    struct thread_placement callback_placement;
     uint64_t        tick_frequency;
+    struct clock_sync clock;
     PyObject        *name;
-    TAILQ_HEAD(image_head, image) images;   /* Locked with the GIL */
-    unsigned int    images_length;          /* Queue length */
-    unsigned int    images_max;             /* Max queue length */
+    struct frame_queue queue;               /* Images for next() */
+    struct camera_stats stats;
+    int             zero_copy;              /* Arrays wrap pool frames */
+    unsigned int    pool_timeout;           /* ms callback waits for a frame */
+    struct frame_queue preview;             /* Images for next_preview() */
+    unsigned int    preview_decimation;     /* Preview scale factor, 0 if off */
+    double          preview_interval;       /* Minimum seconds between previews */
+    double          preview_next;           /* Monotonic time of next preview */
+    int             unpack_shift;           /* Left shift of 12-bit pixels */
+    int             output_format;          /* enum output_format */
+    struct recorder record;
+    struct native_hook *native;             /* Or NULL */
+    int             native_users;           /* Callbacks using native */
+    struct frame_bus *bus;                  /* Or NULL */
+    int             bus_users;              /* Callbacks using bus */
+    struct frame_queue grab;                /* Image for grab() */
+    int             grab_armed;             /* Next image goes to grab */
+    struct config_cache config;
+    uint32_t        ip;                     /* Of the camera, to reconnect */
+    uint32_t        source_ip;
+    struct camera_monitor monitor;
+    PyObject        *info;                  /* Cached info dict, or NULL */
     PyThreadState   *main_thread;
 } svs_core_Camera;   /* Be sure to update svs_core_Camera_members with new entries */
 
+/* Image metadata class */
+typedef struct {
+    PyObject_HEAD;
+    struct frame_info   info;
+} svs_core_FrameInfo;
+
+/* Camera group class */
+typedef struct {
+    PyObject_HEAD;
+    PyObject        *cameras;       /* Tuple of Camera objects */
+    svs_core_Camera **camera;       /* Borrowed from cameras */
+    unsigned int    count;
+    int             *pending;       /* Frame taken from each camera, or -1 */
+    double          tolerance;      /* Max seconds between matched images */
+    uint64_t        matched;
+    uint64_t        *unmatched;     /* Images dropped, per camera */
+    double          skew_last;
+    double          skew_sum;
+    double          skew_max;
+} svs_core_CameraGroup;
+
 enum ready {
     NOT_READY,
     CONNECTED,
     NAME_ALLOCATED,
     READY,
+    CLOSED,     /* Closed by close(), name still allocated */
+    DISCONNECTED,   /* Connection lost, name still allocated */
 };
 
+/*
+ * Update the camera after an image geometry or format change
+ *
+ * Reads back the image size and buffer size the camera settled on.  If
+ * the buffer size changed, the stream is replaced with one whose SVGigE
+ * buffers fit the new images.  Images already queued are kept.
+ * Requires the GIL.
+ *
+ * @param self  Camera object
+ * @returns 0 on success, negative on error with exception set
+ */
+int svs_core_Camera_reconfigure(svs_core_Camera *self);
+
+/*
+ * Resume streaming from a reconnected camera
+ *
+ * Takes the new handle, reads back the image geometry and buffer size
+ * after config_restore(), and opens a stream feeding the same queues.
+ * Requires the GIL.
+ *
+ * @param self      Camera object, DISCONNECTED
+ * @param handle    Newly opened camera
+ * @returns 0 on success, negative on error with exception set
+ */
+int svs_core_Camera_resume(svs_core_Camera *self, Camera_handle handle);
+
+/*
+ * Camera info dict
+ *
+ * Built from the SDK on first use, then copied from the cache.
+ *
+ * @returns new dict, or NULL on error
+ */
+PyObject *svs_core_Camera_getinfo(svs_core_Camera *self, void *closure);
+
+/*
+ * Cache a register, after writing it outside configure()
+ *
+ * @param cache     Settings cache
+ * @param reg       Register written
+ * @param first     Value written, in SDK units
+ * @param second    Second of a register pair, else ignored
+ */
+void config_store(struct config_cache *cache, enum config_register reg,
+                  float first, float second);
+
+/*
+ * Write the cached settings to a newly connected camera
+ *
+ * Restores the binning, pixel depth and area of interest, then each
+ * cached register, then the acquisition mode, so the camera streams as
+ * it did before.  Entries that fail to write are dropped from cache.
+ * Does not require the GIL.
+ *
+ * @param self      Camera object, for its depth and multicast mode
+ * @param handle    Camera to write to
+ * @param cache     Settings to write, usually a copy of self->config
+ * @returns SVGigE_SUCCESS, or the first failure
+ */
+int config_restore(svs_core_Camera *self, Camera_handle handle,
+                   struct config_cache *cache);
+
+/*
+ * Apply several settings at once
+ *
+ * Every value is validated before any is written, then the writes are
+ * made back to back without the GIL.  Requires the GIL.
+ *
+ * @param self      Camera object
+ * @param settings  dict of setting names and values
+ * @returns 0 on success, negative on error with exception set.  If
+ *          writes fail, SVSError is raised with a dict of messages by
+ *          setting name as its second argument.
+ */
+int config_apply(svs_core_Camera *self, PyObject *settings);
+
+/*
+ * Read every setting at once
+ *
+ * Registers not in the cache, or all if refresh is set, are read back
+ * to back without the GIL.  Requires the GIL.
+ *
+ * @param self      Camera object
+ * @param refresh   Read every register from the camera
+ * @returns dict of setting names and values, or NULL on error with
+ *          exception set, as for config_apply()
+ */
+PyObject *config_snapshot(svs_core_Camera *self, int refresh);
+
 /*
  * Add constants to module
  *
@@ -60,7 +731,140 @@ void add_constants(PyObject *m);
  */
 void raise_general_error(int error);
 
+/*
+ * Allocate a frame queue and its pool
+ *
+ * The pool holds at least enough frames for the callback to always have
+ * one to fill while images_max frames are queued and one is being read
+ * by the consumer.  In zero-copy mode, extra frames allow arrays to be
+ * held.
+ *
+ * @param queue         Queue to initialize
+ * @param images_max    Maximum images queued
+ * @param pool_size     Requested frames in pool, 0 for the minimum
+ * @returns 0 on success, negative on error with exception set
+ */
+int frame_queue_init(struct frame_queue *queue, unsigned int images_max,
+                     unsigned int pool_size);
+
+/*
+ * Free a frame queue and its pool
+ *
+ * The stream must be closed, so that the callback is not running.
+ * Safe to call on a queue that was never initialized.
+ */
+void frame_queue_destroy(struct frame_queue *queue);
+
+/*
+ * Return a frame to the pool
+ *
+ * Called from the consumer side once a frame has been copied out, or
+ * once the array wrapping it is freed.  Requires the GIL.
+ */
+void frame_release(struct frame_queue *queue, unsigned int index);
+
+/*
+ * Put a frame taken by frame_queue_pop() back at the front of the queue
+ *
+ * Only one frame may be held at a time.  Requires the GIL.
+ */
+void frame_queue_hold(struct frame_queue *queue, unsigned int index);
+
+/*
+ * Wait for the consumer to return a frame to the pool
+ *
+ * Called by the callback when the pool is exhausted.  Does not require
+ * the GIL.
+ *
+ * @param timeout   Milliseconds to wait, or negative to wait until a
+ *                  frame is returned or the queue is closed
+ * @returns 0 if a frame may be available, 1 on timeout or if closed
+ */
+int frame_pool_wait(struct frame_queue *queue, int timeout);
+
+/*
+ * Wait for the consumer to take an image off a full queue
+ *
+ * As frame_pool_wait(), for the block overflow policy.
+ *
+ * @returns 0 if there may be room, 1 on timeout or if closed
+ */
+int frame_queue_wait(struct frame_queue *queue, int timeout);
+
+/*
+ * Stop the callback waiting on the queue
+ *
+ * Wakes the callback if blocked in frame_pool_wait(), and makes later
+ * waits return immediately, so that the stream can be closed.
+ */
+void frame_queue_close(struct frame_queue *queue);
+
+/*
+ * Let the callback wait on the queue again, once a new stream is open
+ */
+void frame_queue_open(struct frame_queue *queue);
+
+/*
+ * Close the queue for good, as the camera is closed or lost
+ *
+ * As frame_queue_close(), and wakes consumers waiting in
+ * frame_queue_pop(), which then take the images left and return 2.
+ * event_fd stays readable from then on, as a socket at end of file.
+ */
+void frame_queue_end(struct frame_queue *queue);
+
+/*
+ * Count a dropped image
+ *
+ * Called by the callback.  Does not require the GIL.
+ */
+void frame_queue_drop(struct frame_queue *queue, enum drop_reason reason);
+
+/*
+ * Total images dropped by a queue so far
+ */
+uint32_t frame_queue_dropped(struct frame_queue *queue);
+
+/*
+ * Wake up consumers waiting on the image queue
+ *
+ * Called by the callback after an image is queued.  Does not require the GIL.
+ */
+void frame_queue_signal(struct frame_queue *queue);
+
+/*
+ * Take the next image off the queue
+ *
+ * Waits up to timeout for an image to arrive, releasing the GIL while
+ * waiting.  Requires the GIL.
+ *
+ * @param queue     Frame queue
+ * @param index     Frame index returned here
+ * @param timeout   Milliseconds to wait, 0 to not wait, or negative to
+ *                  wait forever
+ * @returns 0 on success, 1 on timeout, 2 if ended and empty, negative on
+ *          error with exception set
+ */
+int frame_queue_pop(struct frame_queue *queue, unsigned int *index,
+                    int timeout);
+
+/*
+ * Raise SVSNoImagesError for a frame_queue_pop() without an image
+ *
+ * SVSClosedError, a subclass, once the queue has ended, with why the
+ * monitor gave up if the camera was lost.  Requires the GIL.
+ *
+ * @param self      Camera object
+ * @param ret       Positive result of frame_queue_pop()
+ * @param message   Message for a timeout
+ */
+void svs_core_Camera_no_images(svs_core_Camera *self, int ret,
+                               const char *message);
+
 extern PyTypeObject svs_core_CameraType;
+extern PyTypeObject svs_core_FrameInfoType;
+extern PyTypeObject svs_core_CameraGroupType;
+extern PyTypeObject svs_core_SubscriberType;
 extern PyMethodDef svs_core_Camera_methods[];
 extern PyGetSetDef svs_core_Camera_getseters[];
 
@@ -68,6 +872,7 @@ extern PyGetSetDef svs_core_Camera_getseters[];
 extern PyObject *SVSError;
 extern PyObject *SVSAsyncError;
 extern PyObject *SVSNoImagesError;
+extern PyObject *SVSClosedError;
 
 /*
  * Camera stream callback
@@ -78,13 +883,698 @@ SVGigE_RETURN svs_core_Camera_stream_callback(SVGigE_SIGNAL *signal,
                                               void *context);
 
 /*
- * Import datetime module
+ * Convert a frame to Python objects
  *
- * This module is needed in svs_core_Camera_callback.c, but needs to be
- * imported on a per-file basis, so provide a function to call from the
- * main initialization.
+ * Builds the image array and FrameInfo metadata for a frame taken off
+ * an image queue.  The frame is returned to the pool once copied, or in
+ * zero-copy mode, once the array is freed.  Requires the GIL.
+ *
+ * @param self  Camera object
+ * @param queue Queue the frame was taken from
+ * @param index Index of frame to convert
+ * @returns (image, metadata) tuple, or NULL on error with exception set
  */
-void import_datetime(void);
+PyObject *svs_core_Camera_frame(svs_core_Camera *self,
+                                struct frame_queue *queue, unsigned int index);
+
+/*
+ * Take a batch of images off the image queue
+ *
+ * Copies up to max_images images, all of the same shape, into one array,
+ * waiting up to timeout for the batch to fill.  An image of a different
+ * shape ends the batch and is left at the front of the queue.  Requires
+ * the GIL.
+ *
+ * @param self          Camera object
+ * @param max_images    Maximum images in batch
+ * @param timeout       Milliseconds to wait, 0 to not wait, or negative to
+ *                      wait until the batch is full
+ * @param out           Array to fill, or NULL to allocate one
+ * @returns (images, metadata) tuple, where metadata is a structured array
+ *          with a record per image, or NULL on error with exception set
+ */
+PyObject *svs_core_Camera_batch(svs_core_Camera *self,
+                                unsigned int max_images, int timeout,
+                                PyObject *out);
+
+/*
+ * Take the next image off the image queue into a caller's array
+ *
+ * An image that doesn't fit out is left at the front of the queue.
+ * Requires the GIL.
+ *
+ * @param self      Camera object
+ * @param timeout   Milliseconds to wait, 0 to not wait, or negative to
+ *                  wait forever
+ * @param out       C contiguous array of the image's dtype and shape
+ * @returns FrameInfo for the image, or NULL on error with exception set
+ */
+PyObject *svs_core_Camera_into(svs_core_Camera *self, int timeout,
+                               PyObject *out);
+
+/*
+ * Camera tp_iternext, waiting for the next image on the queue
+ *
+ * @returns (image, metadata) tuple, or NULL with an exception set, or
+ *          without one once the camera is closed
+ */
+PyObject *svs_core_Camera_iternext(svs_core_Camera *self);
+
+/*
+ * Determine array shape and type for an image
+ *
+ * @param info      Image metadata
+ * @param format    Output format of the array
+ * @param nd        Number of dimensions returned here
+ * @param dims      Dimensions returned here, as npy_intp
+ * @returns Numpy type, or negative for unsupported pixel types with
+ *          exception set
+ */
+int image_shape(struct frame_info *info, int format, int *nd,
+                Py_intptr_t dims[3]);
+
+/*
+ * Fill a metadata record from frame metadata
+ */
+void batch_fill_record(struct batch_record *record, struct frame_info *info);
+
+/*
+ * Create a FrameInfo object for image metadata
+ *
+ * Objects are reused from a free list when possible.  Requires the GIL.
+ *
+ * @param info  Metadata to copy
+ * @returns FrameInfo object, or NULL on error
+ */
+PyObject *frame_info_new(struct frame_info *info);
+
+/*
+ * Import datetime module
+ *
+ * This module is needed in svs_core_FrameInfo.c, but needs to be
+ * imported on a per-file basis, so provide a function to call from the
+ * main initialization.
+ */
+void import_datetime(void);
+
+/* Recording */
+
+/*
+ * Prepare a recorder, so it may be stopped or destroyed unused
+ */
+void recorder_init(struct recorder *rec);
+
+/*
+ * Create the data and index files, and start the writer thread
+ *
+ * The index is written to path with ".idx" appended.  The data file is
+ * opened with O_DIRECT where the filesystem supports it.  The callback
+ * starts recording once this returns.  Requires the GIL.
+ *
+ * @param rec           Recorder, not active
+ * @param path          Data file path
+ * @param queue_length  Images held waiting for the writer
+ * @param preallocate   Bytes to reserve in the data file, or 0
+ * @param numa_node     NUMA node of frame data, or -1 for any
+ * @param codec         enum image_codec to store images in
+ * @returns 0 on success, negative on error with exception set
+ */
+int recorder_start(struct recorder *rec, const char *path,
+                   unsigned int queue_length, uint64_t preallocate,
+                   int numa_node, int codec);
+
+/*
+ * Stop recording
+ *
+ * Waits for the callback to leave the recorder and for the writer to
+ * write every image queued, then trims and closes the files.  Does not
+ * require the GIL.  Safe to call on an inactive recorder.
+ *
+ * @returns 0 on success, or an errno value if finishing the files failed
+ */
+int recorder_stop(struct recorder *rec);
+
+/*
+ * Recording progress
+ *
+ * @returns dict of progress counters, or NULL on error
+ */
+PyObject *recorder_progress(struct recorder *rec);
+
+/* Frame bus */
+
+/*
+ * Create a bus shared-memory object
+ *
+ * Requires the GIL.
+ *
+ * @param name      Shared-memory object name, as for shm_open()
+ * @param slots     Images held in the ring
+ * @param slot_size Largest image in bytes
+ * @param codec     enum image_codec to publish images in
+ * @returns new bus, or NULL on error with exception set
+ */
+struct frame_bus *bus_create(const char *name, unsigned int slots,
+                             size_t slot_size, int codec);
+
+/*
+ * Close a bus, waking its subscribers, and remove its name
+ *
+ * The callback must no longer be using the bus.  Does not require the GIL.
+ */
+void bus_destroy(struct frame_bus *bus);
+
+/*
+ * Start writing the next image into the bus
+ *
+ * Called by the callback.  Must be followed by bus_write_end() or
+ * bus_write_abort().  Does not require the GIL.
+ *
+ * @returns slot data to fill, or NULL if the image does not fit
+ */
+void *bus_write_begin(struct frame_bus *bus, size_t length);
+
+/*
+ * Publish the image written since bus_write_begin(), and wake subscribers
+ *
+ * @param format    enum output_format of the image, once decompressed
+ * @param shift     As for convert_frame(), for compressed images
+ */
+void bus_write_end(struct frame_bus *bus, size_t length, int format,
+                   int shift, struct frame_info *info);
+
+/*
+ * Abandon the image written since bus_write_begin()
+ */
+void bus_write_abort(struct frame_bus *bus);
+
+/*
+ * Publishing progress
+ *
+ * @returns dict of progress counters, or NULL on error
+ */
+PyObject *bus_progress(struct frame_bus *bus);
+
+/* CPU and memory placement */
+
+/*
+ * NUMA node of the network device with an IPv4 address
+ *
+ * @param ip    Address, as from ip_string_to_int()
+ * @returns node, or -1 if unknown
+ */
+int numa_node_of_ip(uint32_t ip);
+
+/*
+ * Allocate frame data
+ *
+ * Mapped page-aligned, with huge pages for large frames where available,
+ * and preferring NUMA node node.  Does not require the GIL.
+ *
+ * @param size  Bytes needed, replaced with the bytes allocated
+ * @param node  NUMA node, or negative for any
+ * @returns data, or NULL on error
+ */
+void *frame_data_alloc(size_t *size, int node);
+
+/*
+ * Free frame data from frame_data_alloc(), or do nothing if NULL
+ */
+void frame_data_free(void *data, size_t size);
+
+/*
+ * Apply a placement to the calling thread
+ *
+ * Does not require the GIL.
+ *
+ * @returns 0 on success, or an errno value
+ */
+int thread_place(struct thread_placement *placement);
+
+/*
+ * Fill a placement from Python arguments
+ *
+ * @param cpus      Sequence of CPU numbers, or NULL or None for any
+ * @param priority  SCHED_FIFO priority, or 0 for the default policy
+ * @returns 0 on success, negative on error with exception set
+ */
+int thread_placement_parse(struct thread_placement *placement, PyObject *cpus,
+                           int priority);
+
+/*
+ * Describe a placement
+ *
+ * @returns dict of cpus, priority and error, or NULL on error
+ */
+PyObject *thread_placement_dict(struct thread_placement *placement);
+
+/* Worker pool */
+
+/*
+ * Start the worker pool shared by every camera
+ *
+ * Requires the GIL.
+ *
+ * @param threads   Worker threads, or 0 to leave the pool stopped
+ * @param placement CPU affinity and priority for every worker
+ * @returns 0 on success, negative on error with exception set
+ */
+int pool_start(unsigned int threads, struct thread_placement *placement);
+
+/*
+ * Stop the worker pool, once the tasks already queued have run
+ *
+ * Tasks submitted meanwhile run on their submitter.  Does not require
+ * the GIL.
+ */
+void pool_stop(void);
+
+/*
+ * Number of worker threads, 0 if the pool is stopped
+ */
+unsigned int pool_threads(void);
+
+/*
+ * Queue a task on the pool
+ *
+ * Safe from any thread, without the GIL.
+ *
+ * @returns 0 if queued, negative if the pool is stopped and the caller
+ *          must run the task itself
+ */
+int pool_submit(struct pool_task *task);
+
+/*
+ * Take back a task no worker has started
+ *
+ * @returns 1 if the caller now owns the task, 0 if it is running or done
+ */
+int pool_reclaim(struct pool_task *task);
+
+/* Most workers helping with one pool_for() */
+#define POOL_FOR_HELPERS    7
+
+/*
+ * Run fn(arg, i) for every i below count, on this thread and the pool
+ *
+ * Iterations are handed out one at a time, and may run in any order.
+ * Returns once every iteration is done.  Runs them all on this thread if
+ * the pool is stopped.  Does not require the GIL.
+ */
+void pool_for(void (*fn)(void *arg, unsigned int i), void *arg,
+              unsigned int count);
+
+/*
+ * Placement of the worker threads
+ *
+ * @returns dict as thread_placement_dict(), or NULL on error
+ */
+PyObject *pool_placement_dict(void);
+
+/*
+ * Hand a frame's work to the pool, or do it now if the pool is stopped
+ *
+ * The work fields other than task and pending must be filled in.  The
+ * frame may be queued before the work is done; frame_work_wait() before
+ * touching its data.  Called by the callback.
+ */
+void frame_work_submit(struct frame *frame);
+
+/*
+ * Whether a frame's data is still being produced
+ */
+int frame_work_pending(struct frame *frame);
+
+/*
+ * Wait for a frame's work to finish
+ *
+ * Does the work on this thread if no worker has started it.  Does not
+ * require the GIL.
+ */
+void frame_work_wait(struct frame *frame);
+
+/* Simulated camera */
+
+/*
+ * Parse a simulated camera description
+ *
+ * Keys are width, height, pixel_type (a name such as 'mono12_packed' or
+ * 'bayer_gr8', or a GVSP_PIX_* value), framerate, loss, jitter, count and
+ * seed.  Requires the GIL.
+ *
+ * @param sim       Simulation to fill in
+ * @param config    dict of settings, each optional
+ * @returns 0 on success, negative with exception set
+ */
+int sim_parse(struct sim_camera *sim, PyObject *config);
+
+/*
+ * Start producing images for the stream callback
+ *
+ * @param sim       Parsed simulation
+ * @param context   Camera passed to svs_core_Camera_stream_callback()
+ * @returns 0 on success, negative with exception set
+ */
+int sim_start(struct sim_camera *sim, void *context);
+
+/*
+ * Stop producing images, once the callback has returned
+ *
+ * Does nothing if not started.  Does not require the GIL.
+ */
+void sim_stop(struct sim_camera *sim);
+
+/*
+ * Stop and free a simulation
+ */
+void sim_free(struct sim_camera *sim);
+
+/*
+ * Describe a simulation
+ *
+ * @returns dict of its settings and images produced, or NULL on error
+ */
+PyObject *sim_dict(struct sim_camera *sim);
+
+/* Pixel unpacking */
+
+/*
+ * Expand GVSP 12-bit packed pixels to 16-bit
+ *
+ * Selected by unpack_init() for the running CPU.
+ *
+ * @param src       Packed pixels, 3 bytes per 2 pixels, with 2 bytes for
+ *                  an odd pixel out
+ * @param dst       Output pixels
+ * @param pixels    Number of pixels
+ * @param shift     Bits to shift each pixel left, 4 for MSB-aligned output
+ */
+extern void (*unpack12)(const uint8_t *src, uint16_t *dst, size_t pixels,
+                        int shift);
+
+/* Name of the selected unpack12 kernel */
+extern const char *unpack12_kernel;
+
+/*
+ * Select pixel unpacking kernels
+ *
+ * Detects CPU features and picks the fastest available kernels.  Must be
+ * called once at module initialization.
+ */
+void unpack_init(void);
+
+/* Image conversion */
+
+/*
+ * Build a hot kernel for several instruction sets, resolved at load
+ *
+ * Only when the build doesn't already target AVX2 through -march, and the
+ * compiler supports target_clones.  Define SVS_NO_CLONES for one version.
+ */
+#if defined(__x86_64__) && !defined(__AVX2__) && !defined(SVS_NO_CLONES) && \
+    ((defined(__clang__) && __clang_major__ >= 14) || \
+     (!defined(__clang__) && __GNUC__ >= 6))
+#define KERNEL_CLONES   __attribute__((target_clones("avx2", "default")))
+#define KERNEL_CLONED   1
+#else
+#define KERNEL_CLONES
+#define KERNEL_CLONED   0
+#endif
+
+/*
+ * Name of the instruction set the conversion kernels run with
+ */
+const char *convert_kernel(void);
+
+/*
+ * Size of a converted image in bytes
+ *
+ * @returns size, or 0 if the pixel type is not supported
+ */
+size_t convert_size(uint32_t pixel_type, uint32_t width, uint32_t height,
+                    int format);
+
+/*
+ * Convert a raw camera image to an output format
+ *
+ * Bayer images are demosaiced for the RGB formats, and converted to luma
+ * for mono8.  Large images are split across the worker pool, when it is
+ * running, and otherwise converted on the calling thread.  Does not
+ * require the GIL.
+ *
+ * @param src           Raw image data
+ * @param pixel_type    GVSP pixel type of src
+ * @param width         Image width
+ * @param height        Image height
+ * @param format        enum output_format
+ * @param shift         Left shift of 12-bit pixels for FORMAT_RAW
+ * @param dst           Output, of convert_size() bytes
+ * @returns 0 on success, negative on error
+ */
+int convert_frame(const void *src, uint32_t pixel_type, uint32_t width,
+                  uint32_t height, int format, int shift, void *dst);
+
+/*
+ * Whether a pixel type has a Bayer color filter
+ */
+int convert_bayer(uint32_t pixel_type);
+
+/*
+ * Output format of decimated images
+ *
+ * @returns FORMAT_RGB8 for Bayer pixel types, FORMAT_MONO8 otherwise
+ */
+int decimate_format(uint32_t pixel_type);
+
+/*
+ * Downscale a raw camera image by box filtering
+ *
+ * Each factor x factor block of pixels is averaged into one output pixel.
+ * For Bayer images, the colors of each block are averaged separately,
+ * which demosaics as it scales.  Does not require the GIL.
+ *
+ * @param src           Raw image data
+ * @param pixel_type    GVSP pixel type of src
+ * @param width         Image width
+ * @param height        Image height
+ * @param factor        Scale factor, even for Bayer images
+ * @param dst           Output, of width/factor x height/factor pixels in
+ *                      decimate_format()
+ * @returns 0 on success, negative on error
+ */
+int decimate_frame(const void *src, uint32_t pixel_type, uint32_t width,
+                   uint32_t height, unsigned int factor, void *dst);
+
+/* Lossless compression */
+
+/*
+ * Largest compressed size of a raw image
+ *
+ * @returns bytes, at most a few more than the raw image
+ */
+size_t codec_bound(uint32_t pixel_type, uint32_t width, uint32_t height);
+
+/*
+ * Compress a raw camera image
+ *
+ * Bands of rows are compressed in parallel on the worker pool, when it
+ * is running.  Does not require the GIL.
+ *
+ * @param src           Raw image data
+ * @param pixel_type    GVSP pixel type of src
+ * @param width         Image width
+ * @param height        Image height
+ * @param dst           Output, of codec_bound() bytes
+ * @returns bytes of dst used, or 0 if the pixel type is not supported
+ */
+size_t codec_encode(const void *src, uint32_t pixel_type, uint32_t width,
+                    uint32_t height, void *dst);
+
+/*
+ * Size of the raw image a compressed image decodes to
+ *
+ * @returns bytes, or 0 if src is not a compressed image
+ */
+size_t codec_raw_length(const void *src, size_t length);
+
+/*
+ * Decompress an image from codec_encode()
+ *
+ * The data is fully checked, so it may come from an untrusted file or a
+ * bus slot being overwritten.  Does not require the GIL.
+ *
+ * @param src       Compressed image
+ * @param length    Bytes of src
+ * @param dst       Output, the raw camera image
+ * @param size      Bytes of dst, at least codec_raw_length()
+ * @returns 0 on success, negative if src is invalid
+ */
+int codec_decode(const void *src, size_t length, void *dst, size_t size);
+
+/* Clock synchronization */
+
+/*
+ * Synchronize with the camera clock
+ *
+ * Measures the initial offset immediately, then starts a thread which
+ * refreshes the offset and drift estimate every interval seconds.
+ * Does not require the GIL.
+ *
+ * @param clock             Clock to initialize
+ * @param handle            Camera to synchronize with
+ * @param tick_frequency    Camera timestamp ticks per second
+ * @param interval          Seconds between refreshes, or 0 to only
+ *                          measure once
+ * @returns 0 on success, negative on error
+ */
+int clock_sync_start(struct clock_sync *clock, Camera_handle handle,
+                     uint64_t tick_frequency, double interval);
+
+/*
+ * Set a fixed clock model, for cameras that share the host clock
+ *
+ * @param clock             Clock to initialize
+ * @param tick_frequency    Camera timestamp ticks per second
+ * @param offset            Host minus camera clock (s)
+ */
+void clock_sync_fixed(struct clock_sync *clock, uint64_t tick_frequency,
+                      double offset);
+
+/*
+ * Stop the refresh thread, if running
+ */
+void clock_sync_stop(struct clock_sync *clock);
+
+/*
+ * Convert a camera timestamp to host time
+ *
+ * Safe to call from any thread, without the GIL.
+ *
+ * @param clock     Camera clock
+ * @param ticks     Camera timestamp
+ * @param tv        Host time returned here
+ * @param offset    Host minus camera clock at ticks returned here (s)
+ * @param drift     Current drift estimate returned here (s/s)
+ */
+void clock_sync_convert(struct clock_sync *clock, uint64_t ticks,
+                        struct timeval *tv, double *offset, double *drift);
+
+/* Connection monitoring */
+
+/*
+ * Initialize the monitor as connected, without a thread
+ */
+void monitor_init(struct camera_monitor *monitor);
+
+/*
+ * Start the thread that reconnects the camera when its connection is lost
+ *
+ * Requires the GIL.
+ *
+ * @param self      Camera object, READY
+ * @param interval  Seconds between attempts to reconnect, or 0 to only
+ *                  report the loss and end the queues
+ * @returns 0 on success, negative if the thread could not be started
+ */
+int monitor_start(svs_core_Camera *self, double interval);
+
+/*
+ * Stop the thread, if running, abandoning any reconnect
+ *
+ * Must not hold the GIL, which the thread may be waiting for.  A camera
+ * still DISCONNECTED afterwards has its SDK handles closed, and its queues
+ * ended.
+ */
+void monitor_stop(struct camera_monitor *monitor);
+
+/*
+ * Report a lost connection, from the stream callback
+ *
+ * Wakes the thread to close and reconnect the camera.  Repeated reports
+ * of the same loss are ignored.  Does not require the GIL.
+ */
+void monitor_lost(struct camera_monitor *monitor);
+
+/*
+ * Connection state and history, as returned by connection()
+ *
+ * Requires the GIL.
+ *
+ * @returns new dict, or NULL on error
+ */
+PyObject *monitor_dict(struct camera_monitor *monitor);
+
+/* Frame rings */
+
+/*
+ * Initialize a ring holding up to limit entries
+ *
+ * @returns 0 on success, negative if allocation fails
+ */
+int frame_ring_init(struct frame_ring *ring, unsigned int limit);
+
+/*
+ * Free ring storage
+ */
+void frame_ring_destroy(struct frame_ring *ring);
+
+/*
+ * Add an entry to the ring.  Only the producer may push.
+ *
+ * @returns 0 on success, negative if the ring is full
+ */
+int frame_ring_push(struct frame_ring *ring, unsigned int index);
+
+/*
+ * Remove the oldest entry from the ring.  Safe from either side.
+ *
+ * @returns 0 on success, negative if the ring is empty
+ */
+int frame_ring_pop(struct frame_ring *ring, unsigned int *index);
+
+/*
+ * Number of entries currently in the ring
+ */
+unsigned int frame_ring_length(struct frame_ring *ring);
+
+/* Statistics */
+
+/*
+ * Current monotonic time in ns
+ */
+uint64_t stats_now(void);
+
+/*
+ * Add a duration to a histogram
+ *
+ * @param stats Statistics, or NULL to do nothing
+ * @param id    Histogram to update
+ * @param start stats_now() at the start of the duration
+ */
+void stats_record(struct camera_stats *stats, enum stats_histogram_id id,
+                  uint64_t start);
+
+/*
+ * Add to a counter
+ *
+ * @param stats Statistics, or NULL to do nothing
+ */
+void stats_count(struct camera_stats *stats, enum stats_counter_id id,
+                 uint64_t n);
+
+/*
+ * Build a dictionary of statistics since the last reset
+ *
+ * @param stats Statistics
+ * @param queue Queue whose drops are reported
+ * @returns dict object, or NULL on error
+ */
+PyObject *stats_dict(struct camera_stats *stats, struct frame_queue *queue);
+
+/*
+ * Restart statistics from zero
+ */
+void stats_reset(struct camera_stats *stats, struct frame_queue *queue);
 
 /* Utility functions */
 
@@ -106,4 +1596,13 @@ uint32_t ip_string_to_int(const char *ip);
  */
 void ip_int_to_string(uint32_t ip, char buf[16]);
 
+/*
+ * Convert a Python timeout in seconds (or None) to milliseconds
+ *
+ * @param value     Timeout object, or NULL if not passed
+ * @param timeout   Milliseconds returned here, negative for no timeout
+ * @returns 0 on success, negative on error with exception set
+ */
+int parse_timeout(PyObject *value, int *timeout);
+
 #endif
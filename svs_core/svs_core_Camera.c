@@ -27,17 +27,122 @@
 
 #include <Python.h>
 #include <structmember.h>
-#include <sys/queue.h>
+#include <math.h>
+#include <unistd.h>
 #include <libsvgige/svgige.h>
 #include "svs_core.h"
 
-/* Camera released when heartbeat missing this long (ms) */
+/* Default ms without a heartbeat before the camera is released */
 #define HEARTBEAT_TIMEOUT  3000
 
-/* Packet bookkeeping and resend begin after this timeout (ms) */
+/* Default ms before packet bookkeeping and resends begin */
 #define PACKET_RESEND_TIMEOUT   1000
 
+/* Auto-tuned streams buffer this many seconds of images */
+#define AUTOTUNE_BUFFER_SECONDS 0.5
+
+/* Auto-tuned buffers take at most this fraction of free memory */
+#define AUTOTUNE_MEMORY_FRACTION    8
+
+/* Fewest buffers an auto-tuned stream gets */
+#define AUTOTUNE_MIN_BUFFERS    10
+
+/* Default seconds between attempts to reconnect a lost camera */
+#define RECONNECT_INTERVAL  1.0
+
 static void svs_core_Camera_dealloc(svs_core_Camera *self);
+/*
+ * Read the image geometry and pixel depth set by the multicast controller
+ *
+ * @returns 0 on success, negative on error with exception set
+ */
+static int svs_core_Camera_listener_settings(svs_core_Camera *self) {
+    int width, height, offset_x, offset_y, ret;
+    SVGIGE_PIXEL_DEPTH depth;
+
+    ret = Camera_getAreaOfInterest(self->handle, &width, &height, &offset_x,
+                                   &offset_y);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    self->width = width;
+    self->height = height;
+
+    ret = Camera_getPixelDepth(self->handle, &depth);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    switch (depth) {
+    case SVGIGE_PIXEL_DEPTH_8:
+        self->depth = 8;
+        break;
+    case SVGIGE_PIXEL_DEPTH_16:
+        self->depth = 16;
+        break;
+    default:
+        self->depth = 12;
+    }
+
+    return 0;
+}
+
+/*
+ * Choose the packet size and buffer count for the stream
+ *
+ * The packet size is the largest the network path carries, up to
+ * packet_size, as probed by the SDK.  Enough SVGigE buffers are used to
+ * hold AUTOTUNE_BUFFER_SECONDS of images at the current frame rate,
+ * within a share of free memory.  Listeners take the controller's
+ * packet size.
+ *
+ * @returns 0 on success, negative on error with exception set
+ */
+static int svs_core_Camera_autotune(svs_core_Camera *self) {
+    unsigned long long available, count, limit;
+    int packet_size, ret;
+    float framerate;
+
+    if (self->multicast != MULTICAST_MODE_LISTENER) {
+        ret = Camera_evaluateMaximalPacketSize(self->handle, &packet_size);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return -1;
+        }
+
+        if (packet_size > 0 && (unsigned int) packet_size < self->packet_size) {
+            self->packet_size = packet_size;
+        }
+    }
+
+    ret = Camera_getFrameRate(self->handle, &framerate);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    count = framerate > 0 ? (unsigned long long) ceil(framerate*AUTOTUNE_BUFFER_SECONDS) : 0;
+    if (count < AUTOTUNE_MIN_BUFFERS) {
+        count = AUTOTUNE_MIN_BUFFERS;
+    }
+
+    available = (unsigned long long) sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    limit = available/AUTOTUNE_MEMORY_FRACTION/(self->buffer_size ? self->buffer_size : 1);
+    if (limit < 2) {
+        limit = 2;
+    }
+    if (count > limit) {
+        count = limit;
+    }
+
+    self->buffer_count = count;
+
+    return 0;
+}
+
 static int svs_core_Camera_init(svs_core_Camera *self, PyObject *args, PyObject *kwds);
 
 PyMemberDef svs_core_Camera_members[] = {
@@ -65,27 +170,108 @@ PyTypeObject svs_core_CameraType = {
     0,                         /* tp_setattro */
     0,                         /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,   /* tp_flags */
-    "Camera(ip, source_ip, [buffer_count=10, packet_size=9000,\n"
-    "       queue_length=50]) -> Camera object\n\n"
+    "Camera(ip=None, source_ip=None, [buffer_count=10, packet_size=9000,\n"
+    "       queue_length=50, zero_copy=False, pool_size=0,\n"
+    "       pool_timeout=0, clock_interval=10,\n"
+    "       msb_aligned=True, output_format='raw',\n"
+    "       preview_decimation=0, preview_rate=0,\n"
+    "       overflow_policy='drop_oldest', multicast='none',\n"
+    "       autotune=False, resend_timeout=1000,\n"
+    "       heartbeat_timeout=3000, cpus=None, priority=0,\n"
+    "       numa_node=None, simulate=None,\n"
+    "       reconnect_interval=1.0]) -> Camera object\n\n"
     "Wrapper object for the SVS-VISTEK SVGigE SDK.  Provides a simpler interface\n"
     "to use for controlling cameras.  Exposes various camera settings as\n"
     "attributes, and provides methods for capturing images from the camera.\n\n"
     "Arguments:\n"
-    "   ip: IP address of camera to connect to.\n"
+    "   ip: IP address of camera to connect to.  Required, unless\n"
+    "       simulate is passed.\n"
     "   source_ip: IP address of local interface used for connection.\n"
+    "       Required, unless simulate is passed.\n"
     "   buffer_count (optional): Number of internal buffers for SVGigE\n"
     "       streaming channels.\n"
     "   packet_size (optional): MTU packet size.\n"
     "   queue_length (optional): Maximum number of images to queue for\n"
     "       return by next().  Once this limit is reached, old images are\n"
-    "       dropped from the queue.  A length of zero allows infinite\n"
-    "       images to queue.\n",    /* tp_doc */
+    "       dropped from the queue.  Frame buffers are allocated as the\n"
+    "       queue grows and reused afterwards, so this must be at least 1.\n"
+    "   zero_copy (optional): If True, next() returns arrays backed\n"
+    "       directly by the camera's frame pool instead of copies.  A\n"
+    "       frame returns to the pool once its array is freed.\n"
+    "   pool_size (optional): Number of frames in the pool.  At least\n"
+    "       queue_length + 2 are used.  In zero-copy mode, each array held\n"
+    "       by the application occupies one frame.\n"
+    "   pool_timeout (optional): Milliseconds to wait for the application\n"
+    "       to free a frame when the pool is exhausted, before dropping\n"
+    "       the new image.  Zero drops immediately.\n"
+    "   clock_interval (optional): Seconds between measurements of the\n"
+    "       camera clock against the host clock, used to estimate offset\n"
+    "       and drift for image timestamps.  Zero measures only at open.\n"
+    "   msb_aligned (optional): If True, 12-bit pixels are shifted to the\n"
+    "       top of the 16-bit array values (0..65520).  If False, they\n"
+    "       keep their 12-bit range (0..4095).\n"
+    "   output_format (optional): Format of images returned by next().\n"
+    "       'raw' returns the sensor data (Bayer or mono).  'rgb8' and\n"
+    "       'rgb16' return demosaiced (height, width, 3) arrays, with rgb16\n"
+    "       at full 16-bit scale.  'mono8' returns 8-bit luma.\n"
+    "   preview_decimation (optional): If non-zero, also produce preview\n"
+    "       images for next_preview(), box filtered down by this factor in\n"
+    "       each dimension.  Must be even, up to 16.  Previews of Bayer\n"
+    "       cameras are (height, width, 3) rgb8 arrays, otherwise mono8.\n"
+    "   preview_rate (optional): Maximum preview images per second.  Zero\n"
+    "       produces a preview of every image.\n"
+    "   overflow_policy (optional): What to do with a new image when\n"
+    "       queue_length images are already queued.  'drop_oldest' drops\n"
+    "       the oldest queued image.  'drop_newest' drops the new image.\n"
+    "       'latest_only' keeps only the newest image, ignoring\n"
+    "       queue_length.  'block' holds the SVGigE buffer until next()\n"
+    "       makes room, for up to pool_timeout milliseconds, or\n"
+    "       indefinitely if pool_timeout is 0.  Dropped images are\n"
+    "       counted in the dropped attribute.\n"
+    "   multicast (optional): 'none' streams to this host only.\n"
+    "       'controller' controls the camera and streams to a multicast\n"
+    "       group chosen by the SDK, which other hosts may join.\n"
+    "       'listener' joins a controller's group without taking control:\n"
+    "       images are queued as usual, but settings are read-only, and\n"
+    "       the image size and depth are those set by the controller.\n"
+    "   autotune (optional): If True, use the largest packet size up to\n"
+    "       packet_size that the network path carries, and enough buffers\n"
+    "       for half a second of images at the current framerate, within\n"
+    "       an eighth of free memory, and at least 10.  The values chosen\n"
+    "       are in stream_config.\n"
+    "   resend_timeout (optional): Milliseconds before missing packets\n"
+    "       are requested again.\n"
+    "   heartbeat_timeout (optional): Milliseconds without a heartbeat\n"
+    "       before the camera releases this connection.\n"
+    "   cpus (optional): Sequence of CPU numbers to pin the stream\n"
+    "       callback thread to.\n"
+    "   priority (optional): SCHED_FIFO priority for the stream callback\n"
+    "       thread, 1 to 99, or 0 to leave its policy alone.  Needs\n"
+    "       CAP_SYS_NICE.  Failures are reported in placement.\n"
+    "   numa_node (optional): NUMA node to allocate frame buffers on.\n"
+    "       By default, the node of the NIC with source_ip.  -1 allows\n"
+    "       any node.\n"
+    "   simulate (optional): dict describing a simulated camera, used\n"
+    "       instead of the SDK to exercise the capture path without\n"
+    "       hardware.  Keys, all optional, are width and height (1024 x\n"
+    "       768), pixel_type ('mono12_packed', or e.g. 'mono8', 'mono16',\n"
+    "       'bayer_gr8', 'bayer_gr12_packed'), framerate (30, or 0 for as\n"
+    "       fast as possible), loss (probability an image is lost), jitter\n"
+    "       (largest deviation of image times, in seconds), count (images\n"
+    "       to produce, 0 for no limit) and seed.  Images start at once and\n"
+    "       carry host monotonic microseconds in ticks.  Camera settings\n"
+    "       are unavailable; ip and source_ip are not needed.\n"
+    "   reconnect_interval (optional): Seconds between attempts to\n"
+    "       reopen the camera after its connection is lost.  Settings are\n"
+    "       restored and images resume into the same queue; see\n"
+    "       connection().  Zero only reports the loss, after which\n"
+    "       next() and iteration raise SVSClosedError.\n",    /* tp_doc */
     0,                         /* tp_traverse */
     0,                         /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
-    0,                         /* tp_iter */
-    0,                         /* tp_iternext */
+    PyObject_SelfIter,         /* tp_iter */
+    (iternextfunc) svs_core_Camera_iternext,    /* tp_iternext */
     svs_core_Camera_methods,        /* tp_methods */
     svs_core_Camera_members,        /* tp_members */
     svs_core_Camera_getseters,      /* tp_getset */
@@ -100,60 +286,135 @@ PyTypeObject svs_core_CameraType = {
 };
 
 static void svs_core_Camera_dealloc(svs_core_Camera *self) {
+    /* The monitor takes the GIL to hand the camera back */
+    Py_BEGIN_ALLOW_THREADS
+    monitor_stop(&self->monitor);
+    Py_END_ALLOW_THREADS
+
+    clock_sync_stop(&self->clock);
+    recorder_stop(&self->record);
+
+    /* Release a callback blocked on a full queue, so the stream can close */
+    frame_queue_end(&self->queue);
+    frame_queue_end(&self->preview);
+    frame_queue_end(&self->grab);
+
     /* Use ready flag to determine state of readiness to deallocate */
     switch (self->ready) {
     case READY:
-        closeStream(self->stream);
+        if (self->sim) {
+            sim_stop(self->sim);
+        }
+        else {
+            closeStream(self->stream);
+        }
     case NAME_ALLOCATED:
         Py_DECREF(self->name);
+        Py_XDECREF(self->info);
     case CONNECTED:
-        closeCamera(self->handle);
+        if (!self->sim) {
+            closeCamera(self->handle);
+        }
+        break;
+    case CLOSED:
+    case DISCONNECTED:
+        Py_DECREF(self->name);
+        Py_XDECREF(self->info);
         break;
     }
 
+    /* Stream is closed, so the callback no longer touches the pools */
+    if (self->sim) {
+        sim_free(self->sim);
+        self->sim = NULL;
+    }
+
+    if (self->bus) {
+        bus_destroy(self->bus);
+        self->bus = NULL;
+    }
+
+    if (self->native) {
+        Py_DECREF(self->native->capsule);
+        free(self->native);
+        self->native = NULL;
+    }
+
+    frame_queue_destroy(&self->queue);
+    frame_queue_destroy(&self->preview);
+    frame_queue_destroy(&self->grab);
+
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
-static int svs_core_Camera_init(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
-    static char *kwlist[] = {
-        "ip", "source_ip", "buffer_count", "packet_size", "queue_length", NULL
-    };
-
-    const char *ip = NULL;
-    const char *source_ip = NULL;
-    unsigned int buffer_count = 10;
-    unsigned int packet_size = 9000;
-    uint32_t ip_num, source_ip_num;
-    char *manufacturer, *model;
+/*
+ * Add and enable the image stream, with SVGigE buffers of buffer_size
+ *
+ * @returns 0 on success, negative on error with exception set
+ */
+static int svs_core_Camera_open_stream(svs_core_Camera *self) {
+    struct thread_placement *placement = &self->callback_placement;
     int ret;
 
-    self->main_thread = PyGILState_GetThisThreadState();
-    self->ready = NOT_READY;
-    TAILQ_INIT(&self->images);
-    self->images_length = 0;
-    self->images_max = 50;
+    /* A new stream may come with a new stream thread */
+    placement->pending = placement->cpus_set || placement->priority;
 
-    /*
-     * This means the definition is:
-     * def __init__(self, ip, source_ip, buffer_count=10, packet_size=9000,
-     *              queue_length=50):
-     */
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|III", kwlist,
-                &ip, &source_ip, &buffer_count, &packet_size,
-                &self->images_max)) {
+    if (self->sim) {
+        return sim_start(self->sim, self);
+    }
+
+    ret = addStream(self->handle, &self->stream, &self->stream_ip,
+                    &self->stream_port, self->buffer_size, self->buffer_count,
+                    self->packet_size, self->resend_timeout,
+                    svs_core_Camera_stream_callback, self);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    ret = enableStream(self->stream, 1);
+    if (ret != SVGigE_SUCCESS) {
+        closeStream(self->stream);
+        raise_general_error(ret);
         return -1;
     }
 
+    return 0;
+}
+
+/*
+ * Connect to the camera through the SDK
+ *
+ * Reads the name, clock, image geometry and buffer size.
+ *
+ * @returns 0 on success, negative on error with exception set
+ */
+static int svs_core_Camera_connect(svs_core_Camera *self, const char *ip,
+                                   const char *source_ip, PyObject *numa_node,
+                                   unsigned int heartbeat_timeout,
+                                   double clock_interval) {
+    uint32_t ip_num, source_ip_num;
+    char *manufacturer, *model;
+    int ret;
+
     ip_num = ip_string_to_int(ip);
     source_ip_num = ip_string_to_int(source_ip);
 
-    ret = openCamera(&self->handle, ip_num, source_ip_num, HEARTBEAT_TIMEOUT, MULTICAST_MODE_NONE);
+    /* By default, frames live next to the NIC receiving them */
+    if (!numa_node || numa_node == Py_None) {
+        self->numa_node = numa_node_of_ip(source_ip_num);
+    }
+
+    ret = openCamera(&self->handle, ip_num, source_ip_num, heartbeat_timeout, self->multicast);
     if (ret != SVGigE_SUCCESS) {
         raise_general_error(ret);
         return -1;
     }
 
     self->ready = CONNECTED;
+    self->ip = ip_num;
+    self->source_ip = source_ip_num;
+    self->heartbeat_timeout = heartbeat_timeout;
 
     manufacturer = strdup(Camera_getManufacturerName(self->handle));
     if (!manufacturer) {
@@ -183,49 +444,437 @@ static int svs_core_Camera_init(svs_core_Camera *self, PyObject *args, PyObject
         return -1;
     }
 
-    ret = Camera_getImagerWidth(self->handle, &self->width);
-    if (ret != SVGigE_SUCCESS) {
-        raise_general_error(ret);
+    ret = clock_sync_start(&self->clock, self->handle, self->tick_frequency,
+                           clock_interval);
+    if (ret) {
+        PyErr_SetString(SVSError, "Unable to synchronize with camera clock");
         return -1;
     }
 
-    ret = Camera_getImagerHeight(self->handle, &self->height);
+    if (self->multicast == MULTICAST_MODE_LISTENER) {
+        /* The controller owns the settings, so take the stream as it is */
+        if (svs_core_Camera_listener_settings(self)) {
+            return -1;
+        }
+    }
+    else {
+        ret = Camera_getImagerWidth(self->handle, &self->width);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return -1;
+        }
+
+        ret = Camera_getImagerHeight(self->handle, &self->height);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return -1;
+        }
+
+        /* 12-bit pixel depth */
+        self->depth = 12;
+        ret = Camera_setPixelDepth(self->handle, SVGIGE_PIXEL_DEPTH_12);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return -1;
+        }
+    }
+
+    /* Image buffer size in bytes */
+    ret = Camera_getBufferSize(self->handle, &self->buffer_size);
     if (ret != SVGigE_SUCCESS) {
         raise_general_error(ret);
         return -1;
     }
 
-    /* 12-bit pixel depth */
-    self->depth = 12;
-    ret = Camera_setPixelDepth(self->handle, SVGIGE_PIXEL_DEPTH_12);
+    return 0;
+}
+
+/*
+ * Stand a simulated camera in for the SDK connection
+ *
+ * The simulation timestamps images with the host's monotonic clock, in
+ * microseconds.  Camera settings remain SDK calls, so are unavailable.
+ *
+ * @returns 0 on success, negative on error with exception set
+ */
+static int svs_core_Camera_simulate(svs_core_Camera *self, PyObject *config) {
+    struct timespec real, mono;
+    struct sim_camera *sim;
+
+    if (self->multicast != MULTICAST_MODE_NONE) {
+        PyErr_SetString(PyExc_ValueError,
+                        "A simulated camera cannot use multicast");
+        return -1;
+    }
+
+    sim = calloc(1, sizeof(*sim));
+    if (!sim) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate simulation");
+        return -1;
+    }
+
+    if (sim_parse(sim, config)) {
+        free(sim);
+        return -1;
+    }
+
+    self->sim = sim;
+    self->handle = -1;
+
+    self->name = PyBytes_FromFormat("Simulated %ux%u", sim->width,
+                                    sim->height);
+    if (!self->name) {
+        return -1;
+    }
+
+    self->ready = NAME_ALLOCATED;
+
+    self->width = sim->width;
+    self->height = sim->height;
+    self->depth = (sim->pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16;
+    self->buffer_size = sim->size;
+
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    self->tick_frequency = 1000000;
+    clock_sync_fixed(&self->clock, self->tick_frequency,
+                     (real.tv_sec - mono.tv_sec) +
+                     1e-9*(real.tv_nsec - mono.tv_nsec));
+
+    return 0;
+}
+
+static int svs_core_Camera_init(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {
+        "ip", "source_ip", "buffer_count", "packet_size", "queue_length",
+        "zero_copy", "pool_size", "pool_timeout", "clock_interval",
+        "msb_aligned", "output_format", "preview_decimation", "preview_rate",
+        "overflow_policy", "multicast", "autotune", "resend_timeout",
+        "heartbeat_timeout", "cpus", "priority", "numa_node", "simulate",
+        "reconnect_interval", NULL
+    };
+
+    const char *ip = NULL;
+    const char *source_ip = NULL;
+    unsigned int buffer_count = 10;
+    unsigned int packet_size = 9000;
+    unsigned int images_max = 50;
+    unsigned int pool_size = 0;
+    double clock_interval = 10;
+    double preview_rate = 0;
+    double reconnect_interval = RECONNECT_INTERVAL;
+    int msb_aligned = 1;
+    const char *output_format = "raw";
+    const char *overflow_policy = "drop_oldest";
+    const char *multicast = "none";
+    int autotune = 0;
+    unsigned int heartbeat_timeout = HEARTBEAT_TIMEOUT;
+    PyObject *cpus = NULL, *numa_node = NULL, *simulate = NULL;
+    int priority = 0;
+    int policy;
+    int ret;
+
+    self->main_thread = PyGILState_GetThisThreadState();
+    self->ready = NOT_READY;
+    self->zero_copy = 0;
+    self->pool_timeout = 0;
+    self->preview_decimation = 0;
+    self->resend_timeout = PACKET_RESEND_TIMEOUT;
+    monitor_init(&self->monitor);
+
+    /*
+     * This means the definition is:
+     * def __init__(self, ip=None, source_ip=None, buffer_count=10,
+     *              packet_size=9000, queue_length=50, zero_copy=False,
+     *              pool_size=0, pool_timeout=0, clock_interval=10,
+     *              msb_aligned=True,
+     *              output_format="raw", preview_decimation=0,
+     *              preview_rate=0, overflow_policy="drop_oldest",
+     *              multicast="none", autotune=False, resend_timeout=1000,
+     *              heartbeat_timeout=3000, cpus=None, priority=0,
+     *              numa_node=None, simulate=None, reconnect_interval=1.0):
+     */
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzIIIiIIdisIdssiIIOiOOd", kwlist,
+                &ip, &source_ip, &buffer_count, &packet_size,
+                &images_max, &self->zero_copy, &pool_size,
+                &self->pool_timeout, &clock_interval, &msb_aligned,
+                &output_format, &self->preview_decimation, &preview_rate,
+                &overflow_policy, &multicast, &autotune,
+                &self->resend_timeout, &heartbeat_timeout, &cpus, &priority,
+                &numa_node, &simulate, &reconnect_interval)) {
+        return -1;
+    }
+
+    self->unpack_shift = msb_aligned ? 4 : 0;
+
+    if (!strcmp(output_format, "raw")) {
+        self->output_format = FORMAT_RAW;
+    }
+    else if (!strcmp(output_format, "mono8")) {
+        self->output_format = FORMAT_MONO8;
+    }
+    else if (!strcmp(output_format, "rgb8")) {
+        self->output_format = FORMAT_RGB8;
+    }
+    else if (!strcmp(output_format, "rgb16")) {
+        self->output_format = FORMAT_RGB16;
+    }
+    else {
+        PyErr_Format(PyExc_ValueError, "Unknown output_format '%s'", output_format);
+        return -1;
+    }
+
+    if (!strcmp(overflow_policy, "drop_oldest")) {
+        policy = OVERFLOW_DROP_OLDEST;
+    }
+    else if (!strcmp(overflow_policy, "drop_newest")) {
+        policy = OVERFLOW_DROP_NEWEST;
+    }
+    else if (!strcmp(overflow_policy, "latest_only")) {
+        policy = OVERFLOW_LATEST_ONLY;
+        images_max = 1;
+    }
+    else if (!strcmp(overflow_policy, "block")) {
+        policy = OVERFLOW_BLOCK;
+    }
+    else {
+        PyErr_Format(PyExc_ValueError, "Unknown overflow_policy '%s'", overflow_policy);
+        return -1;
+    }
+
+    if (!strcmp(multicast, "none")) {
+        self->multicast = MULTICAST_MODE_NONE;
+    }
+    else if (!strcmp(multicast, "controller")) {
+        self->multicast = MULTICAST_MODE_CONTROLLER;
+    }
+    else if (!strcmp(multicast, "listener")) {
+        self->multicast = MULTICAST_MODE_LISTENER;
+    }
+    else {
+        PyErr_Format(PyExc_ValueError, "Unknown multicast mode '%s'", multicast);
+        return -1;
+    }
+
+    if (thread_placement_parse(&self->callback_placement, cpus, priority)) {
+        return -1;
+    }
+
+    if (numa_node && numa_node != Py_None) {
+        self->numa_node = PyLong_AsLong(numa_node);
+        if (self->numa_node == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (self->numa_node < -1) {
+            PyErr_SetString(PyExc_ValueError, "numa_node must be -1 or a node number");
+            return -1;
+        }
+    }
+
+    if (!images_max) {
+        PyErr_SetString(PyExc_ValueError, "queue_length must be at least 1");
+        return -1;
+    }
+
+    if (self->preview_decimation && (self->preview_decimation & 1 ||
+            self->preview_decimation > PREVIEW_MAX_DECIMATION)) {
+        PyErr_Format(PyExc_ValueError,
+                     "preview_decimation must be an even number up to %d",
+                     PREVIEW_MAX_DECIMATION);
+        return -1;
+    }
+
+    if (preview_rate < 0) {
+        PyErr_SetString(PyExc_ValueError, "preview_rate must not be negative");
+        return -1;
+    }
+
+    if (reconnect_interval < 0) {
+        PyErr_SetString(PyExc_ValueError, "reconnect_interval must not be negative");
+        return -1;
+    }
+
+    self->preview_interval = preview_rate > 0 ? 1/preview_rate : 0;
+    self->preview_next = 0;
+
+    recorder_init(&self->record);
+
+    if (simulate && simulate != Py_None) {
+        if (autotune) {
+            PyErr_SetString(PyExc_ValueError,
+                            "autotune needs a real camera");
+            return -1;
+        }
+
+        /* No NIC receives the images */
+        if (!numa_node || numa_node == Py_None) {
+            self->numa_node = -1;
+        }
+
+        self->heartbeat_timeout = heartbeat_timeout;
+        ret = svs_core_Camera_simulate(self, simulate);
+    }
+    else if (!ip || !source_ip) {
+        PyErr_SetString(PyExc_TypeError,
+                        "ip and source_ip are required, unless simulated");
+        return -1;
+    }
+    else {
+        ret = svs_core_Camera_connect(self, ip, source_ip, numa_node,
+                                      heartbeat_timeout, clock_interval);
+    }
+    if (ret) {
+        return -1;
+    }
+
+    ret = frame_queue_init(&self->queue, images_max, pool_size);
+    if (ret) {
+        return -1;
+    }
+
+    self->queue.overflow_policy = policy;
+    self->queue.numa_node = self->numa_node;
+
+    memset(&self->stats, 0, sizeof(self->stats));
+    self->queue.stats = &self->stats;
+
+    if (self->preview_decimation) {
+        ret = frame_queue_init(&self->preview, PREVIEW_QUEUE_LENGTH, 0);
+        if (ret) {
+            return -1;
+        }
+
+        self->preview.numa_node = self->numa_node;
+    }
+
+    /* grab() only ever wants the image it asked for */
+    ret = frame_queue_init(&self->grab, 1, 0);
+    if (ret) {
+        return -1;
+    }
+
+    self->grab.overflow_policy = OVERFLOW_LATEST_ONLY;
+    self->grab.numa_node = self->numa_node;
+
+    /* Open stream */
+    self->buffer_count = buffer_count;
+    self->packet_size = packet_size;
+    if (autotune && svs_core_Camera_autotune(self)) {
+        return -1;
+    }
+    self->autotuned = autotune;
+
+    if (svs_core_Camera_open_stream(self)) {
+        return -1;
+    }
+
+    self->ready = READY;
+
+    /* A simulation never loses its connection */
+    if (!self->sim && monitor_start(self, reconnect_interval)) {
+        PyErr_SetString(SVSError, "Unable to start connection monitor");
+        return -1;
+    }
+
+    return 0;
+}
+
+int svs_core_Camera_reconfigure(svs_core_Camera *self) {
+    int width, height, offset_x, offset_y, ret;
+    unsigned int buffer_size;
+
+    ret = Camera_getAreaOfInterest(self->handle, &width, &height, &offset_x,
+                                   &offset_y);
     if (ret != SVGigE_SUCCESS) {
         raise_general_error(ret);
         return -1;
     }
 
-    /* Image buffer size in bytes */
-    ret = Camera_getBufferSize(self->handle, &self->buffer_size);
+    self->width = width;
+    self->height = height;
+
+    /* Kept to restore after a reconnect */
+    self->config.roi_valid = 1;
+    self->config.roi[0] = width;
+    self->config.roi[1] = height;
+    self->config.roi[2] = offset_x;
+    self->config.roi[3] = offset_y;
+
+    ret = Camera_getBufferSize(self->handle, &buffer_size);
     if (ret != SVGigE_SUCCESS) {
         raise_general_error(ret);
         return -1;
     }
 
-    /* Open stream */
-    ret = addStream(self->handle, &self->stream, &self->stream_ip,
-                    &self->stream_port, self->buffer_size, buffer_count,
-                    packet_size, PACKET_RESEND_TIMEOUT,
-                    svs_core_Camera_stream_callback, self);
+    if (buffer_size == self->buffer_size || self->ready != READY) {
+        self->buffer_size = buffer_size;
+        return 0;
+    }
+
+    /* SVGigE buffers are sized when the stream is added, so replace it */
+    frame_queue_close(&self->queue);
+
+    /* Before releasing the GIL, so the monitor leaves the stream alone */
+    self->ready = NAME_ALLOCATED;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = closeStream(self->stream);
+    Py_END_ALLOW_THREADS
+
+    frame_queue_open(&self->queue);
+
     if (ret != SVGigE_SUCCESS) {
+        self->ready = READY;
         raise_general_error(ret);
         return -1;
     }
 
-    ret = enableStream(self->stream, 1);
+    self->buffer_size = buffer_size;
+
+    if (svs_core_Camera_open_stream(self)) {
+        return -1;
+    }
+
+    self->ready = READY;
+
+    return 0;
+}
+
+int svs_core_Camera_resume(svs_core_Camera *self, Camera_handle handle) {
+    int width, height, offset_x, offset_y, ret;
+
+    self->handle = handle;
+
+    if (self->multicast == MULTICAST_MODE_LISTENER) {
+        if (svs_core_Camera_listener_settings(self)) {
+            return -1;
+        }
+    }
+    else {
+        /* As restored, or as the camera chose if that failed */
+        ret = Camera_getAreaOfInterest(self->handle, &width, &height,
+                                       &offset_x, &offset_y);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return -1;
+        }
+
+        self->width = width;
+        self->height = height;
+    }
+
+    ret = Camera_getBufferSize(self->handle, &self->buffer_size);
     if (ret != SVGigE_SUCCESS) {
         raise_general_error(ret);
         return -1;
     }
 
+    /* Packet size and buffer count as before, tuned or not */
+    if (svs_core_Camera_open_stream(self)) {
+        return -1;
+    }
+
     self->ready = READY;
 
     return 0;
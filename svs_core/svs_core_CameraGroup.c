@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Synchronized capture from several cameras
+ *
+ * A CameraGroup takes images from each camera's queue and matches them
+ * by capture time.  Each camera's hardware timestamps are converted to
+ * host time with its own clock model, so cameras with independent tick
+ * counters can be compared.  Queues deliver images in capture order, so
+ * when the oldest pending image is too far from the others it can never
+ * be matched, and is dropped.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+#define GROUP_TOLERANCE     0.002   /* Default match window (s) */
+
+static double frame_time(struct frame *frame) {
+    return frame->info.time.tv_sec + frame->info.time.tv_usec*1e-6;
+}
+
+static int64_t group_monotonic_ms(void) {
+    return stats_now()/1000000;
+}
+
+/*
+ * Return pending frames to their cameras
+ */
+static void group_release(svs_core_CameraGroup *self) {
+    for (unsigned int i = 0; i < self->count; i++) {
+        if (self->pending[i] >= 0) {
+            frame_release(&self->camera[i]->queue, self->pending[i]);
+            self->pending[i] = -1;
+        }
+    }
+}
+
+static void svs_core_CameraGroup_dealloc(svs_core_CameraGroup *self) {
+    if (self->pending) {
+        group_release(self);
+    }
+
+    free(self->pending);
+    free(self->unmatched);
+    free(self->camera);
+    Py_XDECREF(self->cameras);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int svs_core_CameraGroup_init(svs_core_CameraGroup *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"cameras", "tolerance", NULL};
+    PyObject *cameras;
+    double tolerance = GROUP_TOLERANCE;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|d", kwlist, &cameras,
+                                     &tolerance)) {
+        return -1;
+    }
+
+    if (tolerance < 0) {
+        PyErr_SetString(PyExc_ValueError, "tolerance must not be negative");
+        return -1;
+    }
+
+    if (self->cameras) {
+        PyErr_SetString(PyExc_RuntimeError, "CameraGroup already initialized");
+        return -1;
+    }
+
+    self->cameras = PySequence_Tuple(cameras);
+    if (!self->cameras) {
+        return -1;
+    }
+
+    self->count = PyTuple_GET_SIZE(self->cameras);
+    if (self->count < 2) {
+        PyErr_SetString(PyExc_ValueError, "CameraGroup needs at least two cameras");
+        return -1;
+    }
+
+    self->camera = calloc(self->count, sizeof(*self->camera));
+    self->pending = calloc(self->count, sizeof(*self->pending));
+    self->unmatched = calloc(self->count, sizeof(*self->unmatched));
+    if (!self->camera || !self->pending || !self->unmatched) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate CameraGroup");
+        return -1;
+    }
+
+    /* Nothing pending, so dealloc releases nothing if a member is wrong */
+    for (unsigned int i = 0; i < self->count; i++) {
+        self->pending[i] = -1;
+    }
+
+    for (unsigned int i = 0; i < self->count; i++) {
+        PyObject *camera = PyTuple_GET_ITEM(self->cameras, i);
+
+        if (!PyObject_TypeCheck(camera, &svs_core_CameraType)) {
+            PyErr_SetString(PyExc_TypeError, "CameraGroup members must be Cameras");
+            return -1;
+        }
+
+        /* Borrowed, the tuple holds the references */
+        self->camera[i] = (svs_core_Camera *) camera;
+    }
+
+    self->tolerance = tolerance;
+
+    return 0;
+}
+
+/*
+ * Take any newly queued images for cameras without a pending image
+ *
+ * @param ended     Set if a camera without an image is closed, else
+ *                  unchanged, or NULL
+ * @returns number of cameras still without an image
+ */
+static unsigned int group_fill(svs_core_CameraGroup *self, int *ended) {
+    unsigned int missing = 0, index;
+    int ret;
+
+    for (unsigned int i = 0; i < self->count; i++) {
+        if (self->pending[i] >= 0) {
+            continue;
+        }
+
+        ret = frame_queue_pop(&self->camera[i]->queue, &index, 0);
+        if (!ret) {
+            self->pending[i] = index;
+        }
+        else {
+            missing++;
+
+            if (ret == 2 && ended) {
+                *ended = 1;
+            }
+        }
+    }
+
+    return missing;
+}
+
+/*
+ * Wait for images on cameras without a pending image
+ *
+ * @returns 0 on wakeup or timeout, negative on error with exception set
+ */
+static int group_wait(svs_core_CameraGroup *self, int timeout) {
+    struct pollfd *pfds;
+    unsigned int nfds = 0;
+    int ret;
+
+    pfds = calloc(self->count, sizeof(*pfds));
+    if (!pfds) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < self->count; i++) {
+        if (self->pending[i] < 0) {
+            pfds[nfds].fd = self->camera[i]->queue.event_fd;
+            pfds[nfds].events = POLLIN;
+            nfds++;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = poll(pfds, nfds, timeout);
+    Py_END_ALLOW_THREADS
+
+    free(pfds);
+
+    if (ret < 0) {
+        if (errno != EINTR) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            return -1;
+        }
+
+        /* Allow KeyboardInterrupt while waiting */
+        if (PyErr_CheckSignals()) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Try to match the pending images
+ *
+ * While the pending images span more than the tolerance, the oldest is
+ * dropped, as no later image can be closer to the others.
+ *
+ * @returns 1 if every camera has a matching image, 0 otherwise
+ */
+static int group_match(svs_core_CameraGroup *self) {
+    for (;;) {
+        unsigned int oldest = 0;
+        double first = INFINITY, last = -INFINITY;
+
+        for (unsigned int i = 0; i < self->count; i++) {
+            svs_core_Camera *camera = self->camera[i];
+            double t;
+
+            if (self->pending[i] < 0) {
+                return 0;
+            }
+
+            t = frame_time(&camera->queue.frames[self->pending[i]]);
+            if (t < first) {
+                first = t;
+                oldest = i;
+            }
+            if (t > last) {
+                last = t;
+            }
+        }
+
+        if (last - first <= self->tolerance) {
+            self->matched++;
+            self->skew_last = last - first;
+            self->skew_sum += self->skew_last;
+            if (self->skew_last > self->skew_max) {
+                self->skew_max = self->skew_last;
+            }
+            return 1;
+        }
+
+        frame_release(&self->camera[oldest]->queue, self->pending[oldest]);
+        self->pending[oldest] = -1;
+        self->unmatched[oldest]++;
+
+        if (group_fill(self, NULL)) {
+            return 0;
+        }
+    }
+}
+
+static PyObject *svs_core_CameraGroup_next(svs_core_CameraGroup *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeout_obj = NULL, *ret;
+    int64_t deadline;
+    int timeout, remaining;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj)) {
+        return NULL;
+    }
+
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    deadline = group_monotonic_ms() + timeout;
+
+    for (;;) {
+        int ended = 0;
+
+        group_fill(self, &ended);
+
+        if (group_match(self)) {
+            break;
+        }
+
+        /* Its fd stays readable, so waiting would spin */
+        if (ended) {
+            PyErr_SetString(SVSClosedError, "Camera is closed");
+            return NULL;
+        }
+
+        if (timeout < 0) {
+            remaining = -1;
+        }
+        else {
+            remaining = deadline - group_monotonic_ms();
+            if (remaining <= 0) {
+                PyErr_SetString(SVSNoImagesError, "No matching images available");
+                return NULL;
+            }
+        }
+
+        if (group_wait(self, remaining)) {
+            return NULL;
+        }
+    }
+
+    ret = PyTuple_New(self->count);
+    if (!ret) {
+        group_release(self);
+        return NULL;
+    }
+
+    /* Each frame is handed over, or released on error */
+    for (unsigned int i = 0; i < self->count; i++) {
+        svs_core_Camera *camera = self->camera[i];
+        unsigned int index = self->pending[i];
+        PyObject *item;
+
+        self->pending[i] = -1;
+        item = svs_core_Camera_frame(camera, &camera->queue, index);
+        if (!item) {
+            group_release(self);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(ret, i, item);
+    }
+
+    return ret;
+}
+
+static PyObject *svs_core_CameraGroup_trigger(svs_core_CameraGroup *self, PyObject *args) {
+    int ret = SVGigE_SUCCESS;
+
+    /* Back to back, without the GIL, to keep the trigger skew small */
+    Py_BEGIN_ALLOW_THREADS
+    for (unsigned int i = 0; i < self->count && ret == SVGigE_SUCCESS; i++) {
+        ret = Camera_startAcquisitionCycle(self->camera[i]->handle);
+    }
+    Py_END_ALLOW_THREADS
+
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_CameraGroup_stats(svs_core_CameraGroup *self, PyObject *args) {
+    PyObject *unmatched;
+
+    unmatched = PyTuple_New(self->count);
+    if (!unmatched) {
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < self->count; i++) {
+        PyObject *count = PyLong_FromUnsignedLongLong(self->unmatched[i]);
+
+        if (!count) {
+            Py_DECREF(unmatched);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(unmatched, i, count);
+    }
+
+    return Py_BuildValue("{sKsNsdsdsd}",
+            "matched", (unsigned long long) self->matched,
+            "unmatched", unmatched,
+            "skew_last", self->skew_last,
+            "skew_mean", self->matched ? self->skew_sum/self->matched : 0.0,
+            "skew_max", self->skew_max);
+}
+
+static PyObject *svs_core_CameraGroup_getcameras(svs_core_CameraGroup *self, void *closure) {
+    Py_INCREF(self->cameras);
+    return self->cameras;
+}
+
+static PyMethodDef svs_core_CameraGroup_methods[] = {
+    {"next", (PyCFunction) svs_core_CameraGroup_next, METH_VARARGS | METH_KEYWORDS,
+        "next(timeout=0) -> ((image, metadata), ...)\n\n"
+        "Gets the next set of matching images.\n\n"
+        "Waits for every camera to have an image captured within tolerance\n"
+        "seconds of the others.  Images that can't be matched are dropped\n"
+        "and counted in stats().\n\n"
+        "Arguments:\n"
+        "    timeout (optional): Seconds to wait.  Zero returns immediately,\n"
+        "        None waits forever.  The GIL is released while waiting.\n\n"
+        "Returns:\n"
+        "    Tuple with an (image, metadata) tuple per camera, in the order\n"
+        "    the cameras were given.\n\n"
+        "Raises:\n"
+        "    SVSNoImagesError: No matching images before the timeout.\n"
+        "    SVSClosedError: A camera without an image was closed."
+    },
+    {"trigger", (PyCFunction) svs_core_CameraGroup_trigger, METH_NOARGS,
+        "trigger()\n\n"
+        "Software trigger every camera, back to back.\n\n"
+        "The cameras must be in software trigger acquisition mode.\n\n"
+        "Raises:\n"
+        "    SVSError: An unknown error occured in the SVGigE SDK."
+    },
+    {"stats", (PyCFunction) svs_core_CameraGroup_stats, METH_NOARGS,
+        "stats() -> dict\n\n"
+        "Matching statistics.\n\n"
+        "Returns:\n"
+        "    Dictionary with the number of matched sets, a tuple of images\n"
+        "    dropped unmatched per camera, and the last, mean and maximum\n"
+        "    skew (s) between the first and last image of a matched set."
+    },
+    {NULL}
+};
+
+static PyGetSetDef svs_core_CameraGroup_getseters[] = {
+    {"cameras", (getter) svs_core_CameraGroup_getcameras, NULL, "Cameras in group", NULL},
+    {NULL}
+};
+
+PyTypeObject svs_core_CameraGroupType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "svs_core.CameraGroup",         /* tp_name */
+    sizeof(svs_core_CameraGroup),   /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) svs_core_CameraGroup_dealloc,   /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,   /* tp_flags */
+    "CameraGroup(cameras, [tolerance=0.002]) -> CameraGroup object\n\n"
+    "Synchronized capture from several cameras.  Images are matched by\n"
+    "capture time, using each camera's clock model to convert hardware\n"
+    "timestamps to host time.\n\n"
+    "Images must only be taken through the group, not the cameras' own\n"
+    "next().\n\n"
+    "Arguments:\n"
+    "   cameras: Sequence of at least two Camera objects.\n"
+    "   tolerance (optional): Maximum seconds between the first and last\n"
+    "       image of a matched set.\n",      /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    svs_core_CameraGroup_methods,   /* tp_methods */
+    0,                         /* tp_members */
+    svs_core_CameraGroup_getseters, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc) svs_core_CameraGroup_init,       /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
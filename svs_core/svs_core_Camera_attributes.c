@@ -26,11 +26,15 @@
  */
 
 #include <Python.h>
+#include <limits.h>
 #include <libsvgige/svgige.h>
 
 #include "svs_core.h"
 
-PyObject *svs_core_Camera_getinfo(svs_core_Camera *self, void *closure) {
+/*
+ * Build the info dict from the SDK
+ */
+static PyObject *camera_info(svs_core_Camera *self) {
     PyObject *dict = PyDict_New();
     if (!dict) {
         return NULL;
@@ -78,6 +82,18 @@ PyObject *svs_core_Camera_getinfo(svs_core_Camera *self, void *closure) {
     return dict;
 }
 
+PyObject *svs_core_Camera_getinfo(svs_core_Camera *self, void *closure) {
+    /* Identity strings don't change while the camera is open */
+    if (!self->info) {
+        self->info = camera_info(self);
+        if (!self->info) {
+            return NULL;
+        }
+    }
+
+    return PyDict_Copy(self->info);
+}
+
 static int svs_core_Camera_setinfo(svs_core_Camera *self, PyObject *value, void *closure) {
     PyErr_SetString(PyExc_TypeError, "Cannot modify attribute 'info'");
     return -1;
@@ -97,9 +113,65 @@ static PyObject *svs_core_Camera_getwidth(svs_core_Camera *self, void *closure)
     return PyLong_FromLong(self->width);
 }
 
+/*
+ * Set the area of interest, then update the image size and stream
+ */
+static int camera_set_roi(svs_core_Camera *self, int width, int height,
+                          int offset_x, int offset_y) {
+    int ret;
+
+    ret = Camera_setAreaOfInterest(self->handle, width, height, offset_x,
+                                   offset_y);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    return svs_core_Camera_reconfigure(self);
+}
+
+/*
+ * Change one dimension of the area of interest, keeping its offset
+ */
+static int camera_set_size(svs_core_Camera *self, PyObject *value,
+                           const char *name, int is_width) {
+    int width, height, offset_x, offset_y, ret;
+    long size;
+
+    if (value == NULL) {
+        PyErr_Format(PyExc_TypeError, "Cannot delete attribute '%s'", name);
+        return -1;
+    }
+
+    size = PyLong_AsLong(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    if (size <= 0 || size > INT_MAX) {
+        PyErr_Format(PyExc_ValueError, "Attribute '%s' must be positive", name);
+        return -1;
+    }
+
+    ret = Camera_getAreaOfInterest(self->handle, &width, &height, &offset_x,
+                                   &offset_y);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    if (is_width) {
+        width = size;
+    }
+    else {
+        height = size;
+    }
+
+    return camera_set_roi(self, width, height, offset_x, offset_y);
+}
+
 static int svs_core_Camera_setwidth(svs_core_Camera *self, PyObject *value, void *closure) {
-    PyErr_SetString(PyExc_NotImplementedError, "Changing image width not yet supported.");
-    return -1;
+    return camera_set_size(self, value, "width", 1);
 }
 
 static PyObject *svs_core_Camera_getheight(svs_core_Camera *self, void *closure) {
@@ -107,8 +179,160 @@ static PyObject *svs_core_Camera_getheight(svs_core_Camera *self, void *closure)
 }
 
 static int svs_core_Camera_setheight(svs_core_Camera *self, PyObject *value, void *closure) {
-    PyErr_SetString(PyExc_NotImplementedError, "Changing image height not yet supported.");
-    return -1;
+    return camera_set_size(self, value, "height", 0);
+}
+
+static PyObject *svs_core_Camera_getroi(svs_core_Camera *self, void *closure) {
+    int width, height, offset_x, offset_y, ret;
+
+    ret = Camera_getAreaOfInterest(self->handle, &width, &height, &offset_x,
+                                   &offset_y);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return NULL;
+    }
+
+    return Py_BuildValue("(iiii)", offset_x, offset_y, width, height);
+}
+
+static int svs_core_Camera_setroi(svs_core_Camera *self, PyObject *value, void *closure) {
+    int width, height, offset_x, offset_y;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete attribute 'roi'");
+        return -1;
+    }
+
+    if (!PyTuple_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "Attribute 'roi' must be a tuple");
+        return -1;
+    }
+
+    if (!PyArg_ParseTuple(value, "iiii", &offset_x, &offset_y, &width, &height)) {
+        return -1;
+    }
+
+    if (width <= 0 || height <= 0 || offset_x < 0 || offset_y < 0) {
+        PyErr_SetString(PyExc_ValueError, "Attribute 'roi' must have a positive size and offset");
+        return -1;
+    }
+
+    return camera_set_roi(self, width, height, offset_x, offset_y);
+}
+
+static PyObject *svs_core_Camera_getbinning(svs_core_Camera *self, void *closure) {
+    BINNING_MODE mode;
+    int ret;
+
+    ret = Camera_getBinningMode(self->handle, &mode);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return NULL;
+    }
+
+    switch (mode) {
+    case BINNING_MODE_OFF:
+        return PyLong_FromLong(1);
+    case BINNING_MODE_2x2:
+        return PyLong_FromLong(2);
+    case BINNING_MODE_3x3:
+        return PyLong_FromLong(3);
+    case BINNING_MODE_4x4:
+        return PyLong_FromLong(4);
+    default:
+        PyErr_Format(SVSError, "Unsupported binning mode %d", mode);
+        return NULL;
+    }
+}
+
+static int svs_core_Camera_setbinning(svs_core_Camera *self, PyObject *value, void *closure) {
+    BINNING_MODE mode;
+    long factor;
+    int ret;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete attribute 'binning'");
+        return -1;
+    }
+
+    factor = PyLong_AsLong(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    switch (factor) {
+    case 1:
+        mode = BINNING_MODE_OFF;
+        break;
+    case 2:
+        mode = BINNING_MODE_2x2;
+        break;
+    case 3:
+        mode = BINNING_MODE_3x3;
+        break;
+    case 4:
+        mode = BINNING_MODE_4x4;
+        break;
+    default:
+        PyErr_SetString(PyExc_ValueError, "Attribute 'binning' must be 1, 2, 3 or 4");
+        return -1;
+    }
+
+    ret = Camera_setBinningMode(self->handle, mode);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    self->config.binning_valid = 1;
+    self->config.binning = mode;
+
+    return svs_core_Camera_reconfigure(self);
+}
+
+static PyObject *svs_core_Camera_getdepth(svs_core_Camera *self, void *closure) {
+    return PyLong_FromLong(self->depth);
+}
+
+static int svs_core_Camera_setdepth(svs_core_Camera *self, PyObject *value, void *closure) {
+    SVGIGE_PIXEL_DEPTH depth;
+    long bits;
+    int ret;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete attribute 'depth'");
+        return -1;
+    }
+
+    bits = PyLong_AsLong(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    switch (bits) {
+    case 8:
+        depth = SVGIGE_PIXEL_DEPTH_8;
+        break;
+    case 12:
+        depth = SVGIGE_PIXEL_DEPTH_12;
+        break;
+    case 16:
+        depth = SVGIGE_PIXEL_DEPTH_16;
+        break;
+    default:
+        PyErr_SetString(PyExc_ValueError, "Attribute 'depth' must be 8, 12 or 16");
+        return -1;
+    }
+
+    ret = Camera_setPixelDepth(self->handle, depth);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    self->depth = bits;
+
+    return svs_core_Camera_reconfigure(self);
 }
 
 static PyObject *svs_core_Camera_getpixelclock(svs_core_Camera *self, void *closure) {
@@ -161,6 +385,8 @@ static int svs_core_Camera_setgain(svs_core_Camera *self, PyObject *value, void
         return -1;
     }
 
+    config_store(&self->config, CONFIG_GAIN, gain, 0);
+
     return 0;
 }
 
@@ -200,6 +426,8 @@ static int svs_core_Camera_setexposure(svs_core_Camera *self, PyObject *value, v
         return -1;
     }
 
+    config_store(&self->config, CONFIG_EXPOSURE, 1000*exposure, 0);
+
     return 0;
 }
 
@@ -244,6 +472,8 @@ static int svs_core_Camera_setauto_exposure(svs_core_Camera *self, PyObject *val
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_EXPOSURE, autoexposure, 0);
+
     return 0;
 }
 
@@ -290,6 +520,8 @@ static int svs_core_Camera_setauto_exposure_min(svs_core_Camera *self, PyObject
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_EXPOSURE_LIMITS, min, max);
+
     return 0;
 }
 
@@ -336,6 +568,8 @@ static int svs_core_Camera_setauto_exposure_max(svs_core_Camera *self, PyObject
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_EXPOSURE_LIMITS, min, max);
+
     return 0;
 }
 
@@ -380,6 +614,8 @@ static int svs_core_Camera_setauto_gain_min(svs_core_Camera *self, PyObject *val
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_GAIN_LIMITS, min, max);
+
     return 0;
 }
 
@@ -424,6 +660,8 @@ static int svs_core_Camera_setauto_gain_max(svs_core_Camera *self, PyObject *val
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_GAIN_LIMITS, min, max);
+
     return 0;
 }
 
@@ -462,6 +700,8 @@ static int svs_core_Camera_setauto_exposure_brightness(svs_core_Camera *self, Py
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_BRIGHTNESS, brightness, 0);
+
     return 0;
 }
 
@@ -508,6 +748,8 @@ static int svs_core_Camera_setauto_exposure_dynamics(svs_core_Camera *self, PyOb
         return -1;
     }
 
+    config_store(&self->config, CONFIG_AUTO_DYNAMICS, i, d);
+
     return 0;
 }
 
@@ -561,6 +803,162 @@ static int svs_core_Camera_setcontinuous_capture(svs_core_Camera *self,
         return -1;
     }
 
+    self->config.acquisition_valid = 1;
+    self->config.acquisition_mode = ACQUISITION_MODE_FIXED_FREQUENCY;
+    self->config.acquisition_start = value == Py_True;
+
+    return 0;
+}
+
+static PyObject *svs_core_Camera_getstream_config(svs_core_Camera *self, void *closure) {
+    return Py_BuildValue("{sIsIsIsI}",
+            "packet_size", self->packet_size,
+            "buffer_count", self->buffer_count,
+            "resend_timeout", self->resend_timeout,
+            "heartbeat_timeout", self->heartbeat_timeout);
+}
+
+static PyObject *svs_core_Camera_getplacement(svs_core_Camera *self, void *closure) {
+    PyObject *placement, *node;
+    int ret;
+
+    placement = thread_placement_dict(&self->callback_placement);
+    if (!placement) {
+        return NULL;
+    }
+
+    node = PyLong_FromLong(self->numa_node);
+    if (!node) {
+        Py_DECREF(placement);
+        return NULL;
+    }
+
+    ret = PyDict_SetItemString(placement, "numa_node", node);
+    Py_DECREF(node);
+    if (ret) {
+        Py_DECREF(placement);
+        return NULL;
+    }
+
+    return placement;
+}
+
+static PyObject *svs_core_Camera_getsimulated(svs_core_Camera *self, void *closure) {
+    if (!self->sim) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    return sim_dict(self->sim);
+}
+
+static PyObject *svs_core_Camera_getmulticast(svs_core_Camera *self, void *closure) {
+    const char *mode;
+
+    switch (self->multicast) {
+    case MULTICAST_MODE_CONTROLLER:
+        mode = "controller";
+        break;
+    case MULTICAST_MODE_LISTENER:
+        mode = "listener";
+        break;
+    default:
+        mode = "none";
+    }
+
+    return Py_BuildValue("s", mode);
+}
+
+static PyObject *svs_core_Camera_getacquisition_mode(svs_core_Camera *self, void *closure) {
+    ACQUISITION_MODE mode;
+    int ret;
+
+    ret = Camera_getAcquisitionMode(self->handle, &mode);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return NULL;
+    }
+
+    return PyLong_FromLong(mode);
+}
+
+static int svs_core_Camera_setacquisition_mode(svs_core_Camera *self, PyObject *value, void *closure) {
+    long mode;
+    int ret;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete attribute 'acquisition_mode'");
+        return -1;
+    }
+
+    mode = PyLong_AsLong(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    if (mode < ACQUISITION_MODE_NO_ACQUISITION ||
+            mode > ACQUISITION_MODE_FIXED_FREQUENCY) {
+        PyErr_Format(PyExc_ValueError, "Unknown acquisition mode %ld", mode);
+        return -1;
+    }
+
+    /* Start acquisition, so that the camera accepts triggers */
+    ret = Camera_setAcquisitionMode(self->handle, mode,
+                                    mode != ACQUISITION_MODE_NO_ACQUISITION);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    self->config.acquisition_valid = 1;
+    self->config.acquisition_mode = mode;
+    self->config.acquisition_start = mode != ACQUISITION_MODE_NO_ACQUISITION;
+
+    return 0;
+}
+
+static PyObject *svs_core_Camera_gettrigger_polarity(svs_core_Camera *self, void *closure) {
+    TRIGGER_POLARITY polarity;
+    int ret;
+
+    ret = Camera_getTriggerPolarity(self->handle, &polarity);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return NULL;
+    }
+
+    return PyLong_FromLong(polarity);
+}
+
+static int svs_core_Camera_settrigger_polarity(svs_core_Camera *self, PyObject *value, void *closure) {
+    long polarity;
+    int ret;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete attribute 'trigger_polarity'");
+        return -1;
+    }
+
+    polarity = PyLong_AsLong(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    if (polarity != TRIGGER_POLARITY_POSITIVE &&
+            polarity != TRIGGER_POLARITY_NEGATIVE) {
+        PyErr_Format(PyExc_ValueError, "Unknown trigger polarity %ld", polarity);
+        return -1;
+    }
+
+    ret = Camera_setTriggerPolarity(self->handle, polarity);
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        return -1;
+    }
+
+    self->config.polarity_valid = 1;
+    self->config.polarity = polarity;
+
     return 0;
 }
 
@@ -597,6 +995,8 @@ static int svs_core_Camera_setframerate(svs_core_Camera *self, PyObject *value,
         return -1;
     }
 
+    config_store(&self->config, CONFIG_FRAMERATE, framerate, 0);
+
     return 0;
 }
 
@@ -618,11 +1018,61 @@ static int svs_core_Camera_setactual_framerate(svs_core_Camera *self, PyObject *
     return -1;
 }
 
+static PyObject *svs_core_Camera_getdropped(svs_core_Camera *self, void *closure) {
+    PyObject *dict, *count;
+
+    dict = PyDict_New();
+    if (!dict) {
+        return NULL;
+    }
+
+    for (int i = 0; i < DROP_REASONS; i++) {
+        count = PyLong_FromUnsignedLongLong(
+                __atomic_load_n(&self->queue.dropped[i], __ATOMIC_RELAXED));
+        if (!count || PyDict_SetItemString(dict, drop_reason_names[i], count)) {
+            Py_XDECREF(count);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(count);
+    }
+
+    return dict;
+}
+
+static int svs_core_Camera_setdropped(svs_core_Camera *self, PyObject *value, void *closure) {
+    PyErr_SetString(PyExc_TypeError, "Cannot modify attribute 'dropped'");
+    return -1;
+}
+
 PyGetSetDef svs_core_Camera_getseters[] = {
     {"info", (getter) svs_core_Camera_getinfo, (setter) svs_core_Camera_setinfo, "Camera info", NULL},
     {"name", (getter) svs_core_Camera_getname, (setter) svs_core_Camera_setname, "Camera manufacturer and name", NULL},
-    {"width", (getter) svs_core_Camera_getwidth, (setter) svs_core_Camera_setwidth, "Image width", NULL},
-    {"height", (getter) svs_core_Camera_getheight, (setter) svs_core_Camera_setheight, "Image height", NULL},
+    {"width", (getter) svs_core_Camera_getwidth, (setter) svs_core_Camera_setwidth,
+        "Image width\n\n"
+        "Setting it changes the width of the area of interest, keeping its\n"
+        "offset.", NULL},
+    {"height", (getter) svs_core_Camera_getheight, (setter) svs_core_Camera_setheight,
+        "Image height\n\n"
+        "Setting it changes the height of the area of interest, keeping its\n"
+        "offset.", NULL},
+    {"roi", (getter) svs_core_Camera_getroi, (setter) svs_core_Camera_setroi,
+        "Area of interest read from the sensor\n\n"
+        "In the form of a tuple (offset_x, offset_y, width, height), in\n"
+        "pixels.  Only the area of interest is transferred, so a smaller\n"
+        "area reduces link bandwidth and allows higher frame rates.  The\n"
+        "camera may round the values to its increments.\n\n"
+        "Changing the image size may replace the stream, so capture should\n"
+        "be stopped first.", NULL},
+    {"binning", (getter) svs_core_Camera_getbinning, (setter) svs_core_Camera_setbinning,
+        "Binning factor (1 to 4)\n\n"
+        "Pixels are binned in square blocks of this size on the camera,\n"
+        "dividing the image width and height.  1 disables binning.", NULL},
+    {"depth", (getter) svs_core_Camera_getdepth, (setter) svs_core_Camera_setdepth,
+        "Pixel depth transferred, in bits (8, 12 or 16)\n\n"
+        "12-bit pixels are packed on the link, and 8-bit pixels halve the\n"
+        "bandwidth of 16-bit ones.  8-bit images are returned as uint8\n"
+        "arrays, otherwise uint16.", NULL},
     {"pixelclock", (getter) svs_core_Camera_getpixelclock, (setter) svs_core_Camera_setpixelclock, "Pixel Clock of camera", NULL},
     {"gain", (getter) svs_core_Camera_getgain, (setter) svs_core_Camera_setgain, "Camera gain (0..18dB)", NULL},
     {"exposure", (getter) svs_core_Camera_getexposure, (setter) svs_core_Camera_setexposure, "Exposure time in milliseconds", NULL},
@@ -644,6 +1094,36 @@ PyGetSetDef svs_core_Camera_getseters[] = {
         "Enable or disable camera continuous capture (free-run) mode.\n\n"
         "Once set to True, continuous capture is enabled, and methods\n"
         "to retrieve images can be called.", NULL},
+    {"stream_config", (getter) svs_core_Camera_getstream_config, NULL,
+        "Stream settings in use, as Camera() arguments\n\n"
+        "Dictionary of packet_size, buffer_count, resend_timeout and\n"
+        "heartbeat_timeout.  With autotune, these are the values chosen,\n"
+        "which can be passed to Camera() later to skip tuning.", NULL},
+    {"placement", (getter) svs_core_Camera_getplacement, NULL,
+        "CPU and memory placement of the stream callback\n\n"
+        "Dictionary of:\n"
+        "   cpus: CPUs the callback thread is pinned to, or None\n"
+        "   priority: SCHED_FIFO priority of the callback, or 0\n"
+        "   error: Why the last placement of the callback failed, or None\n"
+        "   numa_node: Node frame buffers are allocated on, or -1", NULL},
+    {"simulated", (getter) svs_core_Camera_getsimulated, NULL,
+        "Settings of a simulated camera, or None for a real one\n\n"
+        "As passed in simulate, with defaults filled in, and produced, the\n"
+        "images given to the stream callback so far.", NULL},
+    {"multicast", (getter) svs_core_Camera_getmulticast, NULL,
+        "Multicast mode the camera was opened in\n\n"
+        "'none', 'controller' or 'listener'.  Listeners receive the\n"
+        "controller's stream, but cannot change camera settings.", NULL},
+    {"acquisition_mode", (getter) svs_core_Camera_getacquisition_mode, (setter) svs_core_Camera_setacquisition_mode,
+        "Acquisition mode, one of the ACQUISITION_MODE_* constants\n\n"
+        "ACQUISITION_MODE_FIXED_FREQUENCY captures at framerate, as\n"
+        "continuous_capture does.  ACQUISITION_MODE_SOFTWARE_TRIGGER\n"
+        "captures on trigger(), and the ACQUISITION_MODE_EXT_TRIGGER_*\n"
+        "modes on an edge of the trigger input, with exposure set by the\n"
+        "camera or by the pulse width.  Acquisition is started when set.", NULL},
+    {"trigger_polarity", (getter) svs_core_Camera_gettrigger_polarity, (setter) svs_core_Camera_settrigger_polarity,
+        "Trigger input edge, TRIGGER_POLARITY_POSITIVE or\n"
+        "TRIGGER_POLARITY_NEGATIVE", NULL},
     {"framerate", (getter) svs_core_Camera_getframerate, (setter) svs_core_Camera_setframerate,
         "Desired image capture framerate\n\n"
         "Actual framerate may be slower than this value.\n"
@@ -652,5 +1132,15 @@ PyGetSetDef svs_core_Camera_getseters[] = {
         "Actual measured image capture framerate\n\n"
         "Actual achieved framerate, based on measurement of received images.\n"
         "Will not be valid until image capture is active.", NULL},
+    {"dropped", (getter) svs_core_Camera_getdropped, (setter) svs_core_Camera_setdropped,
+        "Images dropped from the queue, by reason\n\n"
+        "Dictionary of counts since the camera was opened:\n"
+        "   oldest: Queued images replaced by newer ones\n"
+        "   newest: New images discarded as the queue was full\n"
+        "   pool: New images discarded as every frame was held\n"
+        "   timeout: New images discarded after blocking for room\n"
+        "   error: Images that could not be copied or converted\n\n"
+        "The metadata of each image also has the total dropped before it\n"
+        "was queued, as 'dropped'.", NULL},
     {NULL}
 };
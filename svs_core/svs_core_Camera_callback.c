@@ -29,264 +29,1177 @@
 #define NO_IMPORT_ARRAY
 
 #include <Python.h>
-#include <datetime.h>
 #include <numpy/arrayobject.h>
 #include <pthread.h>
 #include <math.h>
 #include <stdint.h>
-#include <sys/queue.h>
 #include <sys/time.h>
 #include <time.h>
+#include <unistd.h>
 #include <libsvgige/svgige.h>
 #include "svs_core.h"
 
-void import_datetime(void) {
-    PyDateTime_IMPORT;
+int image_shape(struct frame_info *info, int format, int *nd,
+                Py_intptr_t dims[3]) {
+    dims[0] = info->height;
+    dims[1] = info->width;
+    dims[2] = 3;
+
+    switch (format) {
+    case FORMAT_MONO8:
+        *nd = 2;
+        return NPY_UINT8;
+    case FORMAT_RGB8:
+        *nd = 3;
+        return NPY_UINT8;
+    case FORMAT_RGB16:
+        *nd = 3;
+        return NPY_UINT16;
+    }
+
+    *nd = 2;
+
+    switch (info->pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) {
+    case GVSP_PIX_OCCUPY8BIT:
+        return NPY_UINT8;
+    case GVSP_PIX_OCCUPY12BIT:
+    case GVSP_PIX_OCCUPY16BIT:
+        return NPY_UINT16;
+    default:
+        PyErr_Format(SVSError, "Unsupported pixel type %#x", info->pixel_type);
+        return -1;
+    }
 }
 
 /*
- * Asynchronously raise an exception in the main thread.
- *
- * Since the callbacks are called from a different thread, there is not
- * a good way to indicate errors to the program.
- *
- * In the event of fatal problem, raise SVSAsyncError in the main thread.
- * Note that this exception will probably not be caught, and should only be
- * used when nothing else can be done.
+ * Capsule destructor returning a zero-copy frame to the pool
  */
-static void raise_asynchronous_exception(svs_core_Camera *self) {
-    PyThreadState_SetAsyncExc(self->main_thread->thread_id, SVSAsyncError);
+static void frame_capsule_destructor(PyObject *capsule) {
+    svs_core_Camera *self = PyCapsule_GetContext(capsule);
+    struct frame *frame = PyCapsule_GetPointer(capsule, "svs_core.frame");
 
+    frame_release(&self->queue, frame - self->queue.frames);
+    Py_DECREF(self);
 }
 
-static void timestamp_to_timeval(svs_core_Camera *self, uint64_t timestamp,
-                                 struct timeval *tv) {
-    double timestamp_sec = ((double)timestamp)/self->tick_frequency;
+/*
+ * Wrap a frame in an array without copying
+ *
+ * The array holds a capsule as its base, which returns the frame to the
+ * pool once the array is freed.
+ */
+static PyObject *image_array_wrap(svs_core_Camera *self, unsigned int index) {
+    struct frame *frame = &self->queue.frames[index];
+    PyObject *array, *capsule;
+    int numpy_type, nd;
+    npy_intp dims[3];
+
+    numpy_type = image_shape(&frame->info, frame->format, &nd, dims);
+    if (numpy_type < 0) {
+        frame_release(&self->queue, index);
+        return NULL;
+    }
+
+    capsule = PyCapsule_New(frame, "svs_core.frame", frame_capsule_destructor);
+    if (!capsule) {
+        frame_release(&self->queue, index);
+        return NULL;
+    }
+
+    /* Capsule owns the frame and a reference to the camera from here on */
+    Py_INCREF(self);
+    PyCapsule_SetContext(capsule, self);
+
+    array = PyArray_SimpleNewFromData(nd, dims, numpy_type, frame->data);
+    if (!array) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
 
-    tv->tv_sec = (int) timestamp_sec;
-    tv->tv_usec = (int) round(1e6 * (timestamp_sec - tv->tv_sec));
+    /* Steals the capsule reference, even on failure */
+    if (PyArray_SetBaseObject((PyArrayObject *) array, capsule)) {
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    return array;
+}
+
+/*
+ * Format of the array for a frame
+ */
+static int image_format(svs_core_Camera *self, struct frame *frame) {
+    return frame->converted ? frame->format : self->output_format;
 }
 
 /*
- * Determine camera boot time, return in boot.
+ * Raise if a worker failed to convert a frame
  *
- * This function attempts to synchronize the camera's internal timestamps
- * with the system time, and there be be some small error.
+ * @returns 0 if the frame holds an image, negative with exception set
+ */
+static int image_check(struct frame *frame) {
+    if (frame->converted && !frame->length) {
+        PyErr_Format(SVSError, "Unable to convert %ux%u image of pixel type %#x",
+                     frame->info.width, frame->info.height,
+                     frame->info.pixel_type);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy a frame's image into dst, converting it to the output format
+ * unless the callback already did.
  *
- * @param self  Camera object
- * @param boot  Camera boot time returned here
- * @returns 0 on success, negative on error, and sets asynchronous exception
+ * @returns 0 on success, negative on error with exception set
  */
-static int camera_boot_time(svs_core_Camera *self, struct timeval *boot) {
-    uint64_t ticks;
-    struct timeval system, camera_delta;
+static int image_copy(svs_core_Camera *self, struct frame *frame, void *dst) {
+    struct frame_info *info = &frame->info;
+    struct camera_stats *stats = self->queue.stats;
+    uint64_t start, done;
     int ret;
 
-    /* Current time - time since camera boot = camera boot time */
+    if (image_check(frame)) {
+        return -1;
+    }
+
+    /* Large copies and conversions don't hold up other Python threads */
+    Py_BEGIN_ALLOW_THREADS
+    start = stats_now();
+    if (frame->converted) {
+        memcpy(dst, frame->data, frame->length);
+        ret = 0;
+    }
+    else {
+        ret = convert_frame(frame->data, info->pixel_type, info->width,
+                            info->height, self->output_format,
+                            self->unpack_shift, dst);
+        stats_record(stats, STATS_UNPACK, start);
+    }
+    done = stats_now();
+    Py_END_ALLOW_THREADS
 
-    gettimeofday(&system, NULL);
+    stats_record(stats, STATS_GIL_WAIT, done);
 
-    ret = Camera_getTimestampCounter(self->handle, &ticks);
-    if (ret != SVGigE_SUCCESS) {
-        raise_asynchronous_exception(self);
+    if (ret) {
+        PyErr_Format(SVSError, "Unable to convert %ux%u image of pixel type %#x",
+                     info->width, info->height, info->pixel_type);
         return -1;
     }
 
-    timestamp_to_timeval(self, ticks, &camera_delta);
-    timersub(&system, &camera_delta, boot);
-
     return 0;
 }
 
 /*
- * Create a DateTime object of the time when the image was captured.
- *
- * @param self      Camera object
- * @param svimage   Image
- * @returns DateTime object, or NULL on error and sets asynchronous exception
+ * Copy a frame into a new array
  */
-static PyObject *image_timestamp(svs_core_Camera *self, SVGigE_IMAGE *svimage) {
-    struct timeval camera_boot, image_delta, image_timestamp;
-    struct tm timestamp;
-    PyObject *image_datetime;
-    int ret;
+static PyObject *image_array(svs_core_Camera *self, struct frame *frame) {
+    PyArrayObject *array;
+    int numpy_type, nd;
+    npy_intp dims[3];
 
-    ret = camera_boot_time(self, &camera_boot);
-    if (ret) {
+    numpy_type = image_shape(&frame->info, image_format(self, frame), &nd, dims);
+    if (numpy_type < 0) {
+        return NULL;
+    }
+
+    array = (PyArrayObject*)PyArray_SimpleNew(nd, dims, numpy_type);
+    if (!array) {
+        return NULL;
+    }
+
+    if (image_copy(self, frame, PyArray_DATA(array))) {
+        Py_DECREF((PyObject*)array);
+        return NULL;
+    }
+
+    return (PyObject *) array;
+}
+
+PyObject *svs_core_Camera_frame(svs_core_Camera *self,
+                                struct frame_queue *queue, unsigned int index) {
+    struct frame *frame = &queue->frames[index];
+    PyObject *array, *info, *ret;
+
+    if (image_check(frame)) {
+        frame_release(queue, index);
+        return NULL;
+    }
+
+    info = frame_info_new(&frame->info);
+    if (!info) {
+        frame_release(queue, index);
+        return NULL;
+    }
+
+    /* Only the main queue hands out its frames, previews are small */
+    if (queue == &self->queue && self->zero_copy) {
+        array = image_array_wrap(self, index);
+    }
+    else {
+        array = image_array(self, frame);
+        frame_release(queue, index);
+    }
+
+    if (!array) {
+        Py_DECREF(info);
         return NULL;
     }
 
-    /* Image time since boot */
-    timestamp_to_timeval(self, svimage->Timestamp, &image_delta);
+    ret = Py_BuildValue("(OO)", array, info);
 
-    /* Camera boot time + image time from camera boot = image time */
-    timeradd(&camera_boot, &image_delta, &image_timestamp);
+    Py_DECREF(array);
+    Py_DECREF(info);
 
-    gmtime_r(&image_timestamp.tv_sec, &timestamp);
+    return ret;
+}
 
-    image_datetime = PyDateTime_FromDateAndTime(timestamp.tm_year + 1900,
-            timestamp.tm_mon + 1, timestamp.tm_mday, timestamp.tm_hour,
-            timestamp.tm_min, timestamp.tm_sec, image_timestamp.tv_usec);
+/*
+ * Structured dtype of batch metadata, built once
+ *
+ * Aligned, so numpy pads it as the compiler pads struct batch_record.
+ *
+ * @returns new reference, or NULL on error
+ */
+static PyArray_Descr *batch_descr(void) {
+    static PyArray_Descr *descr;
+    PyObject *spec;
+
+    if (!descr) {
+        spec = Py_BuildValue("[(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)(ss)]",
+                "timestamp", "M8[us]", "ticks", "u8",
+                "clock_offset", "f8", "clock_drift", "f8",
+                "width", "u4", "height", "u4", "pixel_type", "u4",
+                "image_count", "u4", "frame_loss", "u4",
+                "packet_count", "u4", "packet_resend", "u4",
+                "transfer_time", "u4", "dropped", "u4");
+        if (!spec) {
+            return NULL;
+        }
 
-    return image_datetime;
+        if (!PyArray_DescrAlignConverter(spec, &descr)) {
+            Py_DECREF(spec);
+            return NULL;
+        }
+        Py_DECREF(spec);
+    }
+
+    Py_INCREF(descr);
+    return descr;
+}
+
+void batch_fill_record(struct batch_record *record, struct frame_info *info) {
+    record->timestamp = (int64_t) info->time.tv_sec*1000000 + info->time.tv_usec;
+    record->ticks = info->timestamp;
+    record->clock_offset = info->clock_offset;
+    record->clock_drift = info->clock_drift;
+    record->width = info->width;
+    record->height = info->height;
+    record->pixel_type = info->pixel_type;
+    record->image_count = info->image_count;
+    record->frame_loss = info->frame_loss;
+    record->packet_count = info->packet_count;
+    record->packet_resend = info->packet_resend;
+    record->transfer_time = info->transfer_time;
+    record->dropped = info->dropped;
 }
 
 /*
- * Create a dictionary with various image metadata.
+ * Check a caller supplied array fits images of the given shape
  *
- * @param self      Camera object
- * @param svimage   Image
- * @returns dict object, or NULL on error and sets asynchronous exception
+ * @param batch 1 if out holds a batch, with a leading image dimension
+ * @returns 0 if usable, negative with exception set otherwise
  */
-static PyObject *image_info(svs_core_Camera *self, SVGigE_IMAGE *svimage) {
-    PyObject *dict, *timestamp;
+static int image_check_out(PyObject *out, int numpy_type, int nd,
+                           npy_intp dims[3], int batch) {
+    PyArrayObject *array = (PyArrayObject *) out;
+
+    if (!PyArray_Check(out)) {
+        PyErr_SetString(PyExc_TypeError, "out must be a numpy array");
+        return -1;
+    }
+
+    if (!PyArray_ISCARRAY(array)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "out must be C contiguous, aligned and writeable");
+        return -1;
+    }
+
+    if (PyArray_TYPE(array) != numpy_type ||
+            PyArray_NDIM(array) != nd + batch ||
+            (batch && PyArray_DIM(array, 0) < 1)) {
+        goto shape;
+    }
 
-    dict = PyDict_New();
-    if (!dict) {
-        raise_asynchronous_exception(self);
+    for (int i = 0; i < nd; i++) {
+        if (PyArray_DIM(array, i + batch) != dims[i]) {
+            goto shape;
+        }
+    }
+
+    return 0;
+
+shape:
+    if (batch) {
+        PyErr_SetString(PyExc_ValueError,
+                        "out must have the dtype and shape (n, ...) of the images");
+    }
+    else {
+        PyErr_SetString(PyExc_ValueError,
+                        "out must have the dtype and shape of the image");
+    }
+    return -1;
+}
+
+PyObject *svs_core_Camera_into(svs_core_Camera *self, int timeout,
+                               PyObject *out) {
+    struct frame_queue *queue = &self->queue;
+    struct frame *frame;
+    PyObject *info;
+    npy_intp dims[3];
+    unsigned int index;
+    int numpy_type, nd, ret;
+
+    ret = frame_queue_pop(queue, &index, timeout);
+    if (ret < 0) {
+        return NULL;
+    }
+    else if (ret) {
+        svs_core_Camera_no_images(self, ret, "No images available");
         return NULL;
     }
 
-    timestamp = image_timestamp(self, svimage);
-    if (!timestamp) {
-        Py_DECREF(dict);
+    frame = &queue->frames[index];
+
+    numpy_type = image_shape(&frame->info, image_format(self, frame), &nd,
+                             dims);
+    if (numpy_type < 0) {
+        frame_release(queue, index);
         return NULL;
     }
 
-    PyObject *width = Py_BuildValue("i", svimage->ImageWidth);
-    PyObject *height = Py_BuildValue("i", svimage->ImageHeight);
-    PyObject *image_count = Py_BuildValue("i", svimage->ImageCount);
-    PyObject *frame_loss = Py_BuildValue("i", svimage->FrameLoss);
-    PyObject *packet_count = Py_BuildValue("i", svimage->PacketCount);
-    PyObject *packet_resend = Py_BuildValue("i", svimage->PacketResend);
-    PyObject *transfer_time = Py_BuildValue("i", svimage->TransferTime);
-
-    PyDict_SetItemString(dict, "timestamp", timestamp);
-    PyDict_SetItemString(dict, "width", width);
-    PyDict_SetItemString(dict, "height", height);
-    PyDict_SetItemString(dict, "image_count", image_count);
-    PyDict_SetItemString(dict, "frame_loss", frame_loss);
-    PyDict_SetItemString(dict, "packet_count", packet_count);
-    PyDict_SetItemString(dict, "packet_resend", packet_resend);
-    PyDict_SetItemString(dict, "transfer_time", transfer_time);
-
-    Py_DECREF(timestamp);
-    Py_DECREF(width);
-    Py_DECREF(height);
-    Py_DECREF(image_count);
-    Py_DECREF(frame_loss);
-    Py_DECREF(packet_count);
-    Py_DECREF(packet_resend);
-    Py_DECREF(transfer_time);
-
-    return dict;
-}
+    /* Keep the image for a call with a suitable array */
+    if (image_check_out(out, numpy_type, nd, dims, 0)) {
+        frame_queue_hold(queue, index);
+        return NULL;
+    }
 
-static PyObject *image_array(svs_core_Camera *self, SVGigE_IMAGE *svimage) {
-    npy_intp dims[2] = {svimage->ImageHeight, svimage->ImageWidth};
-    PyArrayObject *array;
-    int ret, pixel_size, numpy_type, numpy_size, convert;
+    if (image_copy(self, frame, PyArray_DATA((PyArrayObject *) out))) {
+        frame_release(queue, index);
+        return NULL;
+    }
 
-    pixel_size = svimage->PixelType & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK;
+    info = frame_info_new(&frame->info);
+    frame_release(queue, index);
 
-    switch (pixel_size) {
-    case GVSP_PIX_OCCUPY8BIT:
-        numpy_type = NPY_UINT8;
-        numpy_size = dims[0]*dims[1];
-        convert = 0;
-        break;
-    case GVSP_PIX_OCCUPY12BIT:
-        numpy_type = NPY_UINT16;
-        numpy_size = 2*dims[0]*dims[1];
-        convert = 1;
-        break;
-    case GVSP_PIX_OCCUPY16BIT:
-        numpy_type = NPY_UINT16;
-        numpy_size = 2*dims[0]*dims[1];
-        convert = 0;
-        break;
-    default:
+    return info;
+}
+
+PyObject *svs_core_Camera_batch(svs_core_Camera *self,
+                                unsigned int max_images, int timeout,
+                                PyObject *out) {
+    struct frame_queue *queue = &self->queue;
+    PyArrayObject *images = NULL, *records = NULL;
+    PyObject *images_ret = NULL, *records_ret = NULL, *ret = NULL;
+    struct batch_record *record_data;
+    struct frame_info first;
+    struct frame *frame;
+    npy_intp dims[4], count = 0, length;
+    int64_t deadline = stats_now()/1000000 + timeout;
+    int numpy_type, nd, format, wait;
+    unsigned int index;
+    char *image_data;
+    size_t image_size;
+
+    wait = frame_queue_pop(queue, &index, timeout);
+    if (wait < 0) {
+        return NULL;
+    }
+    else if (wait) {
+        svs_core_Camera_no_images(self, wait, "No images available");
         return NULL;
     }
 
-    array = (PyArrayObject*)PyArray_SimpleNew(2, dims, numpy_type);
-    if (!array) {
-        raise_asynchronous_exception(self);
+    frame = &queue->frames[index];
+    first = frame->info;
+    format = image_format(self, frame);
+
+    numpy_type = image_shape(&first, format, &nd, dims + 1);
+    if (numpy_type < 0) {
+        frame_release(queue, index);
         return NULL;
     }
 
-    if (convert) {
-        ret = Image_getImage12bitAs16bit(svimage->ImageData, dims[1], dims[0],
-                svimage->PixelType, PyArray_DATA(array), 2*dims[0]*dims[1]);
-        if (ret) {
-            raise_asynchronous_exception(self);
-            Py_DECREF((PyObject*)array);
+    image_size = convert_size(first.pixel_type, first.width, first.height,
+                              format);
+
+    if (out) {
+        /* Keep the image for a call with a suitable array */
+        if (image_check_out(out, numpy_type, nd, dims + 1, 1)) {
+            frame_queue_hold(queue, index);
             return NULL;
         }
+
+        images = (PyArrayObject *) out;
+        Py_INCREF(out);
+
+        if (max_images > PyArray_DIM(images, 0)) {
+            max_images = PyArray_DIM(images, 0);
+        }
     }
     else {
-        memcpy(PyArray_DATA(array), svimage->ImageData, numpy_size);
+        dims[0] = max_images;
+        images = (PyArrayObject *) PyArray_SimpleNew(nd + 1, dims, numpy_type);
+        if (!images) {
+            frame_release(queue, index);
+            return NULL;
+        }
     }
 
-    return (PyObject *) array;
+    length = max_images;
+    records = (PyArrayObject *) PyArray_NewFromDescr(&PyArray_Type,
+            batch_descr(), 1, &length, NULL, NULL, 0, NULL);
+    if (!records) {
+        frame_release(queue, index);
+        goto out;
+    }
+
+    if (PyArray_ITEMSIZE(records) != sizeof(struct batch_record)) {
+        PyErr_SetString(PyExc_SystemError, "Unexpected batch metadata layout");
+        frame_release(queue, index);
+        goto out;
+    }
+
+    image_data = PyArray_DATA(images);
+    record_data = PyArray_DATA(records);
+
+    for (;;) {
+        if (image_copy(self, frame, image_data + count*image_size)) {
+            frame_release(queue, index);
+            goto out;
+        }
+
+        batch_fill_record(&record_data[count], &frame->info);
+        frame_release(queue, index);
+
+        if (++count == (npy_intp) max_images) {
+            break;
+        }
+
+        if (timeout < 0) {
+            wait = -1;
+        }
+        else {
+            wait = deadline - (int64_t) (stats_now()/1000000);
+            if (wait < 0) {
+                wait = 0;
+            }
+        }
+
+        wait = frame_queue_pop(queue, &index, wait);
+        if (wait < 0) {
+            goto out;
+        }
+        else if (wait) {
+            break;
+        }
+
+        frame = &queue->frames[index];
+
+        /* A differently shaped image starts the next batch */
+        if (frame->info.width != first.width ||
+                frame->info.height != first.height ||
+                frame->info.pixel_type != first.pixel_type ||
+                image_format(self, frame) != format) {
+            frame_queue_hold(queue, index);
+            break;
+        }
+    }
+
+    if (count < (npy_intp) max_images) {
+        images_ret = PySequence_GetSlice((PyObject *) images, 0, count);
+        records_ret = PySequence_GetSlice((PyObject *) records, 0, count);
+    }
+    else {
+        images_ret = (PyObject *) images;
+        records_ret = (PyObject *) records;
+        Py_INCREF(images_ret);
+        Py_INCREF(records_ret);
+    }
+
+    if (images_ret && records_ret) {
+        ret = Py_BuildValue("(OO)", images_ret, records_ret);
+    }
+
+    Py_XDECREF(images_ret);
+    Py_XDECREF(records_ret);
+
+out:
+    Py_XDECREF((PyObject *) images);
+    Py_XDECREF((PyObject *) records);
+
+    return ret;
+}
+
+/*
+ * Raw image size in bytes, based on the effective pixel size.
+ *
+ * Rounded up to whole bytes, as an odd 12-bit pixel out keeps its low
+ * nibble in a last, half used byte.
+ */
+static size_t image_length(SVGigE_IMAGE *svimage) {
+    size_t bits = (svimage->PixelType & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16;
+
+    return ((size_t) svimage->ImageWidth * svimage->ImageHeight * bits + 7) / 8;
+}
+
+/*
+ * Get a frame for the callback to fill.
+ *
+ * Prefers frames already returned by the consumer, then frames never
+ * used, and finally steals the oldest queued image, if the overflow
+ * policy allows it.
+ *
+ * @returns 0 on success, negative if no frame is available
+ */
+static int frame_acquire(struct frame_queue *queue, unsigned int *index) {
+    if (queue->spare_frame >= 0) {
+        *index = queue->spare_frame;
+        queue->spare_frame = -1;
+        frame_work_wait(&queue->frames[*index]);
+        return 0;
+    }
+
+    if (!frame_ring_pop(&queue->free_frames, index)) {
+        return 0;
+    }
+
+    if (queue->frames_allocated < queue->frames_count) {
+        *index = queue->frames_allocated++;
+        return 0;
+    }
+
+    switch (queue->overflow_policy) {
+    case OVERFLOW_DROP_OLDEST:
+    case OVERFLOW_LATEST_ONLY:
+        if (!frame_ring_pop(&queue->images, index)) {
+            frame_queue_drop(queue, DROP_OLDEST);
+            frame_work_wait(&queue->frames[*index]);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Add a filled frame to the image queue, dropping the oldest image if
+ * the queue is full.  A dropped frame is kept for the next image.
+ *
+ * Under the drop_newest and block policies, frame_make_room() has
+ * already made sure the queue has room.
+ */
+static void frame_enqueue(struct frame_queue *queue, unsigned int index) {
+    unsigned int oldest;
+
+    queue->frames[index].queued = stats_now();
+
+    while (frame_ring_push(&queue->images, index)) {
+        /* Queue full, drop the first item */
+        if (!frame_ring_pop(&queue->images, &oldest)) {
+            queue->spare_frame = oldest;
+            frame_queue_drop(queue, DROP_OLDEST);
+        }
+    }
+
+    frame_queue_signal(queue);
+}
+
+/*
+ * Make sure a frame can hold size bytes
+ *
+ * @returns 0 on success, negative if allocation fails
+ */
+static int frame_reserve(struct frame_queue *queue, struct frame *frame,
+                         size_t size) {
+    void *data;
+
+    if (frame->size >= size) {
+        return 0;
+    }
+
+    data = frame_data_alloc(&size, queue->numa_node);
+    if (!data) {
+        return -1;
+    }
+
+    frame_data_free(frame->data, frame->size);
+    frame->data = data;
+    frame->size = size;
+
+    return 0;
+}
+
+/*
+ * Copy image metadata from the SVGigE image
+ */
+static void frame_fill_info(svs_core_Camera *self, struct frame_info *info,
+                            SVGigE_IMAGE *svimage) {
+    info->timestamp = svimage->Timestamp;
+    info->width = svimage->ImageWidth;
+    info->height = svimage->ImageHeight;
+    info->pixel_type = svimage->PixelType;
+    info->image_count = svimage->ImageCount;
+    info->frame_loss = svimage->FrameLoss;
+    info->packet_count = svimage->PacketCount;
+    info->packet_resend = svimage->PacketResend;
+    info->transfer_time = svimage->TransferTime;
+    info->compressed = 0;
+
+    clock_sync_convert(&self->clock, svimage->Timestamp, &info->time,
+                       &info->clock_offset, &info->clock_drift);
+}
+
+/*
+ * Copy image data and metadata into a frame
+ *
+ * Images are converted to the output format while copying if convert is
+ * set, as in zero-copy mode, where the frame is handed to Python as-is.
+ *
+ * @returns 0 on success, negative on error
+ */
+static int frame_fill(svs_core_Camera *self, struct frame_queue *queue,
+                      struct frame *frame, SVGigE_IMAGE *svimage,
+                      size_t length, int convert) {
+    size_t size = length;
+
+    if (convert) {
+        size = convert_size(svimage->PixelType, svimage->ImageWidth,
+                            svimage->ImageHeight, self->output_format);
+        if (!size) {
+            return -1;
+        }
+    }
+
+    if (frame_reserve(queue, frame, size)) {
+        return -1;
+    }
+
+    if (convert) {
+        uint64_t start = stats_now();
+
+        if (convert_frame(svimage->ImageData, svimage->PixelType,
+                          svimage->ImageWidth, svimage->ImageHeight,
+                          self->output_format, self->unpack_shift,
+                          frame->data)) {
+            return -1;
+        }
+
+        stats_record(self->queue.stats, STATS_UNPACK, start);
+    }
+    else {
+        memcpy(frame->data, svimage->ImageData, length);
+    }
+
+    frame->length = size;
+    frame->converted = convert;
+    frame->format = self->output_format;
+
+    frame_fill_info(self, &frame->info, svimage);
+
+    return 0;
+}
+
+/*
+ * Copy the raw image for a worker to convert into the frame
+ *
+ * @param size      Bytes of frame data the worker produces
+ * @param factor    Decimation factor, or 0 to convert to the output format
+ * @returns 0 on success, negative on error
+ */
+static int frame_fill_work(svs_core_Camera *self, struct frame_queue *queue,
+                           struct frame *frame, SVGigE_IMAGE *svimage,
+                           size_t length, size_t size, unsigned int factor) {
+    struct frame_work *work = &frame->work;
+    size_t raw_size = length;
+    void *raw;
+
+    if (frame_reserve(queue, frame, size)) {
+        return -1;
+    }
+
+    if (work->raw_size < length) {
+        raw = frame_data_alloc(&raw_size, queue->numa_node);
+        if (!raw) {
+            return -1;
+        }
+
+        frame_data_free(work->raw, work->raw_size);
+        work->raw = raw;
+        work->raw_size = raw_size;
+    }
+
+    memcpy(work->raw, svimage->ImageData, length);
+
+    work->width = svimage->ImageWidth;
+    work->height = svimage->ImageHeight;
+    work->pixel_type = svimage->PixelType;
+    work->format = self->output_format;
+    work->shift = self->unpack_shift;
+    work->factor = factor;
+    work->stats = queue->stats;
+
+    frame->length = size;
+    frame->converted = 1;
+
+    frame_fill_info(self, &frame->info, svimage);
+
+    return 0;
+}
+
+/*
+ * Whether the pool should convert images, rather than the callback or next()
+ *
+ * Only worth it when there is more to do than a copy.
+ */
+static int frame_use_pool(svs_core_Camera *self, SVGigE_IMAGE *svimage) {
+    if (!pool_threads()) {
+        return 0;
+    }
+
+    return self->output_format != FORMAT_RAW ||
+           (svimage->PixelType & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) == GVSP_PIX_OCCUPY12BIT;
+}
+
+static double monotonic_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+/*
+ * Preview image handler
+ *
+ * Decimates the raw image straight from the SVGigE buffer into a small
+ * frame on the preview queue, at most once per preview_interval.  The
+ * preview never waits for the consumer; when its pool is exhausted, the
+ * image is simply skipped.
+ */
+static void svs_core_Camera_new_preview(svs_core_Camera *self,
+                                        SVGigE_IMAGE *svimage) {
+    struct frame_queue *queue = &self->preview;
+    unsigned int factor = self->preview_decimation;
+    uint32_t width, height;
+    struct frame *frame;
+    unsigned int index;
+    double now;
+    size_t size;
+    int format, pooled;
+
+    if (!factor) {
+        return;
+    }
+
+    if (self->preview_interval > 0) {
+        now = monotonic_time();
+        if (now < self->preview_next) {
+            return;
+        }
+
+        /* Keep to the requested rate, without bursts after a stall */
+        self->preview_next += self->preview_interval;
+        if (self->preview_next < now) {
+            self->preview_next = now;
+        }
+    }
+
+    width = svimage->ImageWidth/factor;
+    height = svimage->ImageHeight/factor;
+    format = decimate_format(svimage->PixelType);
+    size = convert_size(svimage->PixelType, width, height, format);
+
+    if (frame_acquire(queue, &index)) {
+        frame_queue_drop(queue, DROP_POOL);
+        return;
+    }
+
+    frame = &queue->frames[index];
+
+    /* Decided once, as the pool may be resized meanwhile */
+    pooled = pool_threads() > 0;
+    if (pooled) {
+        if (frame_fill_work(self, queue, frame, svimage,
+                            image_length(svimage), size, factor)) {
+            queue->spare_frame = index;
+            frame_queue_drop(queue, DROP_ERROR);
+            return;
+        }
+    }
+    else {
+        if (frame_reserve(queue, frame, size) ||
+                decimate_frame(svimage->ImageData, svimage->PixelType,
+                               svimage->ImageWidth, svimage->ImageHeight,
+                               factor, frame->data)) {
+            queue->spare_frame = index;
+            frame_queue_drop(queue, DROP_ERROR);
+            return;
+        }
+
+        frame->length = size;
+        frame->converted = 1;
+
+        frame_fill_info(self, &frame->info, svimage);
+    }
+
+    frame->format = format;
+    frame->info.width = width;
+    frame->info.height = height;
+    frame->info.dropped = frame_queue_dropped(queue);
+
+    if (pooled) {
+        frame_work_submit(frame);
+    }
+
+    frame_enqueue(queue, index);
+}
+
+/*
+ * Pass an image to the native callback, if one is registered
+ *
+ * @returns whether the image should also be queued for next()
+ */
+static int svs_core_Camera_new_native(svs_core_Camera *self,
+                                      SVGigE_IMAGE *svimage, size_t length) {
+    struct svs_native_image image;
+    struct native_hook *hook;
+    struct timeval time;
+    int queue = 1;
+
+    /* Paired with the exchange in set_native_callback() */
+    __atomic_fetch_add(&self->native_users, 1, __ATOMIC_SEQ_CST);
+
+    hook = __atomic_load_n(&self->native, __ATOMIC_SEQ_CST);
+    if (hook) {
+        image.version = SVS_NATIVE_VERSION;
+        image.data = svimage->ImageData;
+        image.length = length;
+        image.width = svimage->ImageWidth;
+        image.height = svimage->ImageHeight;
+        image.pixel_type = svimage->PixelType;
+        image.image_count = svimage->ImageCount;
+        image.frame_loss = svimage->FrameLoss;
+        image.packet_count = svimage->PacketCount;
+        image.packet_resend = svimage->PacketResend;
+        image.transfer_time = svimage->TransferTime;
+        image.ticks = svimage->Timestamp;
+        image.svimage = svimage;
+
+        clock_sync_convert(&self->clock, svimage->Timestamp, &time,
+                           &image.clock_offset, &image.clock_drift);
+        image.time = (int64_t) time.tv_sec*1000000 + time.tv_usec;
+
+        hook->callback(&image, hook->context);
+        queue = hook->queue;
+    }
+
+    __atomic_fetch_sub(&self->native_users, 1, __ATOMIC_SEQ_CST);
+
+    return queue;
+}
+
+/*
+ * Single-shot image handler
+ *
+ * Fills the grab slot, converted to the output format so that grab()
+ * only has to copy it.
+ */
+static void svs_core_Camera_new_grab(svs_core_Camera *self,
+                                     SVGigE_IMAGE *svimage, size_t length) {
+    struct frame_queue *queue = &self->grab;
+    struct frame *frame;
+    unsigned int index;
+
+    if (frame_acquire(queue, &index)) {
+        frame_queue_drop(queue, DROP_POOL);
+        return;
+    }
+
+    frame = &queue->frames[index];
+
+    if (frame_fill(self, queue, frame, svimage, length, 1)) {
+        queue->spare_frame = index;
+        frame_queue_drop(queue, DROP_ERROR);
+        return;
+    }
+
+    frame->info.dropped = 0;
+    frame_enqueue(queue, index);
+}
+
+/*
+ * Recording image handler
+ *
+ * Copies the raw image into a frame for the writer thread, padded for
+ * O_DIRECT.  Recording never waits for the writer; if the writer falls
+ * behind, the image is dropped and counted.
+ */
+static void svs_core_Camera_new_record(svs_core_Camera *self,
+                                       SVGigE_IMAGE *svimage, size_t length) {
+    struct recorder *rec = &self->record;
+    struct frame_queue *queue = &rec->queue;
+    struct frame *frame;
+    unsigned int index;
+
+    if (frame_ring_length(&queue->images) >= queue->images_max ||
+            frame_acquire(queue, &index)) {
+        __atomic_fetch_add(&rec->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    frame = &queue->frames[index];
+
+    if (frame_reserve(queue, frame, RECORD_PADDED(length))) {
+        queue->spare_frame = index;
+        __atomic_fetch_add(&rec->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    memcpy(frame->data, svimage->ImageData, length);
+    frame->length = length;
+    frame->converted = 0;
+    frame->format = FORMAT_RAW;
+
+    frame_fill_info(self, &frame->info, svimage);
+    frame->info.dropped = __atomic_load_n(&rec->dropped, __ATOMIC_RELAXED);
+
+    frame_enqueue(queue, index);
+}
+
+/*
+ * Bus image handler
+ *
+ * Converts the image straight into the next bus slot, so subscribers
+ * never wait for a copy.  On a compressed bus, the raw image is
+ * compressed into the slot instead, and subscribers convert it.  Images
+ * that do not fit a slot are counted and skipped.
+ */
+static void svs_core_Camera_new_bus(svs_core_Camera *self,
+                                    SVGigE_IMAGE *svimage) {
+    struct frame_bus *bus;
+    struct frame_info info;
+    size_t size, length;
+    void *data;
+
+    /* Paired with the exchange in stop_publishing() */
+    __atomic_fetch_add(&self->bus_users, 1, __ATOMIC_SEQ_CST);
+
+    bus = __atomic_load_n(&self->bus, __ATOMIC_SEQ_CST);
+    if (!bus) {
+        goto out;
+    }
+
+    if (bus->codec == CODEC_RICE) {
+        size = codec_bound(svimage->PixelType, svimage->ImageWidth,
+                           svimage->ImageHeight);
+    }
+    else {
+        size = convert_size(svimage->PixelType, svimage->ImageWidth,
+                            svimage->ImageHeight, self->output_format);
+    }
+    if (!size) {
+        __atomic_fetch_add(&bus->errors, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    data = bus_write_begin(bus, size);
+    if (!data) {
+        __atomic_fetch_add(&bus->too_large, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    if (bus->codec == CODEC_RICE) {
+        length = codec_encode(svimage->ImageData, svimage->PixelType,
+                              svimage->ImageWidth, svimage->ImageHeight, data);
+    }
+    else if (!convert_frame(svimage->ImageData, svimage->PixelType,
+                            svimage->ImageWidth, svimage->ImageHeight,
+                            self->output_format, self->unpack_shift, data)) {
+        length = size;
+    }
+    else {
+        length = 0;
+    }
+
+    if (!length) {
+        bus_write_abort(bus);
+        __atomic_fetch_add(&bus->errors, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    frame_fill_info(self, &info, svimage);
+    info.dropped = 0;
+    if (bus->codec != CODEC_NONE) {
+        info.compressed = length;
+    }
+
+    bus_write_end(bus, length, self->output_format, self->unpack_shift, &info);
+
+out:
+    __atomic_fetch_sub(&self->bus_users, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Get a frame for a new image, applying the overflow policy
+ *
+ * Under drop_newest, a full queue drops the new image.  Under block, the
+ * callback waits for the consumer, holding the SVGigE buffer meanwhile,
+ * for up to pool_timeout or indefinitely if pool_timeout is 0.  If the
+ * consumer holds every frame, the callback waits up to pool_timeout
+ * (indefinitely under block) for one to be freed.
+ *
+ * @returns 0 with a frame in index, or negative if the image is dropped
+ */
+static int frame_make_room(svs_core_Camera *self, struct frame_queue *queue,
+                           unsigned int *index) {
+    int block = queue->overflow_policy == OVERFLOW_BLOCK;
+    int timeout = block && !self->pool_timeout ? -1 : (int) self->pool_timeout;
+
+    for (;;) {
+        if (frame_ring_length(&queue->images) >= queue->images_max) {
+            if (queue->overflow_policy == OVERFLOW_DROP_NEWEST) {
+                frame_queue_drop(queue, DROP_NEWEST);
+                return -1;
+            }
+
+            if (block) {
+                if (frame_queue_wait(queue, timeout)) {
+                    frame_queue_drop(queue, DROP_TIMEOUT);
+                    return -1;
+                }
+                continue;
+            }
+        }
+
+        if (!frame_acquire(queue, index)) {
+            return 0;
+        }
+
+        /* Consumer holds every frame, wait for one or drop this image */
+        if (!timeout || frame_pool_wait(queue, timeout)) {
+            frame_queue_drop(queue, block ? DROP_TIMEOUT : DROP_POOL);
+            return -1;
+        }
+    }
 }
 
 /*
  * New image handler
  *
- * Called by the stream callback to handle new images.  Converts them
- * to the appropriate type and collects data about them, then adds to
- * the image queue.
+ * Called by the stream callback to handle new images.  Copies the raw
+ * image and its metadata into a frame from the pool, then adds it to
+ * the image queue.  Conversion to Python objects happens in next(), so
+ * the GIL is not needed here.
  */
 static SVGigE_RETURN svs_core_Camera_new_image(svs_core_Camera *self,
                                                SVGigE_SIGNAL *signal) {
     SVGigE_IMAGE *svimage = signal->Data;
-    struct image *image;
-    PyGILState_STATE gstate;
+    struct camera_stats *stats = self->queue.stats;
+    uint64_t start = stats_now();
+    struct frame *frame;
+    unsigned int index;
+    size_t length, size;
+    int queue, pooled, ret;
 
-    image = malloc(sizeof(*image));
-    if (!image) {
-        return SVGigE_OUT_OF_MEMORY;
+    /* The SDK owns this thread, so it places itself on its first image */
+    if (self->callback_placement.pending) {
+        self->callback_placement.pending = 0;
+        __atomic_store_n(&self->callback_placement.error,
+                         thread_place(&self->callback_placement),
+                         __ATOMIC_RELAXED);
     }
 
-    /* Grab the GIL */
-    gstate = PyGILState_Ensure();
+    stats_count(stats, STATS_IMAGES, 1);
+    stats_count(stats, STATS_FRAME_LOSS, svimage->FrameLoss);
+    stats_count(stats, STATS_PACKETS, svimage->PacketCount);
+    stats_count(stats, STATS_PACKET_RESEND, svimage->PacketResend);
+
+    length = image_length(svimage);
+
+    /* Native consumers see the SVGigE buffer before any copy is made */
+    queue = svs_core_Camera_new_native(self, svimage, length);
+
+    /* The preview is independent of whether the main queue keeps up */
+    svs_core_Camera_new_preview(self, svimage);
+
+    /* Bus subscribers see every image, whatever else consumes it */
+    svs_core_Camera_new_bus(self, svimage);
 
-    image->info = image_info(self, svimage);
-    if (!image->info) {
-        PyGILState_Release(gstate);
-        goto err_free_image;
+    /* An image requested by grab() bypasses the image queue */
+    if (__atomic_exchange_n(&self->grab_armed, 0, __ATOMIC_SEQ_CST)) {
+        svs_core_Camera_new_grab(self, svimage, length);
+
+        stats_record(stats, STATS_CALLBACK, start);
+        return SVGigE_SUCCESS;
     }
 
-    image->array = image_array(self, svimage);
-    if (!image->array) {
-        PyGILState_Release(gstate);
-        goto err_decref_info;
+    /* While recording, images go to disk instead of the image queue */
+    __atomic_fetch_add(&self->record.users, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&self->record.active, __ATOMIC_SEQ_CST)) {
+        svs_core_Camera_new_record(self, svimage, length);
+        __atomic_fetch_sub(&self->record.users, 1, __ATOMIC_SEQ_CST);
+
+        stats_record(stats, STATS_CALLBACK, start);
+        return SVGigE_SUCCESS;
     }
+    __atomic_fetch_sub(&self->record.users, 1, __ATOMIC_SEQ_CST);
 
-    /* Queue full, drop the first item */
-    if (self->images_max && self->images_length == self->images_max) {
-        struct image *image = TAILQ_FIRST(&self->images);
-        TAILQ_REMOVE(&self->images, image, entry);
-        Py_DECREF(image->array);
-        Py_DECREF(image->info);
-        self->images_length--;
+    if (!queue) {
+        stats_record(stats, STATS_CALLBACK, start);
+        return SVGigE_SUCCESS;
     }
 
-    /* Add image to queue */
-    TAILQ_INSERT_TAIL(&self->images, image, entry);
-    self->images_length++;
+    if (frame_make_room(self, &self->queue, &index)) {
+        stats_record(stats, STATS_CALLBACK, start);
+        return SVGigE_SUCCESS;
+    }
 
-    /* Release the GIL */
-    PyGILState_Release(gstate);
+    frame = &self->queue.frames[index];
 
-    return SVGigE_SUCCESS;
+    /* Workers convert, while this thread goes back for the next image */
+    pooled = frame_use_pool(self, svimage);
+    if (pooled) {
+        size = convert_size(svimage->PixelType, svimage->ImageWidth,
+                            svimage->ImageHeight, self->output_format);
+        ret = !size || frame_fill_work(self, &self->queue, frame, svimage,
+                                       length, size, 0);
+        frame->format = self->output_format;
+    }
+    else {
+        ret = frame_fill(self, &self->queue, frame, svimage, length,
+                         self->zero_copy);
+    }
+
+    if (ret) {
+        self->queue.spare_frame = index;
+        frame_queue_drop(&self->queue, DROP_ERROR);
+        stats_record(stats, STATS_CALLBACK, start);
+        return SVGigE_ERROR;
+    }
+
+    frame->info.dropped = frame_queue_dropped(&self->queue);
+
+    if (pooled) {
+        frame_work_submit(frame);
+    }
+
+    frame_enqueue(&self->queue, index);
+
+    stats_record(stats, STATS_CALLBACK, start);
 
-err_decref_info:
-    Py_DECREF(image->info);
-err_free_image:
-    free(image);
-    return SVGigE_ERROR;
+    return SVGigE_SUCCESS;
 }
 
 SVGigE_RETURN svs_core_Camera_stream_callback(SVGigE_SIGNAL *signal,
@@ -298,6 +1211,11 @@ SVGigE_RETURN svs_core_Camera_stream_callback(SVGigE_SIGNAL *signal,
     case SVGigE_SIGNAL_FRAME_COMPLETED:
         ret = svs_core_Camera_new_image(self, signal);
         break;
+    case SVGigE_SIGNAL_CAMERA_CONNECTION_LOST:
+        /* The monitor closes and reopens the camera, outside the SDK */
+        monitor_lost(&self->monitor);
+        ret = SVGigE_SUCCESS;
+        break;
     default:
         ret = SVGigE_SUCCESS;
     }
@@ -0,0 +1,629 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Batched camera configuration
+ *
+ * Each SDK getter and setter is a GigE register transaction.  Settings
+ * applied or read together are converted and checked with the GIL, then
+ * issued in one pass without it, and the values kept so that unchanged
+ * settings need not be read again.
+ */
+
+#include <Python.h>
+#include <string.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+enum setting_kind {
+    SETTING_FLOAT,
+    SETTING_BOOL,
+    SETTING_PAIR,
+};
+
+struct setting {
+    const char          *name;
+    enum config_register reg;
+    enum setting_kind   kind;
+    int                 part;       /* Of a register pair */
+    double              scale;      /* SDK units per Python unit */
+};
+
+/* In snapshot() order */
+static const struct setting settings[] = {
+    {"exposure", CONFIG_EXPOSURE, SETTING_FLOAT, 0, 1000},
+    {"gain", CONFIG_GAIN, SETTING_FLOAT, 0, 1},
+    {"framerate", CONFIG_FRAMERATE, SETTING_FLOAT, 0, 1},
+    {"auto_exposure", CONFIG_AUTO_EXPOSURE, SETTING_BOOL, 0, 1},
+    {"auto_exposure_min", CONFIG_AUTO_EXPOSURE_LIMITS, SETTING_FLOAT, 0, 1000},
+    {"auto_exposure_max", CONFIG_AUTO_EXPOSURE_LIMITS, SETTING_FLOAT, 1, 1000},
+    {"auto_gain_min", CONFIG_AUTO_GAIN_LIMITS, SETTING_FLOAT, 0, 1},
+    {"auto_gain_max", CONFIG_AUTO_GAIN_LIMITS, SETTING_FLOAT, 1, 1},
+    {"auto_exposure_brightness", CONFIG_AUTO_BRIGHTNESS, SETTING_FLOAT, 0, 255},
+    {"auto_exposure_dynamics", CONFIG_AUTO_DYNAMICS, SETTING_PAIR, 0, 1},
+};
+
+#define SETTINGS_COUNT  (sizeof(settings)/sizeof(settings[0]))
+
+/* Registers configure() writes, with auto exposure handled separately */
+static const enum config_register write_order[] = {
+    CONFIG_AUTO_EXPOSURE_LIMITS,
+    CONFIG_AUTO_GAIN_LIMITS,
+    CONFIG_AUTO_BRIGHTNESS,
+    CONFIG_AUTO_DYNAMICS,
+    CONFIG_GAIN,
+    CONFIG_EXPOSURE,
+    CONFIG_FRAMERATE,
+};
+
+/*
+ * Registers pending in a batch
+ */
+struct config_batch {
+    int         parts[CONFIG_REGISTERS];    /* Bit per part given */
+    float       value[CONFIG_REGISTERS][2];
+    int         ret[CONFIG_REGISTERS];
+};
+
+static int register_read(Camera_handle handle, enum config_register reg,
+                         float value[2]) {
+    bool enabled;
+    int ret;
+
+    switch (reg) {
+    case CONFIG_AUTO_EXPOSURE:
+        ret = Camera_getAutoGainEnabled(handle, &enabled);
+        value[0] = enabled;
+        return ret;
+    case CONFIG_AUTO_EXPOSURE_LIMITS:
+        return Camera_getAutoExposureLimits(handle, &value[0], &value[1]);
+    case CONFIG_AUTO_GAIN_LIMITS:
+        return Camera_getAutoGainLimits(handle, &value[0], &value[1]);
+    case CONFIG_AUTO_BRIGHTNESS:
+        return Camera_getAutoGainBrightness(handle, &value[0]);
+    case CONFIG_AUTO_DYNAMICS:
+        return Camera_getAutoGainDynamics(handle, &value[0], &value[1]);
+    case CONFIG_GAIN:
+        return Camera_getGain(handle, &value[0]);
+    case CONFIG_EXPOSURE:
+        return Camera_getExposureTime(handle, &value[0]);
+    case CONFIG_FRAMERATE:
+        return Camera_getFrameRate(handle, &value[0]);
+    default:
+        return SVGigE_ERROR;
+    }
+}
+
+static int register_write(Camera_handle handle, enum config_register reg,
+                          float value[2]) {
+    switch (reg) {
+    case CONFIG_AUTO_EXPOSURE:
+        return Camera_setAutoGainEnabled(handle, value[0] != 0);
+    case CONFIG_AUTO_EXPOSURE_LIMITS:
+        return Camera_setAutoExposureLimits(handle, value[0], value[1]);
+    case CONFIG_AUTO_GAIN_LIMITS:
+        return Camera_setAutoGainLimits(handle, value[0], value[1]);
+    case CONFIG_AUTO_BRIGHTNESS:
+        return Camera_setAutoGainBrightness(handle, value[0]);
+    case CONFIG_AUTO_DYNAMICS:
+        return Camera_setAutoGainDynamics(handle, value[0], value[1]);
+    case CONFIG_GAIN:
+        return Camera_setGain(handle, value[0]);
+    case CONFIG_EXPOSURE:
+        return Camera_setExposureTime(handle, value[0]);
+    case CONFIG_FRAMERATE:
+        return Camera_setFrameRate(handle, value[0]);
+    default:
+        return SVGigE_ERROR;
+    }
+}
+
+static int register_pair(enum config_register reg) {
+    switch (reg) {
+    case CONFIG_AUTO_EXPOSURE_LIMITS:
+    case CONFIG_AUTO_GAIN_LIMITS:
+    case CONFIG_AUTO_DYNAMICS:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Whether a cached register still holds the camera's value
+ */
+static int config_cached(struct config_cache *cache, enum config_register reg) {
+    if (!cache->valid[reg]) {
+        return 0;
+    }
+
+    /* Auto exposure adjusts these continuously */
+    if (reg == CONFIG_GAIN || reg == CONFIG_EXPOSURE) {
+        return cache->valid[CONFIG_AUTO_EXPOSURE] &&
+               !cache->value[CONFIG_AUTO_EXPOSURE][0];
+    }
+
+    return 1;
+}
+
+void config_store(struct config_cache *cache, enum config_register reg,
+                  float first, float second) {
+    cache->valid[reg] = 1;
+    cache->value[reg][0] = first;
+    cache->value[reg][1] = second;
+}
+
+static const struct setting *setting_find(PyObject *key) {
+    PyObject *bytes;
+    const char *name;
+    const struct setting *found = NULL;
+
+#if PY_MAJOR_VERSION >= 3
+    if (!PyUnicode_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "Setting names must be strings");
+        return NULL;
+    }
+    bytes = PyUnicode_AsUTF8String(key);
+    if (!bytes) {
+        return NULL;
+    }
+    name = PyBytes_AsString(bytes);
+#else
+    if (!PyString_Check(key)) {
+        PyErr_SetString(PyExc_TypeError, "Setting names must be strings");
+        return NULL;
+    }
+    Py_INCREF(key);
+    bytes = key;
+    name = PyString_AsString(key);
+#endif
+
+    for (unsigned int i = 0; i < SETTINGS_COUNT; i++) {
+        if (!strcmp(settings[i].name, name)) {
+            found = &settings[i];
+            break;
+        }
+    }
+
+    if (!found) {
+        PyErr_Format(PyExc_ValueError, "Unknown setting '%s'", name);
+    }
+
+    Py_DECREF(bytes);
+    return found;
+}
+
+/*
+ * Convert and check a setting value, adding it to the batch
+ *
+ * @returns 0 on success, negative on error with exception set
+ */
+static int setting_parse(const struct setting *setting, PyObject *value,
+                         struct config_batch *batch) {
+    float *reg = batch->value[setting->reg];
+    double number;
+    float i, d;
+
+    switch (setting->kind) {
+    case SETTING_BOOL:
+        if (!PyBool_Check(value)) {
+            PyErr_Format(PyExc_TypeError, "Setting '%s' must be a bool",
+                         setting->name);
+            return -1;
+        }
+        reg[0] = value == Py_True;
+        batch->parts[setting->reg] |= 1;
+        return 0;
+
+    case SETTING_PAIR:
+        if (!PyTuple_Check(value) || PyTuple_Size(value) != 2) {
+            PyErr_Format(PyExc_TypeError,
+                         "Setting '%s' must be a tuple in the form (I,D)",
+                         setting->name);
+            return -1;
+        }
+        if (!PyArg_ParseTuple(value, "ff", &i, &d)) {
+            return -1;
+        }
+        reg[0] = i;
+        reg[1] = d;
+        batch->parts[setting->reg] |= 3;
+        return 0;
+
+    case SETTING_FLOAT:
+        number = PyFloat_AsDouble(value);
+        if (PyErr_Occurred()) {
+            return -1;
+        }
+        break;
+    }
+
+    switch (setting->reg) {
+    case CONFIG_EXPOSURE:
+    case CONFIG_FRAMERATE:
+    case CONFIG_AUTO_EXPOSURE_LIMITS:
+        if (!(number > 0)) {
+            PyErr_Format(PyExc_ValueError, "Setting '%s' must be positive",
+                         setting->name);
+            return -1;
+        }
+        break;
+    case CONFIG_AUTO_BRIGHTNESS:
+        if (!(number >= 0 && number <= 1)) {
+            PyErr_Format(PyExc_ValueError, "Setting '%s' must be from 0 to 1",
+                         setting->name);
+            return -1;
+        }
+        break;
+    default:
+        break;
+    }
+
+    reg[setting->part] = number*setting->scale;
+    batch->parts[setting->reg] |= 1 << setting->part;
+
+    return 0;
+}
+
+/*
+ * Raise SVSError for registers that failed, with a message per setting
+ *
+ * @returns 0 if every register in mask succeeded, else negative with
+ *          exception set
+ */
+static int config_errors(struct config_batch *batch, const int *mask,
+                         const char *message) {
+    PyObject *errors, *error;
+    const char *reason;
+    int ret;
+
+    errors = PyDict_New();
+    if (!errors) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < SETTINGS_COUNT; i++) {
+        const struct setting *setting = &settings[i];
+
+        ret = batch->ret[setting->reg];
+        if (!mask[setting->reg] || ret == SVGigE_SUCCESS) {
+            continue;
+        }
+
+        reason = getErrorMessage(ret);
+#if PY_MAJOR_VERSION >= 3
+        error = PyUnicode_FromFormat("SVGigE SDK error %d: %s", ret,
+                                     reason ? reason : "Unknown error");
+#else
+        error = PyString_FromFormat("SVGigE SDK error %d: %s", ret,
+                                    reason ? reason : "Unknown error");
+#endif
+        if (!error || PyDict_SetItemString(errors, setting->name, error)) {
+            Py_XDECREF(error);
+            Py_DECREF(errors);
+            return -1;
+        }
+        Py_DECREF(error);
+    }
+
+    if (!PyDict_Size(errors)) {
+        Py_DECREF(errors);
+        return 0;
+    }
+
+    error = Py_BuildValue("(sN)", message, errors);
+    if (error) {
+        PyErr_SetObject(SVSError, error);
+        Py_DECREF(error);
+    }
+    return -1;
+}
+
+int config_apply(svs_core_Camera *self, PyObject *kwargs) {
+    struct config_cache *cache = &self->config;
+    struct config_batch batch;
+    int written[CONFIG_REGISTERS];
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    int auto_first;
+
+    memset(&batch, 0, sizeof(batch));
+    memset(written, 0, sizeof(written));
+
+    while (PyDict_Next(kwargs, &pos, &key, &value)) {
+        const struct setting *setting = setting_find(key);
+
+        if (!setting || setting_parse(setting, value, &batch)) {
+            return -1;
+        }
+    }
+
+    /* Fill in the other half of partly given pairs */
+    for (int reg = 0; reg < CONFIG_REGISTERS; reg++) {
+        if (batch.parts[reg] && batch.parts[reg] != 3 && register_pair(reg) &&
+                config_cached(cache, reg)) {
+            int part = batch.parts[reg] == 1;
+
+            batch.value[reg][part] = cache->value[reg][part];
+            batch.parts[reg] = 3;
+        }
+    }
+
+    /* Switch auto exposure off before setting exposure, on after */
+    auto_first = batch.parts[CONFIG_AUTO_EXPOSURE] &&
+                 !batch.value[CONFIG_AUTO_EXPOSURE][0];
+
+    Py_BEGIN_ALLOW_THREADS
+    if (auto_first) {
+        batch.ret[CONFIG_AUTO_EXPOSURE] = register_write(self->handle,
+                CONFIG_AUTO_EXPOSURE, batch.value[CONFIG_AUTO_EXPOSURE]);
+        written[CONFIG_AUTO_EXPOSURE] = 1;
+    }
+
+    for (unsigned int i = 0; i < sizeof(write_order)/sizeof(write_order[0]); i++) {
+        enum config_register reg = write_order[i];
+        float current[2];
+        int parts = batch.parts[reg];
+
+        if (!parts) {
+            continue;
+        }
+        written[reg] = 1;
+
+        if (register_pair(reg) && parts != 3) {
+            batch.ret[reg] = register_read(self->handle, reg, current);
+            if (batch.ret[reg] != SVGigE_SUCCESS) {
+                continue;
+            }
+            batch.value[reg][parts == 1] = current[parts == 1];
+        }
+
+        batch.ret[reg] = register_write(self->handle, reg, batch.value[reg]);
+    }
+
+    if (batch.parts[CONFIG_AUTO_EXPOSURE] && !auto_first) {
+        batch.ret[CONFIG_AUTO_EXPOSURE] = register_write(self->handle,
+                CONFIG_AUTO_EXPOSURE, batch.value[CONFIG_AUTO_EXPOSURE]);
+        written[CONFIG_AUTO_EXPOSURE] = 1;
+    }
+    Py_END_ALLOW_THREADS
+
+    for (int reg = 0; reg < CONFIG_REGISTERS; reg++) {
+        if (!written[reg]) {
+            continue;
+        }
+
+        if (batch.ret[reg] == SVGigE_SUCCESS) {
+            cache->valid[reg] = 1;
+            memcpy(cache->value[reg], batch.value[reg], sizeof(cache->value[reg]));
+        }
+        else {
+            cache->valid[reg] = 0;
+        }
+    }
+
+    return config_errors(&batch, written, "Unable to apply settings");
+}
+
+static PyObject *setting_value(const struct setting *setting, float *reg) {
+    switch (setting->kind) {
+    case SETTING_BOOL:
+        return PyBool_FromLong(reg[0] != 0);
+    case SETTING_PAIR:
+        return Py_BuildValue("(ff)", reg[0], reg[1]);
+    default:
+        return PyFloat_FromDouble(reg[setting->part]/setting->scale);
+    }
+}
+
+PyObject *config_snapshot(svs_core_Camera *self, int refresh) {
+    struct config_cache *cache = &self->config;
+    struct config_batch batch;
+    int read[CONFIG_REGISTERS];
+    PyObject *dict, *value;
+
+    memset(&batch, 0, sizeof(batch));
+
+    /* Auto exposure first, as it decides whether gain and exposure are cached */
+    read[CONFIG_AUTO_EXPOSURE] = refresh ||
+                                 !config_cached(cache, CONFIG_AUTO_EXPOSURE);
+
+    Py_BEGIN_ALLOW_THREADS
+    if (read[CONFIG_AUTO_EXPOSURE]) {
+        batch.ret[CONFIG_AUTO_EXPOSURE] = register_read(self->handle,
+                CONFIG_AUTO_EXPOSURE, batch.value[CONFIG_AUTO_EXPOSURE]);
+    }
+
+    for (int reg = 0; reg < CONFIG_REGISTERS; reg++) {
+        if (reg == CONFIG_AUTO_EXPOSURE) {
+            continue;
+        }
+
+        if (reg == CONFIG_GAIN || reg == CONFIG_EXPOSURE) {
+            /* Unless auto exposure was just read as off */
+            read[reg] = refresh || !cache->valid[reg] ||
+                        (read[CONFIG_AUTO_EXPOSURE]
+                         ? batch.ret[CONFIG_AUTO_EXPOSURE] != SVGigE_SUCCESS ||
+                           batch.value[CONFIG_AUTO_EXPOSURE][0]
+                         : !config_cached(cache, reg));
+        }
+        else {
+            read[reg] = refresh || !config_cached(cache, reg);
+        }
+
+        if (read[reg]) {
+            batch.ret[reg] = register_read(self->handle, reg, batch.value[reg]);
+        }
+    }
+    Py_END_ALLOW_THREADS
+
+    for (int reg = 0; reg < CONFIG_REGISTERS; reg++) {
+        if (!read[reg]) {
+            memcpy(batch.value[reg], cache->value[reg], sizeof(batch.value[reg]));
+        }
+        else if (batch.ret[reg] == SVGigE_SUCCESS) {
+            cache->valid[reg] = 1;
+            memcpy(cache->value[reg], batch.value[reg], sizeof(cache->value[reg]));
+        }
+        else {
+            cache->valid[reg] = 0;
+        }
+    }
+
+    if (config_errors(&batch, read, "Unable to read settings")) {
+        return NULL;
+    }
+
+    dict = PyDict_New();
+    if (!dict) {
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < SETTINGS_COUNT; i++) {
+        const struct setting *setting = &settings[i];
+
+        value = setting_value(setting, batch.value[setting->reg]);
+        if (!value || PyDict_SetItemString(dict, setting->name, value)) {
+            Py_XDECREF(value);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(value);
+    }
+
+    value = svs_core_Camera_getinfo(self, NULL);
+    if (!value || PyDict_SetItemString(dict, "info", value)) {
+        Py_XDECREF(value);
+        Py_DECREF(dict);
+        return NULL;
+    }
+    Py_DECREF(value);
+
+    return dict;
+}
+
+/*
+ * Note the result of a write by config_restore()
+ *
+ * A failed entry is dropped from the cache, and the first failure kept.
+ */
+static void restore_check(int ret, int *valid, int *first) {
+    if (ret == SVGigE_SUCCESS) {
+        return;
+    }
+
+    if (valid) {
+        *valid = 0;
+    }
+
+    if (*first == SVGigE_SUCCESS) {
+        *first = ret;
+    }
+}
+
+int config_restore(svs_core_Camera *self, Camera_handle handle,
+                   struct config_cache *cache) {
+    SVGIGE_PIXEL_DEPTH depth;
+    int auto_first, ret, first = SVGigE_SUCCESS;
+
+    /* The controller owns the settings */
+    if (self->multicast == MULTICAST_MODE_LISTENER) {
+        return SVGigE_SUCCESS;
+    }
+
+    /* Binning resizes the area of interest, so comes before it */
+    if (cache->binning_valid) {
+        ret = Camera_setBinningMode(handle, cache->binning);
+        restore_check(ret, &cache->binning_valid, &first);
+    }
+
+    switch (self->depth) {
+    case 8:
+        depth = SVGIGE_PIXEL_DEPTH_8;
+        break;
+    case 16:
+        depth = SVGIGE_PIXEL_DEPTH_16;
+        break;
+    default:
+        depth = SVGIGE_PIXEL_DEPTH_12;
+    }
+
+    ret = Camera_setPixelDepth(handle, depth);
+    restore_check(ret, NULL, &first);
+
+    if (cache->roi_valid) {
+        ret = Camera_setAreaOfInterest(handle, cache->roi[0], cache->roi[1],
+                                       cache->roi[2], cache->roi[3]);
+        restore_check(ret, &cache->roi_valid, &first);
+    }
+
+    /* As configure(), auto exposure goes off before exposure, on after */
+    auto_first = cache->valid[CONFIG_AUTO_EXPOSURE] &&
+                 !cache->value[CONFIG_AUTO_EXPOSURE][0];
+
+    if (auto_first) {
+        ret = register_write(handle, CONFIG_AUTO_EXPOSURE,
+                             cache->value[CONFIG_AUTO_EXPOSURE]);
+        restore_check(ret, &cache->valid[CONFIG_AUTO_EXPOSURE], &first);
+    }
+
+    for (unsigned int i = 0; i < sizeof(write_order)/sizeof(write_order[0]); i++) {
+        enum config_register reg = write_order[i];
+
+        /* Gain and exposure are the camera's own under auto exposure */
+        if (!config_cached(cache, reg)) {
+            continue;
+        }
+
+        ret = register_write(handle, reg, cache->value[reg]);
+        restore_check(ret, &cache->valid[reg], &first);
+    }
+
+    if (cache->valid[CONFIG_AUTO_EXPOSURE] && !auto_first) {
+        ret = register_write(handle, CONFIG_AUTO_EXPOSURE,
+                             cache->value[CONFIG_AUTO_EXPOSURE]);
+        restore_check(ret, &cache->valid[CONFIG_AUTO_EXPOSURE], &first);
+    }
+
+    if (cache->polarity_valid) {
+        ret = Camera_setTriggerPolarity(handle, cache->polarity);
+        restore_check(ret, &cache->polarity_valid, &first);
+    }
+
+    /* Last, so the camera only streams once configured */
+    if (cache->acquisition_valid) {
+        if (cache->acquisition_start) {
+            ret = Camera_setAcquisitionMode(handle, cache->acquisition_mode, 1);
+        }
+        else {
+            ret = Camera_setAcquisitionControl(handle, ACQUISITION_CONTROL_STOP);
+        }
+        restore_check(ret, &cache->acquisition_valid, &first);
+    }
+
+    return first;
+}
@@ -26,21 +26,367 @@
  */
 
 #include <Python.h>
-#include <sys/queue.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
 #include <libsvgige/svgige.h>
 #include "svs_core.h"
 
+/*
+ * Stop publishing to the bus, once the callback has left it
+ */
+static void camera_stop_bus(svs_core_Camera *self) {
+    struct frame_bus *bus;
+
+    bus = __atomic_exchange_n(&self->bus, NULL, __ATOMIC_SEQ_CST);
+    if (!bus) {
+        return;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    while (__atomic_load_n(&self->bus_users, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+
+    bus_destroy(bus);
+    Py_END_ALLOW_THREADS
+}
+
 static PyObject *svs_core_Camera_close(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
     int ret;
 
-    ret = closeStream(self->stream);
-    if (ret != SVGigE_SUCCESS) {
-        raise_general_error(ret);
+    /* The monitor takes the GIL to hand the camera back */
+    Py_BEGIN_ALLOW_THREADS
+    monitor_stop(&self->monitor);
+    Py_END_ALLOW_THREADS
+
+    clock_sync_stop(&self->clock);
+
+    /* Wake threads waiting for images, which take those left, then stop */
+    frame_queue_end(&self->queue);
+    frame_queue_end(&self->preview);
+    frame_queue_end(&self->grab);
+
+    Py_BEGIN_ALLOW_THREADS
+    recorder_stop(&self->record);
+    Py_END_ALLOW_THREADS
+
+    camera_stop_bus(self);
+
+    /* The stream may already be gone, if a resize failed to reopen it */
+    if (self->ready == READY && self->sim) {
+        Py_BEGIN_ALLOW_THREADS
+        sim_stop(self->sim);
+        Py_END_ALLOW_THREADS
+        self->ready = NAME_ALLOCATED;
+    }
+    else if (self->ready == READY) {
+        ret = closeStream(self->stream);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return NULL;
+        }
+        self->ready = NAME_ALLOCATED;
+    }
+
+    if (self->ready == NAME_ALLOCATED && self->sim) {
+        self->ready = CLOSED;
+    }
+    else if (self->ready == NAME_ALLOCATED) {
+        ret = closeCamera(self->handle);
+        if (ret != SVGigE_SUCCESS) {
+            raise_general_error(ret);
+            return NULL;
+        }
+        self->ready = CLOSED;
+    }
+    else if (self->ready == DISCONNECTED) {
+        /* The monitor already closed the lost camera */
+        self->ready = CLOSED;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+void svs_core_Camera_no_images(svs_core_Camera *self, int ret,
+                               const char *message) {
+    struct camera_monitor *monitor = &self->monitor;
+    char error[sizeof(monitor->error)];
+
+    if (ret != 2) {
+        PyErr_SetString(SVSNoImagesError, message);
+        return;
+    }
+
+    if (self->ready != DISCONNECTED) {
+        PyErr_SetString(SVSClosedError, "Camera is closed");
+        return;
+    }
+
+    /* The monitor gave up on the lost camera */
+    pthread_mutex_lock(&monitor->lock);
+    memcpy(error, monitor->error, sizeof(error));
+    pthread_mutex_unlock(&monitor->lock);
+
+    if (error[0]) {
+        PyErr_Format(SVSClosedError, "Camera connection lost: %s", error);
+    }
+    else {
+        PyErr_SetString(SVSClosedError, "Camera connection lost");
+    }
+}
+
+static PyObject *svs_core_Camera_enter(svs_core_Camera *self, PyObject *args) {
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+static PyObject *svs_core_Camera_exit(svs_core_Camera *self, PyObject *args) {
+    PyObject *ret;
+    unsigned int index;
+
+    if (self->ready == CLOSED) {
+        Py_INCREF(Py_False);
+        return Py_False;
+    }
+
+    /* Best effort: the stream closes regardless */
+    if (self->ready == READY && !self->sim &&
+            self->multicast != MULTICAST_MODE_LISTENER) {
+        Camera_setAcquisitionControl(self->handle, ACQUISITION_CONTROL_STOP);
+    }
+
+    ret = svs_core_Camera_close(self, NULL, NULL);
+    if (!ret) {
+        return NULL;
+    }
+    Py_DECREF(ret);
+
+    /* Nothing more can arrive, so return queued frames to the pool */
+    while (!frame_queue_pop(&self->queue, &index, 0)) {
+        frame_release(&self->queue, index);
+    }
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    /* Don't suppress exceptions from the with block */
+    Py_INCREF(Py_False);
+    return Py_False;
+}
+
+PyObject *svs_core_Camera_iternext(svs_core_Camera *self) {
+    unsigned int index;
+    int ret;
+
+    /* Never opened, so nothing will be queued */
+    if (!self->queue.frames) {
+        return NULL;
+    }
+
+    /*
+     * Waits out a reconnect or a stream replaced by an attribute change.
+     * Ends iteration, without an exception, once closed and the images
+     * left are taken, and raises if the monitor gave up on the camera.
+     */
+    ret = frame_queue_pop(&self->queue, &index, -1);
+    if (ret == 2 && self->ready == DISCONNECTED) {
+        svs_core_Camera_no_images(self, ret, NULL);
+        return NULL;
+    }
+    else if (ret) {
+        return NULL;
+    }
+
+    return svs_core_Camera_frame(self, &self->queue, index);
+}
+
+static PyObject *svs_core_Camera_fileno(svs_core_Camera *self, PyObject *args) {
+    return PyLong_FromLong(self->queue.event_fd);
+}
+
+static PyObject *svs_core_Camera_next(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeout_obj = NULL;
+    unsigned int index;
+    int ret, timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj)) {
+        return NULL;
+    }
+
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    ret = frame_queue_pop(&self->queue, &index, timeout);
+    if (ret < 0) {
+        return NULL;
+    }
+    else if (ret) {
+        svs_core_Camera_no_images(self, ret, "No images available");
+        return NULL;
+    }
+
+    return svs_core_Camera_frame(self, &self->queue, index);
+}
+
+/*
+ * Replace the native hook, once no callback is using the old one
+ */
+static void camera_set_native(svs_core_Camera *self, struct native_hook *hook) {
+    struct native_hook *old;
+
+    old = __atomic_exchange_n(&self->native, hook, __ATOMIC_SEQ_CST);
+    if (!old) {
+        return;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    while (__atomic_load_n(&self->native_users, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+    Py_END_ALLOW_THREADS
+
+    Py_DECREF(old->capsule);
+    free(old);
+}
+
+static PyObject *svs_core_Camera_publish(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"name", "slots", "slot_size", "compress", NULL};
+    unsigned int slots = BUS_SLOTS;
+    unsigned long long slot_size = 0;
+    struct frame_bus *bus;
+    uint32_t pixel_type;
+    int compress = 0;
+    char *name;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|IKi", kwlist, &name,
+                                     &slots, &slot_size, &compress)) {
+        return NULL;
+    }
+
+    if (!slots) {
+        PyErr_SetString(PyExc_ValueError, "slots must be at least 1");
+        return NULL;
+    }
+
+    if (self->bus) {
+        PyErr_SetString(PyExc_RuntimeError, "Camera is already publishing");
         return NULL;
     }
 
-    ret = closeCamera(self->handle);
+    /* Room for the current image size in the output format */
+    if (!slot_size) {
+        pixel_type = self->depth > 8 ? GVSP_PIX_OCCUPY16BIT : GVSP_PIX_OCCUPY8BIT;
+        if (compress) {
+            slot_size = codec_bound(pixel_type, self->width, self->height);
+        }
+        else {
+            slot_size = convert_size(pixel_type, self->width, self->height,
+                                     self->output_format);
+        }
+    }
+
+    bus = bus_create(name, slots, slot_size,
+                     compress ? CODEC_RICE : CODEC_NONE);
+    if (!bus) {
+        return NULL;
+    }
+
+    __atomic_store_n(&self->bus, bus, __ATOMIC_SEQ_CST);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_Camera_stop_publishing(svs_core_Camera *self, PyObject *args) {
+    PyObject *progress;
+
+    if (!self->bus) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    /* Only the callback writes the counters, and it is about to leave */
+    progress = bus_progress(self->bus);
+    if (!progress) {
+        return NULL;
+    }
+
+    camera_stop_bus(self);
+
+    return progress;
+}
+
+static PyObject *svs_core_Camera_publishing(svs_core_Camera *self, PyObject *args) {
+    if (!self->bus) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    return bus_progress(self->bus);
+}
+
+static PyObject *svs_core_Camera_set_native_callback(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"callback", "queue", NULL};
+    struct native_hook *hook;
+    PyObject *capsule;
+    int queue = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &capsule, &queue)) {
+        return NULL;
+    }
+
+    if (capsule == Py_None) {
+        camera_set_native(self, NULL);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    if (!PyCapsule_IsValid(capsule, SVS_NATIVE_CAPSULE)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "callback must be a capsule named '" SVS_NATIVE_CAPSULE "'");
+        return NULL;
+    }
+
+    hook = malloc(sizeof(*hook));
+    if (!hook) {
+        return PyErr_NoMemory();
+    }
+
+    hook->callback = (svs_native_callback) PyCapsule_GetPointer(capsule, SVS_NATIVE_CAPSULE);
+    hook->context = PyCapsule_GetContext(capsule);
+    hook->queue = queue;
+    hook->capsule = capsule;
+    Py_INCREF(capsule);
+
+    camera_set_native(self, hook);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_Camera_trigger(svs_core_Camera *self, PyObject *args) {
+    unsigned int index;
+    int ret;
+
+    /* Discard an image from an earlier trigger that was never grabbed */
+    while (!frame_queue_pop(&self->grab, &index, 0)) {
+        frame_release(&self->grab, index);
+    }
+
+    __atomic_store_n(&self->grab_armed, 1, __ATOMIC_SEQ_CST);
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = Camera_startAcquisitionCycle(self->handle);
+    Py_END_ALLOW_THREADS
+
     if (ret != SVGigE_SUCCESS) {
+        __atomic_store_n(&self->grab_armed, 0, __ATOMIC_SEQ_CST);
         raise_general_error(ret);
         return NULL;
     }
@@ -49,46 +395,512 @@ static PyObject *svs_core_Camera_close(svs_core_Camera *self, PyObject *args, Py
     return Py_None;
 }
 
-static PyObject *svs_core_Camera_next(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
-    struct image *image;
-    PyObject *ret;
+static PyObject *svs_core_Camera_grab(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeout_obj = Py_None;
+    unsigned int index;
+    int ret, timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj)) {
+        return NULL;
+    }
+
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    /* Without trigger(), take the next image, as from an external trigger */
+    if (!frame_ring_length(&self->grab.images)) {
+        __atomic_store_n(&self->grab_armed, 1, __ATOMIC_SEQ_CST);
+    }
+
+    ret = frame_queue_pop(&self->grab, &index, timeout);
+    if (ret) {
+        /* A late image goes to the image queue instead */
+        __atomic_store_n(&self->grab_armed, 0, __ATOMIC_SEQ_CST);
+
+        if (ret > 0) {
+            svs_core_Camera_no_images(self, ret, "No image before the timeout");
+        }
+        return NULL;
+    }
+
+    return svs_core_Camera_frame(self, &self->grab, index);
+}
+
+static PyObject *svs_core_Camera_next_batch(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"n", "timeout", "out", NULL};
+    PyObject *timeout_obj = NULL, *out = NULL;
+    unsigned int max_images;
+    int timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "I|OO", kwlist, &max_images,
+                                     &timeout_obj, &out)) {
+        return NULL;
+    }
 
-    if (TAILQ_EMPTY(&self->images)) {
-        PyErr_SetString(SVSNoImagesError, "No images available");
+    if (!max_images) {
+        PyErr_SetString(PyExc_ValueError, "n must be at least 1");
         return NULL;
     }
 
-    image = TAILQ_FIRST(&self->images);
-    TAILQ_REMOVE(&self->images, image, entry);
-    self->images_length--;
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    if (out == Py_None) {
+        out = NULL;
+    }
+
+    return svs_core_Camera_batch(self, max_images, timeout, out);
+}
+
+static PyObject *svs_core_Camera_next_into(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"out", "timeout", NULL};
+    PyObject *timeout_obj = NULL, *out;
+    int timeout;
 
-    ret = Py_BuildValue("(OO)", image->array, image->info);
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &out,
+                                     &timeout_obj)) {
+        return NULL;
+    }
 
-    Py_DECREF(image->array);
-    Py_DECREF(image->info);
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    return svs_core_Camera_into(self, timeout, out);
+}
 
-    free(image);
+static PyObject *svs_core_Camera_next_preview(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeout_obj = NULL;
+    unsigned int index;
+    int ret, timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &timeout_obj)) {
+        return NULL;
+    }
+
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    if (!self->preview_decimation) {
+        PyErr_SetString(SVSError, "Preview not enabled, see preview_decimation");
+        return NULL;
+    }
+
+    ret = frame_queue_pop(&self->preview, &index, timeout);
+    if (ret < 0) {
+        return NULL;
+    }
+    else if (ret) {
+        svs_core_Camera_no_images(self, ret, "No preview images available");
+        return NULL;
+    }
+
+    return svs_core_Camera_frame(self, &self->preview, index);
+}
+
+static PyObject *svs_core_Camera_record(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"path", "queue_length", "preallocate",
+                             "compress", NULL};
+    unsigned int queue_length = RECORD_QUEUE_LENGTH;
+    unsigned long long preallocate = 0;
+    int compress = 0;
+    char *path;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|IKi", kwlist, &path,
+                                     &queue_length, &preallocate, &compress)) {
+        return NULL;
+    }
+
+    if (!queue_length) {
+        PyErr_SetString(PyExc_ValueError, "queue_length must be at least 1");
+        return NULL;
+    }
+
+    if (recorder_start(&self->record, path, queue_length, preallocate,
+                       self->numa_node, compress ? CODEC_RICE : CODEC_NONE)) {
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_Camera_stop_recording(svs_core_Camera *self, PyObject *args) {
+    int error;
+
+    Py_BEGIN_ALLOW_THREADS
+    error = recorder_stop(&self->record);
+    Py_END_ALLOW_THREADS
+
+    if (error) {
+        errno = error;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return NULL;
+    }
 
-    return ret;
+    return recorder_progress(&self->record);
+}
+
+static PyObject *svs_core_Camera_recording(svs_core_Camera *self, PyObject *args) {
+    return recorder_progress(&self->record);
+}
+
+static PyObject *svs_core_Camera_configure(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    if (PyTuple_Size(args)) {
+        PyErr_SetString(PyExc_TypeError, "configure() takes only keyword arguments");
+        return NULL;
+    }
+
+    if (kwds && config_apply(self, kwds)) {
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_Camera_snapshot(svs_core_Camera *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"refresh", NULL};
+    PyObject *refresh = Py_False;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", kwlist, &refresh)) {
+        return NULL;
+    }
+
+    return config_snapshot(self, PyObject_IsTrue(refresh));
+}
+
+static PyObject *svs_core_Camera_stats(svs_core_Camera *self, PyObject *args) {
+    return stats_dict(&self->stats, &self->queue);
+}
+
+static PyObject *svs_core_Camera_connection(svs_core_Camera *self, PyObject *args) {
+    return monitor_dict(&self->monitor);
+}
+
+static PyObject *svs_core_Camera_reset_stats(svs_core_Camera *self, PyObject *args) {
+    stats_reset(&self->stats, &self->queue);
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
 PyMethodDef svs_core_Camera_methods[] = {
     {"close", (PyCFunction) svs_core_Camera_close, METH_NOARGS,
         "close()\n\n"
-        "Closes open camera.\n\n"
+        "Closes open camera.  Closing a closed camera does nothing.\n\n"
+        "Threads waiting for images wake, take any left, then get\n"
+        "SVSClosedError, or end iteration.\n\n"
         "Raises:\n"
         "    SVSError: An unknown error occured in the SVGigE SDK."
     },
-    {"next", (PyCFunction) svs_core_Camera_next, METH_VARARGS,
-        "next() -> image, metadata\n\n"
+    {"__enter__", (PyCFunction) svs_core_Camera_enter, METH_NOARGS,
+        "__enter__() -> Camera\n\n"
+        "Returns the camera, for use in a with statement."
+    },
+    {"__exit__", (PyCFunction) svs_core_Camera_exit, METH_VARARGS,
+        "__exit__(*exc_info) -> False\n\n"
+        "Stops acquisition, closes the camera and drains the image queue.\n"
+        "Does nothing if the camera is already closed."
+    },
+    {"next", (PyCFunction) svs_core_Camera_next, METH_VARARGS | METH_KEYWORDS,
+        "next(timeout=0) -> image, metadata\n\n"
         "Gets next available image.\n\n"
         "Gets the next available image from the camera as a Numpy array\n"
         "Blocks until image is available, or timeout occurs.\n\n"
+        "Arguments:\n"
+        "    timeout (optional): Seconds to wait for an image.  Zero returns\n"
+        "        immediately, None waits forever.  The GIL is released while\n"
+        "        waiting.\n\n"
         "Returns:\n"
         "    (image, metadata) tuple, where image is a Numpy array containing\n"
-        "    the image, and metadata is a dictionary containing image metadata.\n\n"
+        "    the image, and metadata is a FrameInfo object, with fields as\n"
+        "    attributes or keys (e.g., metadata.timestamp, metadata['ticks']).\n\n"
+        "Raises:\n"
+        "    SVSNoImagesError: No images became available before the timeout.\n"
+        "    SVSClosedError: The camera is closed, and no images are left."
+    },
+    {"next_into", (PyCFunction) svs_core_Camera_next_into, METH_VARARGS | METH_KEYWORDS,
+        "next_into(out, timeout=0) -> metadata\n\n"
+        "Gets next available image into an existing array.\n\n"
+        "As next(), but copies the image into out instead of a new array,\n"
+        "so a capture loop reusing out allocates nothing.  An image that\n"
+        "doesn't fit out is kept, and returned by the next call.\n\n"
+        "Arguments:\n"
+        "    out: C contiguous, writeable array of the image's dtype and\n"
+        "        shape, as returned by next().\n"
+        "    timeout (optional): Seconds to wait for an image.  Zero returns\n"
+        "        immediately, None waits forever.\n\n"
+        "Returns:\n"
+        "    FrameInfo object for the image.\n\n"
+        "Raises:\n"
+        "    SVSNoImagesError: No images became available before the timeout.\n"
+        "    SVSClosedError: The camera is closed, and no images are left.\n"
+        "    ValueError: out doesn't have the dtype and shape of the image."
+    },
+    {"next_batch", (PyCFunction) svs_core_Camera_next_batch, METH_VARARGS | METH_KEYWORDS,
+        "next_batch(n, timeout=0, out=None) -> images, metadata\n\n"
+        "Gets up to n images in one array.\n\n"
+        "Copies queued images into a single (count, height, width[, 3])\n"
+        "array, waiting up to timeout for n images to arrive.  An image of a\n"
+        "different shape than the first ends the batch early, and is\n"
+        "returned first by the next call.\n\n"
+        "Arguments:\n"
+        "    n: Maximum number of images.\n"
+        "    timeout (optional): Seconds to wait for the batch to fill.  Zero\n"
+        "        takes only images already queued, None waits for n images.\n"
+        "    out (optional): C contiguous array of shape (m, height, width[, 3])\n"
+        "        and the image dtype to fill, instead of allocating one.  At\n"
+        "        most m images are taken.\n\n"
+        "Returns:\n"
+        "    (images, metadata) tuple.  images holds count >= 1 images, and is\n"
+        "    a view of out if passed.  metadata is a structured array with a\n"
+        "    record per image, with the fields of next()'s metadata, and\n"
+        "    timestamp as datetime64[us].\n\n"
         "Raises:\n"
-        "    SVSNoImagesError: No images are available in the queue."
+        "    SVSNoImagesError: No images became available before the timeout.\n"
+        "    SVSClosedError: The camera is closed, and no images are left.\n"
+        "    ValueError: out does not match the shape or dtype of the images.\n"
+        "        The first image is kept, and returned by the next call."
+    },
+    {"set_native_callback", (PyCFunction) svs_core_Camera_set_native_callback, METH_VARARGS | METH_KEYWORDS,
+        "set_native_callback(callback, queue=True)\n\n"
+        "Register a C function to receive every image.\n\n"
+        "The function is called from the stream callback with the raw\n"
+        "image and its metadata, before any Python objects are made, and\n"
+        "without the GIL.  See svs_native.h for the interface.  Replaces any\n"
+        "callback already set; once this returns, the old one is no longer\n"
+        "called.\n\n"
+        "Arguments:\n"
+        "    callback: PyCapsule named 'svs_core.native_callback' holding the\n"
+        "        function, with its context as the capsule context, or None\n"
+        "        to remove the callback.\n"
+        "    queue (optional): Whether images are also queued for next().\n\n"
+        "Raises:\n"
+        "    TypeError: callback is not a native callback capsule."
+    },
+    {"publish", (PyCFunction) svs_core_Camera_publish, METH_VARARGS | METH_KEYWORDS,
+        "publish(name, slots=8, slot_size=0, compress=False)\n\n"
+        "Publish every image on a shared-memory bus for other processes.\n\n"
+        "Images are converted to the output format in the stream callback,\n"
+        "straight into a ring of slots in the POSIX shared-memory object\n"
+        "name.  Any number of svs.Subscriber objects, in any process, can\n"
+        "then view them without copying.  Publishing never waits for\n"
+        "subscribers, and does not take images from next() or recording.\n\n"
+        "Arguments:\n"
+        "    name: Shared-memory object name, such as 'camera0'.\n"
+        "    slots (optional): Images held in the ring.\n"
+        "    slot_size (optional): Largest image in bytes.  By default, the\n"
+        "        current image size in the output format.  Larger images are\n"
+        "        not published.\n"
+        "    compress (optional): Publish raw images losslessly compressed,\n"
+        "        for subscribers to decompress and convert.  The callback\n"
+        "        compresses on the worker pool, if it is running.  slot_size\n"
+        "        then defaults to the largest compressed raw image.\n\n"
+        "Raises:\n"
+        "    OSError: The shared-memory object exists or cannot be created.\n"
+        "        A name left behind by a crashed publisher can be removed\n"
+        "        from /dev/shm.\n"
+        "    RuntimeError: The camera is already publishing."
+    },
+    {"stop_publishing", (PyCFunction) svs_core_Camera_stop_publishing, METH_NOARGS,
+        "stop_publishing() -> dict\n\n"
+        "Stop publishing, and remove the bus name.\n\n"
+        "Subscribers take any images left, then get SVSNoImagesError.  Does\n"
+        "nothing if not publishing.\n\n"
+        "Returns:\n"
+        "    Final progress, as publishing(), or None if not publishing."
+    },
+    {"publishing", (PyCFunction) svs_core_Camera_publishing, METH_NOARGS,
+        "publishing() -> dict\n\n"
+        "Progress of the current bus.\n\n"
+        "Returns:\n"
+        "    None if not publishing, else dict with:\n"
+        "        name: Shared-memory object name\n"
+        "        compress: Whether images are compressed\n"
+        "        published: Images published\n"
+        "        too_large: Images skipped, as larger than a slot\n"
+        "        errors: Images skipped, as they failed to convert\n"
+        "        slots, slot_size: Bus geometry"
+    },
+    {"trigger", (PyCFunction) svs_core_Camera_trigger, METH_NOARGS,
+        "trigger()\n\n"
+        "Software trigger one image, to be taken by grab().\n\n"
+        "The camera must be in ACQUISITION_MODE_SOFTWARE_TRIGGER or\n"
+        "ACQUISITION_MODE_INT_TRIGGER.  The image goes straight to grab(),\n"
+        "not to the queue read by next().  An earlier triggered image that\n"
+        "was not grabbed is discarded.\n\n"
+        "Raises:\n"
+        "    SVSError: An unknown error occured in the SVGigE SDK."
+    },
+    {"grab", (PyCFunction) svs_core_Camera_grab, METH_VARARGS | METH_KEYWORDS,
+        "grab(timeout=None) -> image, metadata\n\n"
+        "Wait for a single image, bypassing the image queue.\n\n"
+        "Returns the image from the last trigger(), or without trigger(),\n"
+        "the next image the camera sends, as from an external trigger.  The\n"
+        "image is converted in the stream callback, so only a copy is left\n"
+        "to do on return.\n\n"
+        "Arguments:\n"
+        "    timeout (optional): Seconds to wait.  None waits forever.\n\n"
+        "Returns:\n"
+        "    (image, metadata) tuple, as next().\n\n"
+        "Raises:\n"
+        "    SVSNoImagesError: No image arrived before the timeout."
+    },
+    {"fileno", (PyCFunction) svs_core_Camera_fileno, METH_NOARGS,
+        "fileno() -> file descriptor\n\n"
+        "File descriptor that is readable while images are queued.\n\n"
+        "For use with select(), poll() or an event loop, to wait on several\n"
+        "cameras at once.  Call next() once readable; the descriptor is\n"
+        "reset by next() when the queue empties, and should not be read\n"
+        "directly."
+    },
+    {"stats", (PyCFunction) svs_core_Camera_stats, METH_NOARGS,
+        "stats() -> dict\n\n"
+        "Capture statistics since the camera was opened or reset_stats().\n\n"
+        "Returns:\n"
+        "    Dictionary of counters:\n"
+        "        images: Images received from the SDK\n"
+        "        delivered: Images returned by next()\n"
+        "        frame_loss, packets, packet_resend: Sums of the image\n"
+        "            metadata of the same names\n"
+        "        dropped: Dictionary of drops by reason, as the dropped\n"
+        "            attribute\n"
+        "    and latency histograms, each a dictionary of count, sum and\n"
+        "    max in seconds, buckets (counts) and bounds (upper bound of each\n"
+        "    bucket, in seconds, the last infinite):\n"
+        "        callback: Stream callback entry until the image is queued\n"
+        "        residency: Image queued until taken by next()\n"
+        "        gil_wait: Reacquiring the GIL after waiting or converting\n"
+        "        unpack: Converting images to the output format"
+    },
+    {"reset_stats", (PyCFunction) svs_core_Camera_reset_stats, METH_NOARGS,
+        "reset_stats()\n\n"
+        "Restart the counts and histograms returned by stats() from zero.\n"
+        "The dropped attribute and image metadata are not affected."
+    },
+    {"next_preview", (PyCFunction) svs_core_Camera_next_preview, METH_VARARGS | METH_KEYWORDS,
+        "next_preview(timeout=0) -> image, metadata\n\n"
+        "Gets next available preview image.\n\n"
+        "Preview images are decimated copies of the camera images, produced\n"
+        "independently of next() at up to preview_rate per second.  Only the\n"
+        "latest few previews are kept.  Metadata is as for next(), with the\n"
+        "preview's width and height.\n\n"
+        "Arguments:\n"
+        "    timeout (optional): Seconds to wait for an image.  Zero returns\n"
+        "        immediately, None waits forever.\n\n"
+        "Returns:\n"
+        "    (image, metadata) tuple.\n\n"
+        "Raises:\n"
+        "    SVSError: Camera was opened without preview_decimation.\n"
+        "    SVSNoImagesError: No previews became available before the timeout."
+    },
+    {"configure", (PyCFunction) svs_core_Camera_configure, METH_VARARGS | METH_KEYWORDS,
+        "configure(**settings)\n\n"
+        "Apply several settings at once.\n\n"
+        "Takes the settings returned by snapshot(), by name, in the units of\n"
+        "the attributes of the same names.  Every value is checked before\n"
+        "any is written, then the writes are made together without the GIL.\n"
+        "Auto exposure is switched off before, or on after, the other\n"
+        "settings.\n\n"
+        "Raises:\n"
+        "    TypeError, ValueError: A setting is unknown or invalid.  Nothing\n"
+        "        is written.\n"
+        "    SVSError: Some writes failed.  The second argument is a dict of\n"
+        "        error messages by setting name.  Others were applied."
+    },
+    {"snapshot", (PyCFunction) svs_core_Camera_snapshot, METH_VARARGS | METH_KEYWORDS,
+        "snapshot(refresh=False) -> dict\n\n"
+        "Read every setting at once.\n\n"
+        "Settings last written by configure() or the attributes, or read by\n"
+        "snapshot(), are served from a cache, without a camera round trip,\n"
+        "except exposure and gain while auto exposure is on.  The rest are\n"
+        "read together without the GIL.\n\n"
+        "Arguments:\n"
+        "    refresh (optional): Read every setting from the camera.\n\n"
+        "Returns:\n"
+        "    Dictionary of settings, suitable for configure(), and the\n"
+        "    camera info dict as 'info'.\n\n"
+        "Raises:\n"
+        "    SVSError: Some reads failed.  The second argument is a dict of\n"
+        "        error messages by setting name."
+    },
+    {"record", (PyCFunction) svs_core_Camera_record, METH_VARARGS | METH_KEYWORDS,
+        "record(path, queue_length=16, preallocate=0, compress=False)\n\n"
+        "Start recording images straight to disk.\n\n"
+        "While recording, images are written as raw camera data by a\n"
+        "background thread, instead of being queued for next().  Images are\n"
+        "written to path, with a record of metadata per image in path.idx.\n"
+        "Previews continue to be produced.  See svs.Recording to read the\n"
+        "files.\n\n"
+        "Arguments:\n"
+        "    path: Data file to create.\n"
+        "    queue_length (optional): Images held waiting to be written.  If\n"
+        "        the disk falls behind, further images are dropped.\n"
+        "    preallocate (optional): Bytes to reserve for the data file up\n"
+        "        front, trimmed when recording stops.\n"
+        "    compress (optional): Compress images losslessly before writing\n"
+        "        them, on the worker pool if it is running.  Images that do\n"
+        "        not shrink are written raw.\n\n"
+        "Raises:\n"
+        "    OSError: The files could not be created.\n"
+        "    RuntimeError: The camera is already recording."
+    },
+    {"stop_recording", (PyCFunction) svs_core_Camera_stop_recording, METH_NOARGS,
+        "stop_recording() -> dict\n\n"
+        "Stop recording, once every queued image is written.\n\n"
+        "Images are queued for next() again.  Does nothing if not recording.\n\n"
+        "Returns:\n"
+        "    Final progress, as recording().\n\n"
+        "Raises:\n"
+        "    OSError: The files could not be completed."
+    },
+    {"recording", (PyCFunction) svs_core_Camera_recording, METH_NOARGS,
+        "recording() -> dict\n\n"
+        "Progress of the current or last recording.\n\n"
+        "Returns:\n"
+        "    Dictionary of:\n"
+        "        active: Whether recording\n"
+        "        direct: Whether the data file uses O_DIRECT\n"
+        "        compress: Whether images are compressed\n"
+        "        written: Images written\n"
+        "        bytes: Raw image bytes written\n"
+        "        stored: Bytes the images take in the file, without\n"
+        "            padding; bytes/stored is the compression ratio\n"
+        "        dropped: Images dropped because the writer fell behind\n"
+        "        write_errors: Images lost to failed writes\n"
+        "        error: Message of the last write error, or None"
+    },
+    {"connection", (PyCFunction) svs_core_Camera_connection, METH_NOARGS,
+        "connection() -> dict\n\n"
+        "State and history of the connection to the camera.\n\n"
+        "When the camera stops answering heartbeats, the stream is closed\n"
+        "and the camera reopened in the background every reconnect_interval\n"
+        "seconds.  Once it answers, the settings last written or read are\n"
+        "restored, and images resume into the same queue, so next() only\n"
+        "waits.  Settings can't be read or written in the meantime.\n\n"
+        "Once it stops trying, because reconnect_interval is 0, waiting\n"
+        "threads take the images left, then next() and iteration raise\n"
+        "SVSClosedError, with the reason in its message.\n\n"
+        "Returns:\n"
+        "    Dictionary of:\n"
+        "        connected: Whether the camera is connected\n"
+        "        reconnecting: Whether trying to reconnect, which is only\n"
+        "            False while disconnected if reconnect_interval is 0\n"
+        "        disconnects: Connections lost since the camera was opened\n"
+        "        reconnects: Connections restored\n"
+        "        attempts: Failed attempts to reconnect, in this outage\n"
+        "        downtime: Seconds disconnected in all, including now\n"
+        "        last_downtime: Seconds of the current or last outage\n"
+        "        lost_time: Host time the connection was last lost, in\n"
+        "            seconds since the epoch, or None\n"
+        "        error: Why the last attempt failed, or settings that could\n"
+        "            not be restored, or None"
     },
     {NULL}
 };
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Image metadata
+ *
+ * FrameInfo holds a copy of the C frame_info record, and builds Python
+ * objects only when a field is accessed.  It supports both attribute and
+ * read-only mapping access, so code written for the metadata dict keeps
+ * working.  Freed objects are kept on a free list for reuse, so steady
+ * state capture doesn't allocate metadata at all.
+ */
+
+#include <Python.h>
+#include <datetime.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "svs_core.h"
+
+/* FrameInfo objects kept for reuse */
+#define FRAME_INFO_FREELIST 64
+
+enum frame_info_field {
+    FIELD_TIMESTAMP,
+    FIELD_WIDTH,
+    FIELD_HEIGHT,
+    FIELD_PIXEL_TYPE,
+    FIELD_IMAGE_COUNT,
+    FIELD_FRAME_LOSS,
+    FIELD_PACKET_COUNT,
+    FIELD_PACKET_RESEND,
+    FIELD_TRANSFER_TIME,
+    FIELD_TICKS,
+    FIELD_CLOCK_OFFSET,
+    FIELD_CLOCK_DRIFT,
+    FIELD_DROPPED,
+    FIELD_COMPRESSED_LENGTH,
+    FIELD_COMPRESSION_RATIO,
+    FIELDS,
+};
+
+static const char *field_names[FIELDS] = {
+    [FIELD_TIMESTAMP] = "timestamp",
+    [FIELD_WIDTH] = "width",
+    [FIELD_HEIGHT] = "height",
+    [FIELD_PIXEL_TYPE] = "pixel_type",
+    [FIELD_IMAGE_COUNT] = "image_count",
+    [FIELD_FRAME_LOSS] = "frame_loss",
+    [FIELD_PACKET_COUNT] = "packet_count",
+    [FIELD_PACKET_RESEND] = "packet_resend",
+    [FIELD_TRANSFER_TIME] = "transfer_time",
+    [FIELD_TICKS] = "ticks",
+    [FIELD_CLOCK_OFFSET] = "clock_offset",
+    [FIELD_CLOCK_DRIFT] = "clock_drift",
+    [FIELD_DROPPED] = "dropped",
+    [FIELD_COMPRESSED_LENGTH] = "compressed_length",
+    [FIELD_COMPRESSION_RATIO] = "compression_ratio",
+};
+
+static svs_core_FrameInfo *freelist[FRAME_INFO_FREELIST];
+static int freelist_count;
+
+void import_datetime(void) {
+    PyDateTime_IMPORT;
+}
+
+/*
+ * Create a DateTime object of the time when the image was captured.
+ *
+ * @param info      Image metadata
+ * @returns DateTime object, or NULL on error
+ */
+static PyObject *image_timestamp(struct frame_info *info) {
+    struct tm timestamp;
+
+    gmtime_r(&info->time.tv_sec, &timestamp);
+
+    return PyDateTime_FromDateAndTime(timestamp.tm_year + 1900,
+            timestamp.tm_mon + 1, timestamp.tm_mday, timestamp.tm_hour,
+            timestamp.tm_min, timestamp.tm_sec, info->time.tv_usec);
+}
+
+/*
+ * Raw image size over compressed size, 1 for uncompressed images
+ */
+static double compression_ratio(struct frame_info *info) {
+    size_t bits = (info->pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16;
+
+    if (!info->compressed) {
+        return 1;
+    }
+
+    return (double) info->width*info->height*bits/8/info->compressed;
+}
+
+/*
+ * Build the Python object for one field
+ *
+ * @returns new reference, or NULL on error
+ */
+static PyObject *frame_info_field(svs_core_FrameInfo *self, int field) {
+    struct frame_info *info = &self->info;
+
+    switch (field) {
+    case FIELD_TIMESTAMP:
+        return image_timestamp(info);
+    case FIELD_WIDTH:
+        return PyLong_FromUnsignedLong(info->width);
+    case FIELD_HEIGHT:
+        return PyLong_FromUnsignedLong(info->height);
+    case FIELD_PIXEL_TYPE:
+        return PyLong_FromUnsignedLong(info->pixel_type);
+    case FIELD_IMAGE_COUNT:
+        return PyLong_FromUnsignedLong(info->image_count);
+    case FIELD_FRAME_LOSS:
+        return PyLong_FromUnsignedLong(info->frame_loss);
+    case FIELD_PACKET_COUNT:
+        return PyLong_FromUnsignedLong(info->packet_count);
+    case FIELD_PACKET_RESEND:
+        return PyLong_FromUnsignedLong(info->packet_resend);
+    case FIELD_TRANSFER_TIME:
+        return PyLong_FromUnsignedLong(info->transfer_time);
+    case FIELD_TICKS:
+        return PyLong_FromUnsignedLongLong(info->timestamp);
+    case FIELD_CLOCK_OFFSET:
+        return PyFloat_FromDouble(info->clock_offset);
+    case FIELD_CLOCK_DRIFT:
+        return PyFloat_FromDouble(info->clock_drift);
+    case FIELD_DROPPED:
+        return PyLong_FromUnsignedLong(info->dropped);
+    case FIELD_COMPRESSED_LENGTH:
+        return PyLong_FromUnsignedLong(info->compressed);
+    case FIELD_COMPRESSION_RATIO:
+        return PyFloat_FromDouble(compression_ratio(info));
+    }
+
+    PyErr_SetString(PyExc_SystemError, "Unknown FrameInfo field");
+    return NULL;
+}
+
+/*
+ * Look up a field by key
+ *
+ * @returns field, or negative if key is not a field name
+ */
+static int frame_info_lookup(PyObject *key) {
+    PyObject *bytes = NULL;
+    const char *name;
+    int field = -1;
+
+#if PY_MAJOR_VERSION >= 3
+    if (!PyUnicode_Check(key)) {
+        return -1;
+    }
+
+    bytes = PyUnicode_AsUTF8String(key);
+    if (!bytes) {
+        PyErr_Clear();
+        return -1;
+    }
+    name = PyBytes_AsString(bytes);
+#else
+    if (!PyString_Check(key)) {
+        return -1;
+    }
+    name = PyString_AsString(key);
+#endif
+
+    for (int i = 0; i < FIELDS; i++) {
+        if (!strcmp(name, field_names[i])) {
+            field = i;
+            break;
+        }
+    }
+
+    Py_XDECREF(bytes);
+
+    return field;
+}
+
+PyObject *frame_info_new(struct frame_info *info) {
+    svs_core_FrameInfo *self;
+
+    if (freelist_count) {
+        self = freelist[--freelist_count];
+        (void) PyObject_INIT(self, &svs_core_FrameInfoType);
+    }
+    else {
+        self = PyObject_New(svs_core_FrameInfo, &svs_core_FrameInfoType);
+        if (!self) {
+            return NULL;
+        }
+    }
+
+    self->info = *info;
+
+    return (PyObject *) self;
+}
+
+static void svs_core_FrameInfo_dealloc(svs_core_FrameInfo *self) {
+    if (freelist_count < FRAME_INFO_FREELIST) {
+        freelist[freelist_count++] = self;
+        return;
+    }
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *svs_core_FrameInfo_getfield(svs_core_FrameInfo *self, void *closure) {
+    return frame_info_field(self, (int) (intptr_t) closure);
+}
+
+static Py_ssize_t svs_core_FrameInfo_length(svs_core_FrameInfo *self) {
+    return FIELDS;
+}
+
+static PyObject *svs_core_FrameInfo_subscript(svs_core_FrameInfo *self, PyObject *key) {
+    int field = frame_info_lookup(key);
+
+    if (field < 0) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+
+    return frame_info_field(self, field);
+}
+
+static int svs_core_FrameInfo_contains(svs_core_FrameInfo *self, PyObject *key) {
+    return frame_info_lookup(key) >= 0;
+}
+
+static PyObject *svs_core_FrameInfo_keys(svs_core_FrameInfo *self, PyObject *args) {
+    PyObject *keys = PyList_New(FIELDS);
+
+    if (!keys) {
+        return NULL;
+    }
+
+    for (int i = 0; i < FIELDS; i++) {
+#if PY_MAJOR_VERSION >= 3
+        PyObject *key = PyUnicode_FromString(field_names[i]);
+#else
+        PyObject *key = PyString_FromString(field_names[i]);
+#endif
+        if (!key) {
+            Py_DECREF(keys);
+            return NULL;
+        }
+        PyList_SET_ITEM(keys, i, key);
+    }
+
+    return keys;
+}
+
+static PyObject *svs_core_FrameInfo_to_dict(svs_core_FrameInfo *self, PyObject *args) {
+    PyObject *dict, *value;
+
+    dict = PyDict_New();
+    if (!dict) {
+        return NULL;
+    }
+
+    for (int i = 0; i < FIELDS; i++) {
+        value = frame_info_field(self, i);
+        if (!value || PyDict_SetItemString(dict, field_names[i], value)) {
+            Py_XDECREF(value);
+            Py_DECREF(dict);
+            return NULL;
+        }
+        Py_DECREF(value);
+    }
+
+    return dict;
+}
+
+static PyObject *svs_core_FrameInfo_get(svs_core_FrameInfo *self, PyObject *args) {
+    PyObject *key, *def = Py_None;
+    int field;
+
+    if (!PyArg_ParseTuple(args, "O|O", &key, &def)) {
+        return NULL;
+    }
+
+    field = frame_info_lookup(key);
+    if (field < 0) {
+        Py_INCREF(def);
+        return def;
+    }
+
+    return frame_info_field(self, field);
+}
+
+static PyObject *svs_core_FrameInfo_iter(svs_core_FrameInfo *self) {
+    PyObject *keys, *iter;
+
+    keys = svs_core_FrameInfo_keys(self, NULL);
+    if (!keys) {
+        return NULL;
+    }
+
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+
+    return iter;
+}
+
+static PyObject *svs_core_FrameInfo_repr(svs_core_FrameInfo *self) {
+    PyObject *dict, *repr, *ret;
+
+    dict = svs_core_FrameInfo_to_dict(self, NULL);
+    if (!dict) {
+        return NULL;
+    }
+
+    repr = PyObject_Repr(dict);
+    Py_DECREF(dict);
+    if (!repr) {
+        return NULL;
+    }
+
+#if PY_MAJOR_VERSION >= 3
+    ret = PyUnicode_FromFormat("FrameInfo(%U)", repr);
+#else
+    ret = PyString_FromFormat("FrameInfo(%s)", PyString_AsString(repr));
+#endif
+    Py_DECREF(repr);
+
+    return ret;
+}
+
+static PyMappingMethods svs_core_FrameInfo_mapping = {
+    (lenfunc) svs_core_FrameInfo_length,            /* mp_length */
+    (binaryfunc) svs_core_FrameInfo_subscript,      /* mp_subscript */
+    0,                                              /* mp_ass_subscript */
+};
+
+static PySequenceMethods svs_core_FrameInfo_sequence = {
+    .sq_contains = (objobjproc) svs_core_FrameInfo_contains,
+};
+
+static PyMethodDef svs_core_FrameInfo_methods[] = {
+    {"keys", (PyCFunction) svs_core_FrameInfo_keys, METH_NOARGS,
+        "keys() -> list of metadata field names"},
+    {"get", (PyCFunction) svs_core_FrameInfo_get, METH_VARARGS,
+        "get(key, default=None) -> value of field key, or default"},
+    {"to_dict", (PyCFunction) svs_core_FrameInfo_to_dict, METH_NOARGS,
+        "to_dict() -> dict of all metadata fields"},
+    {NULL}
+};
+
+static PyGetSetDef svs_core_FrameInfo_getseters[] = {
+    {"timestamp", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Host time of capture (UTC datetime)", (void *) (intptr_t) FIELD_TIMESTAMP},
+    {"width", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Image width", (void *) (intptr_t) FIELD_WIDTH},
+    {"height", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Image height", (void *) (intptr_t) FIELD_HEIGHT},
+    {"pixel_type", (getter) svs_core_FrameInfo_getfield, NULL,
+        "GVSP pixel type of the raw image", (void *) (intptr_t) FIELD_PIXEL_TYPE},
+    {"image_count", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Image number from the camera", (void *) (intptr_t) FIELD_IMAGE_COUNT},
+    {"frame_loss", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Frames lost, as reported by the SDK", (void *) (intptr_t) FIELD_FRAME_LOSS},
+    {"packet_count", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Packets making up the image", (void *) (intptr_t) FIELD_PACKET_COUNT},
+    {"packet_resend", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Packets resent for the image", (void *) (intptr_t) FIELD_PACKET_RESEND},
+    {"transfer_time", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Image transfer time, as reported by the SDK", (void *) (intptr_t) FIELD_TRANSFER_TIME},
+    {"ticks", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Camera timestamp counter", (void *) (intptr_t) FIELD_TICKS},
+    {"clock_offset", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Host minus camera clock at capture (s)", (void *) (intptr_t) FIELD_CLOCK_OFFSET},
+    {"clock_drift", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Camera clock drift estimate (s/s)", (void *) (intptr_t) FIELD_CLOCK_DRIFT},
+    {"dropped", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Images dropped before this one was queued", (void *) (intptr_t) FIELD_DROPPED},
+    {"compressed_length", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Bytes of the image as compressed, 0 if it was not", (void *) (intptr_t) FIELD_COMPRESSED_LENGTH},
+    {"compression_ratio", (getter) svs_core_FrameInfo_getfield, NULL,
+        "Raw image size over compressed size, 1.0 if not compressed", (void *) (intptr_t) FIELD_COMPRESSION_RATIO},
+    {NULL}
+};
+
+PyTypeObject svs_core_FrameInfoType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "svs_core.FrameInfo",           /* tp_name */
+    sizeof(svs_core_FrameInfo),     /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) svs_core_FrameInfo_dealloc,     /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    (reprfunc) svs_core_FrameInfo_repr,          /* tp_repr */
+    0,                         /* tp_as_number */
+    &svs_core_FrameInfo_sequence,   /* tp_as_sequence */
+    &svs_core_FrameInfo_mapping,    /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */
+    "Image metadata\n\n"
+    "Returned with each image by next().  Fields are available both as\n"
+    "attributes and by key, as for a dict.  Use to_dict() for a plain dict.", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    (getiterfunc) svs_core_FrameInfo_iter,       /* tp_iter */
+    0,                         /* tp_iternext */
+    svs_core_FrameInfo_methods,     /* tp_methods */
+    0,                         /* tp_members */
+    svs_core_FrameInfo_getseters,   /* tp_getset */
+};
@@ -0,0 +1,804 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Shared-memory frame bus
+ *
+ * The stream callback converts each image into the next slot of a ring
+ * in a named POSIX shared-memory object.  Subscribers in other processes
+ * map the same object and wrap slots in arrays without copying.  Slots
+ * are published with a seqlock, so the publisher never waits for a
+ * subscriber: a subscriber which falls a whole ring behind skips ahead
+ * to the newest image on its own, and counts the images it missed.
+ * Waiting subscribers sleep on a futex in the header.
+ *
+ * A compressed bus carries raw images from codec_encode() instead, for
+ * subscribers to decompress and convert, which cuts the bandwidth and
+ * the slot memory to a fraction where images compress well.
+ */
+
+#define PY_ARRAY_UNIQUE_SYMBOL  svs_core_ARRAY_API
+#define NO_IMPORT_ARRAY
+
+#include <Python.h>
+#include <numpy/arrayobject.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+static const char bus_magic[8] = "SVSBUS";
+
+/* Subscriber class */
+typedef struct {
+    PyObject_HEAD;
+    PyObject            *name;
+    void                *map;
+    size_t              map_size;
+    struct bus_header   *header;
+    struct bus_slot     *slots;
+    uint8_t             *data;
+    uint64_t            next;       /* Number of the next image wanted */
+    uint64_t            received;
+    uint64_t            dropped;    /* Images overwritten before taken */
+    int                 last_slot;  /* Slot of the last image, or -1 */
+    uint32_t            last_seq;   /* Its seq when taken */
+    void                *raw;       /* Decompressed image, or NULL */
+    size_t              raw_size;   /* Bytes allocated in raw */
+} svs_core_Subscriber;
+
+static size_t bus_round(size_t size) {
+    return (size + BUS_ALIGN - 1) & ~((size_t) BUS_ALIGN - 1);
+}
+
+static int futex(uint32_t *addr, int op, uint32_t val,
+                 const struct timespec *timeout) {
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+/*
+ * Copy a name, adding the leading slash shm_open() requires
+ */
+static char *bus_name(const char *name) {
+    char *path = malloc(strlen(name) + 2);
+
+    if (!path) {
+        return NULL;
+    }
+
+    path[0] = '/';
+    strcpy(path + (name[0] != '/'), name);
+
+    return path;
+}
+
+struct frame_bus *bus_create(const char *name, unsigned int slots,
+                             size_t slot_size, int codec) {
+    struct bus_header *header;
+    struct frame_bus *bus;
+    size_t data_offset;
+
+    bus = calloc(1, sizeof(*bus));
+    if (!bus) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    bus->codec = codec;
+    bus->name = bus_name(name);
+    if (!bus->name) {
+        PyErr_NoMemory();
+        goto err_bus;
+    }
+
+    slot_size = bus_round(slot_size);
+    data_offset = bus_round(sizeof(*header) + slots*sizeof(struct bus_slot));
+    bus->map_size = data_offset + slots*slot_size;
+
+    /* Never take over a name another publisher may be using */
+    bus->fd = shm_open(bus->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (bus->fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, bus->name);
+        goto err_name;
+    }
+
+    if (ftruncate(bus->fd, bus->map_size)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, bus->name);
+        goto err_unlink;
+    }
+
+    bus->map = mmap(NULL, bus->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    bus->fd, 0);
+    if (bus->map == MAP_FAILED) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, bus->name);
+        goto err_unlink;
+    }
+
+    /* The object starts zeroed, so only the geometry needs writing */
+    header = bus->map;
+    header->version = BUS_VERSION;
+    header->slots = slots;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+    header->header_size = sizeof(*header);
+
+    bus->header = header;
+    bus->slots = (struct bus_slot *) (header + 1);
+    bus->data = (uint8_t *) bus->map + data_offset;
+
+    /* Subscribers check the magic before anything else */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, bus_magic, sizeof(header->magic));
+
+    return bus;
+
+err_unlink:
+    shm_unlink(bus->name);
+    close(bus->fd);
+err_name:
+    free(bus->name);
+err_bus:
+    free(bus);
+    return NULL;
+}
+
+void bus_destroy(struct frame_bus *bus) {
+    __atomic_store_n(&bus->header->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&bus->header->futex, 1, __ATOMIC_SEQ_CST);
+    futex(&bus->header->futex, FUTEX_WAKE, INT_MAX, NULL);
+
+    /* Subscribers keep their mappings until they are done */
+    shm_unlink(bus->name);
+    munmap(bus->map, bus->map_size);
+    close(bus->fd);
+
+    free(bus->name);
+    free(bus);
+}
+
+void *bus_write_begin(struct frame_bus *bus, size_t length) {
+    struct bus_header *header = bus->header;
+    uint64_t number;
+    unsigned int index;
+
+    if (length > header->slot_size) {
+        return NULL;
+    }
+
+    number = header->published + 1;
+    index = (number - 1) % header->slots;
+
+    /* Paired with the seq checks in subscriber_take() */
+    __atomic_add_fetch(&bus->slots[index].seq, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&bus->slots[index].number, number, __ATOMIC_RELAXED);
+
+    return bus->data + index*header->slot_size;
+}
+
+void bus_write_end(struct frame_bus *bus, size_t length, int format,
+                   int shift, struct frame_info *info) {
+    struct bus_header *header = bus->header;
+    uint64_t number = header->published + 1;
+    struct bus_slot *slot = &bus->slots[(number - 1) % header->slots];
+
+    slot->length = length;
+    slot->format = format;
+    slot->codec = bus->codec;
+    slot->shift = shift;
+    slot->info = *info;
+
+    __atomic_add_fetch(&slot->seq, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->published, number, __ATOMIC_RELEASE);
+
+    /*
+     * A subscriber announces itself in waiters before sleeping on the
+     * futex value it read, so either it sees the new value, or we see it
+     * waiting.
+     */
+    __atomic_add_fetch(&header->futex, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST)) {
+        futex(&header->futex, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+void bus_write_abort(struct frame_bus *bus) {
+    struct bus_header *header = bus->header;
+    uint64_t number = header->published + 1;
+    struct bus_slot *slot = &bus->slots[(number - 1) % header->slots];
+
+    /* The old image is gone, and the new one never happened */
+    __atomic_store_n(&slot->number, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&slot->seq, 1, __ATOMIC_RELEASE);
+}
+
+PyObject *bus_progress(struct frame_bus *bus) {
+    return Py_BuildValue("{sssOsKsKsKsIsK}",
+            "name", bus->name,
+            "compress", bus->codec != CODEC_NONE ? Py_True : Py_False,
+            "published", (unsigned long long)
+                __atomic_load_n(&bus->header->published, __ATOMIC_RELAXED),
+            "too_large", (unsigned long long)
+                __atomic_load_n(&bus->too_large, __ATOMIC_RELAXED),
+            "errors", (unsigned long long)
+                __atomic_load_n(&bus->errors, __ATOMIC_RELAXED),
+            "slots", bus->header->slots,
+            "slot_size", (unsigned long long) bus->header->slot_size);
+}
+
+/* Subscriber */
+
+static void svs_core_Subscriber_dealloc(svs_core_Subscriber *self) {
+    if (self->map) {
+        munmap(self->map, self->map_size);
+    }
+
+    Py_XDECREF(self->name);
+    free(self->raw);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int svs_core_Subscriber_init(svs_core_Subscriber *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"name", NULL};
+    struct bus_header *header;
+    struct stat st;
+    char *name, *path;
+    int fd;
+
+    if (self->map) {
+        PyErr_SetString(PyExc_RuntimeError, "Subscriber already initialized");
+        return -1;
+    }
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &name)) {
+        return -1;
+    }
+
+    path = bus_name(name);
+    if (!path) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    /* Read-write, as waiting subscribers count themselves in the header */
+    fd = shm_open(path, O_RDWR, 0);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        free(path);
+        return -1;
+    }
+
+    if (fstat(fd, &st)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto err;
+    }
+
+    if ((size_t) st.st_size < sizeof(*header)) {
+        PyErr_Format(SVSError, "%s is not a frame bus", path);
+        goto err;
+    }
+
+    self->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    if (self->map == MAP_FAILED) {
+        self->map = NULL;
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto err;
+    }
+    self->map_size = st.st_size;
+
+    /* The mapping stays valid once the descriptor is closed */
+    close(fd);
+    fd = -1;
+
+    header = self->map;
+    if (memcmp(header->magic, bus_magic, sizeof(header->magic))) {
+        PyErr_Format(SVSError, "%s is not a frame bus", path);
+        goto err;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (header->version != BUS_VERSION ||
+            header->header_size != sizeof(*header) || !header->slots ||
+            header->data_offset + header->slots*header->slot_size > self->map_size) {
+        PyErr_Format(SVSError, "%s has an unsupported frame bus layout", path);
+        goto err;
+    }
+
+    self->header = header;
+    self->slots = (struct bus_slot *) (header + 1);
+    self->data = (uint8_t *) self->map + header->data_offset;
+
+    /* Start with the next image published */
+    self->next = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE) + 1;
+    self->last_slot = -1;
+
+#if PY_MAJOR_VERSION >= 3
+    self->name = PyUnicode_FromString(path);
+#else
+    self->name = PyString_FromString(path);
+#endif
+    free(path);
+
+    return self->name ? 0 : -1;
+
+err:
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (self->map) {
+        munmap(self->map, self->map_size);
+        self->map = NULL;
+    }
+    free(path);
+    return -1;
+}
+
+/*
+ * Wait for an image to be published after number, or the bus to close
+ *
+ * @param timeout   Milliseconds to wait, or negative to wait forever
+ * @returns 0 if an image may be available, 1 on timeout
+ */
+static int subscriber_wait(struct bus_header *header, uint64_t number,
+                           int timeout) {
+    struct timespec now, deadline, remaining, *wait = NULL;
+    uint32_t value;
+    int ret = 0;
+
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout/1000;
+        deadline.tv_nsec += (timeout % 1000)*1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        wait = &remaining;
+    }
+
+    __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+    for (;;) {
+        value = __atomic_load_n(&header->futex, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&header->published, __ATOMIC_SEQ_CST) > number ||
+                __atomic_load_n(&header->closed, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+
+        if (wait) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0) {
+                ret = 1;
+                break;
+            }
+        }
+
+        /* Shared between processes, so not FUTEX_WAIT_PRIVATE */
+        if (futex(&header->futex, FUTEX_WAIT, value, wait) &&
+                errno == ETIMEDOUT) {
+            ret = 1;
+            break;
+        }
+    }
+
+    __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return ret;
+}
+
+/*
+ * Decompress an image from a slot, and convert it to its output format
+ *
+ * The slot may be overwritten meanwhile, so the caller must check its
+ * seq afterwards.  Releases the GIL while decoding.
+ *
+ * @param info      Image metadata, as read before the data
+ * @param numpy_type, nd, dims  Of the image, from image_shape()
+ * @param array     Set to the converted image on success
+ * @returns 0 on success, 1 if the data is invalid, negative on error with
+ *          exception set
+ */
+static int subscriber_decode(svs_core_Subscriber *self, const void *data,
+                             uint64_t length, struct frame_info *info,
+                             int format, int shift, int numpy_type, int nd,
+                             npy_intp *dims, PyObject **array) {
+    size_t bits = (info->pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16;
+    size_t raw_length = (size_t) info->width*info->height*bits/8;
+    size_t raw_size = self->raw_size;
+    void *raw;
+    int ret;
+
+    /* The image must be the one the metadata describes */
+    if (codec_raw_length(data, length) != raw_length) {
+        return 1;
+    }
+
+    *array = PyArray_SimpleNew(nd, dims, numpy_type);
+    if (!*array) {
+        return -1;
+    }
+
+    /* Taken while the GIL is released, so other threads use their own */
+    raw = self->raw;
+    self->raw = NULL;
+
+    if (raw_size < raw_length) {
+        free(raw);
+        raw_size = raw_length;
+        raw = malloc(raw_size);
+        if (!raw) {
+            Py_CLEAR(*array);
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = codec_decode(data, length, raw, raw_size) ||
+          convert_frame(raw, info->pixel_type, info->width, info->height,
+                        format, shift, PyArray_DATA((PyArrayObject *) *array));
+    Py_END_ALLOW_THREADS
+
+    if (!self->raw) {
+        self->raw = raw;
+        self->raw_size = raw_size;
+    }
+    else {
+        free(raw);
+    }
+
+    if (ret) {
+        Py_CLEAR(*array);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Take the next image from the ring
+ *
+ * Skips ahead to the newest image if the wanted one was overwritten.
+ * Compressed images are always decoded into a new array.
+ *
+ * @param copy      Copy the image instead of wrapping the slot
+ * @returns (image, metadata) tuple, Py_None if no image is published
+ *          yet, or NULL on error with exception set
+ */
+static PyObject *subscriber_take(svs_core_Subscriber *self, int copy) {
+    struct bus_header *header = self->header;
+    struct frame_info info;
+    struct bus_slot *slot;
+    PyObject *array, *metadata;
+    npy_intp dims[3];
+    uint64_t published, length;
+    uint32_t seq, codec;
+    unsigned int index;
+    int numpy_type, nd, format, shift, ret;
+    void *data;
+
+    for (;;) {
+        published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+        if (published < self->next) {
+            Py_INCREF(Py_None);
+            return Py_None;
+        }
+
+        /* Lapped, this subscriber alone misses the overwritten images */
+        if (published - self->next >= header->slots) {
+            self->dropped += published - self->next;
+            self->next = published;
+        }
+
+        index = (self->next - 1) % header->slots;
+        slot = &self->slots[index];
+
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1 ||
+                __atomic_load_n(&slot->number, __ATOMIC_RELAXED) != self->next) {
+            /* Being overwritten, so newer images exist */
+            self->dropped++;
+            self->next++;
+            continue;
+        }
+
+        length = slot->length;
+        format = slot->format;
+        codec = slot->codec;
+        shift = slot->shift;
+        info = slot->info;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+
+        data = self->data + index*header->slot_size;
+
+        numpy_type = image_shape(&info, format, &nd, dims);
+        if (numpy_type < 0) {
+            self->next++;
+            return NULL;
+        }
+
+        if (codec != CODEC_NONE) {
+            array = NULL;
+            ret = codec == CODEC_RICE && length <= header->slot_size ?
+                  subscriber_decode(self, data, length, &info, format, shift,
+                                    numpy_type, nd, dims, &array) : 1;
+            if (ret < 0) {
+                self->next++;
+                return NULL;
+            }
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+                /* Overwritten while decoding */
+                Py_XDECREF(array);
+                self->dropped++;
+                self->next++;
+                continue;
+            }
+
+            if (ret) {
+                self->next++;
+                PyErr_SetString(SVSError, "Invalid compressed image on bus");
+                return NULL;
+            }
+        }
+        else if (copy) {
+            array = PyArray_SimpleNew(nd, dims, numpy_type);
+            if (!array) {
+                return NULL;
+            }
+
+            memcpy(PyArray_DATA((PyArrayObject *) array), data, length);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+                /* Torn while copying, the next image is newer anyway */
+                Py_DECREF(array);
+                self->dropped++;
+                self->next++;
+                continue;
+            }
+        }
+        else {
+            array = PyArray_SimpleNewFromData(nd, dims, numpy_type, data);
+            if (!array) {
+                return NULL;
+            }
+
+            /* Subscribers only read, the publisher owns the slot */
+            PyArray_CLEARFLAGS((PyArrayObject *) array, NPY_ARRAY_WRITEABLE);
+
+            /* The mapping must outlive the array */
+            Py_INCREF(self);
+            if (PyArray_SetBaseObject((PyArrayObject *) array, (PyObject *) self)) {
+                Py_DECREF(array);
+                return NULL;
+            }
+        }
+
+        self->last_slot = index;
+        self->last_seq = seq;
+        self->next++;
+        self->received++;
+
+        info.dropped = self->dropped;
+        metadata = frame_info_new(&info);
+        if (!metadata) {
+            Py_DECREF(array);
+            return NULL;
+        }
+
+        return Py_BuildValue("(NN)", array, metadata);
+    }
+}
+
+static PyObject *svs_core_Subscriber_next(svs_core_Subscriber *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", "copy", NULL};
+    PyObject *timeout_obj = NULL, *ret;
+    int timeout, copy = 0, timed_out;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi", kwlist, &timeout_obj,
+                                     &copy)) {
+        return NULL;
+    }
+
+    if (parse_timeout(timeout_obj, &timeout)) {
+        return NULL;
+    }
+
+    for (;;) {
+        ret = subscriber_take(self, copy);
+        if (ret != Py_None) {
+            return ret;
+        }
+        Py_DECREF(ret);
+
+        if (__atomic_load_n(&self->header->closed, __ATOMIC_SEQ_CST)) {
+            PyErr_SetString(SVSNoImagesError, "Publisher has stopped");
+            return NULL;
+        }
+
+        if (!timeout) {
+            break;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        timed_out = subscriber_wait(self->header, self->next - 1, timeout);
+        Py_END_ALLOW_THREADS
+
+        if (timed_out) {
+            break;
+        }
+    }
+
+    PyErr_SetString(SVSNoImagesError, "No images available");
+    return NULL;
+}
+
+static PyObject *svs_core_Subscriber_intact(svs_core_Subscriber *self, PyObject *args) {
+    if (self->last_slot < 0) {
+        Py_RETURN_FALSE;
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return PyBool_FromLong(__atomic_load_n(&self->slots[self->last_slot].seq,
+                                           __ATOMIC_RELAXED) == self->last_seq);
+}
+
+static PyMethodDef svs_core_Subscriber_methods[] = {
+    {"next", (PyCFunction) svs_core_Subscriber_next, METH_VARARGS | METH_KEYWORDS,
+        "next(timeout=0, copy=False) -> (image, metadata)\n\n"
+        "Get the next image published.\n\n"
+        "By default, the image is a read-only view of the bus slot, valid\n"
+        "until the publisher wraps around the ring to it.  Call intact()\n"
+        "after using the view to check it was not overwritten meanwhile,\n"
+        "or pass copy=True for an image that is always consistent.  Images\n"
+        "from a compressed bus are always decoded into a new array, and\n"
+        "metadata.compression_ratio gives how well each compressed.\n\n"
+        "If this subscriber has fallen a whole ring behind, it skips to the\n"
+        "newest image; metadata.dropped counts the images it missed.\n\n"
+        "Arguments:\n"
+        "    timeout (optional): Seconds to wait for an image.  Zero returns\n"
+        "        immediately, None waits forever.  The GIL is released while\n"
+        "        waiting.\n"
+        "    copy (optional): Copy the image out of the bus.\n\n"
+        "Raises:\n"
+        "    SVSNoImagesError: No image arrived in time, or the publisher\n"
+        "        has stopped."
+    },
+    {"intact", (PyCFunction) svs_core_Subscriber_intact, METH_NOARGS,
+        "intact() -> bool\n\n"
+        "Whether the slot viewed by the last image from next() has not been\n"
+        "overwritten since."
+    },
+    {NULL}
+};
+
+static PyObject *svs_core_Subscriber_getname(svs_core_Subscriber *self, void *closure) {
+    Py_INCREF(self->name);
+    return self->name;
+}
+
+static PyObject *svs_core_Subscriber_getreceived(svs_core_Subscriber *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->received);
+}
+
+static PyObject *svs_core_Subscriber_getdropped(svs_core_Subscriber *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(self->dropped);
+}
+
+static PyObject *svs_core_Subscriber_getpublished(svs_core_Subscriber *self, void *closure) {
+    return PyLong_FromUnsignedLongLong(
+            __atomic_load_n(&self->header->published, __ATOMIC_RELAXED));
+}
+
+static PyObject *svs_core_Subscriber_getslots(svs_core_Subscriber *self, void *closure) {
+    return PyLong_FromUnsignedLong(self->header->slots);
+}
+
+static PyGetSetDef svs_core_Subscriber_getseters[] = {
+    {"name", (getter) svs_core_Subscriber_getname, NULL, "Bus name", NULL},
+    {"received", (getter) svs_core_Subscriber_getreceived, NULL,
+        "Images taken by this subscriber", NULL},
+    {"dropped", (getter) svs_core_Subscriber_getdropped, NULL,
+        "Images this subscriber missed by falling behind", NULL},
+    {"published", (getter) svs_core_Subscriber_getpublished, NULL,
+        "Images published on the bus so far", NULL},
+    {"slots", (getter) svs_core_Subscriber_getslots, NULL,
+        "Images held in the bus ring", NULL},
+    {NULL}
+};
+
+PyTypeObject svs_core_SubscriberType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "svs_core.Subscriber",          /* tp_name */
+    sizeof(svs_core_Subscriber),    /* tp_basicsize */
+    0,                         /* tp_itemsize */
+    (destructor) svs_core_Subscriber_dealloc,   /* tp_dealloc */
+    0,                         /* tp_print */
+    0,                         /* tp_getattr */
+    0,                         /* tp_setattr */
+    0,                         /* tp_reserved */
+    0,                         /* tp_repr */
+    0,                         /* tp_as_number */
+    0,                         /* tp_as_sequence */
+    0,                         /* tp_as_mapping */
+    0,                         /* tp_hash  */
+    0,                         /* tp_call */
+    0,                         /* tp_str */
+    0,                         /* tp_getattro */
+    0,                         /* tp_setattro */
+    0,                         /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,   /* tp_flags */
+    "Subscriber(name) -> Subscriber object\n\n"
+    "Receive images published by Camera.publish() in another process.\n"
+    "Only images published after the subscriber is created are received.\n"
+    "Each subscriber falls behind on its own, without slowing the\n"
+    "publisher or other subscribers.\n\n"
+    "Arguments:\n"
+    "   name: Bus name passed to Camera.publish().\n",   /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    svs_core_Subscriber_methods,    /* tp_methods */
+    0,                         /* tp_members */
+    svs_core_Subscriber_getseters,  /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc) svs_core_Subscriber_init,    /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
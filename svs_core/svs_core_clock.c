@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+/* Counter reads per sample; the one with the shortest round trip is kept */
+#define CLOCK_BURST         4
+
+/* Samples with round trip this much over the minimum are ignored (s) */
+#define CLOCK_DELAY_SLACK   100e-6
+
+/* Minimum span of samples before estimating drift (s) */
+#define CLOCK_DRIFT_SPAN    1.0
+
+/* Largest believable drift, beyond this the estimate is discarded */
+#define CLOCK_DRIFT_MAX     500e-6
+
+static double host_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return now.tv_sec + 1e-9*now.tv_nsec;
+}
+
+/*
+ * Measure the camera clock against the host clock
+ *
+ * Reads the camera timestamp counter several times, and keeps the read
+ * with the shortest round trip, as its midpoint best matches the time
+ * the counter was latched.
+ *
+ * @returns 0 on success, negative if the counter could not be read
+ */
+static int clock_measure(struct clock_sync *clock, struct clock_sample *sample) {
+    int found = 0;
+
+    for (int i = 0; i < CLOCK_BURST; i++) {
+        double before, after, delay;
+        uint64_t ticks;
+
+        before = host_time();
+        if (Camera_getTimestampCounter(clock->handle, &ticks) != SVGigE_SUCCESS) {
+            continue;
+        }
+        after = host_time();
+
+        delay = after - before;
+        if (!found || delay < sample->delay) {
+            sample->ticks = ticks;
+            sample->offset = (before + after)/2 - ticks*clock->tick_period;
+            sample->delay = delay;
+            found = 1;
+        }
+    }
+
+    return found ? 0 : -1;
+}
+
+/*
+ * Update the clock model from the sample history
+ *
+ * Discards samples delayed well beyond the best, then fits a line to
+ * offset versus camera time.  The slope is the drift of the camera clock
+ * and the intercept the offset at the newest sample.
+ */
+static void clock_update(struct clock_sync *clock) {
+    struct clock_sample *newest;
+    double min_delay = INFINITY, best_offset = 0, best_x = 0;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, min_x = 0;
+    double offset, drift = clock->drift;
+    unsigned int n = 0;
+
+    newest = &clock->samples[(clock->samples_next + CLOCK_SAMPLES - 1) % CLOCK_SAMPLES];
+
+    for (unsigned int i = 0; i < clock->samples_count; i++) {
+        if (clock->samples[i].delay < min_delay) {
+            min_delay = clock->samples[i].delay;
+            best_offset = clock->samples[i].offset;
+            best_x = ((int64_t) (clock->samples[i].ticks -
+                        newest->ticks))*clock->tick_period;
+        }
+    }
+
+    for (unsigned int i = 0; i < clock->samples_count; i++) {
+        struct clock_sample *sample = &clock->samples[i];
+        double x;
+
+        if (sample->delay > 2*min_delay + CLOCK_DELAY_SLACK) {
+            continue;
+        }
+
+        /* Camera time relative to the newest sample */
+        x = ((int64_t) (sample->ticks - newest->ticks))*clock->tick_period;
+
+        sx += x;
+        sy += sample->offset;
+        sxx += x*x;
+        sxy += x*sample->offset;
+        if (x < min_x) {
+            min_x = x;
+        }
+        n++;
+    }
+
+    if (n >= 2 && -min_x >= CLOCK_DRIFT_SPAN) {
+        double slope = (n*sxy - sx*sy)/(n*sxx - sx*sx);
+
+        if (fabs(slope) <= CLOCK_DRIFT_MAX) {
+            drift = slope;
+        }
+
+        offset = (sy - drift*sx)/n;
+    }
+    else {
+        /* Too little history, project the best sample forward */
+        offset = best_offset - drift*best_x;
+    }
+
+    /* Publish with a seqlock, so the callback never blocks */
+    __atomic_add_fetch(&clock->seq, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&clock->ref_ticks, newest->ticks, __ATOMIC_RELAXED);
+    __atomic_store(&clock->ref_offset, &offset, __ATOMIC_RELAXED);
+    __atomic_store(&clock->drift, &drift, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&clock->seq, 1, __ATOMIC_RELEASE);
+}
+
+static void clock_add_sample(struct clock_sync *clock) {
+    struct clock_sample sample;
+
+    if (clock_measure(clock, &sample)) {
+        return;
+    }
+
+    clock->samples[clock->samples_next] = sample;
+    clock->samples_next = (clock->samples_next + 1) % CLOCK_SAMPLES;
+    if (clock->samples_count < CLOCK_SAMPLES) {
+        clock->samples_count++;
+    }
+
+    clock_update(clock);
+}
+
+static void *clock_thread(void *arg) {
+    struct clock_sync *clock = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&clock->lock);
+
+    while (clock->running) {
+        double next = host_time() + clock->interval;
+
+        deadline.tv_sec = next;
+        deadline.tv_nsec = 1e9*(next - deadline.tv_sec);
+
+        while (clock->running && pthread_cond_timedwait(&clock->cond,
+                    &clock->lock, &deadline) != ETIMEDOUT);
+
+        if (!clock->running) {
+            break;
+        }
+
+        pthread_mutex_unlock(&clock->lock);
+        clock_add_sample(clock);
+        pthread_mutex_lock(&clock->lock);
+    }
+
+    pthread_mutex_unlock(&clock->lock);
+
+    return NULL;
+}
+
+int clock_sync_start(struct clock_sync *clock, Camera_handle handle,
+                     uint64_t tick_frequency, double interval) {
+    clock->handle = handle;
+    clock->tick_period = 1.0/tick_frequency;
+    clock->interval = interval;
+    clock->samples_count = 0;
+    clock->samples_next = 0;
+    clock->seq = 0;
+    clock->drift = 0;
+
+    clock_add_sample(clock);
+    if (!clock->samples_count) {
+        return -1;
+    }
+
+    if (interval <= 0) {
+        return 0;
+    }
+
+    pthread_mutex_init(&clock->lock, NULL);
+    pthread_cond_init(&clock->cond, NULL);
+    clock->running = 1;
+
+    if (pthread_create(&clock->thread, NULL, clock_thread, clock)) {
+        clock->running = 0;
+        pthread_cond_destroy(&clock->cond);
+        pthread_mutex_destroy(&clock->lock);
+        return -1;
+    }
+
+    return 0;
+}
+
+void clock_sync_fixed(struct clock_sync *clock, uint64_t tick_frequency,
+                      double offset) {
+    clock->handle = 0;
+    clock->tick_period = 1.0/tick_frequency;
+    clock->interval = 0;
+    clock->running = 0;
+    clock->samples_count = 0;
+    clock->samples_next = 0;
+    clock->seq = 0;
+    clock->ref_ticks = 0;
+    clock->ref_offset = offset;
+    clock->drift = 0;
+}
+
+void clock_sync_stop(struct clock_sync *clock) {
+    if (!clock->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&clock->lock);
+    clock->running = 0;
+    pthread_cond_signal(&clock->cond);
+    pthread_mutex_unlock(&clock->lock);
+
+    pthread_join(clock->thread, NULL);
+
+    pthread_cond_destroy(&clock->cond);
+    pthread_mutex_destroy(&clock->lock);
+}
+
+void clock_sync_convert(struct clock_sync *clock, uint64_t ticks,
+                        struct timeval *tv, double *offset, double *drift) {
+    uint64_t ref_ticks;
+    double ref_offset, time;
+    unsigned int seq;
+
+    do {
+        seq = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+        ref_ticks = __atomic_load_n(&clock->ref_ticks, __ATOMIC_RELAXED);
+        __atomic_load(&clock->ref_offset, &ref_offset, __ATOMIC_RELAXED);
+        __atomic_load(&clock->drift, drift, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&clock->seq, __ATOMIC_RELAXED));
+
+    *offset = ref_offset + *drift*((int64_t) (ticks - ref_ticks))*clock->tick_period;
+    time = ticks*clock->tick_period + *offset;
+
+    tv->tv_sec = floor(time);
+    tv->tv_usec = round(1e6*(time - tv->tv_sec));
+    if (tv->tv_usec >= 1000000) {
+        tv->tv_sec++;
+        tv->tv_usec -= 1000000;
+    }
+}
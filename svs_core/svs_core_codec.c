@@ -0,0 +1,712 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lossless image compression
+ *
+ * Raw camera images are coded as the residuals of a median edge
+ * detecting predictor, as in LOCO-I, from the neighbours of the same
+ * color: two pixels away in Bayer images, adjacent ones in mono images.
+ * Residuals are Rice coded in blocks, each with its own parameter, so
+ * dark, flat sky costs little more than a bit a pixel, and saturated or
+ * black blocks almost nothing.
+ *
+ * Images are split into bands of rows coded independently, on the
+ * worker pool when it is running.  A band that does not shrink is
+ * stored as is, so a compressed image is never more than its band table
+ * larger than the raw image.  12-bit packed pixels are coded as 12-bit
+ * values, not as their bytes, and packed again when decoding, so the
+ * decoded image is exactly the raw camera data.
+ *
+ * Compressed image layout:
+ *
+ *   struct codec_header
+ *   uint32_t band_length[bands]    CODEC_BAND_RAW set if stored as is
+ *   band data, back to back
+ *
+ * Band data is a stream of bits, least significant first.  Each block of
+ * CODEC_BLOCK residuals, or fewer at the end of a row, starts with its
+ * 5-bit parameter k, or CODEC_BLOCK_ZERO if every residual is zero.
+ * Each residual, mapped to unsigned by zigzag, follows as its quotient
+ * by 2^k in unary, ones ended by a zero, then its low k bits.  Quotients
+ * of CODEC_ESCAPE or more are instead CODEC_ESCAPE ones, then the value.
+ */
+
+#include <Python.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+/* Pixels per band, roughly */
+#define CODEC_BAND_PIXELS   (256*1024)
+
+#define CODEC_BAND_RAW      0x80000000u
+
+/* Residuals per Rice parameter */
+#define CODEC_BLOCK         32
+#define CODEC_BLOCK_ZERO    31
+
+/* Unary quotients from which the value is coded in full */
+#define CODEC_ESCAPE        16
+
+static const char codec_magic[4] = "SVZ1";
+
+struct codec_header {
+    char        magic[4];       /* "SVZ1" */
+    uint32_t    pixel_type;
+    uint32_t    width;
+    uint32_t    height;
+    uint64_t    raw_length;     /* Bytes of the raw image */
+    uint32_t    band_rows;      /* Rows per band, fewer in the last */
+    uint32_t    bands;
+};
+
+/* An image being coded, shared by the bands */
+struct codec_job {
+    const uint8_t   *src;
+    uint8_t         *dst;
+    uint8_t         *table;         /* Band lengths */
+    size_t          *offsets;       /* Of band data in src, when decoding */
+    uint32_t        width;
+    uint32_t        height;
+    unsigned int    pixel_bits;     /* Per raw pixel */
+    unsigned int    bits;           /* Per coded pixel, 0 if stored as is */
+    unsigned int    step;           /* Distance of same color neighbours */
+    uint32_t        band_rows;
+    int             error;
+};
+
+struct bit_writer {
+    uint8_t         *pos;
+    uint8_t         *end;
+    uint64_t        acc;
+    unsigned int    count;      /* Bits in acc, under 32 between calls */
+    int             full;       /* Ran out of room */
+};
+
+struct bit_reader {
+    const uint8_t   *pos;
+    const uint8_t   *end;
+    uint64_t        acc;
+    unsigned int    count;      /* Bits in acc */
+    size_t          past;       /* Zero bits supplied past the end */
+};
+
+static uint32_t load32(const uint8_t *p) {
+    return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+           (uint32_t) p[3] << 24;
+}
+
+static void store32(uint8_t *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/*
+ * Append count bits, at most 32, of value, which has no higher bits set
+ */
+static inline void bits_put(struct bit_writer *w, uint32_t value,
+                            unsigned int count) {
+    w->acc |= (uint64_t) value << w->count;
+    w->count += count;
+
+    if (w->count >= 32) {
+        if (w->end - w->pos >= 4) {
+            store32(w->pos, w->acc);
+            w->pos += 4;
+        }
+        else {
+            w->full = 1;
+        }
+        w->acc >>= 32;
+        w->count -= 32;
+    }
+}
+
+/*
+ * Write out the last bits
+ *
+ * @returns 0 if everything fit, negative otherwise
+ */
+static int bits_flush(struct bit_writer *w) {
+    for (; w->count && w->pos < w->end; w->acc >>= 8) {
+        *w->pos++ = w->acc;
+        w->count = w->count > 8 ? w->count - 8 : 0;
+    }
+
+    return w->full || w->count ? -1 : 0;
+}
+
+/*
+ * Make at least 33 bits available, zeros once past the end
+ */
+static inline void bits_fill(struct bit_reader *r) {
+    if (r->count > 32) {
+        return;
+    }
+
+    if (r->end - r->pos >= 4) {
+        r->acc |= (uint64_t) load32(r->pos) << r->count;
+        r->pos += 4;
+        r->count += 32;
+        return;
+    }
+
+    while (r->pos < r->end && r->count <= 56) {
+        r->acc |= (uint64_t) *r->pos++ << r->count;
+        r->count += 8;
+    }
+
+    if (r->count <= 32) {
+        r->past += 32;
+        r->count += 32;
+    }
+}
+
+/*
+ * Take count bits, at most 32, after bits_fill()
+ */
+static inline uint32_t bits_get(struct bit_reader *r, unsigned int count) {
+    uint32_t value = r->acc & ((1ull << count) - 1);
+
+    r->acc >>= count;
+    r->count -= count;
+
+    return value;
+}
+
+/*
+ * Fill in the coding geometry of an image
+ *
+ * Pixel types other than 8, 12 and 16-bit, and 12-bit images of odd
+ * width, whose rows do not start on a byte boundary, are stored as is,
+ * in a single band.
+ *
+ * @returns number of bands
+ */
+static uint32_t codec_geometry(struct codec_job *job, uint32_t pixel_type,
+                               uint32_t width, uint32_t height) {
+    unsigned int bits = (pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16;
+    uint32_t rows;
+
+    job->width = width;
+    job->height = height;
+    job->pixel_bits = bits;
+    job->step = convert_bayer(pixel_type) ? 2 : 1;
+
+    if (!width || !(bits == 8 || bits == 16 || (bits == 12 && !(width & 1)))) {
+        job->bits = 0;
+        job->band_rows = height;
+        return height ? 1 : 0;
+    }
+
+    /* Even, so every band starts on the same Bayer row */
+    rows = CODEC_BAND_PIXELS/width;
+    rows = rows < 2 ? 2 : (rows + 1) & ~1u;
+
+    job->bits = bits;
+    job->band_rows = rows;
+
+    return ((uint64_t) height + rows - 1)/rows;
+}
+
+/* Byte offset of a row in the raw image */
+static size_t codec_offset(const struct codec_job *job, uint32_t y) {
+    return (uint64_t) y*job->width*job->pixel_bits/8;
+}
+
+static void codec_load_row(const struct codec_job *job, const uint8_t *src,
+                           uint16_t *line) {
+    uint32_t width = job->width;
+
+    switch (job->bits) {
+    case 8:
+        for (uint32_t x = 0; x < width; x++) {
+            line[x] = src[x];
+        }
+        break;
+    case 12:
+        unpack12(src, line, width, 0);
+        break;
+    case 16:
+        for (uint32_t x = 0; x < width; x++) {
+            line[x] = src[2*x] | src[2*x + 1] << 8;
+        }
+        break;
+    }
+}
+
+static void codec_store_row(const struct codec_job *job, const uint16_t *line,
+                            uint8_t *dst) {
+    uint32_t width = job->width;
+
+    switch (job->bits) {
+    case 8:
+        for (uint32_t x = 0; x < width; x++) {
+            dst[x] = line[x];
+        }
+        break;
+    case 12:
+        /* As unpack12() reads them */
+        for (uint32_t x = 0; x < width; x += 2) {
+            dst[0] = line[x] >> 4;
+            dst[1] = (line[x + 1] & 0xf) << 4 | (line[x] & 0xf);
+            dst[2] = line[x + 1] >> 4;
+            dst += 3;
+        }
+        break;
+    case 16:
+        for (uint32_t x = 0; x < width; x++) {
+            dst[2*x] = line[x];
+            dst[2*x + 1] = line[x] >> 8;
+        }
+        break;
+    }
+}
+
+/*
+ * Median edge detecting prediction of pixel x
+ *
+ * @param up    Row step rows above, or NULL in the first rows of a band
+ */
+static inline unsigned int codec_predict(const uint16_t *line,
+                                         const uint16_t *up, uint32_t x,
+                                         unsigned int step) {
+    unsigned int a, b, c, low, high;
+
+    if (x < step) {
+        return up ? up[x] : 0;
+    }
+
+    a = line[x - step];
+    if (!up) {
+        return a;
+    }
+
+    b = up[x];
+    c = up[x - step];
+    low = a < b ? a : b;
+    high = a < b ? b : a;
+
+    if (c >= high) {
+        return low;
+    }
+    if (c <= low) {
+        return high;
+    }
+    return a + b - c;
+}
+
+/* Zigzag mapped residuals of a row */
+static void codec_residuals(const struct codec_job *job, const uint16_t *line,
+                            const uint16_t *up, uint32_t *residuals) {
+    unsigned int shift = 32 - job->bits;
+
+    for (uint32_t x = 0; x < job->width; x++) {
+        unsigned int p = codec_predict(line, up, x, job->step);
+        /* Wrapped to the pixel size, so residuals take bits bits */
+        int32_t s = (int32_t) ((uint32_t) (line[x] - p) << shift) >> shift;
+
+        residuals[x] = (uint32_t) s << 1 ^ (uint32_t) (s >> 31);
+    }
+}
+
+static void codec_put_block(struct bit_writer *w, const uint32_t *residuals,
+                            unsigned int count, unsigned int bits) {
+    uint64_t sum = 0;
+    unsigned int k = 0;
+
+    for (unsigned int i = 0; i < count; i++) {
+        sum += residuals[i];
+    }
+
+    if (!sum) {
+        bits_put(w, CODEC_BLOCK_ZERO, 5);
+        return;
+    }
+
+    /* Roughly the mean's bit length, as in LOCO-I */
+    while (k < bits && ((uint64_t) count << k) < sum) {
+        k++;
+    }
+
+    bits_put(w, k, 5);
+
+    for (unsigned int i = 0; i < count; i++) {
+        uint32_t u = residuals[i], q = u >> k;
+
+        if (q < CODEC_ESCAPE) {
+            bits_put(w, ((1u << q) - 1) | (u & ((1u << k) - 1)) << (q + 1),
+                     q + 1 + k);
+        }
+        else {
+            bits_put(w, (1u << CODEC_ESCAPE) - 1, CODEC_ESCAPE);
+            bits_put(w, u, bits);
+        }
+    }
+}
+
+/*
+ * Read the residuals of a row
+ *
+ * @returns 0 on success, negative if the data is invalid
+ */
+static int codec_get_row(const struct codec_job *job, struct bit_reader *r,
+                         uint32_t *residuals) {
+    unsigned int bits = job->bits, count, k, q;
+
+    for (uint32_t x = 0; x < job->width; x += count) {
+        count = job->width - x < CODEC_BLOCK ? job->width - x : CODEC_BLOCK;
+
+        bits_fill(r);
+        k = bits_get(r, 5);
+
+        if (k == CODEC_BLOCK_ZERO) {
+            memset(&residuals[x], 0, count*sizeof(*residuals));
+            continue;
+        }
+        if (k > bits) {
+            return -1;
+        }
+
+        for (unsigned int i = 0; i < count; i++) {
+            bits_fill(r);
+            q = __builtin_ctz(~(uint32_t) r->acc | 1u << CODEC_ESCAPE);
+
+            if (q < CODEC_ESCAPE) {
+                bits_get(r, q + 1);
+                residuals[x + i] = q << k | bits_get(r, k);
+            }
+            else {
+                bits_get(r, CODEC_ESCAPE);
+                bits_fill(r);
+                residuals[x + i] = bits_get(r, bits);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Unpacked rows of a band: the row being coded and the two above it
+ *
+ * @returns residual buffer, followed by the rows, or NULL
+ */
+static uint32_t *codec_band_buffers(const struct codec_job *job,
+                                    uint16_t **lines) {
+    uint32_t *residuals;
+
+    residuals = malloc(job->width*(sizeof(*residuals) + 3*sizeof(**lines)));
+    if (residuals) {
+        *lines = (uint16_t *) (residuals + job->width);
+    }
+
+    return residuals;
+}
+
+/*
+ * Code the rows of a band
+ *
+ * @returns bytes written, or 0 if they did not fit in capacity
+ */
+static size_t codec_encode_rows(const struct codec_job *job,
+                                uint32_t row_start, uint32_t row_end,
+                                uint8_t *dst, size_t capacity) {
+    struct bit_writer w = {.pos = dst, .end = dst + capacity};
+    uint16_t *lines, *line, *up;
+    uint32_t *residuals;
+    unsigned int count;
+
+    residuals = codec_band_buffers(job, &lines);
+    if (!residuals) {
+        return 0;
+    }
+
+    for (uint32_t y = row_start; y < row_end && !w.full; y++) {
+        line = lines + (y - row_start) % 3*job->width;
+        up = y - row_start >= job->step ?
+             lines + (y - row_start - job->step) % 3*job->width : NULL;
+
+        codec_load_row(job, job->src + codec_offset(job, y), line);
+        codec_residuals(job, line, up, residuals);
+
+        for (uint32_t x = 0; x < job->width; x += count) {
+            count = job->width - x < CODEC_BLOCK ? job->width - x : CODEC_BLOCK;
+            codec_put_block(&w, residuals + x, count, job->bits);
+        }
+    }
+
+    free(residuals);
+
+    return bits_flush(&w) ? 0 : (size_t) (w.pos - dst);
+}
+
+/*
+ * Decode the rows of a band
+ *
+ * @returns 0 on success, negative if the data is invalid
+ */
+static int codec_decode_rows(const struct codec_job *job, uint32_t row_start,
+                             uint32_t row_end, const uint8_t *src,
+                             size_t length) {
+    struct bit_reader r = {.pos = src, .end = src + length};
+    uint32_t mask = (1u << job->bits) - 1, *residuals, u;
+    uint16_t *lines, *line, *up;
+    int ret = 0;
+
+    residuals = codec_band_buffers(job, &lines);
+    if (!residuals) {
+        return -1;
+    }
+
+    for (uint32_t y = row_start; y < row_end; y++) {
+        line = lines + (y - row_start) % 3*job->width;
+        up = y - row_start >= job->step ?
+             lines + (y - row_start - job->step) % 3*job->width : NULL;
+
+        ret = codec_get_row(job, &r, residuals);
+        if (ret) {
+            break;
+        }
+
+        for (uint32_t x = 0; x < job->width; x++) {
+            u = residuals[x];
+            line[x] = (codec_predict(line, up, x, job->step) +
+                       (u >> 1 ^ -(u & 1))) & mask;
+        }
+
+        codec_store_row(job, line, job->dst + codec_offset(job, y));
+    }
+
+    free(residuals);
+
+    /* Running out of data reads zeros, which must not have been used */
+    if (r.past > r.count) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static void codec_encode_band(void *arg, unsigned int band) {
+    struct codec_job *job = arg;
+    uint32_t row_start = band*job->band_rows;
+    uint32_t row_end = job->height - row_start < job->band_rows ?
+                       job->height : row_start + job->band_rows;
+    size_t start = codec_offset(job, row_start);
+    size_t size = codec_offset(job, row_end) - start;
+    size_t length = 0;
+
+    /* Coded where the band would be stored as is, then moved down */
+    if (job->bits) {
+        length = codec_encode_rows(job, row_start, row_end, job->dst + start,
+                                   size);
+    }
+
+    if (!length || length >= size) {
+        memcpy(job->dst + start, job->src + start, size);
+        length = size | CODEC_BAND_RAW;
+    }
+
+    store32(job->table + 4*band, length);
+}
+
+static void codec_decode_band(void *arg, unsigned int band) {
+    struct codec_job *job = arg;
+    uint32_t row_start = band*job->band_rows;
+    uint32_t row_end = job->height - row_start < job->band_rows ?
+                       job->height : row_start + job->band_rows;
+    size_t start = codec_offset(job, row_start);
+    size_t size = codec_offset(job, row_end) - start;
+    uint32_t length = load32(job->table + 4*band);
+    const uint8_t *src = job->src + job->offsets[band];
+    int ret = 0;
+
+    if (length & CODEC_BAND_RAW) {
+        if ((length & ~CODEC_BAND_RAW) == size) {
+            memcpy(job->dst + start, src, size);
+        }
+        else {
+            ret = -1;
+        }
+    }
+    else if (job->bits) {
+        ret = codec_decode_rows(job, row_start, row_end, src, length);
+    }
+    else {
+        ret = -1;
+    }
+
+    if (ret) {
+        __atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+    }
+}
+
+size_t codec_bound(uint32_t pixel_type, uint32_t width, uint32_t height) {
+    struct codec_job job;
+    uint32_t bands = codec_geometry(&job, pixel_type, width, height);
+
+    return sizeof(struct codec_header) + 4*(size_t) bands +
+           codec_offset(&job, height);
+}
+
+size_t codec_encode(const void *src, uint32_t pixel_type, uint32_t width,
+                    uint32_t height, void *dst) {
+    struct codec_header header;
+    struct codec_job job;
+    uint32_t bands, length;
+    uint8_t *data;
+    size_t out = 0, start;
+
+    bands = codec_geometry(&job, pixel_type, width, height);
+
+    /* Band lengths leave a bit for the raw flag */
+    if (!job.pixel_bits ||
+            codec_offset(&job, job.band_rows) >= CODEC_BAND_RAW) {
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, codec_magic, sizeof(header.magic));
+    header.pixel_type = pixel_type;
+    header.width = width;
+    header.height = height;
+    header.raw_length = codec_offset(&job, height);
+    header.band_rows = job.band_rows;
+    header.bands = bands;
+    memcpy(dst, &header, sizeof(header));
+
+    job.src = src;
+    job.table = (uint8_t *) dst + sizeof(header);
+    job.dst = data = job.table + 4*(size_t) bands;
+
+    pool_for(codec_encode_band, &job, bands);
+
+    /* Each band was written at its raw offset, never before out */
+    for (uint32_t i = 0; i < bands; i++) {
+        length = load32(job.table + 4*i) & ~CODEC_BAND_RAW;
+        start = codec_offset(&job, i*job.band_rows);
+        if (start != out) {
+            memmove(data + out, data + start, length);
+        }
+        out += length;
+    }
+
+    return data + out - (uint8_t *) dst;
+}
+
+/*
+ * Check a compressed image header, and set up decoding
+ *
+ * @returns 0 on success, negative if src is not a valid compressed image
+ */
+static int codec_parse(const uint8_t *src, size_t length,
+                       struct codec_header *header, struct codec_job *job) {
+    uint32_t bands;
+
+    if (length < sizeof(*header)) {
+        return -1;
+    }
+
+    memcpy(header, src, sizeof(*header));
+    if (memcmp(header->magic, codec_magic, sizeof(header->magic))) {
+        return -1;
+    }
+
+    bands = codec_geometry(job, header->pixel_type, header->width,
+                           header->height);
+    if (!job->pixel_bits ||
+            header->raw_length != codec_offset(job, header->height)) {
+        return -1;
+    }
+
+    /* Images stored as is have a single band */
+    if (job->bits && header->band_rows) {
+        job->band_rows = header->band_rows;
+        bands = ((uint64_t) header->height + header->band_rows - 1)/
+                header->band_rows;
+    }
+    if (header->bands != bands ||
+            (length - sizeof(*header))/4 < bands) {
+        return -1;
+    }
+
+    job->src = src;
+    job->table = (uint8_t *) src + sizeof(*header);
+
+    return 0;
+}
+
+size_t codec_raw_length(const void *src, size_t length) {
+    struct codec_header header;
+    struct codec_job job;
+
+    if (codec_parse(src, length, &header, &job)) {
+        return 0;
+    }
+
+    return header.raw_length;
+}
+
+int codec_decode(const void *src, size_t length, void *dst, size_t size) {
+    struct codec_header header;
+    struct codec_job job;
+    size_t offset;
+
+    if (codec_parse(src, length, &header, &job) || header.raw_length > size) {
+        return -1;
+    }
+
+    job.offsets = malloc((header.bands ? header.bands : 1)*sizeof(*job.offsets));
+    if (!job.offsets) {
+        return -1;
+    }
+
+    offset = sizeof(header) + 4*(size_t) header.bands;
+    for (uint32_t i = 0; i < header.bands; i++) {
+        job.offsets[i] = offset;
+        offset += load32(job.table + 4*i) & ~CODEC_BAND_RAW;
+        if (offset > length) {
+            free(job.offsets);
+            return -1;
+        }
+    }
+
+    job.dst = dst;
+    job.error = 0;
+
+    pool_for(codec_decode_band, &job, header.bands);
+
+    free(job.offsets);
+
+    return job.error ? -1 : 0;
+}
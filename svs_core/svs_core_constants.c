@@ -26,8 +26,21 @@
  */
 
 #include <Python.h>
+#include <libsvgige/svgige.h>
 
 #include "svs_core.h"
 
 void add_constants(PyObject *m) {
+    /* Acquisition modes, for Camera.acquisition_mode */
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_NO_ACQUISITION);
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_FREE_RUNNING);
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_INT_TRIGGER);
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_EXT_TRIGGER_INT_EXPOSURE);
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_EXT_TRIGGER_EXT_EXPOSURE);
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_SOFTWARE_TRIGGER);
+    PyModule_AddIntMacro(m, ACQUISITION_MODE_FIXED_FREQUENCY);
+
+    /* External trigger edges, for Camera.trigger_polarity */
+    PyModule_AddIntMacro(m, TRIGGER_POLARITY_POSITIVE);
+    PyModule_AddIntMacro(m, TRIGGER_POLARITY_NEGATIVE);
 }
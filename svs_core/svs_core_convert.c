@@ -0,0 +1,639 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Image conversion
+ *
+ * Converts raw camera frames to the output formats in a single pass.
+ * Rows are unpacked to 16-bit one at a time into a three row window, so
+ * the unpack, demosaic and bit depth reduction all run on data in cache.
+ * Large images are split into bands of rows converted in parallel on
+ * the worker pool, when it is running.  Without it, images are
+ * converted on the calling thread, as starting threads per image would
+ * cost more latency than it saves.
+ */
+
+#include <Python.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+/* Pixels per worker before splitting an image into bands */
+#define CONVERT_BAND_PIXELS (1024*1024)
+
+/* Maximum bands a single image is split into */
+#define CONVERT_MAX_BANDS 8
+
+enum color {
+    RED,
+    GREEN,
+    BLUE,
+};
+
+struct convert_job {
+    const uint8_t   *src;
+    uint32_t        pixel_type;
+    uint32_t        width;
+    uint32_t        height;
+    int             format;
+    int             bayer;          /* Non-zero for Bayer sensors */
+    enum color      pattern[4];     /* Colors of the top-left 2x2 block */
+    void            *dst;
+    uint32_t        row_start;      /* Band of rows to convert */
+    uint32_t        row_end;
+    int             ret;
+};
+
+/*
+ * Determine the color filter layout for a pixel type
+ *
+ * @returns 1 for Bayer formats with pattern filled in, 0 for mono
+ */
+static int bayer_pattern(uint32_t pixel_type, enum color pattern[4]) {
+    static const enum color gr[4] = {GREEN, RED, BLUE, GREEN};
+    static const enum color rg[4] = {RED, GREEN, GREEN, BLUE};
+    static const enum color gb[4] = {GREEN, BLUE, RED, GREEN};
+    static const enum color bg[4] = {BLUE, GREEN, GREEN, RED};
+    const enum color *p;
+
+    switch (pixel_type) {
+    case GVSP_PIX_BAYGR8:
+    case GVSP_PIX_BAYGR12_PACKED:
+    case GVSP_PIX_BAYGR16:
+        p = gr;
+        break;
+    case GVSP_PIX_BAYRG8:
+    case GVSP_PIX_BAYRG12_PACKED:
+    case GVSP_PIX_BAYRG16:
+        p = rg;
+        break;
+    case GVSP_PIX_BAYGB8:
+    case GVSP_PIX_BAYGB12_PACKED:
+    case GVSP_PIX_BAYGB16:
+        p = gb;
+        break;
+    case GVSP_PIX_BAYBG8:
+    case GVSP_PIX_BAYBG12_PACKED:
+    case GVSP_PIX_BAYBG16:
+        p = bg;
+        break;
+    default:
+        return 0;
+    }
+
+    memcpy(pattern, p, sizeof(gr));
+    return 1;
+}
+
+/*
+ * Unpack one row to full scale 16-bit
+ *
+ * The row is written to line[1..width], with mirrored pixels at line[0]
+ * and line[width + 1], so neighbours can be read without bounds checks.
+ * Mirroring by two keeps the Bayer pattern intact at the edges.
+ */
+static void fetch_line(struct convert_job *job, uint32_t y, uint16_t *line) {
+    uint32_t width = job->width;
+    uint16_t *out = line + 1;
+
+    switch (job->pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) {
+    case GVSP_PIX_OCCUPY8BIT: {
+        const uint8_t *row = job->src + (size_t) y*width;
+        for (uint32_t x = 0; x < width; x++) {
+            out[x] = row[x] << 8;
+        }
+        break;
+    }
+    case GVSP_PIX_OCCUPY12BIT:
+        unpack12(job->src + (size_t) y*width*3/2, out, width, 4);
+        break;
+    case GVSP_PIX_OCCUPY16BIT:
+        memcpy(out, job->src + (size_t) y*width*2, width*2);
+        break;
+    }
+
+    line[0] = width > 1 ? out[1] : out[0];
+    line[width + 1] = width > 1 ? out[width - 2] : out[0];
+}
+
+/* Average of two or four neighbours */
+#define AVG2(a, b)          (((uint32_t) (a) + (b) + 1) >> 1)
+#define AVG4(a, b, c, d)    (((uint32_t) (a) + (b) + (c) + (d) + 2) >> 2)
+
+static inline uint32_t absdiff(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
+
+/*
+ * Interpolate RGB at one pixel
+ *
+ * up, mid and down point at the pixel in the rows above, at and below it.
+ * Green at red and blue sites follows the direction with the smaller
+ * gradient, which avoids zippering along edges.  Red and blue are
+ * bilinear.
+ */
+static inline void demosaic_pixel(const uint16_t *up, const uint16_t *mid,
+                                  const uint16_t *down, enum color color,
+                                  enum color row_color, uint32_t rgb[3]) {
+    uint32_t v = mid[0];
+
+    if (color == GREEN) {
+        /* Row color on either side, the other color above and below */
+        rgb[GREEN] = v;
+        rgb[row_color] = AVG2(mid[-1], mid[1]);
+        rgb[row_color == RED ? BLUE : RED] = AVG2(up[0], down[0]);
+    }
+    else {
+        uint32_t dh = absdiff(mid[-1], mid[1]);
+        uint32_t dv = absdiff(up[0], down[0]);
+
+        if (dh < dv) {
+            rgb[GREEN] = AVG2(mid[-1], mid[1]);
+        }
+        else if (dv < dh) {
+            rgb[GREEN] = AVG2(up[0], down[0]);
+        }
+        else {
+            rgb[GREEN] = AVG4(mid[-1], mid[1], up[0], down[0]);
+        }
+
+        rgb[color] = v;
+        rgb[color == RED ? BLUE : RED] = AVG4(up[-1], up[1], down[-1], down[1]);
+    }
+}
+
+/* Rec. 601 luma, on 16-bit values */
+static inline uint32_t luma(const uint32_t rgb[3]) {
+    return (77*rgb[RED] + 150*rgb[GREEN] + 29*rgb[BLUE]) >> 8;
+}
+
+/*
+ * Convert one row
+ *
+ * Always inlined with a constant format, so the per-pixel format and
+ * sensor checks are resolved at compile time.
+ */
+static inline __attribute__((always_inline))
+void convert_row(struct convert_job *job, const uint16_t *up,
+                 const uint16_t *mid, const uint16_t *down, uint32_t y,
+                 const int format, const int bayer) {
+    const enum color *pattern = &job->pattern[2*(y & 1)];
+    enum color row_color = pattern[0] == GREEN ? pattern[1] : pattern[0];
+    size_t offset = (size_t) y*job->width;
+
+    for (uint32_t x = 0; x < job->width; x++) {
+        uint32_t rgb[3];
+
+        if (bayer) {
+            demosaic_pixel(up + x + 1, mid + x + 1, down + x + 1,
+                           pattern[x & 1], row_color, rgb);
+        }
+        else {
+            rgb[RED] = rgb[GREEN] = rgb[BLUE] = mid[x + 1];
+        }
+
+        if (format == FORMAT_MONO8) {
+            ((uint8_t *) job->dst)[offset + x] = luma(rgb) >> 8;
+        }
+        else if (format == FORMAT_RGB8) {
+            uint8_t *out = (uint8_t *) job->dst + 3*(offset + x);
+            out[0] = rgb[RED] >> 8;
+            out[1] = rgb[GREEN] >> 8;
+            out[2] = rgb[BLUE] >> 8;
+        }
+        else {
+            uint16_t *out = (uint16_t *) job->dst + 3*(offset + x);
+            out[0] = rgb[RED];
+            out[1] = rgb[GREEN];
+            out[2] = rgb[BLUE];
+        }
+    }
+}
+
+KERNEL_CLONES
+static void *convert_band(void *arg) {
+    struct convert_job *job = arg;
+    uint32_t width = job->width, height = job->height;
+    uint16_t *lines, *up, *mid, *down, *tmp;
+    uint32_t first;
+
+    lines = malloc(3*(width + 2)*sizeof(*lines));
+    if (!lines) {
+        job->ret = -1;
+        return NULL;
+    }
+
+    up = lines;
+    mid = up + width + 2;
+    down = mid + width + 2;
+
+    /* Prime the window, mirroring rows past the top and bottom */
+    first = job->row_start;
+    fetch_line(job, first, mid);
+    if (height > 1) {
+        fetch_line(job, first ? first - 1 : first + 1, up);
+    }
+    else {
+        memcpy(up, mid, (width + 2)*sizeof(*lines));
+    }
+
+    for (uint32_t y = first; y < job->row_end; y++) {
+        if (y + 1 < height) {
+            fetch_line(job, y + 1, down);
+        }
+        else if (height > 1) {
+            memcpy(down, up, (width + 2)*sizeof(*lines));
+        }
+        else {
+            memcpy(down, mid, (width + 2)*sizeof(*lines));
+        }
+
+        if (job->bayer) {
+            switch (job->format) {
+            case FORMAT_MONO8:
+                convert_row(job, up, mid, down, y, FORMAT_MONO8, 1);
+                break;
+            case FORMAT_RGB8:
+                convert_row(job, up, mid, down, y, FORMAT_RGB8, 1);
+                break;
+            case FORMAT_RGB16:
+                convert_row(job, up, mid, down, y, FORMAT_RGB16, 1);
+                break;
+            }
+        }
+        else {
+            /* Mono to mono8 is handled by convert_band_mono8() */
+            switch (job->format) {
+            case FORMAT_RGB8:
+                convert_row(job, up, mid, down, y, FORMAT_RGB8, 0);
+                break;
+            case FORMAT_RGB16:
+                convert_row(job, up, mid, down, y, FORMAT_RGB16, 0);
+                break;
+            }
+        }
+
+        /* Slide the window down one row */
+        tmp = up;
+        up = mid;
+        mid = down;
+        down = tmp;
+    }
+
+    free(lines);
+    job->ret = 0;
+
+    return NULL;
+}
+
+/*
+ * Downconvert a mono image to 8-bit, without demosaicing
+ */
+KERNEL_CLONES
+static void *convert_band_mono8(void *arg) {
+    struct convert_job *job = arg;
+    uint16_t *line;
+
+    line = malloc((job->width + 2)*sizeof(*line));
+    if (!line) {
+        job->ret = -1;
+        return NULL;
+    }
+
+    for (uint32_t y = job->row_start; y < job->row_end; y++) {
+        uint8_t *out = (uint8_t *) job->dst + (size_t) y*job->width;
+
+        fetch_line(job, y, line);
+        for (uint32_t x = 0; x < job->width; x++) {
+            out[x] = line[x + 1] >> 8;
+        }
+    }
+
+    free(line);
+    job->ret = 0;
+
+    return NULL;
+}
+
+/* A band of an image, converted by the worker pool */
+struct convert_task {
+    struct pool_task    task;       /* First, as tasks are cast */
+    struct convert_job  *job;
+    void                *(*band)(void *);
+    int                 *remaining; /* Bands not yet converted */
+};
+
+static void convert_task_run(struct pool_task *task) {
+    struct convert_task *band = (struct convert_task *) task;
+    int *remaining = band->remaining;
+
+    band->band(band->job);
+
+    /*
+     * Paired with the wait in convert_bands_pooled(), which may return as
+     * soon as the count drops, so the task must not be touched after it
+     */
+    if (!__atomic_sub_fetch(remaining, 1, __ATOMIC_ACQ_REL)) {
+        syscall(SYS_futex, remaining, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+ * Convert bands 1 to count - 1 on the worker pool, and band 0 here
+ *
+ * Bands no worker has started by the time band 0 is done are taken
+ * back and converted here too.
+ */
+static void convert_bands_pooled(struct convert_job *jobs, unsigned int count,
+                                 void *(*band)(void *)) {
+    struct convert_task tasks[CONVERT_MAX_BANDS];
+    int remaining = count - 1, left;
+
+    for (unsigned int i = 1; i < count; i++) {
+        tasks[i].task.run = convert_task_run;
+        tasks[i].job = &jobs[i];
+        tasks[i].band = band;
+        tasks[i].remaining = &remaining;
+
+        if (pool_submit(&tasks[i].task)) {
+            convert_task_run(&tasks[i].task);
+        }
+    }
+
+    band(&jobs[0]);
+
+    for (unsigned int i = 1; i < count; i++) {
+        if (pool_reclaim(&tasks[i].task)) {
+            convert_task_run(&tasks[i].task);
+        }
+    }
+
+    while ((left = __atomic_load_n(&remaining, __ATOMIC_ACQUIRE))) {
+        syscall(SYS_futex, &remaining, FUTEX_WAIT_PRIVATE, left, NULL, NULL, 0);
+    }
+}
+
+size_t convert_size(uint32_t pixel_type, uint32_t width, uint32_t height,
+                    int format) {
+    size_t pixels = (size_t) width*height;
+
+    switch (format) {
+    case FORMAT_RAW:
+        switch (pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) {
+        case GVSP_PIX_OCCUPY8BIT:
+            return pixels;
+        case GVSP_PIX_OCCUPY12BIT:
+        case GVSP_PIX_OCCUPY16BIT:
+            return 2*pixels;
+        default:
+            return 0;
+        }
+    case FORMAT_MONO8:
+        return pixels;
+    case FORMAT_RGB8:
+        return 3*pixels;
+    case FORMAT_RGB16:
+        return 6*pixels;
+    default:
+        return 0;
+    }
+}
+
+int convert_frame(const void *src, uint32_t pixel_type, uint32_t width,
+                  uint32_t height, int format, int shift, void *dst) {
+    struct convert_job jobs[CONVERT_MAX_BANDS];
+    void *(*band)(void *);
+    unsigned int count, threads_pooled;
+    int ret = 0;
+
+    switch (pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) {
+    case GVSP_PIX_OCCUPY8BIT:
+    case GVSP_PIX_OCCUPY16BIT:
+        if (format == FORMAT_RAW) {
+            memcpy(dst, src, convert_size(pixel_type, width, height, format));
+            return 0;
+        }
+        break;
+    case GVSP_PIX_OCCUPY12BIT:
+        if (format == FORMAT_RAW) {
+            unpack12(src, dst, (size_t) width*height, shift);
+            return 0;
+        }
+
+        /* Packed rows only start on a byte boundary with even widths */
+        if (width & 1) {
+            return -1;
+        }
+        break;
+    default:
+        return -1;
+    }
+
+    if (!width || !height) {
+        return 0;
+    }
+
+    jobs[0].src = src;
+    jobs[0].pixel_type = pixel_type;
+    jobs[0].width = width;
+    jobs[0].height = height;
+    jobs[0].format = format;
+    jobs[0].bayer = bayer_pattern(pixel_type, jobs[0].pattern);
+    jobs[0].dst = dst;
+
+    band = (!jobs[0].bayer && format == FORMAT_MONO8) ? convert_band_mono8
+                                                      : convert_band;
+
+    /* Without the pool, the whole image is one band on this thread */
+    threads_pooled = pool_threads();
+    if (!threads_pooled) {
+        jobs[0].row_start = 0;
+        jobs[0].row_end = height;
+        band(&jobs[0]);
+
+        return jobs[0].ret ? -1 : 0;
+    }
+
+    /* Split large images into bands of rows, one per worker and this thread */
+    count = (size_t) width*height/CONVERT_BAND_PIXELS;
+    if (count > threads_pooled + 1) {
+        count = threads_pooled + 1;
+    }
+    if (count > CONVERT_MAX_BANDS) {
+        count = CONVERT_MAX_BANDS;
+    }
+    if (count > height/2) {
+        count = height/2;
+    }
+    if (count < 1) {
+        count = 1;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        jobs[i] = jobs[0];
+        jobs[i].row_start = (uint64_t) height*i/count;
+        jobs[i].row_end = (uint64_t) height*(i + 1)/count;
+    }
+
+    convert_bands_pooled(jobs, count, band);
+
+    for (unsigned int i = 0; i < count; i++) {
+        ret |= jobs[i].ret;
+    }
+
+    return ret ? -1 : 0;
+}
+
+const char *convert_kernel(void) {
+#if KERNEL_CLONED
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2") ? "avx2" : "default";
+#elif defined(__AVX2__)
+    return "avx2";
+#else
+    return "default";
+#endif
+}
+
+int convert_bayer(uint32_t pixel_type) {
+    enum color pattern[4];
+
+    return bayer_pattern(pixel_type, pattern);
+}
+
+int decimate_format(uint32_t pixel_type) {
+    enum color pattern[4];
+
+    return bayer_pattern(pixel_type, pattern) ? FORMAT_RGB8 : FORMAT_MONO8;
+}
+
+KERNEL_CLONES
+int decimate_frame(const void *src, uint32_t pixel_type, uint32_t width,
+                   uint32_t height, unsigned int factor, void *dst) {
+    uint32_t out_width = width/factor, out_height = height/factor;
+    struct convert_job job;
+    unsigned int channels;
+    uint32_t *sums, count[3];
+    uint16_t *line;
+    uint8_t *out = dst;
+
+    switch (pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) {
+    case GVSP_PIX_OCCUPY8BIT:
+    case GVSP_PIX_OCCUPY16BIT:
+        break;
+    case GVSP_PIX_OCCUPY12BIT:
+        if (width & 1) {
+            return -1;
+        }
+        break;
+    default:
+        return -1;
+    }
+
+    job.src = src;
+    job.pixel_type = pixel_type;
+    job.width = width;
+    job.height = height;
+    job.bayer = bayer_pattern(pixel_type, job.pattern);
+
+    /* Blocks must cover whole 2x2 Bayer cells */
+    if (!factor || factor > PREVIEW_MAX_DECIMATION ||
+            (job.bayer && (factor & 1))) {
+        return -1;
+    }
+
+    if (!out_width || !out_height) {
+        return 0;
+    }
+
+    channels = job.bayer ? 3 : 1;
+    if (job.bayer) {
+        count[RED] = count[BLUE] = factor*factor/4;
+        count[GREEN] = factor*factor/2;
+    }
+    else {
+        count[0] = factor*factor;
+    }
+
+    /* At most 256 16-bit pixels per sum, which fits in 32 bits */
+    sums = malloc((size_t) out_width*channels*sizeof(*sums));
+    line = malloc((width + 2)*sizeof(*line));
+    if (!sums || !line) {
+        free(sums);
+        free(line);
+        return -1;
+    }
+
+    for (uint32_t oy = 0; oy < out_height; oy++) {
+        memset(sums, 0, (size_t) out_width*channels*sizeof(*sums));
+
+        for (uint32_t y = oy*factor; y < (oy + 1)*factor; y++) {
+            const uint16_t *in = line + 1;
+
+            fetch_line(&job, y, line);
+
+            if (job.bayer) {
+                const enum color *pattern = &job.pattern[2*(y & 1)];
+
+                for (uint32_t ox = 0; ox < out_width; ox++) {
+                    const uint16_t *p = in + (size_t) ox*factor;
+                    uint32_t *s = sums + 3*ox;
+
+                    for (unsigned int i = 0; i < factor; i += 2) {
+                        s[pattern[0]] += p[i];
+                        s[pattern[1]] += p[i + 1];
+                    }
+                }
+            }
+            else {
+                for (uint32_t ox = 0; ox < out_width; ox++) {
+                    const uint16_t *p = in + (size_t) ox*factor;
+
+                    for (unsigned int i = 0; i < factor; i++) {
+                        sums[ox] += p[i];
+                    }
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < out_width*channels; i++) {
+            uint32_t n = count[i % channels];
+
+            *out++ = ((sums[i] + n/2)/n) >> 8;
+        }
+    }
+
+    free(sums);
+    free(line);
+
+    return 0;
+}
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "svs_core.h"
+
+const char *const drop_reason_names[DROP_REASONS] = {
+    [DROP_OLDEST] = "oldest",
+    [DROP_NEWEST] = "newest",
+    [DROP_POOL] = "pool",
+    [DROP_TIMEOUT] = "timeout",
+    [DROP_ERROR] = "error",
+};
+
+int frame_ring_init(struct frame_ring *ring, unsigned int limit) {
+    unsigned int size = 1;
+
+    /* Power of two slots, so indices wrap cleanly with the counters */
+    while (size < limit) {
+        size <<= 1;
+    }
+
+    ring->slots = calloc(size, sizeof(*ring->slots));
+    if (!ring->slots) {
+        return -1;
+    }
+
+    ring->mask = size - 1;
+    ring->limit = limit;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return 0;
+}
+
+void frame_ring_destroy(struct frame_ring *ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int frame_ring_push(struct frame_ring *ring, unsigned int index) {
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= ring->limit) {
+        return -1;
+    }
+
+    __atomic_store_n(&ring->slots[head & ring->mask], index, __ATOMIC_RELAXED);
+
+    /* Publish the slot to the consumer */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int frame_ring_pop(struct frame_ring *ring, unsigned int *index) {
+    unsigned int head, tail, value;
+
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    do {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            return -1;
+        }
+
+        /*
+         * Read the slot before claiming it.  If the other side claims it
+         * first, the CAS fails, tail is reloaded and we try again.
+         */
+        value = __atomic_load_n(&ring->slots[tail & ring->mask], __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    *index = value;
+
+    return 0;
+}
+
+unsigned int frame_ring_length(struct frame_ring *ring) {
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    return head - tail;
+}
+
+int frame_queue_init(struct frame_queue *queue, unsigned int images_max,
+                     unsigned int pool_size) {
+    /* Queued images, plus one being filled and one being read */
+    queue->images_max = images_max;
+    queue->frames_count = images_max + 2;
+    if (pool_size > queue->frames_count) {
+        queue->frames_count = pool_size;
+    }
+
+    queue->frames_allocated = 0;
+    queue->spare_frame = -1;
+    queue->held = -1;
+    queue->event_fd = -1;
+    queue->pool_fd = -1;
+    queue->pool_waiting = 0;
+    queue->closed = 0;
+    queue->ended = 0;
+    queue->overflow_policy = OVERFLOW_DROP_OLDEST;
+    queue->numa_node = -1;
+    queue->stats = NULL;
+    memset(queue->dropped, 0, sizeof(queue->dropped));
+
+    queue->frames = calloc(queue->frames_count, sizeof(*queue->frames));
+    if (!queue->frames) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate frame pool");
+        return -1;
+    }
+
+    if (frame_ring_init(&queue->images, images_max)) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate image queue");
+        return -1;
+    }
+
+    if (frame_ring_init(&queue->free_frames, queue->frames_count)) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate image queue");
+        return -1;
+    }
+
+    queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->event_fd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+
+    queue->pool_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->pool_fd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+
+    return 0;
+}
+
+void frame_queue_destroy(struct frame_queue *queue) {
+    if (!queue->frames) {
+        return;
+    }
+
+    for (unsigned int i = 0; i < queue->frames_count; i++) {
+        struct frame *frame = &queue->frames[i];
+
+        /* Workers may still be filling frames the callback queued */
+        frame_work_wait(frame);
+
+        frame_data_free(frame->data, frame->size);
+        frame_data_free(frame->work.raw, frame->work.raw_size);
+    }
+    free(queue->frames);
+    queue->frames = NULL;
+
+    frame_ring_destroy(&queue->images);
+    frame_ring_destroy(&queue->free_frames);
+
+    if (queue->event_fd >= 0) {
+        close(queue->event_fd);
+        queue->event_fd = -1;
+    }
+
+    if (queue->pool_fd >= 0) {
+        close(queue->pool_fd);
+        queue->pool_fd = -1;
+    }
+}
+
+/*
+ * Wake the callback, if waiting for room in frame_pool_wait()
+ */
+static void frame_pool_signal(struct frame_queue *queue) {
+    /* Paired with the store in frame_pool_wait() */
+    if (__atomic_load_n(&queue->pool_waiting, __ATOMIC_SEQ_CST)) {
+        eventfd_write(queue->pool_fd, 1);
+    }
+}
+
+void frame_release(struct frame_queue *queue, unsigned int index) {
+    /* Cannot fail, the ring has room for every frame in the pool */
+    frame_ring_push(&queue->free_frames, index);
+
+    frame_pool_signal(queue);
+}
+
+/*
+ * Wait for room, as a free frame or a slot in the image queue
+ */
+static int frame_wait(struct frame_queue *queue, int room, int timeout) {
+    struct pollfd pfd = {.fd = queue->pool_fd, .events = POLLIN};
+    eventfd_t count;
+    int ret;
+
+    __atomic_store_n(&queue->pool_waiting, 1, __ATOMIC_SEQ_CST);
+
+    /* Room may have been made before the flag was seen */
+    if (__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)) {
+        ret = 1;
+    }
+    else if (room ? frame_ring_length(&queue->images) < queue->images_max
+                  : frame_ring_length(&queue->free_frames) > 0) {
+        ret = 0;
+    }
+    else {
+        do {
+            ret = poll(&pfd, 1, timeout);
+        } while (ret < 0 && errno == EINTR);
+
+        ret = ret > 0 && !__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)
+              ? 0 : 1;
+    }
+
+    __atomic_store_n(&queue->pool_waiting, 0, __ATOMIC_SEQ_CST);
+    eventfd_read(queue->pool_fd, &count);
+
+    return ret;
+}
+
+int frame_pool_wait(struct frame_queue *queue, int timeout) {
+    return frame_wait(queue, 0, timeout);
+}
+
+int frame_queue_wait(struct frame_queue *queue, int timeout) {
+    return frame_wait(queue, 1, timeout);
+}
+
+void frame_queue_close(struct frame_queue *queue) {
+    if (!queue->frames) {
+        return;
+    }
+
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    eventfd_write(queue->pool_fd, 1);
+}
+
+void frame_queue_open(struct frame_queue *queue) {
+    eventfd_t count;
+
+    __atomic_store_n(&queue->closed, 0, __ATOMIC_SEQ_CST);
+    eventfd_read(queue->pool_fd, &count);
+}
+
+void frame_queue_end(struct frame_queue *queue) {
+    if (!queue->frames) {
+        return;
+    }
+
+    frame_queue_close(queue);
+
+    __atomic_store_n(&queue->ended, 1, __ATOMIC_SEQ_CST);
+    frame_queue_signal(queue);
+}
+
+void frame_queue_drop(struct frame_queue *queue, enum drop_reason reason) {
+    __atomic_fetch_add(&queue->dropped[reason], 1, __ATOMIC_RELAXED);
+}
+
+uint32_t frame_queue_dropped(struct frame_queue *queue) {
+    uint64_t total = 0;
+
+    for (int i = 0; i < DROP_REASONS; i++) {
+        total += __atomic_load_n(&queue->dropped[i], __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+void frame_queue_signal(struct frame_queue *queue) {
+    eventfd_write(queue->event_fd, 1);
+}
+
+/*
+ * Reset the event fd, then re-signal if images were queued meanwhile,
+ * so the fd is only left readable while the queue is non-empty or ended.
+ */
+static void frame_queue_clear(struct frame_queue *queue) {
+    eventfd_t count;
+
+    eventfd_read(queue->event_fd, &count);
+
+    if (frame_ring_length(&queue->images) ||
+            __atomic_load_n(&queue->ended, __ATOMIC_SEQ_CST)) {
+        frame_queue_signal(queue);
+    }
+}
+
+void frame_queue_hold(struct frame_queue *queue, unsigned int index) {
+    queue->held = index;
+
+    /* Keep the fd readable while the frame waits */
+    frame_queue_signal(queue);
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int frame_queue_pop(struct frame_queue *queue, unsigned int *index,
+                    int timeout) {
+    struct pollfd pfd = {.fd = queue->event_fd, .events = POLLIN};
+    int64_t deadline = monotonic_ms() + timeout;
+    int remaining, ret;
+    uint64_t woken;
+
+    if (queue->held >= 0) {
+        *index = queue->held;
+        queue->held = -1;
+
+        if (!frame_ring_length(&queue->images)) {
+            frame_queue_clear(queue);
+        }
+        return 0;
+    }
+
+    for (;;) {
+        if (!frame_ring_pop(&queue->images, index)) {
+            if (!frame_ring_length(&queue->images)) {
+                frame_queue_clear(queue);
+            }
+
+            /* A blocked callback may now queue its image */
+            frame_pool_signal(queue);
+
+            stats_record(queue->stats, STATS_RESIDENCY,
+                         queue->frames[*index].queued);
+            stats_count(queue->stats, STATS_DELIVERED, 1);
+
+            /* Pooled frames are queued in order, before they are done */
+            if (frame_work_pending(&queue->frames[*index])) {
+                Py_BEGIN_ALLOW_THREADS
+                frame_work_wait(&queue->frames[*index]);
+                Py_END_ALLOW_THREADS
+            }
+            return 0;
+        }
+
+        /* Nothing more will arrive, leaving the fd readable for others */
+        if (__atomic_load_n(&queue->ended, __ATOMIC_SEQ_CST)) {
+            return 2;
+        }
+
+        if (timeout < 0) {
+            remaining = -1;
+        }
+        else {
+            remaining = deadline - monotonic_ms();
+            if (remaining <= 0) {
+                return 1;
+            }
+        }
+
+        /* Clear stale wakeups, so poll() doesn't spin */
+        frame_queue_clear(queue);
+        if (frame_ring_length(&queue->images) ||
+                __atomic_load_n(&queue->ended, __ATOMIC_SEQ_CST)) {
+            continue;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        ret = poll(&pfd, 1, remaining);
+        woken = stats_now();
+        Py_END_ALLOW_THREADS
+
+        stats_record(queue->stats, STATS_GIL_WAIT, woken);
+
+        if (ret < 0) {
+            if (errno != EINTR) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                return -1;
+            }
+
+            /* Allow KeyboardInterrupt while waiting */
+            if (PyErr_CheckSignals()) {
+                return -1;
+            }
+        }
+    }
+}
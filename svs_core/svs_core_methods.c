@@ -26,36 +26,138 @@
  */
 
 #include <Python.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <libsvgige/svgige.h>
 
 #include "svs_core.h"
 
-#define MAX_NETWORK_ADAPTERS    5
-#define DISCOVERY_TIMEOUT       1000    /* Wait 1s for cameras */
+#define DISCOVERY_ADAPTERS      16      /* Initial adapter list size */
+#define DISCOVERY_TIMEOUT       1.0     /* Default wait for cameras (s) */
+#define DISCOVERY_MAX_AGE       5.0     /* Default cache lifetime (s) */
+
+/* Discovery on one network adapter */
+struct discovery {
+    unsigned int    adapter;
+    int             timeout;        /* ms */
+    SVGigE_CAMERA   *cameras;
+    unsigned int    count;
+    unsigned int    allocated;
+    int             ret;
+};
+
+/* Results of the last discovery, and when it finished */
+static PyObject *discovery_cache;
+static double discovery_time;
+
+static double monotonic_time(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec*1e-9;
+}
 
 /*
  * Callback for discoverCameras()
  *
- * A PyList is passed in as the context, upon which cameras are appended.
- *
- * This callback is only called from within discoverCameras(), so it does
- * not need to be thread-safe or reentrant (XXX: I think)
+ * The adapter's struct discovery is passed in as the context, to which
+ * cameras are copied.  Runs without the GIL, so no Python objects are
+ * created here.
  */
-SVGigE_RETURN camera_discovery_callback(SVGigE_SIGNAL *signal, void *context) {
-    PyObject *dict;
-    PyObject *list = context;
-    SVGigE_CAMERA *camera;
-    char buf[16];
+static SVGigE_RETURN camera_discovery_callback(SVGigE_SIGNAL *signal,
+                                               void *context) {
+    struct discovery *discovery = context;
 
     if (signal->SignalType != SVGigE_SIGNAL_CAMERA_FOUND) {
-        /* Set an exception, though it may not be noticed */
-        PyErr_Format(SVSError, "Wrong signal type received in %s: %d",
-                     __func__, signal->SignalType);
         return SVGigE_ERROR;
     }
 
-    camera = signal->Data;
+    if (discovery->count == discovery->allocated) {
+        unsigned int allocated = discovery->allocated ? 2*discovery->allocated : 4;
+        SVGigE_CAMERA *cameras;
+
+        cameras = realloc(discovery->cameras, allocated*sizeof(*cameras));
+        if (!cameras) {
+            return SVGigE_ERROR;
+        }
+
+        discovery->cameras = cameras;
+        discovery->allocated = allocated;
+    }
+
+    discovery->cameras[discovery->count++] = *(SVGigE_CAMERA *) signal->Data;
+
+    return SVGigE_SUCCESS;
+}
+
+static void *discovery_thread(void *arg) {
+    struct discovery *discovery = arg;
+
+    discovery->ret = discoverCameras(discovery->adapter, discovery->timeout,
+                                     camera_discovery_callback, discovery);
+
+    return NULL;
+}
+
+/*
+ * Find all network adapters
+ *
+ * The SDK fills a fixed size list, so grow it until there is room to spare.
+ *
+ * @param adapters  List of adapters returned here, to be freed
+ * @returns number of adapters, or negative on error with exception set
+ */
+static int find_adapters(unsigned int **adapters) {
+    unsigned int size = DISCOVERY_ADAPTERS, count;
+    unsigned int *list = NULL, *grown;
+    int ret;
+
+    for (;;) {
+        grown = realloc(list, size*sizeof(*list));
+        if (!grown) {
+            free(list);
+            PyErr_SetString(PyExc_MemoryError, "Unable to allocate adapter list");
+            return -1;
+        }
+        list = grown;
+        memset(list, 0, size*sizeof(*list));
+
+        ret = findNetworkAdapters(list, size);
+        if (ret != SVGigE_SUCCESS) {
+            free(list);
+            raise_general_error(ret);
+            return -1;
+        }
+
+        for (count = 0; count < size && list[count]; count++);
+
+        if (count < size) {
+            *adapters = list;
+            return count;
+        }
+
+        size *= 2;
+    }
+}
+
+/*
+ * Create a dictionary describing a camera
+ *
+ * @returns dict object, or NULL on error
+ */
+static PyObject *camera_dict(SVGigE_CAMERA *camera) {
+    PyObject *dict;
+    char buf[16];
+
     dict = PyDict_New();
+    if (!dict) {
+        return NULL;
+    }
 
     ip_int_to_string(camera->localIP, buf);
 
@@ -85,68 +187,486 @@ SVGigE_RETURN camera_discovery_callback(SVGigE_SIGNAL *signal, void *context) {
     PyDict_SetItemString(dict, "pixel_type", pixel_type);
     PyDict_SetItemString(dict, "pixel_depth", pixel_depth);
 
-    Py_DECREF(local_ip);
-    Py_DECREF(ip);
-    Py_DECREF(subnet);
-    Py_DECREF(mac);
-    Py_DECREF(manufacturer);
-    Py_DECREF(model);
-    Py_DECREF(specific_information);
-    Py_DECREF(device_version);
-    Py_DECREF(serial_number);
-    Py_DECREF(user_name);
-    Py_DECREF(pixel_type);
-    Py_DECREF(pixel_depth);
+    Py_XDECREF(local_ip);
+    Py_XDECREF(ip);
+    Py_XDECREF(subnet);
+    Py_XDECREF(mac);
+    Py_XDECREF(manufacturer);
+    Py_XDECREF(model);
+    Py_XDECREF(specific_information);
+    Py_XDECREF(device_version);
+    Py_XDECREF(serial_number);
+    Py_XDECREF(user_name);
+    Py_XDECREF(pixel_type);
+    Py_XDECREF(pixel_depth);
 
-    PyList_Append(list, dict);
-
-    Py_DECREF(dict);
+    if (PyErr_Occurred()) {
+        Py_DECREF(dict);
+        return NULL;
+    }
 
-    return SVGigE_SUCCESS;
+    return dict;
 }
 
-static PyObject *svs_core_camera_list(PyObject *self, PyObject *args) {
-    unsigned int adapters[MAX_NETWORK_ADAPTERS] = {0};
-    PyObject *list;
-    int ret;
+/*
+ * Discover cameras on all adapters at once
+ *
+ * Each adapter is searched by its own thread, with the GIL released, so
+ * discovery takes one timeout regardless of the number of adapters.
+ *
+ * @param timeout   Milliseconds to wait for cameras to answer
+ * @returns list of camera dicts, or NULL on error with exception set
+ */
+static PyObject *discover(int timeout) {
+    struct discovery *discoveries;
+    unsigned int *adapters = NULL;
+    pthread_t *threads;
+    int count, started, ret = SVGigE_SUCCESS;
+    PyObject *list = NULL;
 
-    ret = findNetworkAdapters(adapters, MAX_NETWORK_ADAPTERS);
-    if (ret != SVGigE_SUCCESS) {
-        raise_general_error(ret);
+    count = find_adapters(&adapters);
+    if (count < 0) {
         return NULL;
     }
 
+    discoveries = calloc(count ? count : 1, sizeof(*discoveries));
+    threads = calloc(count ? count : 1, sizeof(*threads));
+    if (!discoveries || !threads) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to allocate discovery");
+        goto out;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    for (int i = 0; i < count; i++) {
+        discoveries[i].adapter = adapters[i];
+        discoveries[i].timeout = timeout;
+    }
+
+    for (started = 0; started < count; started++) {
+        if (pthread_create(&threads[started], NULL, discovery_thread,
+                           &discoveries[started])) {
+            break;
+        }
+    }
+
+    /* Search any adapters whose threads could not be started here */
+    for (int i = started; i < count; i++) {
+        discovery_thread(&discoveries[i]);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Py_END_ALLOW_THREADS
+
     list = PyList_New(0);
+    if (!list) {
+        goto out;
+    }
 
-    for (int i = 0; i < MAX_NETWORK_ADAPTERS && adapters[i]; i++) {
-        ret = discoverCameras(adapters[i], DISCOVERY_TIMEOUT,
-                              camera_discovery_callback, list);
-        switch (ret) {
+    for (int i = 0; i < count; i++) {
+        switch (discoveries[i].ret) {
         case SVGigE_SUCCESS:
         case SVGigE_TL_CAMERA_COMMUNICATION_TIMEOUT:    /* No cameras */
             break;
         default:
-            /* Don't set an exception if one was set in the callback */
-            if (!PyErr_Occurred()) {
-                raise_general_error(ret);
+            if (ret == SVGigE_SUCCESS) {
+                ret = discoveries[i].ret;
             }
-            Py_DECREF(list);
-            return NULL;
+            continue;
+        }
+
+        for (unsigned int j = 0; j < discoveries[i].count; j++) {
+            PyObject *dict = camera_dict(&discoveries[i].cameras[j]);
+
+            if (!dict || PyList_Append(list, dict)) {
+                Py_XDECREF(dict);
+                Py_CLEAR(list);
+                goto out;
+            }
+            Py_DECREF(dict);
         }
     }
 
+    if (ret != SVGigE_SUCCESS) {
+        raise_general_error(ret);
+        Py_CLEAR(list);
+    }
+
+out:
+    if (discoveries) {
+        for (int i = 0; i < count; i++) {
+            free(discoveries[i].cameras);
+        }
+    }
+    free(discoveries);
+    free(threads);
+    free(adapters);
+
     return list;
 }
 
+/*
+ * Copy a camera list, so callers can't modify the cached dicts
+ */
+static PyObject *camera_list_copy(PyObject *list) {
+    Py_ssize_t length = PyList_GET_SIZE(list);
+    PyObject *copy = PyList_New(length);
+
+    if (!copy) {
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < length; i++) {
+        PyObject *dict = PyDict_Copy(PyList_GET_ITEM(list, i));
+
+        if (!dict) {
+            Py_DECREF(copy);
+            return NULL;
+        }
+        PyList_SET_ITEM(copy, i, dict);
+    }
+
+    return copy;
+}
+
+static PyObject *svs_core_camera_list(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"timeout", "max_age", NULL};
+    double timeout = DISCOVERY_TIMEOUT;
+    double max_age = DISCOVERY_MAX_AGE;
+    PyObject *list;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dd", kwlist, &timeout,
+                                     &max_age)) {
+        return NULL;
+    }
+
+    if (timeout < 0 || timeout > INT_MAX/1000) {
+        PyErr_SetString(PyExc_ValueError, "timeout out of range");
+        return NULL;
+    }
+
+    if (discovery_cache && max_age > 0 &&
+            monotonic_time() - discovery_time < max_age) {
+        return camera_list_copy(discovery_cache);
+    }
+
+    list = discover(ceil(1000*timeout));
+    if (!list) {
+        return NULL;
+    }
+
+    Py_XDECREF(discovery_cache);
+    discovery_cache = list;
+    discovery_time = monotonic_time();
+
+    return camera_list_copy(list);
+}
+
+static PyObject *svs_core_clear_camera_cache(PyObject *self, PyObject *args) {
+    Py_CLEAR(discovery_cache);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_set_worker_threads(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"threads", "cpus", "priority", NULL};
+    struct thread_placement placement;
+    PyObject *cpus = NULL;
+    unsigned int threads;
+    int priority = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "I|Oi", kwlist, &threads,
+                                     &cpus, &priority)) {
+        return NULL;
+    }
+
+    if (thread_placement_parse(&placement, cpus, priority)) {
+        return NULL;
+    }
+
+    /* Queued work finishes on the old workers first */
+    Py_BEGIN_ALLOW_THREADS
+    pool_stop();
+    Py_END_ALLOW_THREADS
+
+    if (pool_start(threads, &placement)) {
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *svs_core_worker_threads(PyObject *self, PyObject *args) {
+    return PyLong_FromUnsignedLong(pool_threads());
+}
+
+static PyObject *svs_core_worker_placement(PyObject *self, PyObject *args) {
+    return pool_placement_dict();
+}
+
+/* Set by setup.py for the chosen build profile */
+#ifndef SVS_BUILD_PROFILE
+#define SVS_BUILD_PROFILE   "unknown"
+#endif
+
+#ifndef SVS_BUILD_FLAGS
+#define SVS_BUILD_FLAGS     ""
+#endif
+
+#ifndef SVS_BUILD_LTO
+#define SVS_BUILD_LTO       0
+#endif
+
+static PyObject *svs_core_build_info(PyObject *self, PyObject *args) {
+    PyObject *isa, *march;
+    static const char *targets[] = {
+#ifdef __SSSE3__
+        "ssse3",
+#endif
+#ifdef __SSE4_2__
+        "sse4.2",
+#endif
+#ifdef __AVX__
+        "avx",
+#endif
+#ifdef __AVX2__
+        "avx2",
+#endif
+#ifdef __AVX512F__
+        "avx512f",
+#endif
+#ifdef __ARM_NEON
+        "neon",
+#endif
+        NULL
+    };
+    int optimized = 0;
+
+#ifdef __OPTIMIZE__
+    optimized = 1;
+#endif
+
+#ifdef SVS_BUILD_MARCH
+    march = Py_BuildValue("s", SVS_BUILD_MARCH);
+#else
+    march = Py_None;
+    Py_INCREF(march);
+#endif
+    if (!march) {
+        return NULL;
+    }
+
+    isa = PyList_New(0);
+    if (!isa) {
+        Py_DECREF(march);
+        return NULL;
+    }
+
+    for (const char **target = targets; *target; target++) {
+        PyObject *name = Py_BuildValue("s", *target);
+
+        if (!name || PyList_Append(isa, name)) {
+            Py_XDECREF(name);
+            Py_DECREF(isa);
+            Py_DECREF(march);
+            return NULL;
+        }
+        Py_DECREF(name);
+    }
+
+    return Py_BuildValue("{sssssssOsOsNsNsOs{ssss}}",
+                         "profile", SVS_BUILD_PROFILE,
+                         "flags", SVS_BUILD_FLAGS,
+                         "compiler", __VERSION__,
+                         "optimized", optimized ? Py_True : Py_False,
+                         "lto", SVS_BUILD_LTO ? Py_True : Py_False,
+                         "march", march,
+                         "isa", isa,
+                         "multiversioned", KERNEL_CLONED ? Py_True : Py_False,
+                         "kernels",
+                            "unpack12", unpack12_kernel,
+                            "convert", convert_kernel());
+}
+
+/* Buffers arrive as bytes-like objects, or old style buffers on Python 2 */
+#if PY_MAJOR_VERSION >= 3
+#define BUFFER_FORMAT   "y*"
+#else
+#define BUFFER_FORMAT   "s*"
+#endif
+
+static PyObject *svs_core_compress(PyObject *self, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"data", "pixel_type", "width", "height", NULL};
+    unsigned int pixel_type, width, height;
+    size_t bits, length;
+    PyObject *compressed;
+    Py_buffer data;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, BUFFER_FORMAT "III", kwlist,
+                                     &data, &pixel_type, &width, &height)) {
+        return NULL;
+    }
+
+    bits = (pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16;
+    if ((size_t) data.len != (size_t) width*height*bits/8) {
+        PyErr_Format(PyExc_ValueError,
+                     "data is %zd bytes, not a %ux%u image of pixel type %#x",
+                     data.len, width, height, pixel_type);
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    compressed = PyBytes_FromStringAndSize(NULL,
+            codec_bound(pixel_type, width, height));
+    if (!compressed) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    length = codec_encode(data.buf, pixel_type, width, height,
+                          PyBytes_AS_STRING(compressed));
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&data);
+
+    if (!length) {
+        Py_DECREF(compressed);
+        PyErr_Format(SVSError, "Unsupported pixel type %#x", pixel_type);
+        return NULL;
+    }
+
+    if (_PyBytes_Resize(&compressed, length)) {
+        return NULL;
+    }
+
+    return compressed;
+}
+
+static PyObject *svs_core_decompress(PyObject *self, PyObject *args) {
+    PyObject *raw;
+    Py_buffer data;
+    size_t length;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, BUFFER_FORMAT, &data)) {
+        return NULL;
+    }
+
+    length = codec_raw_length(data.buf, data.len);
+    if (!length) {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "Not a compressed image");
+        return NULL;
+    }
+
+    raw = PyBytes_FromStringAndSize(NULL, length);
+    if (!raw) {
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = codec_decode(data.buf, data.len, PyBytes_AS_STRING(raw), length);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&data);
+
+    if (ret) {
+        Py_DECREF(raw);
+        PyErr_SetString(PyExc_ValueError, "Invalid compressed image");
+        return NULL;
+    }
+
+    return raw;
+}
+
 PyMethodDef svs_coreMethods[] = {
-    {"camera_list", svs_core_camera_list, METH_VARARGS,
-        "camera_list() -> list of cameras available\n\n"
+    {"camera_list", (PyCFunction) svs_core_camera_list, METH_VARARGS | METH_KEYWORDS,
+        "camera_list(timeout=1.0, max_age=5.0) -> list of cameras available\n\n"
         "Gets information on all available cameras, including camera handle,\n"
         "which can be used to select a camera to open.\n\n"
+        "All network adapters are searched at once, with the GIL released.\n"
+        "Results are cached, and reused while younger than max_age.\n\n"
+        "Arguments:\n"
+        "    timeout (optional): Seconds to wait for cameras to answer.\n"
+        "    max_age (optional): Seconds a cached result may be reused.\n"
+        "        Zero always searches again.\n\n"
         "Returns:\n"
         "    List of dictionaries with information for each available camera.\n\n"
         "Raises:\n"
-        "    SVSError: An unknown error occured in the uEye SDK."
+        "    SVSError: An unknown error occured in the SVGigE SDK."
+    },
+    {"clear_camera_cache", svs_core_clear_camera_cache, METH_NOARGS,
+        "clear_camera_cache()\n\n"
+        "Forget cached camera_list() results, so the next call searches again."
+    },
+    {"set_worker_threads", (PyCFunction) svs_core_set_worker_threads, METH_VARARGS | METH_KEYWORDS,
+        "set_worker_threads(threads, cpus=None, priority=0)\n\n"
+        "Size the worker pool shared by every camera.\n\n"
+        "With workers, the stream callback only copies each raw image, and\n"
+        "the workers unpack, demosaic and decimate it, so a slow image does\n"
+        "not hold up the next.  Images still come out of next() in order.\n"
+        "Large images are split between workers.  Work already queued\n"
+        "finishes first when the pool is resized.\n\n"
+        "Arguments:\n"
+        "    threads: Worker threads, or 0 to convert on the callback and\n"
+        "        next() threads, as by default.\n"
+        "    cpus (optional): Sequence of CPU numbers to pin workers to.\n"
+        "    priority (optional): SCHED_FIFO priority for workers, or 0."
+    },
+    {"worker_threads", svs_core_worker_threads, METH_NOARGS,
+        "worker_threads() -> int\n\n"
+        "Number of worker threads, 0 if the pool is off."
+    },
+    {"worker_placement", svs_core_worker_placement, METH_NOARGS,
+        "worker_placement() -> dict\n\n"
+        "CPU placement of the workers, as Camera.placement, with the error\n"
+        "of the last worker that failed to place itself."
+    },
+    {"build_info", svs_core_build_info, METH_NOARGS,
+        "build_info() -> dict\n\n"
+        "How this module was built, and which kernels it runs.\n\n"
+        "Returns:\n"
+        "    Dictionary of:\n"
+        "        profile: Build profile from setup.py, 'release' or 'debug'\n"
+        "        flags: Compiler flags added by the profile\n"
+        "        compiler: Compiler version\n"
+        "        optimized: Whether compiled with optimization\n"
+        "        lto: Whether link time optimized\n"
+        "        march: Target CPU passed in SVS_MARCH, or None\n"
+        "        isa: Instruction sets the whole build may assume\n"
+        "        multiversioned: Whether hot kernels are built for several\n"
+        "            instruction sets, and chosen for this CPU at load\n"
+        "        kernels: Dictionary of the instruction set in use by each\n"
+        "            kernel: unpack12 (12-bit unpacking) and convert\n"
+        "            (demosaicing, mono8 and preview decimation)"
+    },
+    {"compress", (PyCFunction) svs_core_compress, METH_VARARGS | METH_KEYWORDS,
+        "compress(data, pixel_type, width, height) -> bytes\n\n"
+        "Losslessly compress a raw camera image.\n\n"
+        "Uses the codec of record(compress=True) and publish(compress=True),\n"
+        "running on the worker pool if it is started.  Suits forwarding raw\n"
+        "images to other hosts.\n\n"
+        "Arguments:\n"
+        "    data: Raw image, as bytes or a uint8 array, such as from\n"
+        "        svs.Recording or a native callback.  12-bit images stay\n"
+        "        packed.\n"
+        "    pixel_type: GVSP pixel type of data.\n"
+        "    width, height: Image size.\n\n"
+        "Raises:\n"
+        "    ValueError: data is not the size of such an image.\n"
+        "    SVSError: The pixel type is not supported."
+    },
+    {"decompress", svs_core_decompress, METH_VARARGS,
+        "decompress(data) -> bytes\n\n"
+        "Decompress an image from compress(), or stored by a compressed\n"
+        "recording, back to the exact raw camera data.\n\n"
+        "Raises:\n"
+        "    ValueError: data is not a valid compressed image."
     },
     {NULL, NULL, 0, NULL}
 };
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Camera connection monitoring
+ *
+ * A camera that misses heartbeats drops the connection, which the SDK
+ * reports to the stream callback.  The SDK can't be closed from its own
+ * callback, so a thread closes the stale stream and camera, then tries to
+ * open the camera again every interval seconds.  Once it answers, the
+ * cached settings are written back and a new stream feeds the same
+ * queues, so next() waits out the outage rather than failing.  A monitor
+ * that gives up ends the queues, so that nothing waits for images that
+ * will never come.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <libsvgige/svgige.h>
+#include "svs_core.h"
+
+static double monitor_time(clockid_t clock) {
+    struct timespec now;
+
+    clock_gettime(clock, &now);
+
+    return now.tv_sec + 1e-9*now.tv_nsec;
+}
+
+static int monitor_running(struct camera_monitor *monitor) {
+    return __atomic_load_n(&monitor->running, __ATOMIC_ACQUIRE);
+}
+
+static void monitor_error(struct camera_monitor *monitor, const char *format, ...) {
+    va_list args;
+
+    pthread_mutex_lock(&monitor->lock);
+    va_start(args, format);
+    vsnprintf(monitor->error, sizeof(monitor->error), format, args);
+    va_end(args);
+    pthread_mutex_unlock(&monitor->lock);
+}
+
+static void monitor_sdk_error(struct camera_monitor *monitor, const char *what,
+                              int ret) {
+    const char *message;
+
+    message = getErrorMessage(ret);
+    monitor_error(monitor, "%s: SVGigE SDK error %d: %s", what, ret,
+                  message ? message : "Unknown error");
+}
+
+/*
+ * Keep the message of the pending exception, and clear it
+ *
+ * Requires the GIL.
+ */
+static void monitor_python_error(struct camera_monitor *monitor) {
+    PyObject *type, *value, *traceback, *text, *bytes = NULL;
+    const char *message = NULL;
+
+    PyErr_Fetch(&type, &value, &traceback);
+
+    text = value ? PyObject_Str(value) : NULL;
+    if (text) {
+#if PY_MAJOR_VERSION >= 3
+        bytes = PyUnicode_AsUTF8String(text);
+        message = bytes ? PyBytes_AsString(bytes) : NULL;
+#else
+        message = PyString_AsString(text);
+#endif
+    }
+
+    monitor_error(monitor, "Unable to resume stream: %s",
+                  message ? message : "Unknown error");
+
+    Py_XDECREF(bytes);
+    Py_XDECREF(text);
+    Py_XDECREF(type);
+    Py_XDECREF(value);
+    Py_XDECREF(traceback);
+    PyErr_Clear();
+}
+
+/*
+ * Wait up to seconds, unless stopped first
+ *
+ * @returns nonzero if still running
+ */
+static int monitor_wait(struct camera_monitor *monitor, double seconds) {
+    struct timespec deadline;
+    double until = monitor_time(CLOCK_REALTIME) + seconds;
+    int running;
+
+    deadline.tv_sec = until;
+    deadline.tv_nsec = 1e9*(until - deadline.tv_sec);
+
+    pthread_mutex_lock(&monitor->lock);
+    while (monitor->running && pthread_cond_timedwait(&monitor->cond,
+                &monitor->lock, &deadline) != ETIMEDOUT);
+    running = monitor->running;
+    pthread_mutex_unlock(&monitor->lock);
+
+    return running;
+}
+
+/*
+ * Take the lost camera out of service and close its SDK handles
+ *
+ * @returns 0 on success, negative if the camera isn't streaming, so there
+ *          is nothing to resume
+ */
+static int monitor_release(svs_core_Camera *self, struct config_cache *cache) {
+    PyGILState_STATE gil;
+    Camera_handle handle;
+    Stream_handle stream;
+
+    gil = PyGILState_Ensure();
+
+    if (!monitor_running(&self->monitor) || self->ready != READY) {
+        PyGILState_Release(gil);
+        return -1;
+    }
+
+    /* Python code now leaves the stream and clock to the monitor */
+    self->ready = DISCONNECTED;
+    handle = self->handle;
+    stream = self->stream;
+    *cache = self->config;
+
+    PyGILState_Release(gil);
+
+    /* Release a callback blocked on a full queue, so the stream can close */
+    frame_queue_close(&self->queue);
+    clock_sync_stop(&self->clock);
+
+    closeStream(stream);
+    closeCamera(handle);
+
+    frame_queue_open(&self->queue);
+
+    return 0;
+}
+
+/*
+ * Stop waiting for the lost camera
+ *
+ * Consumers take the images left, then get SVSClosedError, or end
+ * iteration.
+ */
+static void monitor_give_up(svs_core_Camera *self) {
+    struct camera_monitor *monitor = &self->monitor;
+
+    pthread_mutex_lock(&monitor->lock);
+    monitor->state = MONITOR_DISCONNECTED;
+    pthread_mutex_unlock(&monitor->lock);
+
+    frame_queue_end(&self->queue);
+    frame_queue_end(&self->preview);
+    frame_queue_end(&self->grab);
+}
+
+/*
+ * Open the camera again, restore its settings and resume streaming
+ *
+ * @returns 0 on success, negative on failure with the reason kept
+ */
+static int monitor_reconnect(svs_core_Camera *self, struct config_cache *cache) {
+    struct camera_monitor *monitor = &self->monitor;
+    PyGILState_STATE gil;
+    Camera_handle handle;
+    int ret;
+
+    /* Only failures of this attempt are reported once it succeeds */
+    pthread_mutex_lock(&monitor->lock);
+    monitor->error[0] = '\0';
+    pthread_mutex_unlock(&monitor->lock);
+
+    ret = openCamera(&handle, self->ip, self->source_ip,
+                     self->heartbeat_timeout, self->multicast);
+    if (ret != SVGigE_SUCCESS) {
+        monitor_sdk_error(monitor, "Unable to reconnect", ret);
+        return -1;
+    }
+
+    /* Stream with what the camera accepts, rather than not at all */
+    ret = config_restore(self, handle, cache);
+    if (ret != SVGigE_SUCCESS) {
+        monitor_sdk_error(monitor, "Unable to restore settings", ret);
+    }
+
+    if (clock_sync_start(&self->clock, handle, self->tick_frequency,
+                         self->clock.interval)) {
+        monitor_error(monitor, "Unable to synchronize with camera clock");
+        closeCamera(handle);
+        return -1;
+    }
+
+    gil = PyGILState_Ensure();
+
+    if (!monitor_running(monitor)) {
+        ret = -1;
+    }
+    else {
+        self->config = *cache;
+        ret = svs_core_Camera_resume(self, handle);
+        if (ret) {
+            monitor_python_error(monitor);
+        }
+    }
+
+    PyGILState_Release(gil);
+
+    if (ret) {
+        clock_sync_stop(&self->clock);
+        closeCamera(handle);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Handle one loss, until reconnected or stopped
+ */
+static void monitor_recover(svs_core_Camera *self) {
+    struct camera_monitor *monitor = &self->monitor;
+    struct config_cache cache;
+    double downtime;
+
+    if (monitor_release(self, &cache)) {
+        return;
+    }
+
+    if (monitor->interval <= 0) {
+        monitor_give_up(self);
+        return;
+    }
+
+    pthread_mutex_lock(&monitor->lock);
+    monitor->state = MONITOR_RECONNECTING;
+    pthread_mutex_unlock(&monitor->lock);
+
+    /* The camera may only have missed heartbeats, so try at once */
+    while (monitor_reconnect(self, &cache)) {
+        pthread_mutex_lock(&monitor->lock);
+        monitor->attempts++;
+        pthread_mutex_unlock(&monitor->lock);
+
+        if (!monitor_wait(monitor, monitor->interval)) {
+            monitor_give_up(self);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&monitor->lock);
+    downtime = monitor_time(CLOCK_MONOTONIC) - monitor->lost_mono;
+    monitor->state = MONITOR_CONNECTED;
+    monitor->reconnects++;
+    monitor->attempts = 0;
+    monitor->last_downtime = downtime;
+    monitor->downtime += downtime;
+    pthread_mutex_unlock(&monitor->lock);
+}
+
+static void *monitor_thread(void *arg) {
+    svs_core_Camera *self = arg;
+    struct camera_monitor *monitor = &self->monitor;
+
+    pthread_mutex_lock(&monitor->lock);
+
+    while (monitor->running) {
+        if (!monitor->lost) {
+            pthread_cond_wait(&monitor->cond, &monitor->lock);
+            continue;
+        }
+
+        monitor->lost = 0;
+
+        pthread_mutex_unlock(&monitor->lock);
+        monitor_recover(self);
+        pthread_mutex_lock(&monitor->lock);
+    }
+
+    pthread_mutex_unlock(&monitor->lock);
+
+    return NULL;
+}
+
+void monitor_init(struct camera_monitor *monitor) {
+    pthread_mutex_init(&monitor->lock, NULL);
+    pthread_cond_init(&monitor->cond, NULL);
+    monitor->running = 0;
+    monitor->lost = 0;
+    monitor->interval = 0;
+    monitor->state = MONITOR_CONNECTED;
+    monitor->disconnects = 0;
+    monitor->reconnects = 0;
+    monitor->attempts = 0;
+    monitor->lost_time = 0;
+    monitor->lost_mono = 0;
+    monitor->downtime = 0;
+    monitor->last_downtime = 0;
+    monitor->error[0] = '\0';
+}
+
+int monitor_start(svs_core_Camera *self, double interval) {
+    struct camera_monitor *monitor = &self->monitor;
+
+    monitor->interval = interval;
+    monitor->running = 1;
+
+    if (pthread_create(&monitor->thread, NULL, monitor_thread, self)) {
+        monitor->running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void monitor_stop(struct camera_monitor *monitor) {
+    if (!monitor->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&monitor->lock);
+    __atomic_store_n(&monitor->running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&monitor->cond);
+    pthread_mutex_unlock(&monitor->lock);
+
+    pthread_join(monitor->thread, NULL);
+}
+
+void monitor_lost(struct camera_monitor *monitor) {
+    pthread_mutex_lock(&monitor->lock);
+
+    if (monitor->state == MONITOR_CONNECTED) {
+        monitor->state = MONITOR_DISCONNECTED;
+        monitor->disconnects++;
+        monitor->attempts = 0;
+        monitor->lost_time = monitor_time(CLOCK_REALTIME);
+        monitor->lost_mono = monitor_time(CLOCK_MONOTONIC);
+        monitor->lost = 1;
+        pthread_cond_signal(&monitor->cond);
+    }
+
+    pthread_mutex_unlock(&monitor->lock);
+}
+
+PyObject *monitor_dict(struct camera_monitor *monitor) {
+    unsigned long long disconnects, reconnects;
+    double downtime, last_downtime, lost_time;
+    unsigned int attempts;
+    char error[sizeof(monitor->error)];
+    PyObject *lost;
+    int state;
+
+    pthread_mutex_lock(&monitor->lock);
+    state = monitor->state;
+    disconnects = monitor->disconnects;
+    reconnects = monitor->reconnects;
+    attempts = monitor->attempts;
+    lost_time = monitor->lost_time;
+    downtime = monitor->downtime;
+    last_downtime = monitor->last_downtime;
+    if (state != MONITOR_CONNECTED) {
+        /* Include the outage so far */
+        last_downtime = monitor_time(CLOCK_MONOTONIC) - monitor->lost_mono;
+        downtime += last_downtime;
+    }
+    memcpy(error, monitor->error, sizeof(error));
+    pthread_mutex_unlock(&monitor->lock);
+
+    if (disconnects) {
+        lost = PyFloat_FromDouble(lost_time);
+        if (!lost) {
+            return NULL;
+        }
+    }
+    else {
+        Py_INCREF(Py_None);
+        lost = Py_None;
+    }
+
+    return Py_BuildValue("{sNsNsKsKsIsdsdsNsz}",
+            "connected", PyBool_FromLong(state == MONITOR_CONNECTED),
+            "reconnecting", PyBool_FromLong(state == MONITOR_RECONNECTING),
+            "disconnects", disconnects,
+            "reconnects", reconnects,
+            "attempts", attempts,
+            "downtime", downtime,
+            "last_downtime", last_downtime,
+            "lost_time", lost,
+            "error", error[0] ? error : NULL);
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * CPU and memory placement
+ *
+ * Frame data is mapped directly, rather than taken from malloc(), so it
+ * can be bound to the NUMA node of the receiving NIC and backed by huge
+ * pages.  The stream thread belongs to the SDK, so the callback applies
+ * its own CPU affinity and scheduling policy on its first image.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/mempolicy.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "svs_core.h"
+
+/* Frames at least this large try huge pages */
+#define HUGE_PAGE_SIZE  (2*1024*1024)
+
+/* Largest NUMA node number handled */
+#define NUMA_MAX_NODES  1024
+
+#define LONG_BITS       (8*sizeof(unsigned long))
+
+static size_t round_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
+
+int numa_node_of_ip(uint32_t ip) {
+    struct ifaddrs *addrs, *addr;
+    char path[64 + IFNAMSIZ];
+    int node = -1;
+    FILE *file;
+
+    if (getifaddrs(&addrs)) {
+        return -1;
+    }
+
+    for (addr = addrs; addr; addr = addr->ifa_next) {
+        if (!addr->ifa_addr || addr->ifa_addr->sa_family != AF_INET ||
+                ntohl(((struct sockaddr_in *) addr->ifa_addr)->sin_addr.s_addr) != ip) {
+            continue;
+        }
+
+        /* Virtual interfaces have no device, and so no node */
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+                 addr->ifa_name);
+        file = fopen(path, "r");
+        if (file) {
+            if (fscanf(file, "%d", &node) != 1) {
+                node = -1;
+            }
+            fclose(file);
+        }
+        break;
+    }
+
+    freeifaddrs(addrs);
+
+    return node;
+}
+
+void *frame_data_alloc(size_t *size, int node) {
+    size_t length = round_up(*size, sysconf(_SC_PAGESIZE));
+    unsigned long mask[NUMA_MAX_NODES/LONG_BITS];
+    void *data = MAP_FAILED;
+
+    if (length >= HUGE_PAGE_SIZE) {
+        /* Reserved huge pages first, if the system has any */
+        data = mmap(NULL, round_up(length, HUGE_PAGE_SIZE),
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) {
+            length = round_up(length, HUGE_PAGE_SIZE);
+        }
+    }
+
+    if (data == MAP_FAILED) {
+        data = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return NULL;
+        }
+
+        /* Otherwise transparent huge pages, where enabled */
+        if (length >= HUGE_PAGE_SIZE) {
+            madvise(data, length, MADV_HUGEPAGE);
+        }
+    }
+
+    /* Before first touch, so pages are faulted in on the node */
+    if (node >= 0 && node < NUMA_MAX_NODES) {
+        memset(mask, 0, sizeof(mask));
+        mask[node/LONG_BITS] |= 1UL << (node % LONG_BITS);
+        syscall(SYS_mbind, data, length, MPOL_PREFERRED, mask, NUMA_MAX_NODES, 0);
+    }
+
+    *size = length;
+
+    return data;
+}
+
+void frame_data_free(void *data, size_t size) {
+    if (data) {
+        munmap(data, size);
+    }
+}
+
+int thread_place(struct thread_placement *placement) {
+    struct sched_param param;
+    int ret;
+
+    if (placement->cpus_set) {
+        ret = pthread_setaffinity_np(pthread_self(), sizeof(placement->cpus),
+                                     &placement->cpus);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    if (placement->priority) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = placement->priority;
+
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+int thread_placement_parse(struct thread_placement *placement, PyObject *cpus,
+                           int priority) {
+    PyObject *seq;
+    Py_ssize_t i;
+    long cpu;
+
+    memset(placement, 0, sizeof(*placement));
+
+    if (priority < 0 || priority > sched_get_priority_max(SCHED_FIFO)) {
+        PyErr_Format(PyExc_ValueError, "priority must be from 0 to %d",
+                     sched_get_priority_max(SCHED_FIFO));
+        return -1;
+    }
+    placement->priority = priority;
+
+    if (!cpus || cpus == Py_None) {
+        return 0;
+    }
+
+    seq = PySequence_Fast(cpus, "cpus must be a sequence of CPU numbers");
+    if (!seq) {
+        return -1;
+    }
+
+    CPU_ZERO(&placement->cpus);
+
+    for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        cpu = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (cpu == -1 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return -1;
+        }
+
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            PyErr_Format(PyExc_ValueError, "CPU %ld out of range", cpu);
+            Py_DECREF(seq);
+            return -1;
+        }
+
+        CPU_SET(cpu, &placement->cpus);
+    }
+
+    Py_DECREF(seq);
+
+    if (!CPU_COUNT(&placement->cpus)) {
+        PyErr_SetString(PyExc_ValueError, "cpus must not be empty");
+        return -1;
+    }
+
+    placement->cpus_set = 1;
+
+    return 0;
+}
+
+PyObject *thread_placement_dict(struct thread_placement *placement) {
+    PyObject *cpus, *error;
+    int ret = __atomic_load_n(&placement->error, __ATOMIC_RELAXED);
+
+    if (placement->cpus_set) {
+        cpus = PyList_New(0);
+        if (!cpus) {
+            return NULL;
+        }
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            PyObject *item;
+
+            if (!CPU_ISSET(cpu, &placement->cpus)) {
+                continue;
+            }
+
+            item = PyLong_FromLong(cpu);
+            if (!item || PyList_Append(cpus, item)) {
+                Py_XDECREF(item);
+                Py_DECREF(cpus);
+                return NULL;
+            }
+            Py_DECREF(item);
+        }
+    }
+    else {
+        Py_INCREF(Py_None);
+        cpus = Py_None;
+    }
+
+    if (ret) {
+        error = Py_BuildValue("s", strerror(ret));
+        if (!error) {
+            Py_DECREF(cpus);
+            return NULL;
+        }
+    }
+    else {
+        Py_INCREF(Py_None);
+        error = Py_None;
+    }
+
+    return Py_BuildValue("{sNsisN}", "cpus", cpus, "priority",
+                         placement->priority, "error", error);
+}
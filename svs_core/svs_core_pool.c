@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Worker thread pool
+ *
+ * One pool is shared by every camera.  Each worker has a deque of
+ * tasks: it takes its own newest task first, and when idle, steals the
+ * oldest task of another worker.  Threads outside the pool, such as the
+ * SDK stream threads, hand tasks out round robin.
+ *
+ * Tasks are intrusive, so submitting never allocates.  The callback
+ * puts each pooled frame on its image queue in order before the work is
+ * done, and consumers wait for the frame at the front, so per-camera
+ * order is kept however the work is spread.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "svs_core.h"
+
+struct pool_deque {
+    pthread_mutex_t     lock;
+    struct pool_task    *top;       /* Oldest, stolen first */
+    struct pool_task    *bottom;    /* Newest, run first by the owner */
+};
+
+struct pool_worker {
+    struct pool_deque   deque;
+    pthread_t           thread;
+};
+
+static struct {
+    struct pool_worker  *workers;
+    unsigned int        count;
+    int                 running;    /* Accepting tasks */
+    int                 users;      /* Threads inside pool_submit() */
+    int                 stopping;   /* Workers exit once out of tasks */
+    unsigned int        next;       /* Worker for the next outside task */
+    unsigned int        queued;     /* Tasks waiting in deques */
+    unsigned int        idle;       /* Workers waiting on cond */
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    struct thread_placement placement;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Worker running on this thread, or NULL outside the pool */
+static __thread struct pool_worker *pool_self;
+
+static int futex(int *addr, int op, int val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static void deque_push(struct pool_deque *deque, struct pool_task *task) {
+    pthread_mutex_lock(&deque->lock);
+
+    task->next = NULL;
+    task->prev = deque->bottom;
+    if (deque->bottom) {
+        deque->bottom->next = task;
+    }
+    else {
+        deque->top = task;
+    }
+    deque->bottom = task;
+    __atomic_store_n(&task->deque, deque, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/*
+ * Unlink a task from its deque, with the deque locked
+ */
+static void deque_unlink(struct pool_deque *deque, struct pool_task *task) {
+    if (task->prev) {
+        task->prev->next = task->next;
+    }
+    else {
+        deque->top = task->next;
+    }
+
+    if (task->next) {
+        task->next->prev = task->prev;
+    }
+    else {
+        deque->bottom = task->prev;
+    }
+
+    __atomic_store_n(&task->deque, NULL, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Take the newest task, for the owner, or the oldest, for thieves
+ */
+static struct pool_task *deque_take(struct pool_deque *deque, int newest) {
+    struct pool_task *task;
+
+    pthread_mutex_lock(&deque->lock);
+
+    task = newest ? deque->bottom : deque->top;
+    if (task) {
+        deque_unlink(deque, task);
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+
+    return task;
+}
+
+static struct pool_task *pool_find(struct pool_worker *self) {
+    unsigned int start = self - pool.workers;
+    struct pool_task *task;
+
+    task = deque_take(&self->deque, 1);
+    if (task) {
+        return task;
+    }
+
+    for (unsigned int i = 1; i < pool.count; i++) {
+        task = deque_take(&pool.workers[(start + i) % pool.count].deque, 0);
+        if (task) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+static void *pool_thread(void *arg) {
+    struct pool_worker *self = arg;
+    struct pool_task *task;
+
+    pool_self = self;
+
+    /* Failures are reported as for the stream callback */
+    if (pool.placement.cpus_set || pool.placement.priority) {
+        int error = thread_place(&pool.placement);
+
+        if (error) {
+            __atomic_store_n(&pool.placement.error, error, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (;;) {
+        task = pool_find(self);
+        if (task) {
+            task->run(task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+
+        /* Paired with the queued and idle accesses in pool_submit() */
+        __atomic_add_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST)) {
+            if (pool.stopping) {
+                __atomic_sub_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+                pthread_mutex_unlock(&pool.lock);
+                break;
+            }
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+        __atomic_sub_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    return NULL;
+}
+
+int pool_submit(struct pool_task *task) {
+    struct pool_worker *worker;
+    int ret = -1;
+
+    /* Paired with the exchange in pool_stop() */
+    __atomic_add_fetch(&pool.users, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&pool.running, __ATOMIC_SEQ_CST)) {
+        worker = pool_self;
+        if (!worker) {
+            worker = &pool.workers[__atomic_fetch_add(&pool.next, 1,
+                                   __ATOMIC_RELAXED) % pool.count];
+        }
+
+        __atomic_add_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+        deque_push(&worker->deque, task);
+
+        if (__atomic_load_n(&pool.idle, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&pool.lock);
+            pthread_cond_signal(&pool.cond);
+            pthread_mutex_unlock(&pool.lock);
+        }
+
+        ret = 0;
+    }
+
+    __atomic_sub_fetch(&pool.users, 1, __ATOMIC_SEQ_CST);
+
+    return ret;
+}
+
+int pool_reclaim(struct pool_task *task) {
+    struct pool_deque *deque;
+
+    for (;;) {
+        deque = __atomic_load_n(&task->deque, __ATOMIC_ACQUIRE);
+        if (!deque) {
+            return 0;
+        }
+
+        pthread_mutex_lock(&deque->lock);
+        if (task->deque == deque) {
+            deque_unlink(deque, task);
+            pthread_mutex_unlock(&deque->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+}
+
+unsigned int pool_threads(void) {
+    return __atomic_load_n(&pool.running, __ATOMIC_ACQUIRE) ? pool.count : 0;
+}
+
+int pool_start(unsigned int threads, struct thread_placement *placement) {
+    unsigned int started;
+    int ret;
+
+    if (pool.workers) {
+        PyErr_SetString(PyExc_RuntimeError, "Worker pool already running");
+        return -1;
+    }
+
+    if (!threads) {
+        return 0;
+    }
+
+    pool.workers = calloc(threads, sizeof(*pool.workers));
+    if (!pool.workers) {
+        PyErr_NoMemory();
+        return -1;
+    }
+
+    pool.count = threads;
+    pool.stopping = 0;
+    pool.placement = *placement;
+    pool.placement.error = 0;
+
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_mutex_init(&pool.workers[i].deque.lock, NULL);
+    }
+
+    for (started = 0; started < threads; started++) {
+        ret = pthread_create(&pool.workers[started].thread, NULL, pool_thread,
+                             &pool.workers[started]);
+        if (ret) {
+            break;
+        }
+    }
+
+    if (started < threads) {
+        pool.count = started;
+        pool_stop();
+        errno = ret;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+
+    __atomic_store_n(&pool.running, 1, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+void pool_stop(void) {
+    if (!pool.workers) {
+        return;
+    }
+
+    /* Later tasks run on their submitters */
+    __atomic_store_n(&pool.running, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pool.users, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+
+    /* Workers finish every task already queued before exiting */
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (unsigned int i = 0; i < pool.count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    /* Only once no worker can still be stealing */
+    for (unsigned int i = 0; i < pool.count; i++) {
+        pthread_mutex_destroy(&pool.workers[i].deque.lock);
+    }
+
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.count = 0;
+}
+
+PyObject *pool_placement_dict(void) {
+    return thread_placement_dict(&pool.placement);
+}
+
+/* Parallel loops */
+
+struct pool_loop {
+    void            (*fn)(void *arg, unsigned int i);
+    void            *arg;
+    unsigned int    count;
+    unsigned int    next;           /* Next iteration to take */
+    int             remaining;      /* Helpers not yet finished */
+};
+
+struct pool_loop_task {
+    struct pool_task    task;       /* First, as tasks are cast */
+    struct pool_loop    *loop;
+};
+
+/* Run iterations until none are left */
+static void pool_loop_drain(struct pool_loop *loop) {
+    unsigned int i;
+
+    while ((i = __atomic_fetch_add(&loop->next, 1, __ATOMIC_RELAXED)) <
+           loop->count) {
+        loop->fn(loop->arg, i);
+    }
+}
+
+static void pool_loop_run(struct pool_task *task) {
+    struct pool_loop *loop = ((struct pool_loop_task *) task)->loop;
+    int *remaining = &loop->remaining;
+
+    pool_loop_drain(loop);
+
+    /* The loop is on the waiter's stack, and gone once the count drops */
+    if (!__atomic_sub_fetch(remaining, 1, __ATOMIC_ACQ_REL)) {
+        futex(remaining, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+void pool_for(void (*fn)(void *arg, unsigned int i), void *arg,
+              unsigned int count) {
+    struct pool_loop_task tasks[POOL_FOR_HELPERS];
+    struct pool_loop loop = {
+        .fn = fn,
+        .arg = arg,
+        .count = count,
+    };
+    unsigned int helpers = pool_threads();
+    int left;
+
+    if (helpers > POOL_FOR_HELPERS) {
+        helpers = POOL_FOR_HELPERS;
+    }
+    if (count && helpers > count - 1) {
+        helpers = count - 1;
+    }
+
+    loop.remaining = helpers;
+
+    for (unsigned int i = 0; i < helpers; i++) {
+        tasks[i].task.run = pool_loop_run;
+        tasks[i].loop = &loop;
+
+        if (pool_submit(&tasks[i].task)) {
+            pool_loop_run(&tasks[i].task);
+        }
+    }
+
+    pool_loop_drain(&loop);
+
+    /* Helpers no worker has started have nothing left to do */
+    for (unsigned int i = 0; i < helpers; i++) {
+        if (pool_reclaim(&tasks[i].task)) {
+            pool_loop_run(&tasks[i].task);
+        }
+    }
+
+    while ((left = __atomic_load_n(&loop.remaining, __ATOMIC_ACQUIRE))) {
+        futex(&loop.remaining, FUTEX_WAIT_PRIVATE, left);
+    }
+}
+
+/* Frame work */
+
+static void frame_work_run(struct pool_task *task) {
+    struct frame_work *work = (struct frame_work *) task;
+    struct frame *frame = (struct frame *) ((char *) work - offsetof(struct frame, work));
+    uint64_t start = stats_now();
+    int ret;
+
+    if (work->factor) {
+        ret = decimate_frame(work->raw, work->pixel_type, work->width,
+                             work->height, work->factor, frame->data);
+    }
+    else {
+        ret = convert_frame(work->raw, work->pixel_type, work->width,
+                            work->height, work->format, work->shift,
+                            frame->data);
+        stats_record(work->stats, STATS_UNPACK, start);
+    }
+
+    /* Consumers report the failure */
+    if (ret) {
+        frame->length = 0;
+    }
+
+    /* Paired with the acquire in frame_work_wait() */
+    if (__atomic_exchange_n(&work->pending, 0, __ATOMIC_RELEASE) > 1) {
+        futex(&work->pending, FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+}
+
+void frame_work_submit(struct frame *frame) {
+    struct frame_work *work = &frame->work;
+
+    work->task.run = frame_work_run;
+    work->pending = 1;
+
+    if (pool_submit(&work->task)) {
+        frame_work_run(&work->task);
+    }
+}
+
+int frame_work_pending(struct frame *frame) {
+    return __atomic_load_n(&frame->work.pending, __ATOMIC_ACQUIRE) != 0;
+}
+
+void frame_work_wait(struct frame *frame) {
+    int *pending = &frame->work.pending;
+    int expected;
+
+    /* Run it here if no worker has started it yet */
+    if (pool_reclaim(&frame->work.task)) {
+        frame_work_run(&frame->work.task);
+        return;
+    }
+
+    for (;;) {
+        expected = __atomic_load_n(pending, __ATOMIC_ACQUIRE);
+        if (!expected) {
+            return;
+        }
+
+        /* Tell the worker someone is waiting */
+        if (expected == 1 &&
+                !__atomic_compare_exchange_n(pending, &expected, 2, 0,
+                                             __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+
+        futex(pending, FUTEX_WAIT_PRIVATE, 2);
+    }
+}
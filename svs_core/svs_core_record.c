@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Direct to disk recording
+ *
+ * The callback copies raw images into page aligned frames, which a
+ * writer thread appends to the data file in batches with pwritev(),
+ * through O_DIRECT so the page cache is not filled with image data.
+ * Each image written gets a fixed size record in the index file.
+ * Compressed recordings are coded by the writer thread, with the worker
+ * pool, so the callback still only copies.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "svs_core.h"
+
+void recorder_init(struct recorder *rec) {
+    memset(rec, 0, sizeof(*rec));
+    rec->fd = -1;
+    rec->index_fd = -1;
+}
+
+/*
+ * Open the data file, with O_DIRECT if the filesystem allows it
+ *
+ * @returns file descriptor, or negative on error with errno set
+ */
+static int recorder_open(struct recorder *rec, const char *path) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int fd;
+
+    fd = open(path, flags | O_DIRECT, 0644);
+    if (fd >= 0) {
+        rec->direct = 1;
+        return fd;
+    }
+
+    /* tmpfs and some network filesystems refuse O_DIRECT */
+    if (errno != EINVAL) {
+        return -1;
+    }
+
+    rec->direct = 0;
+    return open(path, flags, 0644);
+}
+
+/*
+ * Write the data file header, and reserve space for the recording
+ *
+ * @returns 0 on success, negative on error with errno set
+ */
+static int recorder_prepare(struct recorder *rec, uint64_t preallocate) {
+    struct record_header *header;
+    ssize_t ret;
+
+    if (preallocate) {
+        ret = fallocate(rec->fd, 0, 0, preallocate);
+        if (!ret) {
+            rec->preallocated = preallocate;
+        }
+        else if (errno != EOPNOTSUPP) {
+            return -1;
+        }
+    }
+
+    /* O_DIRECT writes need an aligned buffer */
+    if (posix_memalign((void **) &header, RECORD_ALIGN, RECORD_ALIGN)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(header, 0, RECORD_ALIGN);
+    memcpy(header->magic, "SVSRAW\0\0", sizeof(header->magic));
+    header->version = RECORD_VERSION;
+    header->align = RECORD_ALIGN;
+    header->codec = rec->codec;
+
+    ret = pwrite(rec->fd, header, RECORD_ALIGN, 0);
+    free(header);
+
+    if (ret != RECORD_ALIGN) {
+        if (ret >= 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+
+    rec->offset = RECORD_ALIGN;
+
+    return 0;
+}
+
+static int recorder_prepare_index(struct recorder *rec) {
+    struct record_index_header header;
+    ssize_t ret;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SVSIDX\0\0", sizeof(header.magic));
+    header.version = RECORD_VERSION;
+    header.record_size = sizeof(struct record_index);
+
+    ret = write(rec->index_fd, &header, sizeof(header));
+    if (ret != sizeof(header)) {
+        if (ret >= 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write all of an iovec array at offset
+ *
+ * @returns 0 on success, or an errno value
+ */
+static int record_pwritev(int fd, struct iovec *iov, int count,
+                          uint64_t offset) {
+    ssize_t ret;
+
+    while (count) {
+        ret = pwritev(fd, iov, count, offset);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (!ret) {
+            return EIO;
+        }
+
+        offset += ret;
+
+        /* Skip what was written, in case of a short write */
+        while (count && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (uint8_t *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Compress a frame into the writer's i-th packed buffer
+ *
+ * @returns bytes of compressed image, or 0 to store the image raw
+ */
+static size_t recorder_pack(struct recorder *rec, unsigned int i,
+                            struct frame *frame) {
+    struct frame_info *info = &frame->info;
+    size_t size;
+    void *data;
+
+    size = RECORD_PADDED(codec_bound(info->pixel_type, info->width,
+                                     info->height));
+    if (rec->packed_size[i] < size) {
+        data = frame_data_alloc(&size, rec->queue.numa_node);
+        if (!data) {
+            return 0;
+        }
+
+        frame_data_free(rec->packed[i], rec->packed_size[i]);
+        rec->packed[i] = data;
+        rec->packed_size[i] = size;
+    }
+
+    return codec_encode(frame->data, info->pixel_type, info->width,
+                        info->height, rec->packed[i]);
+}
+
+/*
+ * Write a batch of frames, and their index records
+ */
+static void recorder_write(struct recorder *rec, unsigned int *batch,
+                           unsigned int count) {
+    struct iovec iov[RECORD_BATCH];
+    struct record_index index[RECORD_BATCH];
+    uint64_t offset = rec->offset, bytes = 0, stored = 0;
+    ssize_t length;
+    size_t coded, padded;
+    void *data;
+    int error;
+
+    memset(index, 0, count*sizeof(*index));
+
+    for (unsigned int i = 0; i < count; i++) {
+        struct frame *frame = &rec->queue.frames[batch[i]];
+
+        data = frame->data;
+        index[i].stored = frame->length;
+        index[i].codec = CODEC_NONE;
+
+        if (rec->codec == CODEC_RICE) {
+            coded = recorder_pack(rec, i, frame);
+            if (coded) {
+                data = rec->packed[i];
+                index[i].stored = coded;
+                index[i].codec = CODEC_RICE;
+            }
+        }
+
+        /* frame_reserve() and recorder_pack() left room for the padding */
+        padded = RECORD_PADDED(index[i].stored);
+        memset((uint8_t *) data + index[i].stored, 0,
+               padded - index[i].stored);
+
+        iov[i].iov_base = data;
+        iov[i].iov_len = padded;
+
+        index[i].offset = offset;
+        index[i].length = frame->length;
+        batch_fill_record(&index[i].info, &frame->info);
+
+        offset += padded;
+        bytes += frame->length;
+        stored += index[i].stored;
+    }
+
+    error = record_pwritev(rec->fd, iov, count, rec->offset);
+    if (error) {
+        __atomic_fetch_add(&rec->write_errors, count, __ATOMIC_RELAXED);
+        __atomic_store_n(&rec->error, error, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec->offset = offset;
+
+    length = write(rec->index_fd, index, count * sizeof(*index));
+    if (length != (ssize_t) (count * sizeof(*index))) {
+        __atomic_store_n(&rec->error, length < 0 ? errno : EIO,
+                         __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_add(&rec->written, count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rec->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&rec->stored, stored, __ATOMIC_RELAXED);
+}
+
+/*
+ * Writer thread
+ *
+ * Takes every image queued, up to RECORD_BATCH, per write.  Runs until
+ * the queue is closed and empty.
+ */
+static void *recorder_thread(void *arg) {
+    struct recorder *rec = arg;
+    struct frame_queue *queue = &rec->queue;
+    struct pollfd pfd = {.fd = queue->event_fd, .events = POLLIN};
+    unsigned int batch[RECORD_BATCH];
+    unsigned int count;
+    eventfd_t events;
+
+    for (;;) {
+        count = 0;
+        while (count < RECORD_BATCH &&
+               !frame_ring_pop(&queue->images, &batch[count])) {
+            count++;
+        }
+
+        if (count) {
+            recorder_write(rec, batch, count);
+
+            for (unsigned int i = 0; i < count; i++) {
+                frame_release(queue, batch[i]);
+            }
+            continue;
+        }
+
+        /* Nothing is queued once closed */
+        if (__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST) &&
+                !frame_ring_length(&queue->images)) {
+            break;
+        }
+
+        /* Clear stale wakeups, then check again before sleeping */
+        eventfd_read(queue->event_fd, &events);
+        if (frame_ring_length(&queue->images) ||
+                __atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)) {
+            continue;
+        }
+
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+    }
+
+    return NULL;
+}
+
+/*
+ * Close the files, keeping the first error
+ */
+static int recorder_close(struct recorder *rec, int error) {
+    if (rec->fd >= 0) {
+        if (rec->preallocated && ftruncate(rec->fd, rec->offset) && !error) {
+            error = errno;
+        }
+        if (fdatasync(rec->fd) && !error) {
+            error = errno;
+        }
+        close(rec->fd);
+        rec->fd = -1;
+    }
+
+    if (rec->index_fd >= 0) {
+        if (fdatasync(rec->index_fd) && !error) {
+            error = errno;
+        }
+        close(rec->index_fd);
+        rec->index_fd = -1;
+    }
+
+    return error;
+}
+
+int recorder_start(struct recorder *rec, const char *path,
+                   unsigned int queue_length, uint64_t preallocate,
+                   int numa_node, int codec) {
+    char *index_path;
+    int ret;
+
+    if (rec->state != RECORDER_IDLE) {
+        PyErr_SetString(PyExc_RuntimeError, "Camera is already recording");
+        return -1;
+    }
+
+    recorder_init(rec);
+    rec->codec = codec;
+
+    /* The writer holds a batch while the callback fills the queue */
+    if (frame_queue_init(&rec->queue, queue_length,
+                         queue_length + RECORD_BATCH + 1)) {
+        frame_queue_destroy(&rec->queue);
+        return -1;
+    }
+
+    /* frame_acquire() must never take images not yet written */
+    rec->queue.overflow_policy = OVERFLOW_DROP_NEWEST;
+    rec->queue.numa_node = numa_node;
+
+    index_path = malloc(strlen(path) + sizeof(".idx"));
+    if (!index_path) {
+        PyErr_NoMemory();
+        goto err_queue;
+    }
+    strcpy(index_path, path);
+    strcat(index_path, ".idx");
+
+    rec->fd = recorder_open(rec, path);
+    if (rec->fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto err_path;
+    }
+
+    rec->index_fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                         0644);
+    if (rec->index_fd < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, index_path);
+        goto err_files;
+    }
+
+    if (recorder_prepare(rec, preallocate)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        goto err_files;
+    }
+
+    if (recorder_prepare_index(rec)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, index_path);
+        goto err_files;
+    }
+
+    ret = pthread_create(&rec->thread, NULL, recorder_thread, rec);
+    if (ret) {
+        errno = ret;
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto err_files;
+    }
+
+    free(index_path);
+
+    rec->state = RECORDER_RUNNING;
+    __atomic_store_n(&rec->active, 1, __ATOMIC_SEQ_CST);
+
+    return 0;
+
+err_files:
+    recorder_close(rec, 0);
+err_path:
+    free(index_path);
+err_queue:
+    frame_queue_destroy(&rec->queue);
+    return -1;
+}
+
+int recorder_stop(struct recorder *rec) {
+    int expected = RECORDER_RUNNING;
+    int error;
+
+    if (!__atomic_compare_exchange_n(&rec->state, &expected,
+                                     RECORDER_STOPPING, 0, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_SEQ_CST)) {
+        return 0;
+    }
+
+    /* Paired with the callback's increment of users before reading active */
+    __atomic_store_n(&rec->active, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&rec->users, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+
+    /* No more images will be queued, let the writer drain */
+    __atomic_store_n(&rec->queue.closed, 1, __ATOMIC_SEQ_CST);
+    frame_queue_signal(&rec->queue);
+    pthread_join(rec->thread, NULL);
+
+    error = recorder_close(rec, 0);
+    frame_queue_destroy(&rec->queue);
+
+    for (unsigned int i = 0; i < RECORD_BATCH; i++) {
+        frame_data_free(rec->packed[i], rec->packed_size[i]);
+        rec->packed[i] = NULL;
+        rec->packed_size[i] = 0;
+    }
+
+    __atomic_store_n(&rec->state, RECORDER_IDLE, __ATOMIC_SEQ_CST);
+
+    return error;
+}
+
+PyObject *recorder_progress(struct recorder *rec) {
+    int error = __atomic_load_n(&rec->error, __ATOMIC_RELAXED);
+    PyObject *message;
+
+    if (error) {
+#if PY_MAJOR_VERSION >= 3
+        message = PyUnicode_FromString(strerror(error));
+#else
+        message = PyString_FromString(strerror(error));
+#endif
+        if (!message) {
+            return NULL;
+        }
+    }
+    else {
+        Py_INCREF(Py_None);
+        message = Py_None;
+    }
+
+    return Py_BuildValue("{sOsOsOsKsKsKsKsKsN}",
+            "active", rec->state == RECORDER_RUNNING ? Py_True : Py_False,
+            "direct", rec->direct ? Py_True : Py_False,
+            "compress", rec->codec != CODEC_NONE ? Py_True : Py_False,
+            "written", (unsigned long long)
+                __atomic_load_n(&rec->written, __ATOMIC_RELAXED),
+            "bytes", (unsigned long long)
+                __atomic_load_n(&rec->bytes, __ATOMIC_RELAXED),
+            "stored", (unsigned long long)
+                __atomic_load_n(&rec->stored, __ATOMIC_RELAXED),
+            "dropped", (unsigned long long)
+                __atomic_load_n(&rec->dropped, __ATOMIC_RELAXED),
+            "write_errors", (unsigned long long)
+                __atomic_load_n(&rec->write_errors, __ATOMIC_RELAXED),
+            "error", message);
+}
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Simulated camera
+ *
+ * Stands in for the SDK connection and stream, so the capture path can be
+ * measured and soak tested without hardware.  A thread produces images at
+ * the configured rate, with optional loss and jitter, and hands them to
+ * the real stream callback, exactly as the SDK stream thread would.
+ * Every image shares one buffer of test pattern, so producing an image
+ * costs nothing next to consuming it.
+ */
+
+#include <Python.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "svs_core.h"
+
+/* Payload of a simulated stream packet, as with jumbo frames */
+#define SIM_PACKET_PAYLOAD  8000
+
+/* Simulated link speed, for transfer times (bytes/us) */
+#define SIM_LINK_RATE       125
+
+static const struct {
+    const char  *name;
+    uint32_t    pixel_type;
+} sim_pixel_types[] = {
+    {"mono8",               GVSP_PIX_MONO8},
+    {"mono12_packed",       GVSP_PIX_MONO12_PACKED},
+    {"mono16",              GVSP_PIX_MONO16},
+    {"bayer_gr8",           GVSP_PIX_BAYGR8},
+    {"bayer_rg8",           GVSP_PIX_BAYRG8},
+    {"bayer_gb8",           GVSP_PIX_BAYGB8},
+    {"bayer_bg8",           GVSP_PIX_BAYBG8},
+    {"bayer_gr12_packed",   GVSP_PIX_BAYGR12_PACKED},
+    {"bayer_rg12_packed",   GVSP_PIX_BAYRG12_PACKED},
+    {"bayer_gb12_packed",   GVSP_PIX_BAYGB12_PACKED},
+    {"bayer_bg12_packed",   GVSP_PIX_BAYBG12_PACKED},
+    {"bayer_gr16",          GVSP_PIX_BAYGR16},
+    {"bayer_rg16",          GVSP_PIX_BAYRG16},
+    {"bayer_gb16",          GVSP_PIX_BAYGB16},
+    {"bayer_bg16",          GVSP_PIX_BAYBG16},
+};
+
+#define SIM_PIXEL_TYPES (sizeof(sim_pixel_types)/sizeof(sim_pixel_types[0]))
+
+static uint64_t sim_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+/*
+ * Uniform random number in [0, 1)
+ */
+static double sim_random(unsigned int *seed) {
+    return rand_r(seed)/((double) RAND_MAX + 1);
+}
+
+static void *sim_thread(void *arg) {
+    struct sim_camera *sim = arg;
+    SVGigE_IMAGE image;
+    SVGigE_SIGNAL signal;
+    struct timespec due;
+    unsigned int seed = sim->seed;
+    uint64_t start = sim_now(), at;
+    double period = sim->framerate > 0 ? 1/sim->framerate : 0;
+    int lost = 0;
+
+    memset(&image, 0, sizeof(image));
+    image.ImageData = sim->data;
+    image.ImageWidth = sim->width;
+    image.ImageHeight = sim->height;
+    image.PixelType = sim->pixel_type;
+    image.PacketCount = (sim->size + SIM_PACKET_PAYLOAD - 1)/SIM_PACKET_PAYLOAD;
+    image.TransferTime = sim->size/SIM_LINK_RATE;
+
+    memset(&signal, 0, sizeof(signal));
+    signal.SignalType = SVGigE_SIGNAL_FRAME_COMPLETED;
+    signal.Data = &image;
+    signal.DataLength = sizeof(image);
+
+    pthread_mutex_lock(&sim->lock);
+
+    for (uint64_t n = 1; sim->running && (!sim->count || n <= sim->count);
+            n++) {
+        /* Scheduled from the start, so jitter doesn't accumulate */
+        if (period) {
+            at = start + (uint64_t) (1e9*period*n);
+            if (sim->jitter > 0) {
+                at += (int64_t) (1e9*sim->jitter*(2*sim_random(&seed) - 1));
+            }
+
+            due.tv_sec = at/1000000000;
+            due.tv_nsec = at%1000000000;
+            while (sim->running &&
+                   pthread_cond_timedwait(&sim->cond, &sim->lock, &due) != ETIMEDOUT);
+
+            if (!sim->running) {
+                break;
+            }
+        }
+
+        if (sim->loss > 0 && sim_random(&seed) < sim->loss) {
+            lost++;
+            continue;
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+
+        image.ImageCount = n;
+        image.FrameLoss = lost;
+        image.Timestamp = sim_now()/1000;
+        lost = 0;
+
+        svs_core_Camera_stream_callback(&signal, sim->context);
+        __atomic_add_fetch(&sim->produced, 1, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&sim->lock);
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+
+    return NULL;
+}
+
+/*
+ * Get a number from the config dict, if present
+ *
+ * @returns 0 on success, negative with exception set
+ */
+static int sim_number(PyObject *config, const char *key, double *value) {
+    PyObject *item = PyDict_GetItemString(config, key);
+
+    if (!item) {
+        return 0;
+    }
+
+    *value = PyFloat_AsDouble(item);
+    if (*value == -1 && PyErr_Occurred()) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int sim_pixel_type(PyObject *item, uint32_t *pixel_type) {
+    PyObject *bytes;
+    const char *name;
+    long value;
+
+    if (PyLong_Check(item)) {
+        value = PyLong_AsLong(item);
+        for (unsigned int i = 0; i < SIM_PIXEL_TYPES; i++) {
+            if (sim_pixel_types[i].pixel_type == (uint32_t) value) {
+                *pixel_type = value;
+                return 0;
+            }
+        }
+
+        PyErr_Format(PyExc_ValueError, "Unsupported pixel_type %#lx", value);
+        return -1;
+    }
+
+#if PY_MAJOR_VERSION >= 3
+    bytes = PyUnicode_AsASCIIString(item);
+#else
+    bytes = PyObject_Str(item);
+#endif
+    if (!bytes) {
+        return -1;
+    }
+
+    name = PyBytes_AsString(bytes);
+    for (unsigned int i = 0; i < SIM_PIXEL_TYPES; i++) {
+        if (!strcmp(sim_pixel_types[i].name, name)) {
+            *pixel_type = sim_pixel_types[i].pixel_type;
+            Py_DECREF(bytes);
+            return 0;
+        }
+    }
+
+    PyErr_Format(PyExc_ValueError, "Unknown pixel_type '%s'", name);
+    Py_DECREF(bytes);
+    return -1;
+}
+
+int sim_parse(struct sim_camera *sim, PyObject *config) {
+    static const char *keys[] = {
+        "width", "height", "pixel_type", "framerate", "loss", "jitter",
+        "count", "seed", NULL
+    };
+    double width = 1024, height = 768, count = 0, seed = 1;
+    PyObject *key, *item;
+    Py_ssize_t pos = 0;
+
+    if (!PyDict_Check(config)) {
+        PyErr_SetString(PyExc_TypeError, "simulate must be a dict");
+        return -1;
+    }
+
+    while (PyDict_Next(config, &pos, &key, &item)) {
+        const char **known;
+        PyObject *bytes;
+        int found = 0;
+
+#if PY_MAJOR_VERSION >= 3
+        bytes = PyUnicode_Check(key) ? PyUnicode_AsASCIIString(key) : NULL;
+#else
+        bytes = PyString_Check(key) ? PyObject_Str(key) : NULL;
+#endif
+        if (!bytes) {
+            PyErr_Clear();
+            PyErr_SetString(PyExc_TypeError, "simulate keys must be strings");
+            return -1;
+        }
+
+        for (known = keys; *known; known++) {
+            if (!strcmp(*known, PyBytes_AsString(bytes))) {
+                found = 1;
+                break;
+            }
+        }
+
+        if (!found) {
+            PyErr_Format(PyExc_ValueError, "Unknown simulate key '%s'",
+                         PyBytes_AsString(bytes));
+            Py_DECREF(bytes);
+            return -1;
+        }
+        Py_DECREF(bytes);
+    }
+
+    memset(sim, 0, sizeof(*sim));
+    sim->pixel_type = GVSP_PIX_MONO12_PACKED;
+    sim->framerate = 30;
+
+    if (sim_number(config, "width", &width) ||
+            sim_number(config, "height", &height) ||
+            sim_number(config, "framerate", &sim->framerate) ||
+            sim_number(config, "loss", &sim->loss) ||
+            sim_number(config, "jitter", &sim->jitter) ||
+            sim_number(config, "count", &count) ||
+            sim_number(config, "seed", &seed)) {
+        return -1;
+    }
+
+    item = PyDict_GetItemString(config, "pixel_type");
+    if (item && sim_pixel_type(item, &sim->pixel_type)) {
+        return -1;
+    }
+
+    /* Bayer images come in 2x2 tiles, and 12-bit pixels in pairs */
+    if (width < 2 || height < 2 || width > 65536 || height > 65536 ||
+            (int) width & 1 || (int) height & 1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "width and height must be even, from 2 to 65536");
+        return -1;
+    }
+
+    if (sim->framerate < 0 || sim->jitter < 0 || count < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "framerate, jitter and count must not be negative");
+        return -1;
+    }
+
+    if (sim->loss < 0 || sim->loss >= 1) {
+        PyErr_SetString(PyExc_ValueError, "loss must be from 0 to below 1");
+        return -1;
+    }
+
+    sim->width = width;
+    sim->height = height;
+    sim->count = count;
+    sim->seed = seed;
+    sim->size = (size_t) sim->width*sim->height*
+                ((sim->pixel_type & GVSP_PIX_EFFECTIVE_PIXELSIZE_MASK) >> 16)/8;
+
+    return 0;
+}
+
+int sim_start(struct sim_camera *sim, void *context) {
+    pthread_condattr_t attr;
+    uint8_t *data;
+
+    if (!sim->data) {
+        sim->data = malloc(sim->size);
+        if (!sim->data) {
+            PyErr_SetString(PyExc_MemoryError, "Unable to allocate image");
+            return -1;
+        }
+
+        /* A ramp of bytes, so conversions have something to do */
+        data = sim->data;
+        for (size_t i = 0; i < sim->size; i++) {
+            data[i] = i/sim->width + i%sim->width;
+        }
+    }
+
+    sim->context = context;
+    sim->running = 1;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&sim->lock, NULL);
+
+    if (pthread_create(&sim->thread, NULL, sim_thread, sim)) {
+        sim->running = 0;
+        pthread_mutex_destroy(&sim->lock);
+        pthread_cond_destroy(&sim->cond);
+        PyErr_SetString(SVSError, "Unable to start simulated camera");
+        return -1;
+    }
+
+    sim->started = 1;
+
+    return 0;
+}
+
+void sim_stop(struct sim_camera *sim) {
+    if (!sim->started) {
+        return;
+    }
+
+    pthread_mutex_lock(&sim->lock);
+    sim->running = 0;
+    pthread_cond_signal(&sim->cond);
+    pthread_mutex_unlock(&sim->lock);
+
+    pthread_join(sim->thread, NULL);
+
+    pthread_mutex_destroy(&sim->lock);
+    pthread_cond_destroy(&sim->cond);
+    sim->started = 0;
+}
+
+void sim_free(struct sim_camera *sim) {
+    sim_stop(sim);
+    free(sim->data);
+    free(sim);
+}
+
+PyObject *sim_dict(struct sim_camera *sim) {
+    const char *pixel_type = NULL;
+
+    for (unsigned int i = 0; i < SIM_PIXEL_TYPES; i++) {
+        if (sim_pixel_types[i].pixel_type == sim->pixel_type) {
+            pixel_type = sim_pixel_types[i].name;
+        }
+    }
+
+    return Py_BuildValue("{sIsIsssdsdsdsKsIsK}",
+                         "width", sim->width, "height", sim->height,
+                         "pixel_type", pixel_type, "framerate", sim->framerate,
+                         "loss", sim->loss, "jitter", sim->jitter,
+                         "count", (unsigned long long) sim->count,
+                         "seed", sim->seed,
+                         "produced", (unsigned long long)
+                            __atomic_load_n(&sim->produced, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Capture statistics
+ *
+ * Counters and latency histograms are plain arrays updated with relaxed
+ * atomic adds, so recording costs a few uncontended instructions and
+ * never blocks the callback.
+ */
+
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "svs_core.h"
+
+uint64_t stats_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec*1000000000 + now.tv_nsec;
+}
+
+/*
+ * Bucket i holds durations below 2^i us, and at least 2^(i-1) us
+ */
+static unsigned int stats_bucket(uint64_t ns) {
+    uint64_t us = ns/1000;
+    unsigned int bucket;
+
+    if (!us) {
+        return 0;
+    }
+
+    bucket = 64 - __builtin_clzll(us);
+
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+void stats_record(struct camera_stats *stats, enum stats_histogram_id id,
+                  uint64_t start) {
+    struct stats_histogram *hist;
+    uint64_t ns, max;
+
+    if (!stats) {
+        return;
+    }
+
+    hist = &stats->histograms[id];
+    ns = stats_now() - start;
+
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&hist->max, &max, ns, 1,
+                                                    __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED)) {
+        /* max reloaded by failed CAS */
+    }
+}
+
+void stats_count(struct camera_stats *stats, enum stats_counter_id id,
+                 uint64_t n) {
+    if (stats) {
+        __atomic_fetch_add(&stats->counters[id], n, __ATOMIC_RELAXED);
+    }
+}
+
+static uint64_t load(uint64_t *value) {
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Add an item to a dict, consuming the reference to value
+ *
+ * @returns 0 on success, negative on error
+ */
+static int dict_set(PyObject *dict, const char *key, PyObject *value) {
+    int ret;
+
+    if (!value) {
+        return -1;
+    }
+
+    ret = PyDict_SetItemString(dict, key, value);
+    Py_DECREF(value);
+
+    return ret;
+}
+
+/*
+ * Histogram as a dict of count, sum and max (s), with per-bucket counts
+ * and the bucket upper bounds (s), the last being infinite
+ */
+static PyObject *histogram_dict(struct stats_histogram *hist,
+                                struct stats_histogram *base) {
+    PyObject *dict, *buckets, *bounds;
+    int ret;
+
+    dict = PyDict_New();
+    buckets = PyTuple_New(STATS_BUCKETS);
+    bounds = PyTuple_New(STATS_BUCKETS);
+    if (!dict || !buckets || !bounds) {
+        goto err;
+    }
+
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        PyObject *count, *bound;
+
+        count = PyLong_FromUnsignedLongLong(load(&hist->buckets[i]) -
+                                            base->buckets[i]);
+        if (!count) {
+            goto err;
+        }
+        PyTuple_SET_ITEM(buckets, i, count);
+
+        bound = PyFloat_FromDouble(i < STATS_BUCKETS - 1 ?
+                                   (double) (1ULL << i)*1e-6 : Py_HUGE_VAL);
+        if (!bound) {
+            goto err;
+        }
+        PyTuple_SET_ITEM(bounds, i, bound);
+    }
+
+    if (dict_set(dict, "count", PyLong_FromUnsignedLongLong(
+                    load(&hist->count) - base->count)) ||
+        dict_set(dict, "sum", PyFloat_FromDouble(
+                    (load(&hist->sum) - base->sum)*1e-9)) ||
+        dict_set(dict, "max", PyFloat_FromDouble(load(&hist->max)*1e-9))) {
+        goto err;
+    }
+
+    /* dict_set() consumes the references, even on failure */
+    ret = dict_set(dict, "buckets", buckets);
+    buckets = NULL;
+    if (ret) {
+        goto err;
+    }
+
+    ret = dict_set(dict, "bounds", bounds);
+    bounds = NULL;
+    if (ret) {
+        goto err;
+    }
+
+    return dict;
+
+err:
+    Py_XDECREF(dict);
+    Py_XDECREF(buckets);
+    Py_XDECREF(bounds);
+    return NULL;
+}
+
+PyObject *stats_dict(struct camera_stats *stats, struct frame_queue *queue) {
+    static const char *counters[STATS_COUNTERS] = {
+        [STATS_IMAGES] = "images",
+        [STATS_DELIVERED] = "delivered",
+        [STATS_FRAME_LOSS] = "frame_loss",
+        [STATS_PACKETS] = "packets",
+        [STATS_PACKET_RESEND] = "packet_resend",
+    };
+    static const char *histograms[STATS_HISTOGRAMS] = {
+        [STATS_CALLBACK] = "callback",
+        [STATS_RESIDENCY] = "residency",
+        [STATS_GIL_WAIT] = "gil_wait",
+        [STATS_UNPACK] = "unpack",
+    };
+    PyObject *dict, *dropped;
+
+    dict = PyDict_New();
+    if (!dict) {
+        return NULL;
+    }
+
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        if (dict_set(dict, counters[i], PyLong_FromUnsignedLongLong(
+                        load(&stats->counters[i]) - stats->counters_base[i]))) {
+            goto err;
+        }
+    }
+
+    for (int i = 0; i < STATS_HISTOGRAMS; i++) {
+        if (dict_set(dict, histograms[i],
+                     histogram_dict(&stats->histograms[i],
+                                    &stats->histograms_base[i]))) {
+            goto err;
+        }
+    }
+
+    dropped = PyDict_New();
+    if (dict_set(dict, "dropped", dropped)) {
+        goto err;
+    }
+
+    /* dict holds dropped, so it stays valid */
+    for (int i = 0; i < DROP_REASONS; i++) {
+        if (dict_set(dropped, drop_reason_names[i], PyLong_FromUnsignedLongLong(
+                        load(&queue->dropped[i]) - stats->dropped_base[i]))) {
+            goto err;
+        }
+    }
+
+    return dict;
+
+err:
+    Py_DECREF(dict);
+    return NULL;
+}
+
+void stats_reset(struct camera_stats *stats, struct frame_queue *queue) {
+    for (int i = 0; i < STATS_COUNTERS; i++) {
+        stats->counters_base[i] = load(&stats->counters[i]);
+    }
+
+    for (int i = 0; i < STATS_HISTOGRAMS; i++) {
+        struct stats_histogram *hist = &stats->histograms[i];
+        struct stats_histogram *base = &stats->histograms_base[i];
+
+        base->count = load(&hist->count);
+        base->sum = load(&hist->sum);
+        for (int j = 0; j < STATS_BUCKETS; j++) {
+            base->buckets[j] = load(&hist->buckets[j]);
+        }
+
+        /* The maximum can't be rebased, start it again */
+        __atomic_store_n(&hist->max, 0, __ATOMIC_RELAXED);
+    }
+
+    for (int i = 0; i < DROP_REASONS; i++) {
+        stats->dropped_base[i] = load(&queue->dropped[i]);
+    }
+}
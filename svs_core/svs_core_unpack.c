@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * 12-bit packed to 16-bit unpacking
+ *
+ * GVSP 12-bit packed formats store two pixels in three bytes:
+ *
+ *   byte 0: P0[11:4]
+ *   byte 1: P1[3:0] << 4 | P0[3:0]
+ *   byte 2: P1[11:4]
+ *
+ * Vector kernels are compiled with target attributes, so they are
+ * available regardless of the compiler's -march, and the best one for
+ * the running CPU is chosen by unpack_init().
+ */
+
+#include <Python.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "svs_core.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UNPACK_X86
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UNPACK_NEON
+#endif
+
+void (*unpack12)(const uint8_t *src, uint16_t *dst, size_t pixels, int shift);
+const char *unpack12_kernel = "scalar";
+
+/* Unpack the remaining pixels one pair at a time */
+static void unpack12_scalar(const uint8_t *src, uint16_t *dst, size_t pixels,
+                            int shift) {
+    size_t pairs = pixels/2;
+
+    for (size_t i = 0; i < pairs; i++) {
+        dst[0] = ((src[0] << 4) | (src[1] & 0xf)) << shift;
+        dst[1] = ((src[2] << 4) | (src[1] >> 4)) << shift;
+        src += 3;
+        dst += 2;
+    }
+
+    /* Odd pixel out, with its low nibble in the following byte */
+    if (pixels & 1) {
+        dst[0] = ((src[0] << 4) | (src[1] & 0xf)) << shift;
+    }
+}
+
+#ifdef UNPACK_X86
+/*
+ * Each 16-bit lane is built from two bytes with pshufb, giving
+ * w = B0 << 8 | B1 for even pixels and w = B2 << 8 | B1 for odd pixels.
+ * Odd pixels are then w >> 4, and even pixels (w >> 4) & 0xff0 | w & 0xf.
+ */
+#define UNPACK_SHUFFLE  1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11
+
+__attribute__((target("ssse3")))
+static void unpack12_ssse3(const uint8_t *src, uint16_t *dst, size_t pixels,
+                           int shift) {
+    const __m128i shuffle = _mm_setr_epi8(UNPACK_SHUFFLE);
+    const __m128i high = _mm_setr_epi16(0xff0, 0xfff, 0xff0, 0xfff,
+                                        0xff0, 0xfff, 0xff0, 0xfff);
+    const __m128i low = _mm_setr_epi16(0xf, 0, 0xf, 0, 0xf, 0, 0xf, 0);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    /* 8 pixels from 12 bytes, but loads read 16 bytes */
+    for (; i + 8 <= pixels && (i + 8)/2*3 + 4 <= (pixels/2)*3; i += 8) {
+        __m128i w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) src), shuffle);
+        __m128i v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(w, 4), high),
+                                 _mm_and_si128(w, low));
+
+        _mm_storeu_si128((__m128i *) dst, _mm_sll_epi16(v, count));
+        src += 12;
+        dst += 8;
+    }
+
+    unpack12_scalar(src, dst, pixels - i, shift);
+}
+
+__attribute__((target("avx2")))
+static void unpack12_avx2(const uint8_t *src, uint16_t *dst, size_t pixels,
+                          int shift) {
+    const __m256i shuffle = _mm256_setr_epi8(UNPACK_SHUFFLE, UNPACK_SHUFFLE);
+    const __m256i high = _mm256_setr_epi16(0xff0, 0xfff, 0xff0, 0xfff,
+                                           0xff0, 0xfff, 0xff0, 0xfff,
+                                           0xff0, 0xfff, 0xff0, 0xfff,
+                                           0xff0, 0xfff, 0xff0, 0xfff);
+    const __m256i low = _mm256_setr_epi16(0xf, 0, 0xf, 0, 0xf, 0, 0xf, 0,
+                                          0xf, 0, 0xf, 0, 0xf, 0, 0xf, 0);
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    size_t i = 0;
+
+    /* 16 pixels from 24 bytes, but the second load reads to byte 28 */
+    for (; i + 16 <= pixels && (i + 16)/2*3 + 4 <= (pixels/2)*3; i += 16) {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *) src)),
+                    _mm_loadu_si128((const __m128i *) (src + 12)), 1);
+        __m256i w = _mm256_shuffle_epi8(in, shuffle);
+        __m256i v = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(w, 4), high),
+                                    _mm256_and_si256(w, low));
+
+        _mm256_storeu_si256((__m256i *) dst, _mm256_sll_epi16(v, count));
+        src += 24;
+        dst += 16;
+    }
+
+    unpack12_ssse3(src, dst, pixels - i, shift);
+}
+#endif
+
+#ifdef UNPACK_NEON
+static void unpack12_neon(const uint8_t *src, uint16_t *dst, size_t pixels,
+                          int shift) {
+    const int16x8_t count = vdupq_n_s16(shift);
+    const uint8x8_t nibble = vdup_n_u8(0xf);
+    size_t i = 0;
+
+    /* 16 pixels from 24 bytes, deinterleaved by vld3 */
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x8x3_t in = vld3_u8(src);
+        uint16x8x2_t out;
+
+        out.val[0] = vorrq_u16(vshll_n_u8(in.val[0], 4),
+                               vmovl_u8(vand_u8(in.val[1], nibble)));
+        out.val[1] = vorrq_u16(vshll_n_u8(in.val[2], 4),
+                               vmovl_u8(vshr_n_u8(in.val[1], 4)));
+        out.val[0] = vshlq_u16(out.val[0], count);
+        out.val[1] = vshlq_u16(out.val[1], count);
+
+        vst2q_u16(dst, out);
+        src += 24;
+        dst += 16;
+    }
+
+    unpack12_scalar(src, dst, pixels - i, shift);
+}
+#endif
+
+void unpack_init(void) {
+    unpack12 = unpack12_scalar;
+    unpack12_kernel = "scalar";
+
+#ifdef UNPACK_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        unpack12 = unpack12_avx2;
+        unpack12_kernel = "avx2";
+    }
+    else if (__builtin_cpu_supports("ssse3")) {
+        unpack12 = unpack12_ssse3;
+        unpack12_kernel = "ssse3";
+    }
+#endif
+
+#ifdef UNPACK_NEON
+    unpack12 = unpack12_neon;
+    unpack12_kernel = "neon";
+#endif
+}
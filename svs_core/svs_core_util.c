@@ -26,6 +26,8 @@
  */
 
 #include <Python.h>
+#include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include "svs_core.h"
@@ -50,3 +52,35 @@ void ip_int_to_string(uint32_t ip, char buf[16]) {
     snprintf(buf, 16, "%" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8, octet[3],
              octet[2], octet[1], octet[0]);
 }
+
+int parse_timeout(PyObject *value, int *timeout) {
+    double seconds;
+
+    if (!value) {
+        *timeout = 0;
+        return 0;
+    }
+
+    if (value == Py_None) {
+        *timeout = -1;
+        return 0;
+    }
+
+    seconds = PyFloat_AsDouble(value);
+    if (PyErr_Occurred()) {
+        return -1;
+    }
+
+    if (seconds < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+        return -1;
+    }
+
+    if (seconds > INT_MAX/1000) {
+        *timeout = -1;
+        return 0;
+    }
+
+    *timeout = ceil(1000*seconds);
+    return 0;
+}
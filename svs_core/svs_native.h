@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2013, North Carolina State University Aerial Robotics Club
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the North Carolina State University Aerial Robotics Club
+ *       nor the names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Native image callback interface
+ *
+ * C and C++ extensions can receive images straight from the stream
+ * callback, before any Python objects exist, by passing a PyCapsule to
+ * Camera.set_native_callback():
+ *
+ *     static void on_image(const struct svs_native_image *image,
+ *                          void *context) { ... }
+ *
+ *     capsule = PyCapsule_New((void *) on_image, SVS_NATIVE_CAPSULE, NULL);
+ *     PyCapsule_SetContext(capsule, context);
+ *
+ * The callback runs on the SVGigE stream thread, without the GIL, and
+ * must not call into Python.  Image data is only valid until it returns.
+ * The context must stay valid while the capsule is referenced; the
+ * camera holds a reference until the callback is replaced or the camera
+ * is closed, and no calls are made after that.
+ */
+
+#ifndef SVS_NATIVE_H
+#define SVS_NATIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Name of capsules accepted by Camera.set_native_callback() */
+#define SVS_NATIVE_CAPSULE  "svs_core.native_callback"
+
+/* Incremented when fields are added to struct svs_native_image */
+#define SVS_NATIVE_VERSION  1
+
+struct svs_native_image {
+    unsigned int    version;        /* SVS_NATIVE_VERSION */
+    const void      *data;          /* Raw pixels, as sent by the camera */
+    size_t          length;         /* Bytes of data */
+    uint32_t        width;
+    uint32_t        height;
+    uint32_t        pixel_type;     /* GVSP_PIXEL_TYPE */
+    uint32_t        image_count;
+    uint32_t        frame_loss;
+    uint32_t        packet_count;
+    uint32_t        packet_resend;
+    uint32_t        transfer_time;
+    uint64_t        ticks;          /* Camera timestamp */
+    int64_t         time;           /* Host time of capture, us since the epoch */
+    double          clock_offset;   /* Host minus camera clock (s) */
+    double          clock_drift;    /* Camera clock drift (s/s) */
+    const void      *svimage;       /* The SVGigE_IMAGE itself */
+};
+
+typedef void (*svs_native_callback)(const struct svs_native_image *image,
+                                    void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif